@@ -0,0 +1,123 @@
+/**
+ * \example convolver_bench.c
+ * \brief Cost per block of the partitioned convolver against the length of
+ * the impulse response.
+ *
+ * Noise is convolved in blocks of 64 frames with decaying noise impulse
+ * responses from a quarter of a second to eight seconds at 48 kHz, with
+ * uniform partitions, with a tail computed by the caller and with a tail on
+ * the helper thread. For each, the mean and the largest time the caller spent
+ * on a block are printed in microseconds and as a share of the block's
+ * 1.33 ms budget. The blocks run back to back, faster than real time, so the
+ * helper has less time than it would in a stream; late tails count the blocks
+ * that waited for it.
+ *
+ * Usage: `convolver_bench [seconds per case] [block]`
+ */
+
+#include "workbench.h"
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SAMPLE_RATE 48000.0
+#define DEFAULT_SECONDS 0.5
+#define DEFAULT_BLOCK 64
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  const char *name;
+  size_t tail_block; /**< 0 for the cheapest, the block for uniform */
+  bool background;
+} Layout;
+
+static void bench_case(const Layout *layout, const float *ir, size_t length,
+                       size_t block, double seconds, const float *noise,
+                       size_t noise_length) {
+  Convolver *convolver = convolver_create(
+      ir, length, block, layout->tail_block ? layout->tail_block : 0,
+      layout->background);
+  float *out = malloc(sizeof(float) * block);
+  if (!convolver || !out) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  double budget = block / SAMPLE_RATE, total = 0, worst = 0;
+  size_t blocks = 0, position = 0;
+  double start = now();
+  while (now() - start < seconds) {
+    double before = now();
+    convolver_process(convolver, noise + position, out, block);
+    double elapsed = now() - before;
+    total += elapsed;
+    worst = fmax(worst, elapsed);
+    blocks++;
+    position = (position + block) % (noise_length - block);
+  }
+
+  ConvolverInfo info;
+  convolver_info(convolver, &info);
+  char layout_name[48];
+  if (info.tail_block)
+    snprintf(layout_name, sizeof(layout_name), "%dx%zu + %dx%zu",
+             info.head_partitions, info.block, info.tail_partitions,
+             info.tail_block);
+  else
+    snprintf(layout_name, sizeof(layout_name), "%dx%zu",
+             info.head_partitions, info.block);
+  double mean = total / blocks;
+  printf("  %5.2f s %-10s %-20s %9.1f %9.1f %7.1f%% %7.1f%% %6llu\n",
+         length / SAMPLE_RATE, layout->name, layout_name, mean * 1e6,
+         worst * 1e6, 100 * mean / budget, 100 * worst / budget,
+         (unsigned long long)info.late_tails);
+  convolver_destroy(convolver);
+  free(out);
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : DEFAULT_SECONDS;
+  size_t block = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_BLOCK;
+  size_t longest = (size_t)(8 * SAMPLE_RATE);
+  size_t noise_length = (size_t)SAMPLE_RATE;
+  float *ir = malloc(sizeof(float) * longest);
+  float *noise = malloc(sizeof(float) * noise_length);
+  if (!ir || !noise) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  uint32_t state = 1;
+  for (size_t i = 0; i < noise_length; i++) {
+    state = state * 1664525u + 1013904223u;
+    noise[i] = (int32_t)state * 0x1p-31f;
+  }
+
+  const Layout layouts[] = {
+      {"uniform", block, false},
+      {"inline", 0, false},
+      {"helper", 0, true},
+  };
+  printf("Convolver, %s kernels, %zu frames per block, times in us:\n",
+         fft_isa(), block);
+  printf("  %7s %-10s %-20s %9s %9s %8s %8s %6s\n", "ir", "tail", "partitions",
+         "mean", "worst", "mean", "worst", "late");
+  for (double ir_seconds = 0.25; ir_seconds <= 8; ir_seconds *= 2) {
+    size_t length = (size_t)(ir_seconds * SAMPLE_RATE);
+    // A reverberant decay of 60 dB over the length
+    for (size_t i = 0; i < length; i++) {
+      state = state * 1664525u + 1013904223u;
+      ir[i] = (int32_t)state * 0x1p-31f *
+              (float)pow(10.0, -3.0 * i / length);
+    }
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(*layouts); i++)
+      bench_case(&layouts[i], ir, length, block, seconds, noise,
+                 noise_length);
+  }
+  free(ir);
+  free(noise);
+  return 0;
+}
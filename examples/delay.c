@@ -10,9 +10,17 @@
  * The delay effect is implemented using a circular buffer, and the pitch
  * can be adjusted by changing the playback speed. Feedback and filtering
  * are also applied to the delayed signal.
+ *
+ * The MIDI callback only sets the targets of engine parameters; the engine
+ * computes their glide once per block, and the audio callback reads a value
+ * per sample from the ramps.
+ *
+ * Run it with `--midi_split_blocks=1` to apply the MIDI controls on the exact
+ * sample they arrive at instead of at the start of the block.
  */
 
 #include "workbench.h"
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #define DELAY_CC 48
@@ -26,6 +34,10 @@
 
 #define MIDI2DOUBLE(x) (double)(x) / 128.0
 
+/// Glide time constants in seconds
+#define DELAY_SMOOTHING 1.0
+#define CONTROL_SMOOTHING 0.02
+
 Config *cfg;
 
 typedef struct {
@@ -33,18 +45,19 @@ typedef struct {
   AudioSample_t *filter_buffer; /**< Buffer for the filter */
   size_t write;                 /**< Index of the head (next write position) */
   size_t length;                /**< Maximum number of items in the buffer */
-  double delay;                 /**< Current delay in samples */
-  double delay_target;          /**< Target delay in samples */
-  double feedback;              /**< Feedback amount */
-  double filter_coefficient;    /**< Coefficient for the low-pass filter */
+  int delay;                    /**< Parameter of the delay, 0 to 1 */
+  int feedback;                 /**< Parameter of the feedback amount */
+  int filter_coefficient;       /**< Parameter of the low-pass coefficient */
+  atomic_bool ready;            /**< Set once the fields above are */
 } DelayBuffer;
 
 /**
  * \brief Initialize the delay buffer.
  *
  * \param del Pointer to the DelayBuffer structure.
+ * \return false if the buffers or the parameters can not be added.
  */
-void delay_init(DelayBuffer *del);
+bool delay_init(DelayBuffer *del);
 
 /**
  * \brief Free the memory allocated for the delay buffer.
@@ -65,9 +78,12 @@ void delay_put(DelayBuffer *del, AudioSample_t item);
  * \brief Get an element from the delay buffer.
  *
  * \param del Pointer to the DelayBuffer structure.
+ * \param delay Delay as a fraction of the buffer.
+ * \param filter_coefficient Coefficient for the low-pass filter.
  * \return The delayed sample.
  */
-AudioSample_t delay_get(DelayBuffer *del);
+AudioSample_t delay_get(DelayBuffer *del, float delay,
+                        float filter_coefficient);
 
 // Audio callback function to handle recording and playback
 void audio_cb(const void *input_buffer, void *output_buffer,
@@ -77,14 +93,25 @@ void audio_cb(const void *input_buffer, void *output_buffer,
 int midi_cb(const void *in, void *out, unsigned long length, void *user_data);
 
 int main(int argc, char **argv) {
-  DelayBuffer del;
+  DelayBuffer del = {0};
   cfg = config_init(argc, argv, audio_cb, midi_cb, &del);
-  delay_init(&del);
+  if (!delay_init(&del)) {
+    log_e("Can not set up the delay");
+    audio_deinit();
+    midi_deinit();
+    free_delay_buffer(&del);
+    return 1;
+  }
+  // Starts an offline render now that the delay is set up
+  audio_init();
 
-  while (true) {
+  // Runs until the stream stops, e.g. when an offline render is complete
+  while (audio_is_active()) {
     Pa_Sleep(1000);
   }
 
+  audio_deinit();
+  midi_deinit();
   free_delay_buffer(&del);
   return 0;
 }
@@ -92,18 +119,27 @@ int main(int argc, char **argv) {
 void audio_cb(const void *input_buffer, void *output_buffer,
               unsigned long block_size, void *user_data) {
   DelayBuffer *del = (DelayBuffer *)user_data;
-  if (del == NULL) {
+  AudioSample_t *out = (AudioSample_t *)output_buffer;
+  if (del == NULL ||
+      !atomic_load_explicit(&del->ready, memory_order_acquire)) {
+    // A real-time stream starts before `config_init` returns and
+    // `delay_init` is done, so the global `cfg` can not be used yet
+    memset(out, 0,
+           sizeof(AudioSample_t) * block_size *
+               config_get()->out_channel_count);
     return;
   }
   const AudioSample_t *in = (const float *)input_buffer;
-  AudioSample_t *out = (AudioSample_t *)output_buffer;
+  const float *delay = param_ramp(del->delay);
+  const float *feedback = param_ramp(del->feedback);
+  const float *filter = param_ramp(del->filter_coefficient);
 
   for (unsigned long i = 0; i < block_size; ++i) {
     // Read the delayed sample from the buffer
-    AudioSample_t out_sample = delay_get(del);
+    AudioSample_t out_sample = delay_get(del, delay[i], filter[i]);
 
     // Write the input sample to the delay buffer
-    delay_put(del, in[i] * (1 - del->feedback) + out_sample * del->feedback);
+    delay_put(del, in[i] + (out_sample - in[i]) * feedback[i]);
 
     // Output the delayed sample to all channels
     int channels = cfg->out_channel_count;
@@ -115,7 +151,8 @@ void audio_cb(const void *input_buffer, void *output_buffer,
 
 int midi_cb(const void *in, void *out, unsigned long length, void *user_data) {
   DelayBuffer *del = (DelayBuffer *)user_data;
-  if (del == NULL) {
+  if (del == NULL ||
+      !atomic_load_explicit(&del->ready, memory_order_acquire)) {
     return 0;
   }
   const PmEvent *in_buffer = (const PmEvent *)in;
@@ -131,13 +168,13 @@ int midi_cb(const void *in, void *out, unsigned long length, void *user_data) {
     if (command == MIDI_CTRL) {
       switch (data1) {
       case DELAY_CC:
-        del->delay_target = MIDI2DOUBLE(data2);
+        param_set(del->delay, MIDI2DOUBLE(data2));
         break;
       case FEEDBACK_CC:
-        del->feedback = MIDI2DOUBLE(data2);
+        param_set(del->feedback, MIDI2DOUBLE(data2));
         break;
       case FILTER_CC:
-        del->filter_coefficient = MIDI2DOUBLE(data2);
+        param_set(del->filter_coefficient, MIDI2DOUBLE(data2));
         break;
       }
     }
@@ -145,21 +182,30 @@ int midi_cb(const void *in, void *out, unsigned long length, void *user_data) {
   return 0;
 }
 
-void delay_init(DelayBuffer *del) {
-  del->buffer =
-      (AudioSample_t *)calloc(BUFFER_SIZE_SAMPLES, sizeof(AudioSample_t));
+bool delay_init(DelayBuffer *del) {
+  // Locked and prefaulted, so the callback never page-faults on them
   del->filter_buffer =
-      (AudioSample_t *)malloc(FILTER_ORDER * sizeof(AudioSample_t));
+      (AudioSample_t *)engine_calloc(FILTER_ORDER, sizeof(AudioSample_t));
   del->length = BUFFER_SIZE_SAMPLES;
   del->write = 0;
-  del->delay = del->delay_target = 0.1; // Initial delay
-  del->feedback = 0;
-  del->filter_coefficient = 0.5;
+  // Set from any thread, smoothed by the engine once per block
+  del->delay = param_add("delay", 0.1f, DELAY_SMOOTHING);
+  del->feedback = param_add("feedback", 0.0f, CONTROL_SMOOTHING);
+  del->filter_coefficient = param_add("filter", 0.5f, CONTROL_SMOOTHING);
+  del->buffer = (AudioSample_t *)engine_calloc(BUFFER_SIZE_SAMPLES,
+                                               sizeof(AudioSample_t));
+  if (!del->filter_buffer || !del->buffer || del->delay < 0 ||
+      del->feedback < 0 || del->filter_coefficient < 0)
+    return false;
+  // A real-time stream already runs: its callbacks start once they see the
+  // flag. An offline render only starts in `audio_init`, after this
+  atomic_store_explicit(&del->ready, true, memory_order_release);
+  return true;
 }
 
 void free_delay_buffer(DelayBuffer *del) {
-  free(del->buffer);
-  free(del->filter_buffer);
+  engine_free(del->buffer);
+  engine_free(del->filter_buffer);
 }
 
 void delay_put(DelayBuffer *del, AudioSample_t item) {
@@ -169,13 +215,11 @@ void delay_put(DelayBuffer *del, AudioSample_t item) {
 
 #define lerp(a, b, t) (a + t * (b - a))
 
-AudioSample_t delay_get(DelayBuffer *del) {
-  // Interpolate the delay adjustment
-  del->delay = lerp(del->delay, del->delay_target, 1 / cfg->sample_rate);
-
+AudioSample_t delay_get(DelayBuffer *del, float delay,
+                        float filter_coefficient) {
   // Calculate the read index for current delay
-  double read_idx = del->write - del->delay * (del->length - cfg->block_size) +
-                    cfg->block_size;
+  double read_idx =
+      del->write - delay * (del->length - cfg->block_size) + cfg->block_size;
   if (read_idx < 0) {
     read_idx += del->length;
   }
@@ -193,8 +237,8 @@ AudioSample_t delay_get(DelayBuffer *del) {
   // Apply the multi-stage low-pass filter
   AudioSample_t filtered_sample = interpolated_sample;
   for (size_t i = 0; i < FILTER_ORDER; ++i) {
-    filtered_sample = del->filter_coefficient * filtered_sample +
-                      (1.0 - del->filter_coefficient) * del->filter_buffer[i];
+    filtered_sample = filter_coefficient * filtered_sample +
+                      (1.0f - filter_coefficient) * del->filter_buffer[i];
     del->filter_buffer[i] = filtered_sample;
   }
 
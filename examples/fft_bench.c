@@ -0,0 +1,209 @@
+/**
+ * \example fft_bench.c
+ * \brief Benchmark of the real FFT against a naive DFT, and of the STFT.
+ *
+ * For every power-of-two size the forward and inverse transforms of a noise
+ * signal are timed and compared with a direct evaluation of the DFT sums.
+ * The time of one transform is printed in nanoseconds, along with the largest
+ * error of the FFT relative to the largest bin and of the round trip. The
+ * STFT is then run over blocks of 64 frames for a few frame sizes at a
+ * quarter-frame hop, and its cost is printed per sample and as a share
+ * of the real-time budget at 48 kHz.
+ *
+ * Usage: `fft_bench [seconds per case] [largest naive DFT size]`
+ */
+
+#include "workbench.h"
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MIN_SIZE 64
+#define MAX_SIZE 16384
+#define DEFAULT_SECONDS 0.2
+#define DEFAULT_NAIVE_SIZE 4096
+#define BLOCK_FRAMES 64
+#define SAMPLE_RATE 48000.0
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/// Direct DFT of real samples, `size / 2 + 1` bins, from a table of `size`
+/// cosines and sines
+static void naive_dft(const float *in, float *re, float *im, size_t size,
+                      const float *cosine, const float *sine) {
+  for (size_t k = 0; k <= size / 2; k++) {
+    float sr = 0, si = 0;
+    size_t phase = 0;
+    for (size_t n = 0; n < size; n++) {
+      sr += in[n] * cosine[phase];
+      si -= in[n] * sine[phase];
+      phase = (phase + k) & (size - 1);
+    }
+    re[k] = sr;
+    im[k] = si;
+  }
+}
+
+typedef void (*Transform)(void *context);
+
+/// Runs `transform` until `seconds` have passed, returns ns per call
+static double bench(Transform transform, void *context, double seconds) {
+  size_t calls = 0, batch = 1;
+  double start = now(), elapsed;
+  do {
+    for (size_t i = 0; i < batch; i++)
+      transform(context);
+    calls += batch;
+    if (batch < 1024)
+      batch *= 2;
+    elapsed = now() - start;
+  } while (elapsed < seconds);
+  return elapsed / calls * 1e9;
+}
+
+typedef struct {
+  FftPlan *plan;
+  size_t size;
+  float *in, *out, *re, *im;
+  const float *cosine, *sine;
+} Case;
+
+static void run_forward(void *context) {
+  Case *c = context;
+  fft_forward(c->plan, c->in, c->re, c->im);
+}
+
+static void run_inverse(void *context) {
+  Case *c = context;
+  fft_inverse(c->plan, c->re, c->im, c->out);
+}
+
+static void run_naive(void *context) {
+  Case *c = context;
+  naive_dft(c->in, c->re, c->im, c->size, c->cosine, c->sine);
+}
+
+static void bench_size(size_t size, double seconds, size_t naive_size,
+                       const float *noise) {
+  size_t bins = size / 2 + 1;
+  Case c = {.plan = fft_plan_create(size), .size = size};
+  c.in = malloc(sizeof(float) * size);
+  c.out = malloc(sizeof(float) * size);
+  c.re = malloc(sizeof(float) * bins);
+  c.im = malloc(sizeof(float) * bins);
+  float *cosine = malloc(sizeof(float) * size);
+  float *sine = malloc(sizeof(float) * size);
+  float *dft_re = malloc(sizeof(float) * bins);
+  float *dft_im = malloc(sizeof(float) * bins);
+  if (!c.plan || !c.in || !c.out || !c.re || !c.im || !cosine || !sine ||
+      !dft_re || !dft_im) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  memcpy(c.in, noise, sizeof(float) * size);
+  for (size_t n = 0; n < size; n++) {
+    cosine[n] = (float)cos(2 * M_PI * n / size);
+    sine[n] = (float)sin(2 * M_PI * n / size);
+  }
+  c.cosine = cosine;
+  c.sine = sine;
+
+  // Accuracy against the direct sums, and of the round trip
+  naive_dft(c.in, dft_re, dft_im, size, cosine, sine);
+  fft_forward(c.plan, c.in, c.re, c.im);
+  double error = 0, largest = 0, round_trip = 0;
+  for (size_t k = 0; k < bins; k++) {
+    largest = fmax(largest, hypot(dft_re[k], dft_im[k]));
+    error = fmax(error, hypot(c.re[k] - dft_re[k], c.im[k] - dft_im[k]));
+  }
+  fft_inverse(c.plan, c.re, c.im, c.out);
+  for (size_t n = 0; n < size; n++)
+    round_trip = fmax(round_trip, fabs(c.out[n] - c.in[n]));
+
+  double forward = bench(run_forward, &c, seconds);
+  double inverse = bench(run_inverse, &c, seconds);
+  printf("  %6zu %10.0f %10.0f", size, forward, inverse);
+  if (size <= naive_size) {
+    double naive = bench(run_naive, &c, seconds);
+    printf(" %12.0f %8.0fx", naive, naive / forward);
+  } else {
+    printf(" %12s %9s", "-", "-");
+  }
+  printf(" %9.1e %9.1e\n", error / largest, round_trip);
+
+  fft_plan_destroy(c.plan);
+  free(c.in);
+  free(c.out);
+  free(c.re);
+  free(c.im);
+  free(cosine);
+  free(sine);
+  free(dft_re);
+  free(dft_im);
+}
+
+/// Spectral processing touching every bin, as a filter would
+static void halve(float *re, float *im, size_t bins, void *user_data) {
+  (void)user_data;
+  for (size_t k = 0; k < bins; k++) {
+    re[k] *= 0.5f;
+    im[k] *= 0.5f;
+  }
+}
+
+static void bench_stft(size_t size, double seconds, const float *noise) {
+  Stft *stft = stft_create(size, size / 4, STFT_WINDOW_HANN, halve, NULL);
+  float out[BLOCK_FRAMES];
+  if (!stft) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  size_t frames = 0;
+  double start = now(), elapsed;
+  do {
+    for (int i = 0; i < 256; i++) {
+      stft_process(stft, noise + (frames % size), out, BLOCK_FRAMES);
+      frames += BLOCK_FRAMES;
+    }
+    elapsed = now() - start;
+  } while (elapsed < seconds);
+  double per_sample = elapsed / frames;
+  printf("  %6zu %6zu %10.1f %9.3f%%\n", size, size / 4, per_sample * 1e9,
+         100 * per_sample * SAMPLE_RATE);
+  stft_destroy(stft);
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : DEFAULT_SECONDS;
+  size_t naive_size =
+      argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_NAIVE_SIZE;
+
+  // Room for a block past the end of any frame
+  float *noise = malloc(sizeof(float) * (MAX_SIZE + BLOCK_FRAMES));
+  if (!noise) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  uint32_t state = 1;
+  for (size_t i = 0; i < MAX_SIZE + BLOCK_FRAMES; i++) {
+    state = state * 1664525u + 1013904223u;
+    noise[i] = (int32_t)state * 0x1p-31f;
+  }
+
+  printf("Real FFT, %s kernels, ns per transform:\n", fft_isa());
+  printf("  %6s %10s %10s %12s %9s %9s %9s\n", "size", "forward", "inverse",
+         "naive DFT", "speedup", "error", "roundtrip");
+  for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 2)
+    bench_size(size, seconds, naive_size, noise);
+
+  printf("STFT, Hann window, %d frames per call:\n", BLOCK_FRAMES);
+  printf("  %6s %6s %10s %10s\n", "size", "hop", "ns/sample", "of 48 kHz");
+  for (size_t size = 256; size <= 4096; size *= 4)
+    bench_stft(size, seconds, noise);
+  free(noise);
+  return 0;
+}
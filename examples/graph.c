@@ -0,0 +1,140 @@
+/**
+ * \example graph.c
+ * \brief A two-band tone control built as a processing graph.
+ *
+ * The first input channel is split by a one-pole crossover into a low and a
+ * high band. Each band goes through its own gain node, and both bands are
+ * summed into every output channel by connecting them to the same output
+ * ports. The gains follow MIDI control changes that reach the gain nodes
+ * through their MIDI ports, at the frame the event arrived.
+ *
+ * The graph is compiled once before the stream starts; the engine then runs
+ * its nodes in order with buffers shared between them by liveness. The two
+ * bands are independent branches: with `graph_workers` set they run in
+ * parallel, and `graph_profile` prints how busy each thread was.
+ */
+
+#include "workbench.h"
+#include <math.h>
+#include <stdio.h>
+
+#define LOW_CC 20
+#define HIGH_CC 21
+/// Corner frequency of the crossover in Hz
+#define CROSSOVER_HZ 500.0
+
+Config *cfg;
+
+/// State of the crossover node
+typedef struct {
+  float coefficient; /**< One-pole low-pass coefficient */
+  float low;         /**< Last low-pass output */
+} Crossover;
+
+/// State of a gain node
+typedef struct {
+  uint8_t cc; /**< Controller that sets the gain */
+  float gain; /**< Current gain */
+} Gain;
+
+/// Splits the input into a low band (port 0) and a high band (port 1)
+void crossover_process(const NodeContext *context, void *state);
+
+/// Scales its input, following the control changes of its MIDI input
+void gain_process(const NodeContext *context, void *state);
+
+int main(int argc, char **argv) {
+  // No callbacks: the graph is built for the parsed configuration first
+  cfg = config_init(argc, argv, NULL, NULL, NULL);
+
+  Crossover crossover = {
+      .coefficient = 1.0 - exp(-2.0 * M_PI * CROSSOVER_HZ / cfg->sample_rate)};
+  Gain low = {.cc = LOW_CC, .gain = 1.0f};
+  Gain high = {.cc = HIGH_CC, .gain = 1.0f};
+  NodeDesc crossover_desc = {.name = "crossover",
+                             .audio_inputs = 1,
+                             .audio_outputs = 2,
+                             .process = crossover_process,
+                             .state = &crossover};
+  NodeDesc low_desc = {.name = "low",
+                       .audio_inputs = 1,
+                       .audio_outputs = 1,
+                       .midi_inputs = 1,
+                       .process = gain_process,
+                       .state = &low};
+  NodeDesc high_desc = low_desc;
+  high_desc.name = "high";
+  high_desc.state = &high;
+
+  Graph *graph = graph_create();
+  int split = graph_add_node(graph, &crossover_desc);
+  int bands[2] = {graph_add_node(graph, &low_desc),
+                  graph_add_node(graph, &high_desc)};
+  graph_connect(graph, PORT_AUDIO, GRAPH_INPUT, 0, split, 0);
+  for (int b = 0; b < 2; b++) {
+    graph_connect(graph, PORT_AUDIO, split, b, bands[b], 0);
+    graph_connect(graph, PORT_MIDI, GRAPH_INPUT, 0, bands[b], 0);
+    // Both bands into every output port are summed by the graph
+    for (int c = 0; c < cfg->out_channel_count; c++)
+      graph_connect(graph, PORT_AUDIO, bands[b], 0, GRAPH_OUTPUT, c);
+  }
+  if (!audio_set_graph(graph)) {
+    graph_destroy(graph);
+    return 1;
+  }
+  printf("Graph uses %d audio buffers. CC %d and %d set the band gains.\n",
+         graph_buffer_count(graph), LOW_CC, HIGH_CC);
+
+  midi_init();
+  audio_init();
+  // Runs until the stream stops, e.g. when an offline render is complete
+  while (audio_is_active()) {
+    Pa_Sleep(1000);
+  }
+  if (cfg->graph_profile) {
+    graph_print_stats(graph);
+  }
+
+  audio_deinit();
+  midi_deinit();
+  audio_set_graph(NULL);
+  graph_destroy(graph);
+  return 0;
+}
+
+void crossover_process(const NodeContext *context, void *state) {
+  Crossover *crossover = (Crossover *)state;
+  const float *in = context->audio_in[0];
+  float *low = context->audio_out[0];
+  float *high = context->audio_out[1];
+  for (unsigned long i = 0; i < context->frames; i++) {
+    crossover->low += crossover->coefficient * (in[i] - crossover->low);
+    low[i] = crossover->low;
+    high[i] = in[i] - crossover->low;
+  }
+}
+
+void gain_process(const NodeContext *context, void *state) {
+  Gain *gain = (Gain *)state;
+  const MidiBuffer *midi = context->midi_in[0];
+  const float *in = context->audio_in[0];
+  float *out = context->audio_out[0];
+  unsigned long frame = 0;
+  for (int e = 0; e <= midi->length; e++) {
+    // Render up to the next event, then apply it
+    unsigned long until =
+        e < midi->length ? (unsigned long)midi->events[e].timestamp
+                         : context->frames;
+    for (; frame < until; frame++) {
+      out[frame] = in[frame] * gain->gain;
+    }
+    if (e == midi->length) {
+      break;
+    }
+    PmMessage message = midi->events[e].message;
+    if ((Pm_MessageStatus(message) & MIDI_CODE_MASK) == MIDI_CTRL &&
+        Pm_MessageData1(message) == gain->cc) {
+      gain->gain = Pm_MessageData2(message) / 64.0f;
+    }
+  }
+}
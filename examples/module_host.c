@@ -0,0 +1,48 @@
+/**
+ * \example module_host.c
+ * \brief Runs a processor module and reloads it whenever it is rebuilt.
+ *
+ * The engine loads the shared object given as `audio_module` before the
+ * stream starts. This host then watches the file and calls
+ * `audio_load_module` when it changes, so new DSP code is heard from the
+ * next block on without reopening the devices. Link it with `-rdynamic` so
+ * the modules can call the library.
+ */
+
+#include "workbench.h"
+#include <sys/stat.h>
+
+/// Interval between two checks of the module file in milliseconds
+#define WATCH_INTERVAL 500
+
+/// Time the module file was last changed, 0 if it can not be read
+static time_t module_changed(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+int main(int argc, char **argv) {
+  Config *cfg = config_init(argc, argv, NULL, NULL, NULL);
+  if (!cfg->audio_module) {
+    log_e("Set audio_module to the shared object to run");
+    audio_deinit();
+    return 1;
+  }
+  time_t loaded = module_changed(cfg->audio_module);
+  // Starts an offline render, the real-time streams already run
+  audio_init();
+
+  // Runs until the stream stops, e.g. when an offline render is complete
+  while (audio_is_active()) {
+    Pa_Sleep(WATCH_INTERVAL);
+    if (module_changed(cfg->audio_module) == loaded)
+      continue;
+    // Give the linker time to finish writing the file
+    Pa_Sleep(WATCH_INTERVAL);
+    loaded = module_changed(cfg->audio_module);
+    audio_load_module(cfg->audio_module);
+  }
+
+  audio_deinit();
+  return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ * \example tremolo.c
+ * \brief A processor module that can be swapped into a running stream.
+ *
+ * Build it as a shared object and load it with `module_host`:
+ *
+ *     make bin/modules/tremolo.so
+ *     bin/module_host --audio_module=bin/modules/tremolo.so
+ *
+ * Edit `TREMOLO_RATE` or `TREMOLO_DEPTH` and rebuild while the host runs;
+ * the host picks up the new file and swaps it in between two blocks.
+ */
+
+#include "workbench.h"
+#include <math.h>
+
+/// Modulation rate in Hz
+#define TREMOLO_RATE 4.0
+/// Modulation depth, 0 to 1
+#define TREMOLO_DEPTH 0.5
+
+typedef struct {
+  double phase; /**< Phase of the modulation in cycles */
+} Tremolo;
+
+static void *tremolo_create() {
+  // Locked and prefaulted like every buffer the audio thread touches
+  return engine_calloc(1, sizeof(Tremolo));
+}
+
+static void tremolo_process(void *instance, const void *input_buffer,
+                            void *output_buffer, unsigned long frames) {
+  Tremolo *tremolo = instance;
+  Config *cfg = config_get();
+  const AudioSample_t *in = input_buffer;
+  AudioSample_t *out = output_buffer;
+  double step = TREMOLO_RATE / cfg->sample_rate;
+
+  for (unsigned long i = 0; i < frames; i++) {
+    AudioSample_t sample = in ? in[i * cfg->in_channel_count] : 0;
+    float gain =
+        1 - TREMOLO_DEPTH * 0.5 * (1 - cos(2 * M_PI * tremolo->phase));
+    tremolo->phase += step;
+    if (tremolo->phase >= 1)
+      tremolo->phase -= 1;
+    for (int c = 0; c < cfg->out_channel_count; c++)
+      *out++ = sample * gain;
+  }
+}
+
+const ModuleDesc workbench_module = {
+    .abi = WORKBENCH_MODULE_ABI,
+    .name = "tremolo",
+    .create = tremolo_create,
+    .process = tremolo_process,
+    .destroy = engine_free,
+};
@@ -4,7 +4,8 @@
  *
  * This file contains an example implementation of a simple audio recorder and
  * player using Workbench. The example demonstrates how to:
- * - Record audio input for a specified duration.
+ * - Record all input channels to a WAV file, for as long as the disk allows.
+ * - Play the take from a memory mapping of the file, without loading it.
  * - Playback the recorded audio. ('p')
  * - Playback the recorded audio in reverse. ('r')
  * - Playback the recorded audio in loop. ('l')
@@ -15,15 +16,17 @@
  * a countdown timer.
  */
 #include "workbench.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 /// Define ANSI escape codes to move cursor up and clear the line
 #define SAME_LINE "\033[A\033[2K\r"
 
-/// Maximum recording time in seconds and samples
-#define REC_MAX_SEC 10
-#define REC_MAX_SAMPLES (cfg->sample_rate * REC_MAX_SEC)
+/// File the recording is streamed to
+#define REC_PATH "record.wav"
+/// Audio buffered in memory while the disk is busy, in seconds
+#define REC_BUFFER_SEC 4
 
 /// Animation update interval in milliseconds
 #define ANIM_TIMEOUT 100
@@ -36,34 +39,39 @@
 /// Global configuration pointer
 Config *cfg;
 
-/// Recorder structure to hold recording/playback state and buffer
+/// Recorder structure to hold recording/playback state.
+/// The recorder and the player are handed to the audio callback through
+/// atomic slots. The callback empties a slot while it uses the object, so
+/// the main thread takes it back before closing it.
 typedef struct {
-  AudioSample_t *buffer; /**< Audio buffer to store samples */
-  unsigned long elapsed; /**< Number of samples processed */
-  unsigned long length;  /**< Total number of samples recorded */
-  bool recording;        /**< Flag to indicate if recording is active */
-  bool playing;          /**< Flag to indicate if playback is active */
-  bool reverse;          /**< Flag to indicate if playback is in reverse */
-  bool loop;             /**< Flag to indicate if playback is in reverse */
-  bool backandforth;     /**< Play bask and forth endlessly */
+  /** Recording in progress, taken by the callback while it runs a block */
+  _Atomic(DiskRecorder *) recorder;
+  /** Take being played, taken by the callback while it runs a block */
+  _Atomic(WavPlayer *) player;
+  DiskRecorder *take;    /**< Recording in progress, owned by main */
+  WavPlayer *track;      /**< Player of the last take, owned by main */
+  atomic_bool recording; /**< Flag to indicate if recording is active */
 } Recorder;
 
 // Audio callback function to handle recording and playback
 void audio_cb(const void *input_buffer, void *output_buffer,
               unsigned long block_size, void *user_data);
 
-/// Start recording by initializing the recorder state and buffer
+/// Start recording by opening the file and handing it to the callback
 void start_record(Recorder *rec);
 
 /// Stop recording and update the recorder state
 void stop_record(Recorder *rec);
 
-// Start playback by initializing the recorder state
-void start_playback(Recorder *rec);
+/// Start playback of the last take in the given `PlayerMode`
+void start_playback(Recorder *rec, unsigned mode);
 
-// Stop playback and reset the recorder state
+// Stop playback, the take stays mapped for the next one
 void stop_playback(Recorder *rec);
 
+/// Take the player back from the callback and unmap the take
+void close_playback(Recorder *rec);
+
 /// Countdown function to update recording/playback progress
 void countdoun(PtTimestamp timestamp, void *user_data);
 
@@ -71,7 +79,8 @@ int main(int argc, char **argv) {
   PtError err;
   Recorder rec = {0};
   cfg = config_init(argc, argv, audio_cb, NULL, &rec);
-  rec.buffer = malloc(sizeof(AudioSample_t) * REC_MAX_SAMPLES);
+  // Starts an offline render, the real-time streams already run
+  audio_init();
 
   printf("Press Enter to start recording (Press 'q' to quit)...\n");
 
@@ -82,28 +91,24 @@ int main(int argc, char **argv) {
       run = 0; // Exit the loop if 'q' is pressed
       break;
     case 'p':
-      start_playback(&rec); // Start playback
+      start_playback(&rec, PLAYER_FORWARD); // Start playback
       break;
     case 'l':
-      rec.loop = true;
-      start_playback(&rec); // Start playback
+      start_playback(&rec, PLAYER_LOOP); // Start playback in loop
       break;
     case 'b':
-      rec.loop = true;
-      rec.backandforth = true;
-      start_playback(&rec); // Start playback
+      start_playback(&rec, PLAYER_LOOP | PLAYER_BACK_AND_FORTH);
       break;
     case 'r':
-      rec.reverse = true;
-      start_playback(&rec); // Start reverse playback
+      start_playback(&rec, PLAYER_REVERSE); // Start reverse playback
       break;
     case '\n':
-      if (!rec.playing && !rec.recording) {
-        start_record(&rec); // Start recording
-      } else if (rec.recording) {
+      if (rec.recording) {
         stop_record(&rec); // Stop recording
-      } else if (rec.playing) {
+      } else if (rec.track && player_is_playing(rec.track)) {
         stop_playback(&rec); // Stop playback
+      } else {
+        start_record(&rec); // Start recording
       }
       break;
     default:
@@ -111,7 +116,10 @@ int main(int argc, char **argv) {
     }
     fflush(stdin);
   }
-  free(rec.buffer); // Free the allocated buffer
+  if (rec.recording) {
+    stop_record(&rec); // Finalize the file
+  }
+  close_playback(&rec); // Unmap the take
   config_deinit();
   return 0;
 }
@@ -124,40 +132,20 @@ void audio_cb(const void *input_buffer, void *output_buffer,
   }
   const AudioSample_t *in = (const float *)input_buffer;
   AudioSample_t *out = (AudioSample_t *)output_buffer;
-  if (rec->recording) {
-    // Handle recording
-    if (rec->length >= REC_MAX_SAMPLES) {
-      stop_record(rec); // Handle recording
-      return;
-    }
-    // Copy input samples to buffer
-    for (unsigned long i = 0; i < block_size; ++i) {
-      rec->buffer[rec->length + i] = in[i];
+  // Hold the recorder for the whole block so main can not close it meanwhile
+  DiskRecorder *recorder = atomic_exchange(&rec->recorder, NULL);
+  if (recorder) {
+    // Handle recording, the writer thread takes it to disk
+    if (in) {
+      recorder_push(recorder, in, block_size);
     }
-    rec->length += block_size; // Update the length of recorded samples
-  } else if (rec->playing) {
-    // Handle playback
-    if (rec->elapsed >= rec->length) {
-      if (!rec->loop) {
-        stop_playback(rec); // Stop playback if all samples have been played
-        return;
-      }
-      if (rec->backandforth) {
-        rec->reverse = !rec->reverse;
-      }
-      rec->elapsed = 0;
-    }
-    unsigned long idx =
-        rec->reverse ? rec->length - rec->elapsed : rec->elapsed;
-    // Copy buffer samples to output
-    for (unsigned long i = 0; i < block_size; i++) {
-      idx += rec->reverse ? -1 : 1;
-      int channels = cfg->out_channel_count;
-      while (channels--) {
-        *out++ = rec->buffer[idx];
-      }
-    }
-    rec->elapsed += block_size; // Update elapsed time
+    atomic_store(&rec->recorder, recorder);
+  }
+  WavPlayer *player = atomic_exchange(&rec->player, NULL);
+  if (player) {
+    // Handle playback, straight from the mapped file
+    player_render(player, out, cfg->out_channel_count, block_size);
+    atomic_store(&rec->player, player);
   } else {
     // Clear buffer if nothing to play
     for (unsigned long i = 0; i < block_size * cfg->out_channel_count; ++i) {
@@ -167,56 +155,97 @@ void audio_cb(const void *input_buffer, void *output_buffer,
 }
 
 void start_record(Recorder *rec) {
-  printf(SAME_LINE "Record started! Press Enter again to stop it...\n");
-  // Clear the buffer
-  for (unsigned long i = 0; i < REC_MAX_SAMPLES; i++) {
-    rec->buffer[i] = 0;
+  // The file is about to be truncated under the mapping
+  close_playback(rec);
+  rec->take = recorder_open(REC_PATH, cfg->in_channel_count, cfg->sample_rate,
+                            REC_BUFFER_SEC);
+  if (!rec->take) {
+    printf(SAME_LINE "Can not record to \"%s\"\n", REC_PATH);
+    return;
   }
-  rec->length = 0;  // Reset the length of recorded samples
-  rec->elapsed = 0; // Reset elapsed time
-  rec->playing = false;
-  rec->recording = true;
+  printf(SAME_LINE "Record started! Press Enter again to stop it...\n");
+  atomic_store(&rec->recording, true);
+  atomic_store(&rec->recorder, rec->take);
   Pt_Stop();
   Pt_Start(ANIM_TIMEOUT, countdoun, rec); // Restart the countdown timer
 }
 
 void stop_record(Recorder *rec) {
   Pt_Stop(); // Stop the timer
-  rec->recording = false;
+  // Take the recorder back, the slot is empty while the callback holds it
+  while (!atomic_exchange(&rec->recorder, NULL)) {
+    Pa_Sleep(1);
+  }
+  atomic_store(&rec->recording, false);
+  recorder_close(rec->take);
+  rec->take = NULL;
   printf("Record finished! Press 'p' to listen it.\n");
 }
 
-void start_playback(Recorder *rec) {
+void start_playback(Recorder *rec, unsigned mode) {
+  if (atomic_load(&rec->recording)) {
+    return;
+  }
+  if (!rec->track) {
+    // Map the take written by the recorder
+    rec->track = player_open(REC_PATH);
+    if (!rec->track) {
+      printf("Nothing recorded yet. Press Enter to start recording.\n");
+      return;
+    }
+    atomic_store(&rec->player, rec->track);
+  }
+  player_start(rec->track, mode);
   printf("Playback started! Press Enter to stop it...\n");
-  rec->recording = false;
-  rec->playing = true;
   Pt_Stop();
   Pt_Start(ANIM_TIMEOUT, countdoun, rec); // Restart the countdown timer
 }
 
 void stop_playback(Recorder *rec) {
   Pt_Stop(); // Stop the timer
-  rec->playing = false;
-  rec->reverse = false;
-  rec->loop = false;
-  rec->backandforth = false;
-  rec->elapsed = 0; // Reset elapsed time
+  player_stop(rec->track);
   printf("Playback finished! Press 'p' listen again or Enter to start "
          "new recording.\n");
 }
 
+void close_playback(Recorder *rec) {
+  if (!rec->track) {
+    return;
+  }
+  Pt_Stop(); // The timer reads the player too
+  // Take the player back, the slot is empty while the callback holds it
+  while (!atomic_exchange(&rec->player, NULL)) {
+    Pa_Sleep(1);
+  }
+  player_close(rec->track);
+  rec->track = NULL;
+}
+
 void countdoun(PtTimestamp timestamp, void *user_data) {
   Recorder *rec = (Recorder *)user_data;
+  // Touched by the timer thread only
+  static bool active = false;
   int progress;
-  if (rec->recording) {
-    // Calculate and display recording progress
-    progress = ((float)rec->length / (float)REC_MAX_SAMPLES) * ANIM_WIDTH;
-    printf("%lu seconds recorded   " ANIM_TEMPLATE "\n" SAME_LINE,
-           (unsigned long)((double)rec->length / cfg->sample_rate), ANIM_ARGS);
-  } else if (rec->playing) {
+  if (atomic_load(&rec->recording)) {
+    // Display recording progress, the bar is the peak memory buffer use
+    RecorderStats stats;
+    recorder_get_stats(rec->take, &stats);
+    progress = stats.ring_high_water * ANIM_WIDTH / stats.ring_frames;
+    printf("%lu seconds recorded   " ANIM_TEMPLATE " %llu dropped\n" SAME_LINE,
+           (unsigned long)(stats.frames_pushed / cfg->sample_rate), ANIM_ARGS,
+           (unsigned long long)stats.frames_dropped);
+  } else if (rec->track && player_is_playing(rec->track)) {
     // Calculate and display playback progress
-    progress = ((float)rec->elapsed / (float)rec->length) * ANIM_WIDTH;
+    uint64_t length = player_info(rec->track)->frames;
+    uint64_t position = player_position(rec->track);
+    active = true;
+    progress = ((float)position / (float)length) * ANIM_WIDTH;
     printf("%lu seconds played     " ANIM_TEMPLATE "\n" SAME_LINE,
-           (unsigned long)((double)rec->elapsed / cfg->sample_rate), ANIM_ARGS);
+           (unsigned long)(position / cfg->sample_rate), ANIM_ARGS);
+  } else if (active) {
+    // The audio callback reached the end of the take
+    active = false;
+    printf("Playback finished! Press 'p' listen again or Enter to start "
+           "new recording.\n");
   }
 }
@@ -0,0 +1,100 @@
+/**
+ * \example resample_bench.c
+ * \brief Throughput benchmark of the polyphase resampler.
+ *
+ * Every quality level converts a noise signal for common rate pairs and for
+ * a drifting clock, one block of output frames per call as an audio
+ * callback would. The rate is printed in frames per second per channel,
+ * along with whether the ratio ran on an exact bank and how many times
+ * faster than real time one stereo stream at the output rate is converted.
+ *
+ * Usage: `resample_bench [seconds per case] [channels]`
+ */
+
+#include "workbench.h"
+#include <stdio.h>
+#include <time.h>
+
+#define BLOCK_FRAMES 256
+#define DEFAULT_SECONDS 0.5
+
+typedef struct {
+  const char *name;
+  double in_rate;
+  double out_rate;
+} Case;
+
+static const Case cases[] = {
+    {"44.1k -> 48k", 44100, 48000},  {"48k -> 44.1k", 48000, 44100},
+    {"48k -> 96k (2x)", 48000, 96000}, {"48k -> 192k (4x)", 48000, 192000},
+    {"96k -> 48k (/2)", 96000, 48000}, {"48k +100 ppm", 48004.8, 48000},
+};
+
+static const char *quality_names[] = {"low", "medium", "high"};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_case(const Case *c, ResampleQuality quality, int channels,
+                       double seconds, const float *noise) {
+  double ratio = c->in_rate / c->out_rate;
+  Resampler *resampler =
+      resampler_create(channels, ratio, BLOCK_FRAMES, quality);
+  float *out = malloc(sizeof(float) * BLOCK_FRAMES * channels);
+  if (!resampler || !out) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+
+  size_t frames = 0;
+  double start = now(), elapsed;
+  do {
+    // A few hundred blocks between clock reads
+    for (int i = 0; i < 256; i++) {
+      size_t needed = resampler_input_needed(resampler, BLOCK_FRAMES);
+      frames += resampler_process(resampler, noise, needed, out, BLOCK_FRAMES);
+    }
+    elapsed = now() - start;
+  } while (elapsed < seconds);
+
+  double rate = frames / elapsed;
+  printf("  %-18s %3d taps %-6s %8.2f Mframes/s/ch %8.0fx realtime\n",
+         c->name, resampler_taps(resampler),
+         resampler_is_exact(resampler) ? "exact" : "interp",
+         rate * channels * 1e-6, rate / c->out_rate * channels / 2);
+  resampler_destroy(resampler);
+  free(out);
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : DEFAULT_SECONDS;
+  int channels = argc > 2 ? atoi(argv[2]) : 2;
+  if (channels <= 0)
+    channels = 2;
+
+  // Enough input for one block at the largest ratio
+  size_t samples = (size_t)channels * (4 * BLOCK_FRAMES + 1024);
+  float *noise = malloc(sizeof(float) * samples);
+  if (!noise) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  uint32_t state = 1;
+  for (size_t i = 0; i < samples; i++) {
+    state = state * 1664525u + 1013904223u;
+    noise[i] = (int32_t)state * 0x1p-31f;
+  }
+
+  printf("Resampler, %s kernels, %d channels, %d frames per call:\n",
+         resampler_isa(), channels, BLOCK_FRAMES);
+  for (int q = RESAMPLE_QUALITY_LOW; q <= RESAMPLE_QUALITY_HIGH; q++) {
+    printf(" %s:\n", quality_names[q]);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+      bench_case(&cases[i], q, channels, seconds, noise);
+  }
+  free(noise);
+  return 0;
+}
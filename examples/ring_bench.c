@@ -0,0 +1,153 @@
+/**
+ * \example ring_bench.c
+ * \brief Throughput benchmark of the SPSC ring and the triple buffer.
+ *
+ * A producer thread streams float samples through an `SpscRing` to the
+ * main thread, once for every block size, and the achieved rate is printed.
+ * The producer writes in place with `ring_write_begin`/`ring_write_commit`,
+ * the consumer reads with `ring_read`, as an audio callback and a disk
+ * writer would. The triple buffer is measured the same way with a
+ * meter-sized snapshot.
+ *
+ * Usage: `ring_bench [samples per block size]`
+ */
+
+#include "workbench.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#define RING_CAPACITY 16384
+#define DEFAULT_SAMPLES (1UL << 26)
+#define SNAPSHOT_FLOATS 64
+
+/// Test pattern that stays exact in a float
+#define SEQUENCE(i) ((float)((i) & 0xffff))
+
+static const size_t block_sizes[] = {1, 16, 64, 256, 1024, 4096};
+
+typedef struct {
+  SpscRing ring;
+  TripleBuffer triple;
+  size_t block_size;
+  size_t samples;
+  atomic_bool done;
+} Bench;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *ring_producer(void *arg) {
+  Bench *bench = arg;
+  size_t written = 0;
+  while (written < bench->samples) {
+    RingSpan span;
+    size_t n = bench->block_size;
+    if (bench->samples - written < n)
+      n = bench->samples - written;
+    n = ring_write_begin(&bench->ring, n, &span);
+    for (size_t i = 0; i < span.first_count; i++)
+      ((float *)span.first)[i] = SEQUENCE(written + i);
+    for (size_t i = 0; i < span.second_count; i++)
+      ((float *)span.second)[i] = SEQUENCE(written + span.first_count + i);
+    ring_write_commit(&bench->ring, n);
+    written += n;
+    // Give the consumer a chance on machines with fewer cores than threads
+    if (n == 0)
+      sched_yield();
+  }
+  return NULL;
+}
+
+static void *triple_producer(void *arg) {
+  Bench *bench = arg;
+  for (size_t i = 0; i < bench->samples; i++) {
+    float *snapshot = triple_buffer_write(&bench->triple);
+    for (int j = 0; j < SNAPSHOT_FLOATS; j++)
+      snapshot[j] = (float)i;
+    triple_buffer_publish(&bench->triple);
+  }
+  atomic_store(&bench->done, true);
+  return NULL;
+}
+
+static void bench_ring(Bench *bench) {
+  float *block = malloc(sizeof(float) * bench->block_size);
+  size_t read = 0;
+  bool ordered = true;
+  pthread_t thread;
+
+  double start = now();
+  pthread_create(&thread, NULL, ring_producer, bench);
+  while (read < bench->samples) {
+    size_t n = ring_read(&bench->ring, block, bench->block_size);
+    for (size_t i = 0; i < n; i++)
+      ordered &= block[i] == SEQUENCE(read + i);
+    read += n;
+    if (n == 0)
+      sched_yield();
+  }
+  pthread_join(thread, NULL);
+  double elapsed = now() - start;
+
+  printf("  block %5zu: %8.1f Msamples/s %7.2f GB/s%s\n", bench->block_size,
+         read / elapsed * 1e-6, read * sizeof(float) / elapsed * 1e-9,
+         ordered ? "" : " (out of order!)");
+  free(block);
+}
+
+static void bench_triple(Bench *bench) {
+  size_t fresh_reads = 0;
+  bool consistent = true;
+  pthread_t thread;
+
+  atomic_store(&bench->done, false);
+  double start = now();
+  pthread_create(&thread, NULL, triple_producer, bench);
+  while (!atomic_load(&bench->done)) {
+    bool fresh;
+    const float *snapshot = triple_buffer_read(&bench->triple, &fresh);
+    if (!fresh) {
+      sched_yield();
+      continue;
+    }
+    fresh_reads++;
+    for (int j = 1; j < SNAPSHOT_FLOATS; j++)
+      consistent &= snapshot[j] == snapshot[0];
+  }
+  pthread_join(thread, NULL);
+  double elapsed = now() - start;
+
+  printf("  %zu snapshots of %zu bytes: %.1f M/s published, %zu seen%s\n",
+         bench->samples, bench->triple.size, bench->samples / elapsed * 1e-6,
+         fresh_reads, consistent ? "" : " (torn!)");
+}
+
+int main(int argc, char **argv) {
+  Bench bench = {0};
+  bench.samples = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_SAMPLES;
+  if (!ring_init(&bench.ring, sizeof(float), RING_CAPACITY) ||
+      !triple_buffer_init(&bench.triple, sizeof(float) * SNAPSHOT_FLOATS)) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  printf("SpscRing, %zu floats, %zu samples per run:\n",
+         ring_capacity(&bench.ring), bench.samples);
+  for (size_t i = 0; i < sizeof(block_sizes) / sizeof(*block_sizes); i++) {
+    bench.block_size = block_sizes[i];
+    bench_ring(&bench);
+  }
+
+  printf("TripleBuffer:\n");
+  bench.samples /= 64;
+  bench_triple(&bench);
+
+  ring_free(&bench.ring);
+  triple_buffer_free(&bench.triple);
+  return 0;
+}
@@ -11,6 +11,22 @@
 #include "workbench_config.h"
 #include "workbench_audio.h"
 #include "workbench_midi.h"
+#include "workbench_convert.h"
+#include "workbench_memory.h"
+#include "workbench_scratch.h"
+#include "workbench_params.h"
+#include "workbench_meter.h"
+#include "workbench_module.h"
+#include "workbench_ring.h"
+#include "workbench_wav.h"
+#include "workbench_resample.h"
+#include "workbench_fft.h"
+#include "workbench_stft.h"
+#include "workbench_convolver.h"
+#include "workbench_recorder.h"
+#include "workbench_player.h"
+#include "workbench_graph.h"
+#include "workbench_stats.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -34,11 +50,10 @@
  * @typedef AudioSample_t
  * @brief Defines `AudioSample_t` as the type for audio samples.
  *
- * This typedef defines `AudioSample_t` to be the type corresponding
- * to `SAMPLE_FORMAT`. For example, if `SAMPLE_FORMAT` is `paFloat32`,
- * `AudioSample_t` will be defined as `float`.
+ * The callbacks always process `float` samples in [-1, 1), whatever
+ * `sample_format` the device uses.
  */
-typedef SAMPLE AudioSample_t;
+typedef float AudioSample_t;
 
 /**
  * @brief Type definition for audio callback functions.
@@ -64,6 +79,22 @@ typedef SAMPLE AudioSample_t;
  *   }
  * }
  * @endcode
+ *
+ * By default the buffers hold interleaved frames. With `non_interleaved` set
+ * in the configuration, they are arrays of per-channel pointers instead, each
+ * channel aligned to `AUDIO_BUFFER_ALIGNMENT` bytes (slices made by
+ * `midi_split_blocks` start inside the block and are not aligned):
+ * @code
+ * void my_planar_callback(const void *input_buffer, void *output_buffer,
+ * unsigned long block_size, void *user_data) {
+ *   const AudioSample_t *const *in = input_buffer;
+ *   AudioSample_t **out = output_buffer;
+ *
+ *   for (int c = 0; c < config_get()->out_channel_count; c++)
+ *     for (unsigned long i = 0; i < block_size; ++i)
+ *       out[c][i] = 0.5f * in[0][i];
+ * }
+ * @endcode
  */
 typedef void (*AudioCallback)(const void *, void *, unsigned long, void *);
 
@@ -77,9 +108,37 @@ typedef void (*AudioCallback)(const void *, void *, unsigned long, void *);
  *
  * If an error occurs during initialization, it logs the error message
  * and deinitializes the audio system.
+ *
+ * After a `config_init` that started audio, it only starts what is not yet
+ * running: the offline backend, which `config_init` opens but does not start
+ * so that no block is rendered before the application is set up. Call it
+ * once the state of the callbacks is ready; with the real-time backends it
+ * does nothing.
  */
 void audio_init();
 
+/**
+ * @brief Has the engine run a processing graph instead of the audio callback.
+ *
+ * The graph is compiled if it was not yet. Call it before `audio_init`: pass
+ * no callbacks to `config_init`, build the graph for the parsed
+ * configuration, install it and then start MIDI and audio:
+ * @code
+ * cfg = config_init(argc, argv, NULL, NULL, NULL);
+ * Graph *graph = graph_create();
+ * int gain = graph_add_node(graph, &gain_desc);
+ * graph_connect(graph, PORT_AUDIO, GRAPH_INPUT, 0, gain, 0);
+ * graph_connect(graph, PORT_AUDIO, gain, 0, GRAPH_OUTPUT, 0);
+ * audio_set_graph(graph);
+ * midi_init();
+ * audio_init();
+ * @endcode
+ *
+ * @param graph Graph to run, or `NULL` to go back to the audio callback.
+ * @return `false` if the graph can not be compiled.
+ */
+bool audio_set_graph(Graph *graph);
+
 /**
  * @brief Deinitializes the audio system.
  *
@@ -89,6 +148,22 @@ void audio_init();
  */
 void audio_deinit();
 
+/**
+ * @brief Tells whether the audio backend is still running.
+ *
+ * For the PortAudio backend this is true while the stream is active. The
+ * offline backend becomes inactive once the whole input has been rendered,
+ * so applications can use it as their main loop condition:
+ * @code
+ * while (audio_is_active()) {
+ *   Pa_Sleep(1000);
+ * }
+ * @endcode
+ *
+ * @return `true` while the audio callback keeps being called.
+ */
+bool audio_is_active();
+
 /** @} */
 
 /**
@@ -104,6 +179,11 @@ void audio_deinit();
  * the `midi_deinit` function closes the streams and terminates the MIDI system.
  * The `__midi_callback` function processes incoming MIDI messages,
  * and the `process_midi` function handles MIDI message parsing and logging.
+ *
+ * When an audio callback is registered too, the MIDI callback runs on the
+ * audio thread once per block. PortMidi is then only used by a dedicated
+ * MIDI I/O thread that exchanges events with the audio thread through
+ * wait-free queues, so device I/O never blocks the audio callback.
  * @{ */
 /**
  * @brief Type definition for MIDI callback functions.
@@ -116,6 +196,20 @@ void audio_deinit();
  * - `user_data`: A pointer to user-defined data passed to the callback
  * function.
  *
+ * When the callback is driven by the audio engine, the `timestamp` of every
+ * incoming `PmEvent` holds its frame offset inside the current audio block.
+ * Events are stamped against the audio stream clock on arrival and played
+ * one block later at the same position. Outgoing events take a frame offset
+ * in their `timestamp` as well. With `midi_split_blocks` set, the audio
+ * callback is called in slices that end at each event offset, so changes
+ * made in the MIDI callback apply from the exact frame of the event.
+ *
+ * The output buffer holds `midi_buffer_size` events per block. When the MIDI
+ * callback is called once per slice, the slices share it: each call has room
+ * for `midi_buffer_size` minus the events the earlier calls of the block
+ * returned, and once it is full the callback is skipped for the rest of the
+ * block.
+ *
  * Example usage:
  * @code
  * int my_midi_callback(const void *input_buffer, void *output_buffer, unsigned
@@ -252,12 +346,36 @@ enum flags { FLAGS(WORKBENCH_FLAG_DEFINE) };
   FIELD(int, midi_buffer_size, 1024)                                           \
   FIELD(char *, audio_input, NULL)                                             \
   FIELD(char *, audio_output, NULL)                                            \
+  FIELD(char *, audio_host_api, NULL)                                          \
+  FIELD(char *, secondary_input, NULL)                                         \
+  FIELD(int, secondary_in_channels, 0)                                         \
+  FIELD(char *, secondary_output, NULL)                                        \
+  FIELD(int, secondary_out_channels, 0)                                        \
+  FIELD(double, secondary_sample_rate, 0.0)                                    \
+  FIELD(char *, resample_quality, NULL)                                        \
   FIELD(double, sample_rate, 44100.0)                                          \
   FIELD(uint32_t, block_size, 512U)                                            \
+  FIELD(int, device_block_size, 0)                                             \
   FIELD(uint32_t, audio_flags, 0U)                                             \
+  FIELD(uint32_t, non_interleaved, 0U)                                         \
+  FIELD(char *, sample_format, NULL)                                           \
+  FIELD(uint32_t, dither, 0U)                                                  \
   FIELD(int, in_channel_count, DEFAULT_IN_CHANNELS_COUNT)                      \
   FIELD(int, out_channel_count, DEFAULT_OUT_CHANNELS_COUNT)                    \
   FIELD(double, suggested_latency, -1.0)                                       \
+  FIELD(uint32_t, midi_split_blocks, 0U)                                       \
+  FIELD(uint32_t, rt_priority, 0U)                                             \
+  FIELD(char *, cpu_affinity, NULL)                                            \
+  FIELD(uint32_t, memory_pool_size, 64U)                                       \
+  FIELD(uint32_t, scratch_size, 256U)                                          \
+  FIELD(uint32_t, meter_output, 0U)                                            \
+  FIELD(uint32_t, graph_workers, 0U)                                           \
+  FIELD(uint32_t, graph_profile, 0U)                                           \
+  FIELD(char *, audio_module, NULL)                                            \
+  FIELD(char *, audio_backend, NULL)                                           \
+  FIELD(char *, offline_input, NULL)                                           \
+  FIELD(char *, offline_output, NULL)                                          \
+  FIELD(double, offline_duration, 10.0)                                        \
   FIELD(uint32_t, flags, 0U)                                                   \
   FIELD(uint8_t, log_level, 4)
 
@@ -288,6 +406,7 @@ typedef struct {
   AudioCallback audio_callback; /**< Audio callback function pointer */
   MidiCallback midi_callback;   /**< MIDI callback function pointer */
   void *user_data; /**< Pointer to a custom user data passed to callbacks */
+  Graph *graph;    /**< Processing graph run instead of `audio_callback` */
   CONFIG(WORKBENCH_CONFIG_DEFINE_STRUCT)
 } Config;
 
@@ -295,6 +414,11 @@ typedef struct {
  * @brief Initializes the configuration with the specified audio
  * and MIDI callbacks.
  *
+ * MIDI is started if `midi_cb` is given and audio if `audio_cb` is or
+ * `audio_module` is set. With both, PortMidi is initialised on a helper
+ * thread while the audio streams are opened, and the audio engine is started
+ * when both are ready. An offline render waits for `audio_init`.
+ *
  * @param audio_cb The audio callback function.
  * @param midi_cb The MIDI callback function.
  * @param user_data A pointer to the cistom user data.
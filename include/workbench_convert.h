@@ -0,0 +1,84 @@
+/**
+ * @file workbench_convert.h
+ * @brief Sample format conversion between device formats and float.
+ *
+ * This header file declares the converters used by the engine to translate
+ * device buffers to and from the `float` samples processed by the callbacks.
+ * Integer samples are signed and little-endian; `Int24` samples are packed in
+ * three bytes, as PortAudio's `paInt24`.
+ *
+ * Each converter has a scalar reference implementation and vectorised ones
+ * for SSE2/SSSE3, AVX2 and NEON. The fastest set supported by the CPU is
+ * selected once, the first time any converter is used.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup convert Convert
+ * @brief Vectorised sample format converters.
+ *
+ * Integer to float conversion divides by the full scale of the format
+ * (`2^(bits - 1)`), so it maps to [-1, 1). Float to integer conversion
+ * multiplies by the same value, rounds to nearest and saturates. Optional
+ * TPDF dither of one least significant bit is added before rounding.
+ * @{ */
+
+/**
+ * @brief State of the triangular dither noise generator.
+ *
+ * The generator runs eight independent xorshift lanes so that the noise can
+ * be produced in vector registers.
+ */
+typedef struct {
+  uint32_t state[8]; /**< Per-lane generator state, never zero */
+} Dither;
+
+/**
+ * @brief Seeds a dither generator.
+ *
+ * @param dither Generator to seed.
+ * @param seed Any value; different seeds give uncorrelated noise.
+ */
+void dither_init(Dither *dither, uint32_t seed);
+
+/**
+ * @name Integer to float
+ * @param src `count` samples in the source format.
+ * @param dst Receives `count` float samples.
+ * @param count Number of samples (frames times channels).
+ * @{ */
+void convert_s8_to_f32(const void *src, float *dst, size_t count);
+void convert_s16_to_f32(const void *src, float *dst, size_t count);
+void convert_s24_to_f32(const void *src, float *dst, size_t count);
+void convert_s32_to_f32(const void *src, float *dst, size_t count);
+/** @} */
+
+/**
+ * @name Float to integer
+ * @param src `count` float samples.
+ * @param dst Receives `count` samples in the destination format.
+ * @param count Number of samples (frames times channels).
+ * @param dither Dither generator, or `NULL` to round without dither. Dither
+ * is ignored for 32 bit output, where it is below float precision.
+ * @{ */
+void convert_f32_to_s8(const float *src, void *dst, size_t count,
+                       Dither *dither);
+void convert_f32_to_s16(const float *src, void *dst, size_t count,
+                        Dither *dither);
+void convert_f32_to_s24(const float *src, void *dst, size_t count,
+                        Dither *dither);
+void convert_f32_to_s32(const float *src, void *dst, size_t count,
+                        Dither *dither);
+/** @} */
+
+/**
+ * @brief Name of the instruction set used by the converters.
+ *
+ * @return One of `"avx2"`, `"ssse3"`, `"sse2"`, `"neon"` or `"scalar"`.
+ */
+const char *convert_isa();
+
+/** @} */
@@ -0,0 +1,114 @@
+/**
+ * @file workbench_convolver.h
+ * @brief Zero-latency partitioned convolution with long impulse responses.
+ *
+ * The impulse response is cut into two sizes of partitions. The head,
+ * `block` samples per partition, covers the start of the response and runs
+ * on the calling thread with a frequency-domain delay line: every block is
+ * transformed once, and its output is the sum of the spectra of the last
+ * blocks multiplied by the partitions, one `fft_multiply_add` each. Output
+ * is produced for every input sample as it arrives, so there is no latency
+ * whatever the length of the calls.
+ *
+ * Past twice the tail partition size `T`, the rest of the response is
+ * convolved in partitions of `T` samples. A tail partition is due only `T`
+ * samples after its input is complete, so its cost can be spread: with
+ * `background` set, a helper thread computes it while the caller goes on, and
+ * the caller only waits if the helper is late. Without it, the caller
+ * computes the tail in the block that completes its input.
+ *
+ * A late helper blocks the caller: `convolver_process` then sleeps on a
+ * futex until the tail is ready. The helper runs `SCHED_FIFO` one step below
+ * `rt_priority` on any CPU, like the graph workers: the audio thread preempts
+ * it on a shared CPU instead of waiting for a whole tail transform.
+ * `late_tails` in `ConvolverInfo` counts these waits.
+ *
+ * Every table and buffer comes from the engine memory; processing never
+ * allocates.
+ */
+#pragma once
+
+#include "workbench_graph.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup convolver Convolver
+ * @brief Fast convolution with impulse responses of any length.
+ * @{ */
+
+/**
+ * @brief A convolver of one channel.
+ */
+typedef struct Convolver Convolver;
+
+/**
+ * @brief Layout and health of a convolver.
+ */
+typedef struct {
+  size_t block;        /**< Samples per head partition */
+  size_t tail_block;   /**< Samples per tail partition, 0 without a tail */
+  int head_partitions; /**< Partitions of `block` samples */
+  int tail_partitions; /**< Partitions of `tail_block` samples */
+  bool background;     /**< Tail computed on a helper thread */
+  uint64_t late_tails; /**< Times the caller waited for the helper */
+} ConvolverInfo;
+
+/**
+ * @brief Creates a convolver. Not real-time safe.
+ *
+ * @param ir Impulse response, copied.
+ * @param length Samples of the impulse response.
+ * @param block Head partition size, a power of two of at least 2. Calls of
+ * a multiple of `block` frames cost the least.
+ * @param tail_block Tail partition size, a power of two of at least twice
+ * `block`; `block` for a uniform partition without tail, 0 to pick the size
+ * with the lowest estimated cost.
+ * @param background Compute the tail on a helper thread, started at the
+ * priority and on the CPUs of the audio thread.
+ * @return A new convolver, or `NULL` if the parameters are invalid or it can
+ * not be allocated.
+ */
+Convolver *convolver_create(const float *ir, size_t length, size_t block,
+                            size_t tail_block, bool background);
+
+/**
+ * @brief Stops the helper thread and frees a convolver.
+ */
+void convolver_destroy(Convolver *convolver);
+
+/**
+ * @brief Convolves a block of input.
+ *
+ * Real-time safe, except that with a background tail it blocks while the
+ * helper is late. The output of each sample depends on the input up to that
+ * sample only. `in` and `out` may be the same buffer.
+ *
+ * @param convolver Convolver to run.
+ * @param in `frames` input samples, `NULL` for silence.
+ * @param out Receives `frames` output samples.
+ * @param frames Samples in the block, any number.
+ */
+void convolver_process(Convolver *convolver, const float *in, float *out,
+                       size_t frames);
+
+/**
+ * @brief Clears the input history. Not while `convolver_process` runs.
+ */
+void convolver_reset(Convolver *convolver);
+
+/**
+ * @brief Reads the layout of a convolver and how often its tail was late.
+ */
+void convolver_info(const Convolver *convolver, ConvolverInfo *info);
+
+/**
+ * @brief Processing function of a graph node running a convolver.
+ *
+ * Add the node with one audio input, one audio output and the `Convolver`
+ * as its state.
+ */
+void convolver_node(const NodeContext *context, void *state);
+
+/** @} */
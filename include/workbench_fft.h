@@ -0,0 +1,114 @@
+/**
+ * @file workbench_fft.h
+ * @brief Real FFT of power-of-two sizes.
+ *
+ * A plan holds everything a transform of one size needs: twiddle factors,
+ * the bit-reversal permutation and its working buffers, all taken from the
+ * engine memory when the plan is created. Transforms then run without any
+ * allocation and can be called from the audio thread.
+ *
+ * A real transform of size `N` is computed as a complex transform of size
+ * `N / 2` over the even and odd samples, followed by a pass that separates
+ * the two halves of the spectrum. The complex transform works on split real
+ * and imaginary arrays so every radix-2 stage but the first two runs four or
+ * eight butterflies per instruction with AVX2, SSE or NEON, selected once at
+ * run time.
+ *
+ * Spectra have `N / 2 + 1` bins, from DC to Nyquist, in separate real and
+ * imaginary arrays.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @defgroup fft FFT
+ * @brief Real fast Fourier transform.
+ * @{ */
+
+/** @brief Smallest transform size. */
+#define FFT_MIN_SIZE 4
+
+/**
+ * @brief A transform size with its precomputed tables.
+ *
+ * A plan runs one transform at a time; threads that transform concurrently
+ * need their own plans.
+ */
+typedef struct FftPlan FftPlan;
+
+/**
+ * @brief Creates a plan.
+ *
+ * Not real-time safe.
+ *
+ * @param size Samples per transform, a power of two of at least
+ * `FFT_MIN_SIZE`.
+ * @return A new plan, or `NULL` if the size is not supported or the plan can
+ * not be allocated.
+ */
+FftPlan *fft_plan_create(size_t size);
+
+/**
+ * @brief Frees a plan.
+ */
+void fft_plan_destroy(FftPlan *plan);
+
+/**
+ * @brief Samples per transform of a plan.
+ */
+size_t fft_size(const FftPlan *plan);
+
+/**
+ * @brief Transforms real samples into their spectrum.
+ *
+ * Real-time safe. Bin `k` is `sum(in[n] * exp(-2 pi i k n / size))`, without
+ * scaling.
+ *
+ * @param plan Plan of the size.
+ * @param in `size` samples.
+ * @param re Receives the real parts of the `size / 2 + 1` bins.
+ * @param im Receives the imaginary parts of the `size / 2 + 1` bins.
+ */
+void fft_forward(FftPlan *plan, const float *in, float *re, float *im);
+
+/**
+ * @brief Transforms a spectrum back into real samples.
+ *
+ * Real-time safe. The result is divided by `size`, so `fft_inverse` undoes
+ * `fft_forward`. The imaginary parts of DC and Nyquist are ignored.
+ *
+ * @param plan Plan of the size.
+ * @param re Real parts of the `size / 2 + 1` bins.
+ * @param im Imaginary parts of the `size / 2 + 1` bins.
+ * @param out Receives `size` samples.
+ */
+void fft_inverse(FftPlan *plan, const float *re, const float *im, float *out);
+
+/**
+ * @brief Multiplies two spectra bin by bin and adds the products to a third.
+ *
+ * Real-time safe. `acc += a * b` in complex arithmetic, the inner loop of
+ * fast convolution and spectral filtering.
+ *
+ * @param acc_re Real parts of the sum, updated.
+ * @param acc_im Imaginary parts of the sum, updated.
+ * @param a_re Real parts of the first factor.
+ * @param a_im Imaginary parts of the first factor.
+ * @param b_re Real parts of the second factor.
+ * @param b_im Imaginary parts of the second factor.
+ * @param bins Number of bins.
+ */
+void fft_multiply_add(float *acc_re, float *acc_im, const float *a_re,
+                      const float *a_im, const float *b_re, const float *b_im,
+                      size_t bins);
+
+/**
+ * @brief Name of the instruction set used by the butterflies and
+ * `fft_multiply_add`.
+ *
+ * @return One of `"avx2"`, `"sse"`, `"neon"` or `"scalar"`.
+ */
+const char *fft_isa();
+
+/** @} */
@@ -0,0 +1,224 @@
+/**
+ * @file workbench_graph.h
+ * @brief Directed acyclic graph of audio and MIDI processors.
+ *
+ * This header file declares a processing graph that the engine runs in place
+ * of a single audio callback. Nodes are processors with typed ports: audio
+ * ports carry one channel of `float` samples, MIDI ports carry a list of
+ * `PmEvent`s stamped with their frame offset in the block. Connections go
+ * from an output port to an input port of the same type. Several connections
+ * into one input are mixed: audio is summed, MIDI events are merged in time
+ * order.
+ *
+ * `graph_compile` sorts the nodes topologically once and turns the graph into
+ * a flat array of steps. Port buffers are taken from a pool by liveness: a
+ * buffer returns to the pool after the last node that reads it, so the pool
+ * only grows to the number of signals alive at the same time, the widest cut
+ * of the graph, however many nodes it has. Running a block is then a walk
+ * over the steps without any allocation or lookup.
+ *
+ * Two nodes always exist: `GRAPH_INPUT` produces the device input channels
+ * and the incoming MIDI events, `GRAPH_OUTPUT` consumes the device output
+ * channels and the outgoing MIDI events.
+ *
+ * With `graph_workers` set, independent branches run in parallel on that many
+ * worker threads besides the audio thread. A step starts once the steps that
+ * feed it are done; the audio thread takes part and returns when the block is
+ * complete. A buffer is then only reused by a step that already runs after
+ * every earlier user of it, so the pool grows to the signals alive across the
+ * parallel branches. Nodes with no path between them may run at the same time
+ * and must not share unsynchronised state. `graph_profile` times every step
+ * and publishes the utilisation of each thread and the critical path.
+ */
+#pragma once
+
+#include "portmidi.h"
+#include "workbench_scratch.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup graph Graph
+ * @brief Processing graph run by the audio engine.
+ * @{ */
+
+#define GRAPH_INPUT 0  /**< @brief Node of the device inputs. */
+#define GRAPH_OUTPUT 1 /**< @brief Node of the device outputs. */
+
+#ifndef GRAPH_MAX_THREADS
+/** @brief Most threads running a graph, the audio thread included. */
+#define GRAPH_MAX_THREADS 32
+#endif
+
+/**
+ * @brief Kind of data carried by a port.
+ */
+typedef enum {
+  PORT_AUDIO, /**< One channel of `block_size` float samples */
+  PORT_MIDI,  /**< Events of the current block */
+} PortType;
+
+/**
+ * @brief Events passed through a MIDI port.
+ *
+ * The `timestamp` of every event is its frame offset inside the block.
+ */
+typedef struct {
+  PmEvent *events; /**< Events in time order */
+  int length;      /**< Number of events */
+  int capacity;    /**< Room in `events`, `midi_buffer_size` */
+} MidiBuffer;
+
+/**
+ * @brief Port buffers of a node for the current block.
+ *
+ * Output buffers are never shared with the inputs of the same node. MIDI
+ * outputs are empty when the node is called; the node appends its events
+ * and updates `length`.
+ */
+typedef struct {
+  const float *const *audio_in;     /**< One buffer per audio input */
+  float *const *audio_out;          /**< One buffer per audio output */
+  const MidiBuffer *const *midi_in; /**< One buffer per MIDI input */
+  MidiBuffer *const *midi_out;      /**< One buffer per MIDI output */
+  unsigned long frames;             /**< Frames in every audio buffer */
+  ScratchArena *scratch;            /**< Arena of the running thread */
+} NodeContext;
+
+/**
+ * @brief Type definition for node processing functions.
+ *
+ * Called once per block, after every node that feeds it. With `graph_workers`
+ * set, it may be called on a worker thread.
+ *
+ * @param context Port buffers of the node.
+ * @param state The `state` given to `graph_add_node`.
+ */
+typedef void (*NodeProcess)(const NodeContext *context, void *state);
+
+/**
+ * @brief Description of a node.
+ */
+typedef struct {
+  const char *name;    /**< Name used in log messages */
+  int audio_inputs;    /**< Number of audio input ports */
+  int audio_outputs;   /**< Number of audio output ports */
+  int midi_inputs;     /**< Number of MIDI input ports */
+  int midi_outputs;    /**< Number of MIDI output ports */
+  NodeProcess process; /**< Processing function */
+  void *state;         /**< Pointer passed to `process` */
+} NodeDesc;
+
+/**
+ * @brief A processing graph.
+ */
+typedef struct Graph Graph;
+
+/**
+ * @brief Creates an empty graph for the current configuration.
+ *
+ * `GRAPH_INPUT` gets `in_channel_count` audio outputs and `GRAPH_OUTPUT`
+ * `out_channel_count` audio inputs, each with one MIDI port.
+ *
+ * @return A new graph or `NULL` if it can not be allocated.
+ */
+Graph *graph_create();
+
+/**
+ * @brief Frees a graph. It must not be installed with `audio_set_graph`.
+ */
+void graph_destroy(Graph *graph);
+
+/**
+ * @brief Adds a node.
+ *
+ * @param graph Graph to extend.
+ * @param desc Ports and processing function of the node, copied.
+ * @return The node id used in `graph_connect`, or -1 on failure.
+ */
+int graph_add_node(Graph *graph, const NodeDesc *desc);
+
+/**
+ * @brief Connects an output port to an input port of the same type.
+ *
+ * @param graph Graph to modify.
+ * @param type Type of both ports.
+ * @param from Node of the output port.
+ * @param from_port Index of the output port among the outputs of `type`.
+ * @param to Node of the input port.
+ * @param to_port Index of the input port among the inputs of `type`.
+ * @return `false` if a node or a port does not exist.
+ */
+bool graph_connect(Graph *graph, PortType type, int from, int from_port,
+                   int to, int to_port);
+
+/**
+ * @brief Orders the nodes and assigns the port buffers.
+ *
+ * Must be called after the last change to the graph and before it is run.
+ *
+ * @param graph Graph to compile.
+ * @return `false` if the graph has a cycle or the buffers can not be
+ * allocated.
+ */
+bool graph_compile(Graph *graph);
+
+/**
+ * @brief Runs one block through a compiled graph.
+ *
+ * Called by the engine on the audio thread.
+ *
+ * @param graph Compiled graph.
+ * @param input Device input in the `non_interleaved` layout, or `NULL`.
+ * @param output Device output in the `non_interleaved` layout.
+ * @param frames Frames in the block.
+ * @param events Incoming MIDI events stamped with frame offsets.
+ * @param event_count Number of incoming events.
+ * @return The MIDI events that reached `GRAPH_OUTPUT`, stamped with frame
+ * offsets. Valid until the next block.
+ */
+const MidiBuffer *graph_process(Graph *graph, const void *input, void *output,
+                                unsigned long frames, const PmEvent *events,
+                                int event_count);
+
+/**
+ * @brief Number of audio buffers the compiled graph uses for its ports.
+ */
+int graph_buffer_count(const Graph *graph);
+
+/**
+ * @brief Profile of the blocks run since the graph was compiled.
+ *
+ * Times are in seconds. `work` is the time spent in the steps summed over all
+ * threads, the critical path the longest chain of dependent steps. Their
+ * ratio bounds the speedup any number of threads can give.
+ */
+typedef struct {
+  uint64_t blocks;                       /**< Blocks profiled */
+  int threads;                           /**< Threads, the audio thread first */
+  double utilisation[GRAPH_MAX_THREADS]; /**< Busy fraction of each thread */
+  double wall_last;                      /**< Duration of the last block */
+  double work_last;                      /**< Step time of the last block */
+  double critical_path_last;             /**< Critical path of the last one */
+  double critical_path_max;              /**< Longest critical path */
+  double parallelism;                    /**< Total work / critical paths */
+} GraphStats;
+
+/**
+ * @brief Latest profile published by the audio thread.
+ *
+ * Wait-free; call it from one thread at a time.
+ *
+ * @param graph Compiled graph.
+ * @param stats Receives the profile.
+ * @return `false` if `graph_profile` was not set when the graph was created.
+ */
+bool graph_get_stats(Graph *graph, GraphStats *stats);
+
+/**
+ * @brief Prints the latest profile to the standard output.
+ */
+void graph_print_stats(Graph *graph);
+
+/** @} */
@@ -0,0 +1,80 @@
+/**
+ * @file workbench_memory.h
+ * @brief Locked, prefaulted memory for buffers the audio thread touches.
+ *
+ * Memory from `malloc` is only backed by physical pages when it is first
+ * written, so a large buffer allocated at startup page-faults inside the
+ * audio callback, and it can be swapped out later. The engine allocator
+ * instead carves buffers out of one pool that is reserved at first use,
+ * backed by huge pages when the system offers them, locked with `mlock` and
+ * written once before any of it is handed out. Every buffer the library
+ * hands to the audio thread comes from it; applications can use it for
+ * their own delay lines and tables.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @defgroup memory Memory
+ * @brief Engine allocator backed by a locked pool.
+ * @{ */
+
+/** @brief Alignment of every block returned by the engine allocator. */
+#define ENGINE_ALIGNMENT 64
+
+/**
+ * @brief Residency of the engine memory, as reported at startup.
+ */
+typedef struct {
+  size_t pool_bytes;     /**< Size of the pool */
+  size_t used_bytes;     /**< Bytes handed out, headers included */
+  size_t peak_bytes;     /**< Largest `used_bytes` so far */
+  size_t prepared_bytes; /**< Bytes of the pool locked and faulted in */
+  size_t resident_bytes; /**< Bytes of the pool in physical memory */
+  size_t huge_bytes;     /**< Bytes of the pool on huge pages */
+  size_t outside_bytes;  /**< Bytes allocated outside a full pool */
+  bool locked;           /**< Everything prepared is locked */
+  const char *pages;     /**< `"hugetlb"`, `"thp"` or `"base"` pages */
+} EngineMemoryStats;
+
+/**
+ * @brief Allocates zeroed memory that is resident and locked.
+ *
+ * The pool is created by the first call, with `memory_pool_size` MiB. When
+ * it is full, the block is allocated with `posix_memalign` and locked and
+ * faulted in on its own. Not real-time safe; allocate before the stream
+ * starts.
+ *
+ * @param bytes Size of the block.
+ * @return A block aligned to `ENGINE_ALIGNMENT`, or `NULL`.
+ */
+void *engine_alloc(size_t bytes);
+
+/**
+ * @brief Allocates a zeroed, resident and locked array.
+ *
+ * @return A block aligned to `ENGINE_ALIGNMENT`, or `NULL` on overflow or
+ * when out of memory.
+ */
+void *engine_calloc(size_t count, size_t size);
+
+/**
+ * @brief Returns a block to the engine allocator. `NULL` is ignored.
+ */
+void engine_free(void *block);
+
+/**
+ * @brief Takes a snapshot of the residency of the engine memory.
+ */
+void engine_memory_stats(EngineMemoryStats *stats);
+
+/**
+ * @brief Logs the residency of the engine memory.
+ *
+ * `audio_init` calls it once the engine is running.
+ */
+void engine_memory_report();
+
+/** @} */
@@ -0,0 +1,85 @@
+/**
+ * @file workbench_meter.h
+ * @brief Level and loudness meters of the engine output.
+ *
+ * With `meter_output` set, the audio thread meters every output channel
+ * after the callbacks, before the samples are converted to the device
+ * format. The audio is measured in steps of 100 ms; at the end of each step
+ * a snapshot is published through a `TripleBuffer`, so a reader polling at
+ * 10 Hz or faster sees every step and the audio thread never waits.
+ *
+ * - Sample peak and RMS of the step.
+ * - True peak, the peak of the signal upsampled 4x with a 48 tap polyphase
+ *   FIR as in ITU-R BS.1770-4 Annex 2.
+ * - Momentary (400 ms) and short-term (3 s) loudness in LUFS, K-weighted
+ *   as in ITU-R BS.1770 and EBU R128. With six channels, the fourth is
+ *   taken as LFE and left out and the last two as surrounds.
+ *
+ * Peak, power and oversampling kernels are vectorised for SSE, AVX2 and
+ * NEON; the fastest set supported by the CPU is selected once.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @defgroup meter Meter
+ * @brief Peak, RMS, true-peak and loudness meters.
+ * @{ */
+
+/** @brief Most output channels metered, the others are ignored. */
+#ifndef METER_MAX_CHANNELS
+#define METER_MAX_CHANNELS 16
+#endif
+
+/** @brief Loudness and levels reported for silence, in LUFS or dBFS. */
+#define METER_FLOOR_DB -150.0
+
+/**
+ * @brief Meters at the end of a step. Levels are linear, loudness in LUFS.
+ */
+typedef struct {
+  uint64_t steps;                          /**< Steps metered so far */
+  int channels;                            /**< Channels metered */
+  float peak[METER_MAX_CHANNELS];          /**< Sample peak of the step */
+  float rms[METER_MAX_CHANNELS];           /**< RMS of the step */
+  float true_peak[METER_MAX_CHANNELS];     /**< True peak of the step */
+  float peak_max[METER_MAX_CHANNELS];      /**< Sample peak since the reset */
+  float true_peak_max[METER_MAX_CHANNELS]; /**< True peak since the reset */
+  double momentary;                        /**< Loudness of the last 400 ms */
+  double short_term;                       /**< Loudness of the last 3 s */
+  double momentary_max; /**< Largest momentary loudness since the reset */
+} MeterSnapshot;
+
+/**
+ * @brief Latest meters published by the audio thread.
+ *
+ * Wait-free; call it from one thread at a time.
+ *
+ * @param meters Receives the snapshot.
+ * @return `false` if `meter_output` is not set.
+ */
+bool audio_get_meters(MeterSnapshot *meters);
+
+/**
+ * @brief Asks the audio thread to clear the maxima at its next step.
+ */
+void audio_reset_meters();
+
+/**
+ * @brief Prints the latest meters in dBFS and LUFS to the standard output.
+ */
+void audio_print_meters();
+
+/**
+ * @brief Converts a linear level to dBFS, down to `METER_FLOOR_DB`.
+ */
+double meter_db(float level);
+
+/**
+ * @brief Name of the instruction set used by the metering kernels.
+ */
+const char *meter_isa();
+
+/** @} */
@@ -0,0 +1,75 @@
+/**
+ * @file workbench_module.h
+ * @brief Processors loaded from shared objects and swapped into the running
+ * stream.
+ *
+ * A module is a shared object that exports a `ModuleDesc` named
+ * `workbench_module`. `audio_load_module` loads it and creates an instance
+ * on the calling thread, then hands it to the audio thread with one atomic
+ * exchange; the next block is processed by the new instance, so changing
+ * the DSP code costs neither a restart nor a dropped block. The instance it
+ * replaces is queued and destroyed, and its code unloaded, only once the
+ * audio thread has finished every block that could still use it.
+ *
+ * A module compiled with `-shared -fPIC` can call the library, if the host
+ * is linked with `-rdynamic`:
+ * @code
+ * static void *create() { return engine_calloc(1, sizeof(float)); }
+ * static void process(void *instance, const void *in, void *out,
+ *                     unsigned long frames) { ... }
+ * const ModuleDesc workbench_module = {
+ *     WORKBENCH_MODULE_ABI, "gain", create, process, engine_free};
+ * @endcode
+ */
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @defgroup module Module
+ * @brief Hot-swappable processors.
+ * @{ */
+
+/** @brief Version of `ModuleDesc`, bumped when its layout changes. */
+#define WORKBENCH_MODULE_ABI 1
+
+/** @brief Name of the `ModuleDesc` a module exports. */
+#define WORKBENCH_MODULE_SYMBOL "workbench_module"
+
+/**
+ * @brief Description of a module, exported as `workbench_module`.
+ */
+typedef struct {
+  int abi;          /**< `WORKBENCH_MODULE_ABI` the module was built with */
+  const char *name; /**< Name in the log */
+  /** Creates an instance. Called on the loading thread, may allocate. */
+  void *(*create)();
+  /**
+   * Processes a block in place of the audio callback, with the same buffers.
+   * Called on the audio thread.
+   */
+  void (*process)(void *instance, const void *input_buffer,
+                  void *output_buffer, unsigned long frames);
+  /** Destroys an instance, may be `NULL`. Called on a control thread. */
+  void (*destroy)(void *instance);
+} ModuleDesc;
+
+/**
+ * @brief Loads a module and swaps it in for the running one.
+ *
+ * The module processes the blocks in place of the audio callback, unless a
+ * graph is set. The shared object is copied before it is opened, so a
+ * rebuilt file at the same path is loaded anew. Not real-time safe; also
+ * destroys the instances retired by earlier swaps that are no longer used.
+ *
+ * @param path Path of the shared object.
+ * @return `false` if the module can not be loaded; the running one stays.
+ */
+bool audio_load_module(const char *path);
+
+/**
+ * @brief Swaps the running module out, the audio callback takes over again.
+ */
+void audio_unload_module();
+
+/** @} */
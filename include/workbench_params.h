@@ -0,0 +1,83 @@
+/**
+ * @file workbench_params.h
+ * @brief Smoothed parameters shared between control threads and the engine.
+ *
+ * A parameter has a target that any thread may set at any time with an
+ * atomic store, and a value that glides towards it with a time constant.
+ * Instead of every processor smoothing per sample, the engine computes the
+ * glide once per block into an aligned array of per-frame values, the ramp,
+ * before the callbacks run. A processor then only reads `param_ramp(p)[i]`,
+ * which vectorises to a load and multiply-add alongside the audio.
+ *
+ * The exponential glide is followed in straight segments between the ends
+ * of the blocks. Targets set by a MIDI callback are picked up in the same
+ * block; with `midi_split_blocks` the new ramp starts at the event.
+ */
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @defgroup params Params
+ * @brief Lock-free parameter table with per-block ramps.
+ * @{ */
+
+/** @brief Most parameters in the table. */
+#ifndef PARAM_MAX
+#define PARAM_MAX 64
+#endif
+
+/**
+ * @brief Adds a parameter to the table.
+ *
+ * Allocates the ramp, so it is not real-time safe; it may be called while
+ * the stream runs.
+ *
+ * @param name Name for `param_find`, kept by reference.
+ * @param value Initial target and value.
+ * @param smoothing Time constant of the glide in seconds, 0 to jump.
+ * @return Index of the parameter, or -1 if the table is full.
+ */
+int param_add(const char *name, float value, double smoothing);
+
+/**
+ * @brief Looks a parameter up by name.
+ *
+ * @return Index of the parameter, or -1.
+ */
+int param_find(const char *name);
+
+/**
+ * @brief Sets the target of a parameter. Real-time safe, any thread.
+ */
+void param_set(int param, float target);
+
+/**
+ * @brief Last target set. Any thread.
+ */
+float param_target(int param);
+
+/**
+ * @brief Values of a parameter for every frame of the current callback.
+ *
+ * Engine threads only. The array is aligned to `AUDIO_BUFFER_ALIGNMENT`
+ * bytes when the callback starts a block, and holds as many values as the
+ * callback has frames, up to `block_size`.
+ */
+const float *param_ramp(int param);
+
+/**
+ * @brief Value of a parameter at the first frame of the current callback.
+ * Engine threads only.
+ */
+float param_value(int param);
+
+/**
+ * @brief Tells whether the ramp of the current block changes.
+ *
+ * When it does not, a processor may use `param_value` as a constant.
+ * Engine threads only.
+ */
+bool param_moving(int param);
+
+/** @} */
@@ -0,0 +1,135 @@
+/**
+ * @file workbench_player.h
+ * @brief Plays a WAV file from a memory mapping in the audio callback.
+ *
+ * This header file declares a player for backing tracks and test stimuli of
+ * any length. The file is mapped with `mmap` instead of being loaded, so
+ * opening it takes the same time for any length, and the audio callback
+ * converts the samples straight from the mapping into its output buffer.
+ *
+ * A prefetch thread follows the play position. It asks the kernel to read
+ * ahead with `madvise` in the direction of playback, faults the pages in
+ * before the callback needs them and releases the mapping far behind the
+ * play position, so neither the page faults nor the memory use grow with
+ * the file.
+ */
+#pragma once
+
+#include "workbench_wav.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup player Player
+ * @brief Memory mapped WAV playback.
+ * @{ */
+
+/**
+ * @brief Bytes kept resident ahead of the play position.
+ */
+#ifndef PLAYER_READ_AHEAD_SIZE
+#define PLAYER_READ_AHEAD_SIZE (8 << 20)
+#endif
+
+/**
+ * @brief Interval at which the prefetch thread follows the play position.
+ */
+#ifndef PLAYER_PREFETCH_INTERVAL_US
+#define PLAYER_PREFETCH_INTERVAL_US 10000
+#endif
+
+/**
+ * @brief Frames converted at a time when the output can not be written in
+ * place.
+ */
+#ifndef PLAYER_CHUNK_FRAMES
+#define PLAYER_CHUNK_FRAMES 256
+#endif
+
+/**
+ * @brief Playback modes, combined with `|` in `player_start`.
+ */
+typedef enum {
+  PLAYER_FORWARD = 0,        /**< Play once from the start to the end */
+  PLAYER_REVERSE = 1,        /**< Play from the end to the start */
+  PLAYER_LOOP = 2,           /**< Restart when the file ends */
+  PLAYER_BACK_AND_FORTH = 4, /**< Turn around at both ends endlessly */
+} PlayerMode;
+
+/**
+ * @brief An open player.
+ */
+typedef struct WavPlayer WavPlayer;
+
+/**
+ * @brief Maps a WAV file and starts the prefetch thread.
+ *
+ * Only the header and the first read-ahead window are read.
+ *
+ * @param path Path of the WAV file.
+ * @return A new player, or `NULL` if the file can not be mapped or its
+ * format is not supported.
+ */
+WavPlayer *player_open(const char *path);
+
+/**
+ * @brief Gets the sample layout of the mapped file.
+ */
+const WavInfo *player_info(const WavPlayer *player);
+
+/**
+ * @brief Starts playback from the beginning, or from the end in reverse.
+ *
+ * Safe while the audio callback is running; it takes effect on the next
+ * call to `player_render`.
+ *
+ * @param player Player to start.
+ * @param mode `PlayerMode` flags.
+ */
+void player_start(WavPlayer *player, unsigned mode);
+
+/**
+ * @brief Stops playback on the next call to `player_render`.
+ */
+void player_stop(WavPlayer *player);
+
+/**
+ * @brief Checks if playback is in progress. Safe from any thread.
+ *
+ * @return `false` once a non-looping playback reached the end.
+ */
+bool player_is_playing(WavPlayer *player);
+
+/**
+ * @brief Gets the frame of the file that plays next. Safe from any thread.
+ */
+uint64_t player_position(WavPlayer *player);
+
+/**
+ * @brief Renders the next frames of the file. Real-time safe.
+ *
+ * File channels are mapped to output channels in order, the last file
+ * channel is repeated on extra outputs. Output past the end of a playback
+ * is silent. Must be called from one thread only, normally the audio
+ * callback.
+ *
+ * @param player Player to render.
+ * @param frames Destination of `count * channels` interleaved samples.
+ * @param channels Number of output channels.
+ * @param count Number of frames.
+ * @return The number of frames taken from the file.
+ */
+size_t player_render(WavPlayer *player, float *frames, int channels,
+                     size_t count);
+
+/**
+ * @brief Stops the prefetch thread, unmaps the file and frees the player.
+ *
+ * The audio thread must have stopped rendering before this is called.
+ *
+ * @param player Player to close. May be `NULL`.
+ */
+void player_close(WavPlayer *player);
+
+/** @} */
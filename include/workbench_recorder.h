@@ -0,0 +1,102 @@
+/**
+ * @file workbench_recorder.h
+ * @brief Streams audio from the callback to a WAV file on disk.
+ *
+ * This header file declares a recorder for takes of any length. The audio
+ * callback pushes interleaved float frames into a wait-free `SpscRing`; a
+ * writer thread drains the ring in large, block-aligned writes to a 32 bit
+ * float WAV file, which becomes RF64 once it outgrows 4 GiB. On Linux the
+ * file is preallocated ahead of the writer with `fallocate`.
+ *
+ * The callback never blocks. If the disk can not keep up and the ring is
+ * full, the frames that do not fit are dropped and counted.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup recorder Recorder
+ * @brief Disk streaming of the audio callback.
+ * @{ */
+
+/**
+ * @brief Bytes passed to every write, except for the last one.
+ */
+#ifndef RECORDER_WRITE_SIZE
+#define RECORDER_WRITE_SIZE (1 << 20)
+#endif
+
+/**
+ * @brief Bytes reserved on disk at a time ahead of the writer.
+ */
+#ifndef RECORDER_PREALLOCATE_SIZE
+#define RECORDER_PREALLOCATE_SIZE (64 << 20)
+#endif
+
+/**
+ * @brief Interval at which the writer thread checks the ring.
+ */
+#ifndef RECORDER_POLL_INTERVAL_US
+#define RECORDER_POLL_INTERVAL_US 5000
+#endif
+
+/**
+ * @brief An open recording.
+ */
+typedef struct DiskRecorder DiskRecorder;
+
+/**
+ * @brief Progress of a recording.
+ */
+typedef struct {
+  uint64_t frames_pushed;  /**< Frames accepted from the audio thread */
+  uint64_t frames_dropped; /**< Frames lost because the ring was full */
+  uint64_t frames_written; /**< Frames handed to the file system */
+  size_t ring_frames;      /**< Capacity of the ring */
+  size_t ring_high_water;  /**< Most frames ever waiting in the ring */
+} RecorderStats;
+
+/**
+ * @brief Creates the file and starts the writer thread.
+ *
+ * @param path Path of the WAV file to create.
+ * @param channels Number of interleaved channels.
+ * @param sample_rate Frames per second.
+ * @param buffer_seconds Audio the ring can hold while the disk is busy.
+ * @return A new recorder, or `NULL` if the file or the buffers can not be
+ * created.
+ */
+DiskRecorder *recorder_open(const char *path, int channels, double sample_rate,
+                            double buffer_seconds);
+
+/**
+ * @brief Queues interleaved frames for writing. Real-time safe.
+ *
+ * Must be called from one thread only, normally the audio callback.
+ *
+ * @param recorder Recorder to write to.
+ * @param frames `count * channels` interleaved samples.
+ * @param count Number of frames.
+ * @return The number of frames queued; the rest were dropped.
+ */
+size_t recorder_push(DiskRecorder *recorder, const float *frames,
+                     size_t count);
+
+/**
+ * @brief Takes a snapshot of the recorder statistics. Safe from any thread.
+ */
+void recorder_get_stats(DiskRecorder *recorder, RecorderStats *stats);
+
+/**
+ * @brief Writes what is left in the ring, finalizes the file and frees the
+ * recorder.
+ *
+ * The audio thread must have stopped pushing before this is called.
+ *
+ * @param recorder Recorder to close. May be `NULL`.
+ */
+void recorder_close(DiskRecorder *recorder);
+
+/** @} */
@@ -0,0 +1,143 @@
+/**
+ * @file workbench_resample.h
+ * @brief Streaming polyphase resampler with a continuously variable ratio.
+ *
+ * This header file declares the resampler the engine uses to bring audio at
+ * other sample rates to its own: input files of the offline backend and
+ * secondary devices that run at another rate or on another clock. The ratio
+ * can be changed between any two calls without clicks, so a control loop can
+ * steer it by a few parts per million at a time.
+ *
+ * Every output frame is a dot product of the input with a Kaiser windowed
+ * sinc. When the ratio is a fraction `M / L` with a small `L`, as for 44.1 kHz
+ * to 48 kHz (147 / 160) or integer up- and downsampling, the kernel of each of
+ * the `L` output phases is computed once and the phase is stepped exactly in
+ * integers. Any other ratio uses a bank tabulated at a fixed number of
+ * fractional positions; the coefficients of the exact position are
+ * interpolated linearly between the two nearest ones, once per frame for all
+ * channels. The banks are aligned to cache lines and the inner loops use
+ * AVX2, SSE or NEON, selected once at run time.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @defgroup resample Resample
+ * @brief Polyphase sample-rate conversion.
+ * @{ */
+
+/** @brief Largest number of output phases that get an exact bank. */
+#define RESAMPLE_MAX_EXACT_PHASES 1024
+
+/**
+ * @brief Trade-off between conversion quality and CPU time.
+ *
+ * The number of taps doubles from one level to the next. Rejection is for
+ * the aliases that land in the passband, which is flat within 0.1 dB up to the
+ * given fraction of the Nyquist frequency of the slower side. When
+ * downsampling, the kernel widens with the ratio so the transition band stays
+ * the same.
+ */
+typedef enum {
+  RESAMPLE_QUALITY_LOW,    /**< 16 taps, 70 dB, flat to 62% of Nyquist */
+  RESAMPLE_QUALITY_MEDIUM, /**< 32 taps, 90 dB, flat to 77% of Nyquist */
+  RESAMPLE_QUALITY_HIGH,   /**< 64 taps, 110 dB, flat to 87% of Nyquist */
+} ResampleQuality;
+
+/**
+ * @brief A resampler for a fixed number of interleaved channels.
+ */
+typedef struct Resampler Resampler;
+
+/**
+ * @brief Creates a resampler.
+ *
+ * The cutoff of the anti-aliasing filter follows from `ratio`; later changes
+ * of the ratio keep it. If `ratio` is a fraction with a denominator of at
+ * most `RESAMPLE_MAX_EXACT_PHASES`, its exact bank is built as well and used
+ * whenever the ratio is back at `ratio`.
+ *
+ * @param channels Channels of every frame.
+ * @param ratio Input frames per output frame, the input rate divided by the
+ * output rate.
+ * @param max_frames Largest number of output frames of one call.
+ * @param quality Length and passband of the filter.
+ * @return A new resampler, or `NULL` if it can not be allocated.
+ */
+Resampler *resampler_create(int channels, double ratio, size_t max_frames,
+                            ResampleQuality quality);
+
+/**
+ * @brief Frees a resampler.
+ */
+void resampler_destroy(Resampler *resampler);
+
+/**
+ * @brief Changes the ratio from the next output frame on.
+ *
+ * Real-time safe. The ratio is kept within a factor of two of the one given
+ * to `resampler_create`.
+ */
+void resampler_set_ratio(Resampler *resampler, double ratio);
+
+/**
+ * @brief Current ratio of input to output frames.
+ */
+double resampler_ratio(const Resampler *resampler);
+
+/**
+ * @brief Tells whether the current ratio runs on an exact bank.
+ */
+bool resampler_is_exact(const Resampler *resampler);
+
+/**
+ * @brief Input frames under the kernel. The delay is half of them.
+ */
+int resampler_taps(const Resampler *resampler);
+
+/**
+ * @brief Input frames still needed to produce `frames` output frames.
+ *
+ * Never more than `frames` times the ratio, rounded up, plus the taps.
+ */
+size_t resampler_input_needed(const Resampler *resampler, size_t frames);
+
+/**
+ * @brief Takes input frames and produces as many output frames as they allow.
+ *
+ * Real-time safe. Input that is not consumed yet is kept for the next call.
+ * The input of one call must not exceed what `max_frames` output frames need
+ * at twice the ratio given to `resampler_create`; more is ignored.
+ *
+ * @param resampler Resampler to run.
+ * @param in Interleaved input frames.
+ * @param in_frames Number of input frames.
+ * @param out Receives interleaved output frames.
+ * @param out_frames Room in `out` in frames.
+ * @return The number of frames written to `out`.
+ */
+size_t resampler_process(Resampler *resampler, const float *in,
+                         size_t in_frames, float *out, size_t out_frames);
+
+/**
+ * @brief Drops the buffered input and starts again from silence.
+ */
+void resampler_reset(Resampler *resampler);
+
+/**
+ * @brief Parses the `resample_quality` config field.
+ *
+ * @param name `"low"`, `"medium"` or `"high"`; `NULL` selects medium.
+ */
+ResampleQuality resample_quality_parse(const char *name);
+
+/**
+ * @brief Name of the instruction set used by the inner loops.
+ *
+ * @return One of `"avx2"`, `"sse"`, `"neon"` or `"scalar"`.
+ */
+const char *resampler_isa();
+
+/** @} */
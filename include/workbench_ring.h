@@ -0,0 +1,195 @@
+/**
+ * @file workbench_ring.h
+ * @brief Wait-free primitives for passing data to and from the audio thread.
+ *
+ * This header file declares two lock-free structures meant to be shared by
+ * exactly two threads, typically the audio callback and a worker or UI
+ * thread. No operation blocks, allocates or makes a system call, so both are
+ * safe to use from a real-time callback.
+ *
+ * - `SpscRing` is a single producer, single consumer FIFO of fixed size
+ *   elements, suited to sample streams and event queues.
+ * - `TripleBuffer` publishes the latest version of a snapshot, suited to
+ *   meters and state shown by a user interface.
+ */
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @defgroup ring Ring
+ * @brief Single producer, single consumer ring and triple buffer.
+ * @{ */
+
+/**
+ * @brief Size in bytes of a cache line, used to keep the indices written by
+ * different threads apart.
+ */
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+/**
+ * @brief Wait-free single producer, single consumer ring of elements.
+ *
+ * The capacity is a power of two, so indices are free-running counters
+ * masked on access. Only the producer writes `head` and only the consumer
+ * writes `tail`; each side keeps a private copy of the other index and only
+ * reloads it when the copy says the ring is full or empty. The two sides sit
+ * on separate cache lines.
+ */
+typedef struct {
+  char *data;          /**< Storage for `mask + 1` elements */
+  size_t element_size; /**< Size of one element in bytes */
+  size_t mask;         /**< Capacity minus one */
+  _Alignas(CACHE_LINE) atomic_size_t head; /**< Next element to write */
+  size_t tail_cache; /**< Producer's copy of `tail` */
+  _Alignas(CACHE_LINE) atomic_size_t tail; /**< Next element to read */
+  size_t head_cache; /**< Consumer's copy of `head` */
+} SpscRing;
+
+/**
+ * @brief A contiguous view into the ring, split in two where it wraps.
+ *
+ * `second` is `NULL` when the span does not wrap.
+ */
+typedef struct {
+  void *first;         /**< Elements from the current position */
+  size_t first_count;  /**< Number of elements at `first` */
+  void *second;        /**< Elements from the beginning of the storage */
+  size_t second_count; /**< Number of elements at `second` */
+} RingSpan;
+
+/**
+ * @brief Allocates a ring.
+ *
+ * @param ring Ring to initialize.
+ * @param element_size Size of one element in bytes.
+ * @param capacity Minimum number of elements, rounded up to a power of two.
+ * @return `false` if the storage can not be allocated.
+ */
+bool ring_init(SpscRing *ring, size_t element_size, size_t capacity);
+
+/**
+ * @brief Frees the storage of a ring. The ring may be initialized again.
+ */
+void ring_free(SpscRing *ring);
+
+/**
+ * @brief Number of elements the ring holds.
+ */
+size_t ring_capacity(const SpscRing *ring);
+
+/**
+ * @brief Elements that can be written now. Producer only.
+ */
+size_t ring_write_space(SpscRing *ring);
+
+/**
+ * @brief Elements that can be read now. Consumer only.
+ */
+size_t ring_read_available(SpscRing *ring);
+
+/**
+ * @brief Reserves up to `count` elements for writing in place. Producer only.
+ *
+ * @param ring Ring to write to.
+ * @param count Number of elements wanted.
+ * @param span Receives where to write the reserved elements.
+ * @return The number of elements reserved, less than `count` if the ring is
+ * nearly full.
+ */
+size_t ring_write_begin(SpscRing *ring, size_t count, RingSpan *span);
+
+/**
+ * @brief Publishes `count` elements written after `ring_write_begin`.
+ */
+void ring_write_commit(SpscRing *ring, size_t count);
+
+/**
+ * @brief Gives access to up to `count` elements in place. Consumer only.
+ *
+ * @param ring Ring to read from.
+ * @param count Number of elements wanted.
+ * @param span Receives where the readable elements are.
+ * @return The number of elements available, at most `count`.
+ */
+size_t ring_read_begin(SpscRing *ring, size_t count, RingSpan *span);
+
+/**
+ * @brief Releases `count` elements read after `ring_read_begin`.
+ */
+void ring_read_commit(SpscRing *ring, size_t count);
+
+/**
+ * @brief Copies up to `count` elements into the ring. Producer only.
+ *
+ * @return The number of elements written.
+ */
+size_t ring_write(SpscRing *ring, const void *elements, size_t count);
+
+/**
+ * @brief Copies up to `count` elements out of the ring. Consumer only.
+ *
+ * @return The number of elements read.
+ */
+size_t ring_read(SpscRing *ring, void *elements, size_t count);
+
+/**
+ * @brief Wait-free triple buffer publishing the latest snapshot.
+ *
+ * The writer fills the back buffer and swaps it with the middle one; the
+ * reader swaps the middle buffer with its front buffer when a new snapshot
+ * was published. Neither side ever waits, the reader skips versions it was
+ * too slow to see.
+ */
+typedef struct {
+  char *data;    /**< Storage of the three buffers */
+  size_t size;   /**< Size of one buffer in bytes */
+  size_t stride; /**< Distance between buffers, a multiple of `CACHE_LINE` */
+  _Alignas(CACHE_LINE) atomic_uint middle; /**< Middle index and fresh bit */
+  _Alignas(CACHE_LINE) unsigned back;      /**< Index owned by the writer */
+  _Alignas(CACHE_LINE) unsigned front;     /**< Index owned by the reader */
+} TripleBuffer;
+
+/**
+ * @brief Allocates a triple buffer with zeroed buffers.
+ *
+ * @param triple Triple buffer to initialize.
+ * @param size Size of the snapshot in bytes.
+ * @return `false` if the storage can not be allocated.
+ */
+bool triple_buffer_init(TripleBuffer *triple, size_t size);
+
+/**
+ * @brief Frees the storage of a triple buffer.
+ */
+void triple_buffer_free(TripleBuffer *triple);
+
+/**
+ * @brief Buffer to fill with the next snapshot. Writer only.
+ *
+ * The content is whatever snapshot was swapped out last, not necessarily the
+ * previous one written.
+ */
+void *triple_buffer_write(TripleBuffer *triple);
+
+/**
+ * @brief Publishes the buffer returned by `triple_buffer_write`. Writer only.
+ */
+void triple_buffer_publish(TripleBuffer *triple);
+
+/**
+ * @brief Latest published snapshot. Reader only.
+ *
+ * The returned buffer stays valid and unchanged until the next call.
+ *
+ * @param triple Triple buffer to read.
+ * @param fresh Set to `true` if a new snapshot was published since the last
+ * call. May be `NULL`.
+ */
+const void *triple_buffer_read(TripleBuffer *triple, bool *fresh);
+
+/** @} */
@@ -0,0 +1,70 @@
+/**
+ * @file workbench_scratch.h
+ * @brief Per-block scratch memory for the callbacks.
+ *
+ * Processors that need a temporary buffer for one block can neither call
+ * `malloc` in the callback nor rely on a large stack. The engine owns one
+ * bump-pointer arena per processing thread, `scratch_size` KiB of locked
+ * engine memory each. Allocating from it is a bounds check and a pointer
+ * increment, and everything allocated during a block is released at once
+ * when `__audio_callback` returns, so nothing may be kept across blocks.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup scratch Scratch
+ * @brief Bump-pointer arena reset after every block.
+ * @{ */
+
+/** @brief Alignment of every span returned by `scratch_alloc`. */
+#define SCRATCH_ALIGNMENT 64
+
+/**
+ * @brief Arena of one processing thread.
+ *
+ * Owned by the engine; callbacks only allocate from it.
+ */
+typedef struct {
+  char *base;        /**< Storage, aligned to `SCRATCH_ALIGNMENT` */
+  size_t size;       /**< Bytes of storage */
+  size_t used;       /**< Bytes handed out in the current block */
+  uint64_t failures; /**< Allocations that did not fit this block */
+} ScratchArena;
+
+/**
+ * @brief Takes an uninitialised span from an arena. Real-time safe.
+ *
+ * The span stays valid until the end of the current block.
+ *
+ * @param arena Arena of the calling thread, from `audio_scratch` or
+ * `NodeContext.scratch`.
+ * @param bytes Size of the span.
+ * @return A span aligned to `SCRATCH_ALIGNMENT`, or `NULL` if the arena is
+ * full; failures are counted in `AudioStats.scratch_failures`.
+ */
+static inline void *scratch_alloc(ScratchArena *arena, size_t bytes) {
+  size_t size = (bytes + SCRATCH_ALIGNMENT - 1) &
+                ~(size_t)(SCRATCH_ALIGNMENT - 1);
+  if (size < bytes || size > arena->size - arena->used) {
+    arena->failures++;
+    return NULL;
+  }
+  void *span = arena->base + arena->used;
+  arena->used += size;
+  return span;
+}
+
+/**
+ * @brief Arena of the calling processing thread.
+ *
+ * Valid in the audio callback, in MIDI callbacks dispatched with the audio
+ * blocks and in graph nodes, which also receive it as `NodeContext.scratch`.
+ *
+ * @return The arena, or `NULL` outside of the engine threads.
+ */
+ScratchArena *audio_scratch();
+
+/** @} */
@@ -0,0 +1,93 @@
+/**
+ * @file workbench_stats.h
+ * @brief Timing and xrun statistics of the audio callback.
+ *
+ * Every engine callback is timed with the monotonic clock and compared with
+ * its budget, the duration of the block (`block_size / sample_rate`). The
+ * fraction of the budget used is accumulated in a histogram with
+ * `STATS_STEPS_PER_OCTAVE` logarithmic buckets per power of two, and the
+ * status flags reported by the backend are counted.
+ *
+ * The audio thread publishes the numbers through a sequence lock: it never
+ * waits for readers, while readers retry until they get a consistent
+ * snapshot.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @defgroup stats Stats
+ * @brief Deadline accounting of the audio callback.
+ * @{ */
+
+#define STATS_HISTOGRAM_BUCKETS 32 /**< @brief Number of histogram buckets. */
+#define STATS_STEPS_PER_OCTAVE 2   /**< @brief Buckets per power of two. */
+#define STATS_MIN_LOG2 -12 /**< @brief log2 of the lowest bucket edge. */
+
+#define STATS_SECONDARY_INPUT 0  /**< @brief Index of `secondary_input`. */
+#define STATS_SECONDARY_OUTPUT 1 /**< @brief Index of `secondary_output`. */
+#define STATS_SECONDARY_COUNT 2  /**< @brief Number of secondary devices. */
+
+/**
+ * @brief Snapshot of the audio callback statistics.
+ */
+typedef struct {
+  uint64_t callbacks;         /**< Number of timed callbacks */
+  uint64_t frames;            /**< Frames processed */
+  uint64_t overruns;          /**< Callbacks that exceeded their budget */
+  uint64_t input_underflows;  /**< `paInputUnderflow` flags seen */
+  uint64_t input_overflows;   /**< `paInputOverflow` flags seen */
+  uint64_t output_underflows; /**< `paOutputUnderflow` flags seen */
+  uint64_t output_overflows;  /**< `paOutputOverflow` flags seen */
+  uint64_t priming_outputs;   /**< `paPrimingOutput` flags seen */
+  double budget_last;         /**< Fraction of the budget used last time */
+  double budget_avg;          /**< Average fraction of the budget used */
+  double budget_max;          /**< Largest fraction of the budget used */
+  double cpu_load; /**< `Pa_GetStreamCpuLoad`, or `budget_avg` without a
+                      PortAudio stream */
+  uint64_t histogram[STATS_HISTOGRAM_BUCKETS]; /**< Callbacks per bucket */
+  double drift_ppm[STATS_SECONDARY_COUNT]; /**< Clock drift of each secondary
+                                              device against the primary */
+  uint64_t secondary_xruns[STATS_SECONDARY_COUNT]; /**< Frames lost between
+                                                      the device clocks */
+  uint64_t secondary_device_xruns[STATS_SECONDARY_COUNT]; /**< Callbacks
+                                                             flagged with xruns
+                                                             by each device */
+  uint64_t scratch_last;     /**< Scratch bytes used by the last block */
+  uint64_t scratch_peak;     /**< Most scratch bytes used by a block */
+  uint64_t scratch_failures; /**< Scratch allocations that did not fit */
+} AudioStats;
+
+/**
+ * @brief Takes a consistent snapshot of the statistics.
+ *
+ * Safe to call from any thread. It never blocks the audio thread; if a
+ * callback publishes while the snapshot is taken, the read is retried.
+ *
+ * @param stats Receives the snapshot.
+ */
+void audio_get_stats(AudioStats *stats);
+
+/**
+ * @brief Asks the audio thread to clear the statistics before its next block.
+ */
+void audio_reset_stats();
+
+/**
+ * @brief Prints a snapshot and its histogram to the standard output.
+ */
+void audio_print_stats();
+
+/**
+ * @brief Lower edge of a histogram bucket.
+ *
+ * Bucket 0 holds everything below `2^STATS_MIN_LOG2` of the budget, the last
+ * bucket everything above the last edge.
+ *
+ * @param bucket Bucket index.
+ * @return The smallest budget fraction counted in the bucket.
+ */
+double audio_stats_bucket_edge(int bucket);
+
+/** @} */
@@ -0,0 +1,116 @@
+/**
+ * @file workbench_stft.h
+ * @brief Streaming short-time Fourier transform with overlap-add resynthesis.
+ *
+ * An `Stft` turns a mono stream into spectra of `size` samples every `hop`
+ * samples, hands each spectrum to a callback that may read or change it, and
+ * overlap-adds the inverse transforms into the output stream. Blocks of any
+ * length are accepted: with a hop longer than the block, a frame is
+ * transformed only in the blocks that complete a hop.
+ *
+ * The same window is applied before the forward and after the inverse
+ * transform. The synthesis window is divided by the sum of the squared
+ * windows that overlap at each sample, so an unchanged spectrum comes back as
+ * the input delayed by `size` samples for any window and hop, as long as the
+ * overlapping windows do not all vanish at some sample. A Hann window with a
+ * hop of `size`, for one, loses the first sample of every frame.
+ */
+#pragma once
+
+#include "workbench_fft.h"
+#include "workbench_graph.h"
+#include <stddef.h>
+
+/**
+ * @defgroup stft STFT
+ * @brief Spectral processing of a stream.
+ * @{ */
+
+/**
+ * @brief Window applied to every frame, periodic.
+ */
+typedef enum {
+  STFT_WINDOW_RECTANGULAR, /**< No window, for block convolution */
+  STFT_WINDOW_HANN,        /**< Hann, the default */
+  STFT_WINDOW_HAMMING,     /**< Hamming */
+  STFT_WINDOW_BLACKMAN,    /**< Blackman, for less leakage */
+} StftWindow;
+
+/**
+ * @brief Type definition for spectral processing functions.
+ *
+ * Called on the thread that runs `stft_process` once per hop with the
+ * spectrum of the last `size` samples. Changes to the spectrum are heard
+ * after `size` samples.
+ *
+ * @param re Real parts of the bins, DC to Nyquist.
+ * @param im Imaginary parts of the bins.
+ * @param bins `size / 2 + 1`.
+ * @param user_data The `user_data` given to `stft_create`.
+ */
+typedef void (*StftCallback)(float *re, float *im, size_t bins,
+                             void *user_data);
+
+/**
+ * @brief A streaming STFT of one channel.
+ */
+typedef struct Stft Stft;
+
+/**
+ * @brief Creates an STFT. Not real-time safe.
+ *
+ * @param size Samples per frame, a power of two of at least `FFT_MIN_SIZE`.
+ * @param hop Samples between two frames, from 1 to `size`.
+ * @param window Window of the frames.
+ * @param callback Processing of every spectrum, `NULL` to pass it through.
+ * @param user_data Pointer passed to `callback`.
+ * @return A new STFT, or `NULL` if the parameters are invalid or it can not
+ * be allocated.
+ */
+Stft *stft_create(size_t size, size_t hop, StftWindow window,
+                  StftCallback callback, void *user_data);
+
+/**
+ * @brief Frees an STFT.
+ */
+void stft_destroy(Stft *stft);
+
+/**
+ * @brief Delay of the output behind the input in samples, `size`.
+ */
+size_t stft_latency(const Stft *stft);
+
+/**
+ * @brief Runs a block through the STFT.
+ *
+ * Real-time safe. `in` and `out` may be the same buffer.
+ *
+ * @param stft STFT to run.
+ * @param in `frames` input samples, `NULL` for silence.
+ * @param out Receives `frames` output samples, `NULL` to only analyse.
+ * @param frames Samples in the block, any number.
+ */
+void stft_process(Stft *stft, const float *in, float *out, size_t frames);
+
+/**
+ * @brief Clears the buffered input and output.
+ */
+void stft_reset(Stft *stft);
+
+/**
+ * @brief Processing function of a graph node running an STFT.
+ *
+ * Add the node with one audio input, one audio output and the `Stft` as its
+ * state.
+ */
+void stft_node(const NodeContext *context, void *state);
+
+/**
+ * @brief Parses a window name.
+ *
+ * @param name `"rectangular"`, `"hann"`, `"hamming"` or `"blackman"`;
+ * anything else selects Hann.
+ */
+StftWindow stft_window_parse(const char *name);
+
+/** @} */
@@ -0,0 +1,148 @@
+/**
+ * @file workbench_wav.h
+ * @brief Minimal RIFF/WAVE file reader and writer.
+ *
+ * This header file declares a small WAV file API used by the Workbench
+ * engine for offline rendering. Reading supports 8, 16, 24 and 32 bit integer
+ * PCM as well as 32 and 64 bit IEEE float data (including
+ * `WAVE_FORMAT_EXTENSIBLE` and RF64 files). Writing always produces 32 bit
+ * float files.
+ * Samples are exchanged as interleaved `float` frames.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @defgroup wav WAV
+ * @brief Reading and writing interleaved float frames from and to WAV files.
+ * @{ */
+
+#define WAV_FORMAT_PCM 0x0001   /**< @brief Integer PCM data. */
+#define WAV_FORMAT_FLOAT 0x0003 /**< @brief IEEE float data. */
+#define WAV_FORMAT_EXTENSIBLE                                                  \
+  0xfffe /**< @brief Format given by the sub-format GUID. */
+
+/**
+ * @brief Size of the headers built by `wav_build_header`, a multiple of the
+ * disk block size so that the samples can be written with aligned I/O.
+ */
+#define WAV_PADDED_HEADER_SIZE 4096
+
+/**
+ * @brief Describes the sample layout of a WAV file.
+ */
+typedef struct {
+  uint16_t format;          /**< `WAV_FORMAT_PCM` or `WAV_FORMAT_FLOAT` */
+  uint16_t channels;        /**< Number of interleaved channels */
+  uint32_t sample_rate;     /**< Frames per second */
+  uint16_t bits_per_sample; /**< Bits in a single sample */
+  uint16_t block_align;     /**< Bytes in a single frame */
+  uint64_t frames;          /**< Number of frames in the data chunk */
+  uint64_t data_offset;     /**< Offset of the first sample in the file */
+} WavInfo;
+
+/**
+ * @brief An open WAV file.
+ */
+typedef struct {
+  FILE *file;      /**< Underlying stdio stream */
+  WavInfo info;    /**< Sample layout of the file */
+  uint64_t cursor; /**< Frames read or written so far */
+  bool writing;    /**< The file was opened with `wav_open_write` */
+} WavFile;
+
+/**
+ * @brief Opens a WAV file for reading.
+ *
+ * @param path Path to the file.
+ * @return A new `WavFile` or `NULL` if the file can not be opened or its
+ * format is not supported.
+ */
+WavFile *wav_open_read(const char *path);
+
+/**
+ * @brief Creates a 32 bit float WAV file for writing.
+ *
+ * The `WAV_PADDED_HEADER_SIZE` bytes of `wav_build_header` are reserved and
+ * rewritten with the final sizes when the file is closed with `wav_close`,
+ * as RF64 if the data grew past 4 GiB.
+ *
+ * @param path Path to the file.
+ * @param channels Number of interleaved channels.
+ * @param sample_rate Frames per second.
+ * @return A new `WavFile` or `NULL` if the file can not be created.
+ */
+WavFile *wav_open_write(const char *path, int channels, double sample_rate);
+
+/**
+ * @brief Reads up to `count` frames converted to float.
+ *
+ * @param wav File opened with `wav_open_read`.
+ * @param frames Destination of `count * channels` interleaved samples.
+ * @param count Number of frames to read.
+ * @return The number of frames actually read, zero at the end of the data.
+ */
+size_t wav_read_float(WavFile *wav, float *frames, size_t count);
+
+/**
+ * @brief Converts frames in the file encoding to float.
+ *
+ * Used on data that does not come through a `WavFile`, such as a memory
+ * mapping of the file.
+ *
+ * @param info Sample layout of `raw`.
+ * @param raw `count` frames as stored in the data chunk.
+ * @param frames Destination of `count * channels` interleaved samples.
+ * @param count Number of frames to convert.
+ */
+void wav_decode_float(const WavInfo *info, const void *raw, float *frames,
+                      size_t count);
+
+/**
+ * @brief Appends `count` interleaved float frames.
+ *
+ * @param wav File opened with `wav_open_write`.
+ * @param frames Source of `count * channels` interleaved samples.
+ * @param count Number of frames to write.
+ * @return The number of frames actually written; fewer than `count`, for
+ * instance on a full disk, is logged.
+ */
+size_t wav_write_float(WavFile *wav, const float *frames, size_t count);
+
+/**
+ * @brief Parses the RIFF header of an open stream.
+ *
+ * On success the stream is positioned at the first sample.
+ *
+ * @param file Stream positioned at the beginning of the file.
+ * @param info Receives the sample layout.
+ * @return `true` if the header describes a supported WAV file.
+ */
+bool wav_read_header(FILE *file, WavInfo *info);
+
+/**
+ * @brief Builds the header of a 32 bit float file for streaming writers.
+ *
+ * The header is `WAV_PADDED_HEADER_SIZE` bytes long. It reserves space for an
+ * RF64 `ds64` chunk and becomes an RF64 header when the data does not fit the
+ * 32 bit sizes of RIFF, so a writer can rewrite it in place when done.
+ *
+ * @param header Receives `WAV_PADDED_HEADER_SIZE` bytes.
+ * @param channels Number of interleaved channels.
+ * @param sample_rate Frames per second.
+ * @param frames Number of frames that follow the header.
+ */
+void wav_build_header(uint8_t *header, int channels, double sample_rate,
+                      uint64_t frames);
+
+/**
+ * @brief Finalizes the header of a written file and closes it.
+ *
+ * @param wav File to close. May be `NULL`.
+ */
+void wav_close(WavFile *wav);
+
+/** @} */
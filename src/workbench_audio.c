@@ -1,4 +1,5 @@
-#include "workbench.h"
+#include "workbench_internal.h"
+#include <strings.h>
 
 #define TRY(x)                                                                 \
   err = (x);                                                                   \
@@ -14,6 +15,97 @@ static PaStreamParameters output_parameters;
 static PaStream *stream = NULL;
 static int __audio_in_id;
 static int __audio_out_id;
+static AudioBackend backend = AUDIO_BACKEND_PORTAUDIO;
+static PaHostApiIndex host_api = -1; /**< `audio_host_api`, -1 for all */
+/** Set once the backend runs; publishes `backend` and `stream` to the
+ * threads that read the stream clock */
+static atomic_bool clock_running = false;
+/** How far `audio_init` got, back to closed in `audio_deinit` */
+static enum {
+  AUDIO_CLOSED,
+  AUDIO_OPENED,
+  AUDIO_STARTED
+} audio_state = AUDIO_CLOSED;
+
+/**
+ * @brief A sample format the device can use and its converters.
+ *
+ * Formats without converters are exchanged with the callbacks in place. The
+ * converters are picked once per stream, so the per-sample loops never test
+ * the format.
+ */
+typedef struct {
+  const char *name;
+  PaSampleFormat pa_format;
+  void (*to_float)(const void *, float *, size_t);
+  void (*from_float)(const float *, void *, size_t, Dither *);
+} DeviceFormat;
+
+/** Formats by name; the first is the float format of the engine */
+static const DeviceFormat device_formats[] = {
+    {"float32", paFloat32, NULL, NULL},
+    {"int32", paInt32, convert_s32_to_f32, convert_f32_to_s32},
+    {"int24", paInt24, convert_s24_to_f32, convert_f32_to_s24},
+    {"int16", paInt16, convert_s16_to_f32, convert_f32_to_s16},
+    {"int8", paInt8, convert_s8_to_f32, convert_f32_to_s8},
+};
+
+#define DEVICE_FORMAT_COUNT (sizeof(device_formats) / sizeof(*device_formats))
+
+/**
+ * Indices in `device_formats` tried by `auto`, best first. PortAudio converts
+ * float itself on nearly every host API, so it would always be accepted:
+ * integer formats come first so that the device gets its native samples and
+ * the converters run in the engine. 8 bit is only used when configured.
+ */
+static const int device_format_order[] = {1, 2, 3, 0};
+
+#define DEVICE_FORMAT_ORDER_COUNT                                              \
+  (sizeof(device_format_order) / sizeof(*device_format_order))
+
+/**
+ * @brief Conversion between the device format and the float buffers of the
+ * callbacks.
+ *
+ * The primary stream carries the first `in_channels` and `out_channels` of
+ * the engine channels, the secondary devices the rest. When they differ,
+ * interleaved frames are staged in `in` and `out` at the engine width.
+ */
+static struct {
+  const DeviceFormat *format; /**< Format of the device buffers */
+  float *in;                  /**< Interleaved float input */
+  float *out;                 /**< Interleaved float output */
+  float *scratch;             /**< Converted frames at the primary width */
+  int in_channels;            /**< Input channels of the primary stream */
+  int out_channels;           /**< Output channels of the primary stream */
+  Dither dither;              /**< Noise added to integer output */
+  bool dithered;              /**< `dither` is enabled */
+} device = {.format = &device_formats[0]};
+
+/**
+ * @brief Channel pointers handed to the callbacks in planar mode.
+ */
+static struct {
+  AudioSample_t **in;        /**< Aligned input channels */
+  AudioSample_t **out;       /**< Aligned output channels */
+  AudioSample_t **in_slice;  /**< Input channels of a split slice */
+  AudioSample_t **out_slice; /**< Output channels of a split slice */
+  AudioSample_t *storage;    /**< Bounce buffers for unaligned channels */
+  size_t stride;             /**< Samples between bounce buffers */
+} planar = {0};
+
+AudioBackend audio_backend_get() {
+  Config *cfg = config_get();
+  if (!cfg->audio_backend || strcmp(cfg->audio_backend, "portaudio") == 0)
+    return AUDIO_BACKEND_PORTAUDIO;
+  if (strcmp(cfg->audio_backend, "offline") == 0)
+    return AUDIO_BACKEND_OFFLINE;
+  if (strcmp(cfg->audio_backend, "null") == 0)
+    return AUDIO_BACKEND_NULL;
+  log_w("Unknown audio backend \"%s\". Using portaudio instead.",
+        cfg->audio_backend);
+  return AUDIO_BACKEND_PORTAUDIO;
+}
 
 void stream_configure(PaStreamParameters *stream_parameters, int device_idx,
                       int channel_count, unsigned long sample_format,
@@ -26,80 +118,516 @@ void stream_configure(PaStreamParameters *stream_parameters, int device_idx,
   // Pa_GetStreamTime(stream);
 }
 
-static int __audio_callback(const void *input_buffer, void *output_buffer,
-                            unsigned long block_size,
-                            const PaStreamCallbackTimeInfo *time_info,
-                            PaStreamCallbackFlags status_flags,
-                            void *user_data) {
-  (void)time_info;
-  (void)status_flags;
-  if (cfg->midi_callback)
-    __midi_callback((int32_t)(time_info->currentTime / 1000), user_data);
-  if (cfg->audio_callback) {
-    cfg->audio_callback(input_buffer, output_buffer, block_size, user_data);
+static void planar_init() {
+  int channels = cfg->in_channel_count + cfg->out_channel_count;
+  size_t bytes = sizeof(AudioSample_t) * cfg->block_size;
+  bytes = (bytes + AUDIO_BUFFER_ALIGNMENT - 1) & ~(AUDIO_BUFFER_ALIGNMENT - 1);
+  planar.stride = bytes / sizeof(AudioSample_t);
+  planar.storage = engine_alloc(bytes * channels);
+  if (!planar.storage) {
+    log_e("Can not allocate planar buffers");
+    return;
   }
+  planar.in = engine_calloc(cfg->in_channel_count, sizeof(AudioSample_t *));
+  planar.in_slice =
+      engine_calloc(cfg->in_channel_count, sizeof(AudioSample_t *));
+  planar.out = engine_calloc(cfg->out_channel_count, sizeof(AudioSample_t *));
+  planar.out_slice =
+      engine_calloc(cfg->out_channel_count, sizeof(AudioSample_t *));
+}
+
+static void planar_deinit() {
+  engine_free(planar.storage);
+  engine_free(planar.in);
+  engine_free(planar.in_slice);
+  engine_free(planar.out);
+  engine_free(planar.out_slice);
+  planar = (typeof(planar)){0};
+}
+
+static inline bool is_aligned(const void *pointer) {
+  return ((uintptr_t)pointer & (AUDIO_BUFFER_ALIGNMENT - 1)) == 0;
+}
+
+/**
+ * @brief Points the callback channels at the device channels.
+ *
+ * Float device channels that are already aligned are used in place. The
+ * others go through a bounce buffer, converted if the device is not float.
+ */
+static void planar_prepare(void *const *input, unsigned long frames,
+                           void *const *output) {
+  bool convert = device.format->to_float != NULL;
+  for (int c = 0; c < device.in_channels && input; c++) {
+    planar.in[c] = input[c];
+    if ((convert || !is_aligned(input[c])) && frames <= planar.stride) {
+      planar.in[c] = planar.storage + c * planar.stride;
+      if (convert)
+        device.format->to_float(input[c], planar.in[c], frames);
+      else
+        memcpy(planar.in[c], input[c], sizeof(AudioSample_t) * frames);
+    }
+  }
+  for (int c = 0; c < device.out_channels; c++) {
+    planar.out[c] = output[c];
+    if ((convert || !is_aligned(output[c])) && frames <= planar.stride)
+      planar.out[c] =
+          planar.storage + (cfg->in_channel_count + c) * planar.stride;
+  }
+  // Secondary channels always live in their bounce buffers
+  for (int c = device.in_channels; c < cfg->in_channel_count; c++)
+    planar.in[c] = planar.storage + c * planar.stride;
+  for (int c = device.out_channels; c < cfg->out_channel_count; c++)
+    planar.out[c] =
+        planar.storage + (cfg->in_channel_count + c) * planar.stride;
+  if (device.in_channels < cfg->in_channel_count && frames <= planar.stride)
+    secondary_capture(planar.in[device.in_channels], planar.stride, 1, frames);
+}
+
+static void planar_finish(void *const *output, unsigned long frames) {
+  if (device.out_channels < cfg->out_channel_count && frames <= planar.stride)
+    secondary_play(planar.out[device.out_channels], planar.stride, 1, frames);
+  for (int c = 0; c < device.out_channels; c++) {
+    if (planar.out[c] == output[c])
+      continue;
+    if (device.format->from_float)
+      device.format->from_float(planar.out[c], output[c], frames,
+                                device.dithered ? &device.dither : NULL);
+    else
+      memcpy(output[c], planar.out[c], sizeof(AudioSample_t) * frames);
+  }
+}
+
+static const DeviceFormat *device_format_find(const char *name) {
+  if (!name || strcmp(name, "auto") == 0)
+    return NULL;
+  for (size_t i = 0; i < DEVICE_FORMAT_COUNT; i++)
+    if (strcmp(device_formats[i].name, name) == 0)
+      return &device_formats[i];
+  log_w("Unknown sample format \"%s\". Using auto instead.", name);
+  return NULL;
+}
+
+static bool device_format_supported(const DeviceFormat *format) {
+  PaSampleFormat flags = cfg->non_interleaved ? paNonInterleaved : 0;
+  input_parameters.sampleFormat = format->pa_format | flags;
+  output_parameters.sampleFormat = format->pa_format | flags;
+  return Pa_IsFormatSupported(
+             device.in_channels > 0 ? &input_parameters : NULL,
+             device.out_channels > 0 ? &output_parameters : NULL,
+             cfg->sample_rate) == paFormatIsSupported;
+}
+
+/**
+ * @brief Chooses the sample format of the stream.
+ *
+ * The configured `sample_format` is used if both devices accept it,
+ * otherwise the first format of `device_format_order` they both accept.
+ *
+ * @param reason Set to why the format was chosen, for the log.
+ */
+static const DeviceFormat *device_format_negotiate(const char **reason) {
+  const DeviceFormat *wanted = device_format_find(cfg->sample_format);
+  if (wanted) {
+    *reason = "configured";
+    if (device_format_supported(wanted))
+      return wanted;
+    log_w("Sample format \"%s\" is not supported by the devices.",
+          wanted->name);
+  }
+  for (size_t i = 0; i < DEVICE_FORMAT_ORDER_COUNT; i++) {
+    const DeviceFormat *format = &device_formats[device_format_order[i]];
+    if (format == wanted || !device_format_supported(format))
+      continue;
+    *reason = format->to_float ? "best integer format the devices accept"
+                               : "the devices accept no integer format";
+    return format;
+  }
+  // Let Pa_OpenStream report why the devices can not be used
+  *reason = "no format is accepted";
+  return wanted ? wanted : &device_formats[0];
+}
+
+/**
+ * @brief Selects the device format and allocates the interleaved float
+ * buffers it needs.
+ *
+ * @return `false` if the buffers can not be allocated; the callbacks would
+ * then get the device buffers as they are.
+ */
+static bool device_format_init(const DeviceFormat *format) {
+  device.format = format;
+  device.dithered = cfg->dither != 0;
+  dither_init(&device.dither, (uint32_t)monotonic_ns());
+  bool aggregate = device.in_channels < cfg->in_channel_count ||
+                   device.out_channels < cfg->out_channel_count;
+  if ((!device.format->to_float && !aggregate) || cfg->non_interleaved)
+    return true;
+  int primary = device.in_channels > device.out_channels ? device.in_channels
+                                                         : device.out_channels;
+  size_t samples = (size_t)cfg->block_size *
+                   (cfg->in_channel_count + cfg->out_channel_count + primary);
+  device.in = engine_calloc(samples, sizeof(float));
+  if (!device.in) {
+    log_e("Can not allocate conversion buffers");
+    return false;
+  }
+  device.out = device.in + (size_t)cfg->block_size * cfg->in_channel_count;
+  device.scratch =
+      device.out + (size_t)cfg->block_size * cfg->out_channel_count;
+  return true;
+}
+
+static void device_format_deinit() {
+  engine_free(device.in);
+  device.in = device.out = device.scratch = NULL;
+  device.format = &device_formats[0];
+}
+
+/**
+ * @brief Fills the staged input frames from the primary and secondary input.
+ *
+ * @return The input for the callbacks, `NULL` if there is none.
+ */
+static const float *device_read(const void *input, unsigned long frames) {
+  int width = cfg->in_channel_count;
+  if (device.in_channels == width) {
+    if (input && device.format->to_float)
+      device.format->to_float(input, device.in, frames * width);
+    else if (input)
+      memcpy(device.in, input, sizeof(float) * frames * width);
+    return input ? device.in : NULL;
+  }
+  const float *primary = input;
+  if (input && device.format->to_float) {
+    device.format->to_float(input, device.scratch, frames * device.in_channels);
+    primary = device.scratch;
+  }
+  for (unsigned long i = 0; i < frames && primary; i++)
+    memcpy(device.in + i * width, primary + i * device.in_channels,
+           sizeof(float) * device.in_channels);
+  secondary_capture(device.in + device.in_channels, 1, width, frames);
+  return device.in;
+}
+
+/**
+ * @brief Hands the staged output frames to the primary and secondary output.
+ */
+static void device_write(void *output, unsigned long frames) {
+  int width = cfg->out_channel_count;
+  Dither *dither = device.dithered ? &device.dither : NULL;
+  if (device.out_channels == width) {
+    if (output && device.format->from_float)
+      device.format->from_float(device.out, output, frames * width, dither);
+    else if (output)
+      memcpy(output, device.out, sizeof(float) * frames * width);
+    return;
+  }
+  secondary_play(device.out + device.out_channels, 1, width, frames);
+  if (!output)
+    return;
+  float *primary = device.format->from_float ? device.scratch : output;
+  for (unsigned long i = 0; i < frames; i++)
+    memcpy(primary + i * device.out_channels, device.out + i * width,
+           sizeof(float) * device.out_channels);
+  if (device.format->from_float)
+    device.format->from_float(primary, output, frames * device.out_channels,
+                              dither);
+}
+
+/**
+ * @brief Processes a block or a slice with the running module, or else the
+ * audio callback.
+ */
+static void audio_run(const void *input_buffer, void *output_buffer,
+                      unsigned long frames, void *user_data) {
+  if (!module_process(input_buffer, output_buffer, frames) &&
+      cfg->audio_callback)
+    cfg->audio_callback(input_buffer, output_buffer, frames, user_data);
+}
+
+/**
+ * @brief Runs the callbacks in slices that end at MIDI events.
+ *
+ * The MIDI callback gets each group of events with the same frame offset
+ * right before the audio callback renders the frames from that offset on,
+ * so parameter changes apply on the exact sample.
+ */
+static void audio_process_split(const void *input_buffer, void *output_buffer,
+                                unsigned long block_size, int events,
+                                void *user_data) {
+  const PmEvent *event = midi_block_events();
+  size_t in_stride = sizeof(AudioSample_t) * cfg->in_channel_count;
+  size_t out_stride = sizeof(AudioSample_t) * cfg->out_channel_count;
+  unsigned long position = 0;
+  int first = 0;
+
+  while (position < block_size) {
+    int last = first;
+    while (last < events && (unsigned long)event[last].timestamp <= position)
+      last++;
+    if (last > first) {
+      midi_block_dispatch(first, last - first, user_data);
+      first = last;
+    }
+    params_process(position, block_size - position);
+    unsigned long next =
+        first < events ? (unsigned long)event[first].timestamp : block_size;
+    if (!cfg->audio_callback && !module_running()) {
+      position = next;
+      continue;
+    }
+    if (cfg->non_interleaved) {
+      for (int c = 0; c < cfg->in_channel_count && input_buffer; c++)
+        planar.in_slice[c] = planar.in[c] + position;
+      for (int c = 0; c < cfg->out_channel_count; c++)
+        planar.out_slice[c] = planar.out[c] + position;
+      audio_run(input_buffer ? planar.in_slice : NULL, planar.out_slice,
+                next - position, user_data);
+    } else {
+      audio_run(
+          input_buffer ? (const char *)input_buffer + position * in_stride
+                       : NULL,
+          output_buffer ? (char *)output_buffer + position * out_stride : NULL,
+          next - position, user_data);
+    }
+    position = next;
+  }
+}
+
+int __audio_callback(const void *input_buffer, void *output_buffer,
+                     unsigned long block_size,
+                     const PaStreamCallbackTimeInfo *time_info,
+                     PaStreamCallbackFlags status_flags, void *user_data) {
+  realtime_enter("Audio");
+  int64_t start = monotonic_ns();
+  scratch_bind(0);
+  module_block_begin();
+  const void *in = input_buffer;
+  void *out = output_buffer;
+  bool staged =
+      !cfg->non_interleaved && device.in && block_size <= cfg->block_size;
+  if (cfg->non_interleaved) {
+    planar_prepare((void *const *)input_buffer, block_size, output_buffer);
+    bool captured = input_buffer || device.in_channels < cfg->in_channel_count;
+    in = captured ? planar.in : NULL;
+    out = planar.out;
+  } else if (staged) {
+    in = device_read(input_buffer, block_size);
+    out = device.out;
+  }
+
+  int events = -1;
+  if (cfg->midi_callback || cfg->graph)
+    events = midi_block_begin(time_info, block_size);
+  if (cfg->graph) {
+    if (events > 0 && cfg->midi_callback)
+      midi_block_dispatch(0, events, user_data);
+    params_process(0, block_size);
+    const MidiBuffer *sent =
+        graph_process(cfg->graph, in, out, block_size, midi_block_events(),
+                      events > 0 ? events : 0);
+    if (events >= 0)
+      midi_block_send(sent->events, sent->length);
+  } else if (events > 0 && cfg->midi_split_blocks) {
+    audio_process_split(in, out, block_size, events, user_data);
+  } else {
+    if (events >= 0)
+      midi_block_dispatch(0, events, user_data);
+    params_process(0, block_size);
+    audio_run(in, out, block_size, user_data);
+  }
+  if (events >= 0)
+    midi_block_end();
+  if (cfg->meter_output)
+    meter_process(out, block_size);
+  if (cfg->non_interleaved)
+    planar_finish(output_buffer, block_size);
+  else if (staged)
+    device_write(output_buffer, block_size);
+  scratch_finish();
+  module_block_end();
+  stats_record(block_size, monotonic_ns() - start, status_flags);
   return paContinue;
 }
 
-static bool audio_device_find(char *pattern, bool input) {
-  bool not_enough_channels = false;
-  if (pattern == NULL)
+bool audio_set_graph(Graph *graph) {
+  cfg = config_get();
+  if (graph && !graph_compile(graph))
     return false;
-  for (int i = 0; i < Pa_GetDeviceCount(); i++) {
+  cfg->graph = graph;
+  return true;
+}
+
+/**
+ * @brief Resolves the `audio_host_api` config field.
+ *
+ * @return Index of the host API, or -1 to use the devices of all of them.
+ */
+static PaHostApiIndex host_api_find() {
+  if (!cfg->audio_host_api)
+    return -1;
+  for (PaHostApiIndex i = 0; i < Pa_GetHostApiCount(); i++) {
+    const PaHostApiInfo *info = Pa_GetHostApiInfo(i);
+    if (strcasecmp(info->name, cfg->audio_host_api) == 0) {
+      log_i("Host API: %s, %d devices", info->name, info->deviceCount);
+      return i;
+    }
+  }
+  log_w("Host API \"%s\" was not found. Using all of them instead.",
+        cfg->audio_host_api);
+  return -1;
+}
+
+/**
+ * @brief Default device of the selected host API, or of PortAudio.
+ */
+static PaDeviceIndex audio_device_default(bool input) {
+  if (host_api < 0)
+    return input ? Pa_GetDefaultInputDevice() : Pa_GetDefaultOutputDevice();
+  const PaHostApiInfo *info = Pa_GetHostApiInfo(host_api);
+  return input ? info->defaultInputDevice : info->defaultOutputDevice;
+}
+
+PaDeviceIndex audio_device_find(const char *name, bool input, int channels) {
+  if (name == NULL)
+    return paNoDevice;
+  // Only the devices of the selected host API are looked at
+  int count = host_api < 0 ? Pa_GetDeviceCount()
+                           : Pa_GetHostApiInfo(host_api)->deviceCount;
+  for (int n = 0; n < count; n++) {
+    PaDeviceIndex i =
+        host_api < 0 ? n : Pa_HostApiDeviceIndexToDeviceIndex(host_api, n);
     const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
-    if (strcmp(info->name, pattern) == 0) {
-      if (input) {
-        not_enough_channels = info->maxInputChannels < cfg->in_channel_count;
-      } else {
-        not_enough_channels = info->maxOutputChannels < cfg->out_channel_count;
-      }
-      if (not_enough_channels) {
-        log_w("Not enough channels on device \"%s\"", info->name);
-        return false;
-      }
-      return true;
+    if (strcmp(info->name, name) != 0)
+      continue;
+    if ((input ? info->maxInputChannels : info->maxOutputChannels) <
+        channels) {
+      log_w("Not enough channels on device \"%s\"", info->name);
+      return paNoDevice;
     }
+    return i;
   }
-  return false;
+  return paNoDevice;
 }
 
-void audio_init() {
+void audio_open() {
   log_d("Audio init start");
   PaError err;
-  TRY(Pa_Initialize());
+  int64_t phase = monotonic_ns();
   cfg = config_get();
+  backend = audio_backend_get();
+  realtime_init(backend == AUDIO_BACKEND_OFFLINE);
+  device.in_channels = cfg->in_channel_count - secondary_in_channels();
+  device.out_channels = cfg->out_channel_count - secondary_out_channels();
+  if (cfg->non_interleaved)
+    planar_init();
+  scratch_init();
+  if (cfg->meter_output)
+    meter_init();
+  if (backend != AUDIO_BACKEND_PORTAUDIO) {
+    // The offline and null backends exchange float buffers with the engine,
+    // never aggregated, so nothing is allocated
+    device_format_init(&device_formats[0]);
+    audio_state = AUDIO_OPENED;
+    return;
+  }
+  TRY(Pa_Initialize());
+  startup_phase("PortAudio init", &phase);
+  host_api = host_api_find();
+  secondary_open();
+  startup_phase("secondary devices", &phase);
 
-  if (!cfg->audio_input) {
-    __audio_in_id = Pa_GetDefaultInputDevice();
-  } else if (!audio_device_find(cfg->audio_input, true)) {
-    __audio_in_id = Pa_GetDefaultInputDevice();
-    log_w("Input audio device \"%s\" was not found. Using default instead.",
-          cfg->audio_input);
+  if (device.in_channels > 0) {
+    __audio_in_id =
+        audio_device_find(cfg->audio_input, true, device.in_channels);
+    if (__audio_in_id == paNoDevice) {
+      __audio_in_id = audio_device_default(true);
+      if (cfg->audio_input)
+        log_w("Input audio device \"%s\" was not found. Using default "
+              "instead.",
+              cfg->audio_input);
+    }
+    const PaDeviceInfo *in_device_info = Pa_GetDeviceInfo(__audio_in_id);
+    stream_configure(&input_parameters, __audio_in_id, device.in_channels,
+                     paFloat32, in_device_info->defaultLowInputLatency);
   }
-  const PaDeviceInfo *in_device_info = Pa_GetDeviceInfo(__audio_in_id);
 
-  stream_configure(&input_parameters, __audio_in_id, cfg->in_channel_count,
-                   PA_SAMPLE_FORMAT, in_device_info->defaultLowInputLatency);
+  if (device.out_channels > 0) {
+    __audio_out_id =
+        audio_device_find(cfg->audio_output, false, device.out_channels);
+    if (__audio_out_id == paNoDevice) {
+      __audio_out_id = audio_device_default(false);
+      if (cfg->audio_output)
+        log_w("Output audio device \"%s\" was not found. Using default "
+              "instead.",
+              cfg->audio_output);
+    }
+    const PaDeviceInfo *out_device_info = Pa_GetDeviceInfo(__audio_out_id);
+    stream_configure(&output_parameters, __audio_out_id, device.out_channels,
+                     paFloat32, out_device_info->defaultLowOutputLatency);
+  }
 
-  if (!cfg->audio_output) {
-    __audio_out_id = Pa_GetDefaultOutputDevice();
-  } else if (!audio_device_find(cfg->audio_output, false)) {
-    __audio_out_id = Pa_GetDefaultOutputDevice();
-    log_w("Output audio device \"%s\" was not found. Using default instead.",
-          cfg->audio_output);
+  const char *reason;
+  if (!device_format_init(device_format_negotiate(&reason))) {
+    audio_deinit();
+    return;
   }
-  const PaDeviceInfo *out_device_info = Pa_GetDeviceInfo(__audio_out_id);
+  log_i("Sample format: %s (%s)", device.format->name, reason);
+  startup_phase("audio devices", &phase);
 
-  stream_configure(&output_parameters, __audio_out_id, cfg->out_channel_count,
-                   PA_SAMPLE_FORMAT, out_device_info->defaultLowOutputLatency);
+  // The engine always sees `block_size` frames, the device may differ
+  unsigned long device_frames = cfg->block_size;
+  PaStreamCallback *callback = __audio_callback;
+  if (quantum_enabled() &&
+      quantum_init(device.in_channels, device.out_channels,
+                   device.format->pa_format)) {
+    device_frames = quantum_device_frames();
+    callback = quantum_callback;
+  }
+  TRY(Pa_OpenStream(&stream,
+                    device.in_channels > 0 ? &input_parameters : NULL,
+                    device.out_channels > 0 ? &output_parameters : NULL,
+                    cfg->sample_rate, device_frames, cfg->audio_flags,
+                    callback, cfg->user_data));
+  audio_state = AUDIO_OPENED;
+  startup_phase("stream open", &phase);
+}
 
-  TRY(Pa_OpenStream(&stream, &input_parameters, &output_parameters,
-                    cfg->sample_rate, cfg->block_size, cfg->audio_flags,
-                    __audio_callback, cfg->user_data));
-  TRY(Pa_StartStream(stream));
+void audio_start() {
+  PaError err;
+  int64_t phase = monotonic_ns();
+  if (audio_state != AUDIO_OPENED)
+    return;
+  // The first block is already processed by the module
+  if (cfg->audio_module)
+    audio_load_module(cfg->audio_module);
+  switch (backend) {
+  case AUDIO_BACKEND_OFFLINE:
+    offline_start();
+    break;
+  case AUDIO_BACKEND_NULL:
+    null_start();
+    break;
+  default:
+    // The rings of the secondaries fill up while the primary starts
+    secondary_start();
+    TRY(Pa_StartStream(stream));
+  }
+  atomic_store_explicit(&clock_running, true, memory_order_release);
+  audio_state = AUDIO_STARTED;
+  startup_phase("stream start", &phase);
+  realtime_report();
+  engine_memory_report();
   log_d("Audio init finish");
 }
 
+void audio_init() {
+  if (audio_state == AUDIO_CLOSED)
+    audio_open();
+  audio_start();
+}
+
 #define PRINT_ERROR(x)                                                         \
   err = (x);                                                                   \
   if (err != paNoError) {                                                      \
@@ -108,7 +636,60 @@ void audio_init() {
 
 void audio_deinit() {
   PaError err;
-  PRINT_ERROR(Pa_StopStream(stream));
-  PRINT_ERROR(Pa_CloseStream(stream));
-  PRINT_ERROR(Pa_Terminate());
-}
\ No newline at end of file
+  atomic_store_explicit(&clock_running, false, memory_order_relaxed);
+  audio_state = AUDIO_CLOSED;
+  switch (backend) {
+  case AUDIO_BACKEND_OFFLINE:
+    offline_stop();
+    break;
+  case AUDIO_BACKEND_NULL:
+    null_stop();
+    break;
+  default:
+    PRINT_ERROR(Pa_StopStream(stream));
+    PRINT_ERROR(Pa_CloseStream(stream));
+    secondary_close();
+    PRINT_ERROR(Pa_Terminate());
+    stream = NULL;
+    host_api = -1;
+    quantum_deinit();
+  }
+  module_deinit();
+  planar_deinit();
+  scratch_deinit();
+  meter_deinit();
+  params_deinit();
+  device_format_deinit();
+  realtime_report();
+}
+
+double audio_stream_time() {
+  // Events stamped before the engine runs go to the start of the first block
+  if (!atomic_load_explicit(&clock_running, memory_order_acquire))
+    return 0.0;
+  switch (backend) {
+  case AUDIO_BACKEND_OFFLINE:
+    return offline_stream_time();
+  case AUDIO_BACKEND_NULL:
+    return null_stream_time();
+  default:
+    return stream ? Pa_GetStreamTime(stream) : monotonic_seconds();
+  }
+}
+
+double audio_cpu_load() {
+  if (backend != AUDIO_BACKEND_PORTAUDIO || !stream)
+    return -1.0;
+  return Pa_GetStreamCpuLoad(stream);
+}
+
+bool audio_is_active() {
+  switch (backend) {
+  case AUDIO_BACKEND_OFFLINE:
+    return offline_is_active();
+  case AUDIO_BACKEND_NULL:
+    return null_is_active();
+  default:
+    return stream && Pa_IsStreamActive(stream) == 1;
+  }
+}
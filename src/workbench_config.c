@@ -1,4 +1,6 @@
-#include "workbench.h"
+#include "workbench_internal.h"
+#include <ctype.h>
+#include <pthread.h>
 
 #ifndef STRING_MAX
 #define STRING_MAX 256
@@ -38,9 +40,51 @@ CONFIG(WORKBENCH_CONFIG_IMPLEMENT_SETTERS)
 // void config_set_flags(uint32_t flags) { __cfg.flags |= flags; }
 // void config_clear_flags(uint32_t flags) { __cfg.flags ^= flags; }
 
+static void *midi_open_thread(void *arg) {
+  (void)arg;
+  midi_open();
+  return NULL;
+}
+
+/**
+ * \brief Starts MIDI and audio for the registered callbacks.
+ *
+ * PortMidi and PortAudio each enumerate their devices when they are
+ * initialised, so the MIDI devices are opened on a helper thread while the
+ * audio streams are opened. The MIDI I/O thread, which reads the audio stream
+ * clock, and the audio engine are started only after both are ready, so the
+ * first block already finds the MIDI queues.
+ *
+ * An offline render is only opened: it runs flat out, so the blocks it
+ * renders before the application is set up would depend on thread timing.
+ * The application starts it with `audio_init`.
+ *
+ * \param midi Start MIDI.
+ * \param audio Start audio.
+ */
+static void subsystems_init(bool midi, bool audio) {
+  int64_t start = monotonic_ns();
+  pthread_t thread;
+  bool parallel = midi && audio &&
+                  pthread_create(&thread, NULL, midi_open_thread, NULL) == 0;
+  if (midi && !parallel)
+    midi_open();
+  if (audio)
+    audio_open();
+  if (parallel)
+    pthread_join(thread, NULL);
+  if (midi)
+    midi_start();
+  if (audio && audio_backend_get() != AUDIO_BACKEND_OFFLINE)
+    audio_start();
+  startup_phase(parallel ? "MIDI and audio" : midi ? "MIDI" : "audio",
+                &start);
+}
+
 Config *config_init(int argc, char **argv, AudioCallback audio_cb,
                     MidiCallback midi_cb, void *user_data) {
   log_d("Start config");
+  int64_t start = monotonic_ns();
   // Initialize with default values
   Config config = {CONFIG(WORKBENCH_CONFIG_SET_DEFAULTS)};
 
@@ -69,10 +113,11 @@ Config *config_init(int argc, char **argv, AudioCallback audio_cb,
   __cfg.audio_callback = audio_cb;
   __cfg.midi_callback = midi_cb;
   __cfg.user_data = user_data;
-  if (midi_cb)
-    midi_init();
-  if (audio_cb)
-    audio_init();
+  startup_phase("config", &start);
+  // A module processes the audio without a callback
+  bool audio = audio_cb || __cfg.audio_module;
+  if (midi_cb || audio)
+    subsystems_init(midi_cb, audio);
 
   // Cleanup
   if (config_file)
@@ -199,7 +244,8 @@ void argparse(int argc, char **argv, Argument_t *arguments, int *args_parsed,
       while (!val || (*val == '=')) {
         val = argv[i++];
       }
-      if (*val == '-') {
+      // A dash starts the next argument unless a negative number follows
+      if (*val == '-' && !isdigit((unsigned char)val[1])) {
         log_w("No value for arg '%s'", arg);
         i--;
         continue;
@@ -225,13 +271,37 @@ void config_print() {
          "    midi_output_ltc: \t%i\n"
          "    midi_buffer_size: \t%i\n"
          "  AUDIO:\n"
+         "    audio_backend: \t%s\n"
          "    audio_input: \t%s\n"
          "    audio_output: \t%s\n"
+         "    audio_host_api: \t%s\n"
          "    sample_rate: \t%f\n"
+         "    sample_format: \t%s\n"
          "    block_size: \t%i\n"
          "    channels(i/o): \t%i/%i\n",
          __cfg.midi_input, __cfg.midi_output, __cfg.midi_output_latecncy,
-         __cfg.midi_buffer_size, __cfg.audio_input, __cfg.audio_output,
-         __cfg.sample_rate, __cfg.block_size, __cfg.in_channel_count,
-         __cfg.out_channel_count);
+         __cfg.midi_buffer_size,
+         __cfg.audio_backend ? __cfg.audio_backend : "portaudio",
+         __cfg.audio_input, __cfg.audio_output,
+         __cfg.audio_host_api ? __cfg.audio_host_api : "all",
+         __cfg.sample_rate,
+         __cfg.sample_format ? __cfg.sample_format : "auto", __cfg.block_size,
+         __cfg.in_channel_count, __cfg.out_channel_count);
+  if (__cfg.rt_priority || __cfg.cpu_affinity)
+    printf("    rt_priority: \t%u\n"
+           "    cpu_affinity: \t%s\n",
+           __cfg.rt_priority, __cfg.cpu_affinity ? __cfg.cpu_affinity : "any");
+  if (__cfg.device_block_size)
+    printf("    device_block_size: \t%i\n", __cfg.device_block_size);
+  if (__cfg.meter_output)
+    printf("    meter_output: \t%u\n", __cfg.meter_output);
+  if (__cfg.audio_module)
+    printf("    audio_module: \t%s\n", __cfg.audio_module);
+  if (__cfg.secondary_input || __cfg.secondary_output)
+    printf("    secondary_input: \t%s (%i)\n"
+           "    secondary_output: \t%s (%i)\n"
+           "    secondary_sample_rate: \t%f\n",
+           __cfg.secondary_input, __cfg.secondary_in_channels,
+           __cfg.secondary_output, __cfg.secondary_out_channels,
+           __cfg.secondary_sample_rate);
 }
\ No newline at end of file
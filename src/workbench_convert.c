@@ -0,0 +1,689 @@
+#include "workbench_internal.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CONVERT_NEON 1
+#endif
+
+#define DITHER_CHUNK 256
+
+#define S8_SCALE 128.0f
+#define S16_SCALE 32768.0f
+#define S24_SCALE 8388608.0f
+#define S32_SCALE 2147483648.0f
+/** Largest float below 2^31, the upper limit of float to int32 conversion */
+#define S32_MAX_FLOAT 2147483520.0f
+
+typedef void (*ToFloat)(const void *, float *, size_t);
+typedef void (*FromFloat)(const float *, void *, size_t, const float *);
+
+/**
+ * @brief One implementation of every converter.
+ *
+ * `FromFloat` kernels take the dither noise in least significant bits, one
+ * value per sample, or `NULL`.
+ */
+typedef struct {
+  const char *isa;
+  ToFloat s8_to_f32;
+  ToFloat s16_to_f32;
+  ToFloat s24_to_f32;
+  ToFloat s32_to_f32;
+  FromFloat f32_to_s8;
+  FromFloat f32_to_s16;
+  FromFloat f32_to_s24;
+  FromFloat f32_to_s32;
+} ConvertKernels;
+
+/*
+ * Scalar reference implementation, also used for the tails of the vector
+ * loops.
+ */
+
+static inline int32_t clamp_round(float x, float lo, float hi) {
+  return (int32_t)lrintf(x < lo ? lo : (x > hi ? hi : x));
+}
+
+static inline int32_t load_s24(const uint8_t *p) {
+  return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) |
+                   ((uint32_t)p[2] << 24)) >>
+         8;
+}
+
+static inline void store_s24(uint8_t *p, int32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+}
+
+#define NOISE(i) (noise ? noise[i] : 0.0f)
+
+static void s8_to_f32_scalar(const void *src, float *dst, size_t count) {
+  const int8_t *s = src;
+  for (size_t i = 0; i < count; i++)
+    dst[i] = s[i] * (1.0f / S8_SCALE);
+}
+
+static void s16_to_f32_scalar(const void *src, float *dst, size_t count) {
+  const int16_t *s = src;
+  for (size_t i = 0; i < count; i++)
+    dst[i] = s[i] * (1.0f / S16_SCALE);
+}
+
+static void s24_to_f32_scalar(const void *src, float *dst, size_t count) {
+  const uint8_t *s = src;
+  for (size_t i = 0; i < count; i++)
+    dst[i] = load_s24(s + 3 * i) * (1.0f / S24_SCALE);
+}
+
+static void s32_to_f32_scalar(const void *src, float *dst, size_t count) {
+  const int32_t *s = src;
+  for (size_t i = 0; i < count; i++)
+    dst[i] = s[i] * (1.0f / S32_SCALE);
+}
+
+static void f32_to_s8_scalar(const float *src, void *dst, size_t count,
+                             const float *noise) {
+  int8_t *d = dst;
+  for (size_t i = 0; i < count; i++)
+    d[i] = clamp_round(src[i] * S8_SCALE + NOISE(i), -S8_SCALE, S8_SCALE - 1);
+}
+
+static void f32_to_s16_scalar(const float *src, void *dst, size_t count,
+                              const float *noise) {
+  int16_t *d = dst;
+  for (size_t i = 0; i < count; i++)
+    d[i] = clamp_round(src[i] * S16_SCALE + NOISE(i), -S16_SCALE,
+                       S16_SCALE - 1);
+}
+
+static void f32_to_s24_scalar(const float *src, void *dst, size_t count,
+                              const float *noise) {
+  uint8_t *d = dst;
+  for (size_t i = 0; i < count; i++)
+    store_s24(d + 3 * i, clamp_round(src[i] * S24_SCALE + NOISE(i),
+                                     -S24_SCALE, S24_SCALE - 1));
+}
+
+static void f32_to_s32_scalar(const float *src, void *dst, size_t count,
+                              const float *noise) {
+  (void)noise;
+  int32_t *d = dst;
+  for (size_t i = 0; i < count; i++)
+    d[i] = clamp_round(src[i] * S32_SCALE, -S32_SCALE, S32_MAX_FLOAT);
+}
+
+static const ConvertKernels scalar_kernels = {
+    .isa = "scalar",
+    .s8_to_f32 = s8_to_f32_scalar,
+    .s16_to_f32 = s16_to_f32_scalar,
+    .s24_to_f32 = s24_to_f32_scalar,
+    .s32_to_f32 = s32_to_f32_scalar,
+    .f32_to_s8 = f32_to_s8_scalar,
+    .f32_to_s16 = f32_to_s16_scalar,
+    .f32_to_s24 = f32_to_s24_scalar,
+    .f32_to_s32 = f32_to_s32_scalar,
+};
+
+#ifdef CONVERT_X86
+/*
+ * SSE2 is the x86-64 baseline. Packed 24 bit samples need the byte shuffle
+ * from SSSE3, AVX2 doubles the width of everything else.
+ */
+
+#define SSE_NOISE(i) (noise ? _mm_loadu_ps(noise + (i)) : _mm_setzero_ps())
+
+/** Scales, adds noise, clamps and rounds four samples. */
+#define SSE_TO_INT(src, i, scale, lo, hi)                                      \
+  _mm_cvtps_epi32(_mm_min_ps(                                                  \
+      _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps((src) + (i)), scale),      \
+                            SSE_NOISE(i)),                                     \
+                 lo),                                                          \
+      hi))
+
+__attribute__((target("sse2"))) static void
+s8_to_f32_sse2(const void *src, float *dst, size_t count) {
+  const int8_t *s = src;
+  const __m128 k = _mm_set1_ps(1.0f / S8_SCALE);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    // Widen by interleaving with itself, then shift the sign in
+    __m128i lo16 = _mm_unpacklo_epi8(v, v);
+    __m128i hi16 = _mm_unpackhi_epi8(v, v);
+    __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(lo16, lo16), 24);
+    __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(lo16, lo16), 24);
+    __m128i c = _mm_srai_epi32(_mm_unpacklo_epi16(hi16, hi16), 24);
+    __m128i d = _mm_srai_epi32(_mm_unpackhi_epi16(hi16, hi16), 24);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), k));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), k));
+    _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(c), k));
+    _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(d), k));
+  }
+  s8_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void
+s16_to_f32_sse2(const void *src, float *dst, size_t count) {
+  const int16_t *s = src;
+  const __m128 k = _mm_set1_ps(1.0f / S16_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+  }
+  s16_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void
+s32_to_f32_sse2(const void *src, float *dst, size_t count) {
+  const int32_t *s = src;
+  const __m128 k = _mm_set1_ps(1.0f / S32_SCALE);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), k));
+  }
+  s32_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+__attribute__((target("sse2"))) static void
+f32_to_s8_sse2(const float *src, void *dst, size_t count, const float *noise) {
+  int8_t *d = dst;
+  const __m128 k = _mm_set1_ps(S8_SCALE);
+  const __m128 lo = _mm_set1_ps(-S8_SCALE);
+  const __m128 hi = _mm_set1_ps(S8_SCALE - 1);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = SSE_TO_INT(src, i, k, lo, hi);
+    __m128i b = SSE_TO_INT(src, i + 4, k, lo, hi);
+    __m128i c = SSE_TO_INT(src, i + 8, k, lo, hi);
+    __m128i e = SSE_TO_INT(src, i + 12, k, lo, hi);
+    __m128i v = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, e));
+    _mm_storeu_si128((__m128i *)(d + i), v);
+  }
+  f32_to_s8_scalar(src + i, d + i, count - i, noise ? noise + i : NULL);
+}
+
+__attribute__((target("sse2"))) static void
+f32_to_s16_sse2(const float *src, void *dst, size_t count,
+                const float *noise) {
+  int16_t *d = dst;
+  const __m128 k = _mm_set1_ps(S16_SCALE);
+  const __m128 lo = _mm_set1_ps(-S16_SCALE);
+  const __m128 hi = _mm_set1_ps(S16_SCALE - 1);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = SSE_TO_INT(src, i, k, lo, hi);
+    __m128i b = SSE_TO_INT(src, i + 4, k, lo, hi);
+    _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(a, b));
+  }
+  f32_to_s16_scalar(src + i, d + i, count - i, noise ? noise + i : NULL);
+}
+
+__attribute__((target("sse2"))) static void
+f32_to_s32_sse2(const float *src, void *dst, size_t count,
+                const float *noise) {
+  // 32-bit output is below any dither worth adding
+  (void)noise;
+  int32_t *d = dst;
+  const __m128 k = _mm_set1_ps(S32_SCALE);
+  const __m128 lo = _mm_set1_ps(-S32_SCALE);
+  const __m128 hi = _mm_set1_ps(S32_MAX_FLOAT);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), k);
+    __m128i v = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x, lo), hi));
+    _mm_storeu_si128((__m128i *)(d + i), v);
+  }
+  f32_to_s32_scalar(src + i, d + i, count - i, NULL);
+}
+
+__attribute__((target("ssse3"))) static void
+s24_to_f32_ssse3(const void *src, float *dst, size_t count) {
+  const uint8_t *s = src;
+  const __m128 k = _mm_set1_ps(1.0f / S32_SCALE);
+  // Put the three bytes of every sample into the top of a 32 bit lane
+  const __m128i unpack = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+                                       -1, 9, 10, 11);
+  size_t i = 0;
+  // A 16 byte load covers 4 samples and must not run past the buffer
+  for (; i + 6 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + 3 * i));
+    v = _mm_shuffle_epi8(v, unpack);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), k));
+  }
+  s24_to_f32_scalar(s + 3 * i, dst + i, count - i);
+}
+
+__attribute__((target("ssse3"))) static void
+f32_to_s24_ssse3(const float *src, void *dst, size_t count,
+                 const float *noise) {
+  uint8_t *d = dst;
+  const __m128 k = _mm_set1_ps(S24_SCALE);
+  const __m128 lo = _mm_set1_ps(-S24_SCALE);
+  const __m128 hi = _mm_set1_ps(S24_SCALE - 1);
+  // Drop the top byte of every 32 bit lane
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                     -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_shuffle_epi8(SSE_TO_INT(src, i, k, lo, hi), pack);
+    int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    _mm_storel_epi64((__m128i *)(d + 3 * i), v);
+    memcpy(d + 3 * i + 8, &tail, sizeof(tail));
+  }
+  f32_to_s24_scalar(src + i, d + 3 * i, count - i, noise ? noise + i : NULL);
+}
+
+#define AVX_NOISE(i)                                                           \
+  (noise ? _mm256_loadu_ps(noise + (i)) : _mm256_setzero_ps())
+
+#define AVX_TO_INT(src, i, scale, lo, hi)                                      \
+  _mm256_cvtps_epi32(_mm256_min_ps(                                            \
+      _mm256_max_ps(                                                           \
+          _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps((src) + (i)), scale),    \
+                        AVX_NOISE(i)),                                         \
+          lo),                                                                 \
+      hi))
+
+__attribute__((target("avx2"))) static void
+s8_to_f32_avx2(const void *src, float *dst, size_t count) {
+  const int8_t *s = src;
+  const __m256 k = _mm256_set1_ps(1.0f / S8_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(s + i)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+  }
+  s8_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+s16_to_f32_avx2(const void *src, float *dst, size_t count) {
+  const int16_t *s = src;
+  const __m256 k = _mm256_set1_ps(1.0f / S16_SCALE);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(s + i)));
+    __m256i b = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i *)(s + i + 8)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), k));
+    _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), k));
+  }
+  s16_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+s32_to_f32_avx2(const void *src, float *dst, size_t count) {
+  const int32_t *s = src;
+  const __m256 k = _mm256_set1_ps(1.0f / S32_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+  }
+  s32_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+f32_to_s8_avx2(const float *src, void *dst, size_t count, const float *noise) {
+  int8_t *d = dst;
+  const __m256 k = _mm256_set1_ps(S8_SCALE);
+  const __m256 lo = _mm256_set1_ps(-S8_SCALE);
+  const __m256 hi = _mm256_set1_ps(S8_SCALE - 1);
+  // The packs work within 128 bit lanes, this restores the sample order
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i a = AVX_TO_INT(src, i, k, lo, hi);
+    __m256i b = AVX_TO_INT(src, i + 8, k, lo, hi);
+    __m256i c = AVX_TO_INT(src, i + 16, k, lo, hi);
+    __m256i e = AVX_TO_INT(src, i + 24, k, lo, hi);
+    __m256i v = _mm256_packs_epi16(_mm256_packs_epi32(a, b),
+                                   _mm256_packs_epi32(c, e));
+    v = _mm256_permutevar8x32_epi32(v, order);
+    _mm256_storeu_si256((__m256i *)(d + i), v);
+  }
+  f32_to_s8_sse2(src + i, d + i, count - i, noise ? noise + i : NULL);
+}
+
+__attribute__((target("avx2"))) static void
+f32_to_s16_avx2(const float *src, void *dst, size_t count,
+                const float *noise) {
+  int16_t *d = dst;
+  const __m256 k = _mm256_set1_ps(S16_SCALE);
+  const __m256 lo = _mm256_set1_ps(-S16_SCALE);
+  const __m256 hi = _mm256_set1_ps(S16_SCALE - 1);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = AVX_TO_INT(src, i, k, lo, hi);
+    __m256i b = AVX_TO_INT(src, i + 8, k, lo, hi);
+    // Lanes come out as a0-3 b0-3 a4-7 b4-7
+    __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+    _mm256_storeu_si256((__m256i *)(d + i), v);
+  }
+  f32_to_s16_sse2(src + i, d + i, count - i, noise ? noise + i : NULL);
+}
+
+__attribute__((target("avx2"))) static void
+f32_to_s32_avx2(const float *src, void *dst, size_t count,
+                const float *noise) {
+  // 32-bit output is below any dither worth adding
+  (void)noise;
+  int32_t *d = dst;
+  const __m256 k = _mm256_set1_ps(S32_SCALE);
+  const __m256 lo = _mm256_set1_ps(-S32_SCALE);
+  const __m256 hi = _mm256_set1_ps(S32_MAX_FLOAT);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src + i), k);
+    __m256i v = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(x, lo), hi));
+    _mm256_storeu_si256((__m256i *)(d + i), v);
+  }
+  f32_to_s32_scalar(src + i, d + i, count - i, NULL);
+}
+
+static const ConvertKernels sse2_kernels = {
+    .isa = "sse2",
+    .s8_to_f32 = s8_to_f32_sse2,
+    .s16_to_f32 = s16_to_f32_sse2,
+    .s24_to_f32 = s24_to_f32_scalar,
+    .s32_to_f32 = s32_to_f32_sse2,
+    .f32_to_s8 = f32_to_s8_sse2,
+    .f32_to_s16 = f32_to_s16_sse2,
+    .f32_to_s24 = f32_to_s24_scalar,
+    .f32_to_s32 = f32_to_s32_sse2,
+};
+
+static const ConvertKernels ssse3_kernels = {
+    .isa = "ssse3",
+    .s8_to_f32 = s8_to_f32_sse2,
+    .s16_to_f32 = s16_to_f32_sse2,
+    .s24_to_f32 = s24_to_f32_ssse3,
+    .s32_to_f32 = s32_to_f32_sse2,
+    .f32_to_s8 = f32_to_s8_sse2,
+    .f32_to_s16 = f32_to_s16_sse2,
+    .f32_to_s24 = f32_to_s24_ssse3,
+    .f32_to_s32 = f32_to_s32_sse2,
+};
+
+static const ConvertKernels avx2_kernels = {
+    .isa = "avx2",
+    .s8_to_f32 = s8_to_f32_avx2,
+    .s16_to_f32 = s16_to_f32_avx2,
+    .s24_to_f32 = s24_to_f32_ssse3,
+    .s32_to_f32 = s32_to_f32_avx2,
+    .f32_to_s8 = f32_to_s8_avx2,
+    .f32_to_s16 = f32_to_s16_avx2,
+    .f32_to_s24 = f32_to_s24_ssse3,
+    .f32_to_s32 = f32_to_s32_avx2,
+};
+#endif
+
+#ifdef CONVERT_NEON
+#define NEON_NOISE(i) (noise ? vld1q_f32(noise + (i)) : vdupq_n_f32(0))
+
+/** Scales, adds noise, clamps and rounds four samples to nearest. */
+#define NEON_TO_INT(src, i, scale, lo, hi)                                     \
+  vcvtnq_s32_f32(vminq_f32(                                                    \
+      vmaxq_f32(vmlaq_f32(NEON_NOISE(i), vld1q_f32((src) + (i)), scale), lo), \
+      hi))
+
+static void s8_to_f32_neon(const void *src, float *dst, size_t count) {
+  const int8_t *s = src;
+  const float32x4_t k = vdupq_n_f32(1.0f / S8_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vmovl_s8(vld1_s8(s + i));
+    vst1q_f32(dst + i,
+              vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), k));
+    vst1q_f32(dst + i + 4,
+              vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), k));
+  }
+  s8_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+static void s16_to_f32_neon(const void *src, float *dst, size_t count) {
+  const int16_t *s = src;
+  const float32x4_t k = vdupq_n_f32(1.0f / S16_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vld1q_s16(s + i);
+    vst1q_f32(dst + i,
+              vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), k));
+    vst1q_f32(dst + i + 4,
+              vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), k));
+  }
+  s16_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+static void s24_to_f32_neon(const void *src, float *dst, size_t count) {
+  const uint8_t *s = src;
+  const float32x4_t k = vdupq_n_f32(1.0f / S32_SCALE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    // De-interleave the three bytes of eight samples
+    uint8x8x3_t b = vld3_u8(s + 3 * i);
+    // Byte 0 goes to bits 8-15, bytes 1 and 2 to bits 16-31
+    uint16x8_t low = vshll_n_u8(b.val[0], 8);
+    uint16x8_t high = vorrq_u16(vshll_n_u8(b.val[2], 8), vmovl_u8(b.val[1]));
+    uint32x4_t lo = vorrq_u32(vshll_n_u16(vget_low_u16(high), 16),
+                              vmovl_u16(vget_low_u16(low)));
+    uint32x4_t hi = vorrq_u32(vshll_n_u16(vget_high_u16(high), 16),
+                              vmovl_u16(vget_high_u16(low)));
+    vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(lo)), k));
+    vst1q_f32(dst + i + 4,
+              vmulq_f32(vcvtq_f32_s32(vreinterpretq_s32_u32(hi)), k));
+  }
+  s24_to_f32_scalar(s + 3 * i, dst + i, count - i);
+}
+
+static void s32_to_f32_neon(const void *src, float *dst, size_t count) {
+  const int32_t *s = src;
+  const float32x4_t k = vdupq_n_f32(1.0f / S32_SCALE);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(s + i)), k));
+  s32_to_f32_scalar(s + i, dst + i, count - i);
+}
+
+static void f32_to_s8_neon(const float *src, void *dst, size_t count,
+                           const float *noise) {
+  int8_t *d = dst;
+  const float32x4_t k = vdupq_n_f32(S8_SCALE);
+  const float32x4_t lo = vdupq_n_f32(-S8_SCALE);
+  const float32x4_t hi = vdupq_n_f32(S8_SCALE - 1);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vcombine_s16(vqmovn_s32(NEON_TO_INT(src, i, k, lo, hi)),
+                               vqmovn_s32(NEON_TO_INT(src, i + 4, k, lo, hi)));
+    vst1_s8(d + i, vqmovn_s16(v));
+  }
+  f32_to_s8_scalar(src + i, d + i, count - i, noise ? noise + i : NULL);
+}
+
+static void f32_to_s16_neon(const float *src, void *dst, size_t count,
+                            const float *noise) {
+  int16_t *d = dst;
+  const float32x4_t k = vdupq_n_f32(S16_SCALE);
+  const float32x4_t lo = vdupq_n_f32(-S16_SCALE);
+  const float32x4_t hi = vdupq_n_f32(S16_SCALE - 1);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    vst1q_s16(d + i,
+              vcombine_s16(vqmovn_s32(NEON_TO_INT(src, i, k, lo, hi)),
+                           vqmovn_s32(NEON_TO_INT(src, i + 4, k, lo, hi))));
+  }
+  f32_to_s16_scalar(src + i, d + i, count - i, noise ? noise + i : NULL);
+}
+
+static void f32_to_s24_neon(const float *src, void *dst, size_t count,
+                            const float *noise) {
+  uint8_t *d = dst;
+  const float32x4_t k = vdupq_n_f32(S24_SCALE);
+  const float32x4_t lo = vdupq_n_f32(-S24_SCALE);
+  const float32x4_t hi = vdupq_n_f32(S24_SCALE - 1);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    int32x4_t a = NEON_TO_INT(src, i, k, lo, hi);
+    int32x4_t b = NEON_TO_INT(src, i + 4, k, lo, hi);
+    // Split into the three bytes of every sample and interleave them
+    uint8x8x3_t out;
+    out.val[0] = vmovn_u16(vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(a)),
+                                        vmovn_u32(vreinterpretq_u32_s32(b))));
+    out.val[1] = vmovn_u16(
+        vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(a, 8))),
+                     vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(b, 8)))));
+    out.val[2] = vmovn_u16(
+        vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(a, 16))),
+                     vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(b, 16)))));
+    vst3_u8(d + 3 * i, out);
+  }
+  f32_to_s24_scalar(src + i, d + 3 * i, count - i, noise ? noise + i : NULL);
+}
+
+static void f32_to_s32_neon(const float *src, void *dst, size_t count,
+                            const float *noise) {
+  // 32-bit output is below any dither worth adding
+  (void)noise;
+  int32_t *d = dst;
+  const float32x4_t k = vdupq_n_f32(S32_SCALE);
+  const float32x4_t lo = vdupq_n_f32(-S32_SCALE);
+  const float32x4_t hi = vdupq_n_f32(S32_MAX_FLOAT);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t x = vmulq_f32(vld1q_f32(src + i), k);
+    vst1q_s32(d + i, vcvtnq_s32_f32(vminq_f32(vmaxq_f32(x, lo), hi)));
+  }
+  f32_to_s32_scalar(src + i, d + i, count - i, NULL);
+}
+
+static const ConvertKernels neon_kernels = {
+    .isa = "neon",
+    .s8_to_f32 = s8_to_f32_neon,
+    .s16_to_f32 = s16_to_f32_neon,
+    .s24_to_f32 = s24_to_f32_neon,
+    .s32_to_f32 = s32_to_f32_neon,
+    .f32_to_s8 = f32_to_s8_neon,
+    .f32_to_s16 = f32_to_s16_neon,
+    .f32_to_s24 = f32_to_s24_neon,
+    .f32_to_s32 = f32_to_s32_neon,
+};
+#endif
+
+static inline const ConvertKernels *kernels_get() {
+#if defined(CONVERT_X86)
+  unsigned cpu = cpu_features();
+  if (cpu & CPU_AVX2)
+    return &avx2_kernels;
+  if (cpu & CPU_SSSE3)
+    return &ssse3_kernels;
+  if (cpu & CPU_SSE2)
+    return &sse2_kernels;
+#elif defined(CONVERT_NEON)
+  if (cpu_features() & CPU_NEON)
+    return &neon_kernels;
+#endif
+  return &scalar_kernels;
+}
+
+const char *convert_isa() { return kernels_get()->isa; }
+
+void dither_init(Dither *dither, uint32_t seed) {
+  for (int lane = 0; lane < 8; lane++) {
+    // splitmix32 spreads the seed over the lanes
+    uint32_t z = seed + 0x9e3779b9u * (lane + 1);
+    z = (z ^ (z >> 16)) * 0x85ebca6bu;
+    z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+    z ^= z >> 16;
+    dither->state[lane] = z ? z : 0x6d2b79f5u;
+  }
+}
+
+static inline uint32_t xorshift32(uint32_t x) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+/**
+ * @brief Produces triangular noise between -1 and 1 LSB.
+ *
+ * The difference of two uniform values has a triangular distribution. The
+ * lanes are independent, so the inner loop maps onto vector registers.
+ */
+static void dither_fill(Dither *dither, float *noise, size_t count) {
+  for (size_t i = 0; i < count; i += 8) {
+    for (int lane = 0; lane < 8; lane++) {
+      uint32_t a = xorshift32(dither->state[lane]);
+      uint32_t b = xorshift32(a);
+      dither->state[lane] = b;
+      if (i + lane < count)
+        noise[i + lane] = ((float)(a >> 8) - (float)(b >> 8)) * 0x1p-24f;
+    }
+  }
+}
+
+static void from_float(FromFloat kernel, const float *src, void *dst,
+                       size_t count, size_t sample_bytes, Dither *dither) {
+  float noise[DITHER_CHUNK];
+  if (!dither) {
+    kernel(src, dst, count, NULL);
+    return;
+  }
+  while (count) {
+    size_t n = count < DITHER_CHUNK ? count : DITHER_CHUNK;
+    dither_fill(dither, noise, n);
+    kernel(src, dst, n, noise);
+    src += n;
+    dst = (uint8_t *)dst + n * sample_bytes;
+    count -= n;
+  }
+}
+
+void convert_s8_to_f32(const void *src, float *dst, size_t count) {
+  kernels_get()->s8_to_f32(src, dst, count);
+}
+
+void convert_s16_to_f32(const void *src, float *dst, size_t count) {
+  kernels_get()->s16_to_f32(src, dst, count);
+}
+
+void convert_s24_to_f32(const void *src, float *dst, size_t count) {
+  kernels_get()->s24_to_f32(src, dst, count);
+}
+
+void convert_s32_to_f32(const void *src, float *dst, size_t count) {
+  kernels_get()->s32_to_f32(src, dst, count);
+}
+
+void convert_f32_to_s8(const float *src, void *dst, size_t count,
+                       Dither *dither) {
+  from_float(kernels_get()->f32_to_s8, src, dst, count, 1, dither);
+}
+
+void convert_f32_to_s16(const float *src, void *dst, size_t count,
+                        Dither *dither) {
+  from_float(kernels_get()->f32_to_s16, src, dst, count, 2, dither);
+}
+
+void convert_f32_to_s24(const float *src, void *dst, size_t count,
+                        Dither *dither) {
+  from_float(kernels_get()->f32_to_s24, src, dst, count, 3, dither);
+}
+
+void convert_f32_to_s32(const float *src, void *dst, size_t count,
+                        Dither *dither) {
+  (void)dither;
+  kernels_get()->f32_to_s32(src, dst, count, NULL);
+}
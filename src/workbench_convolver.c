@@ -0,0 +1,378 @@
+#include "workbench_internal.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/** Spectra are padded to whole cache lines so each starts aligned */
+#define SPECTRUM_ALIGN (ENGINE_ALIGNMENT / sizeof(float))
+
+/**
+ * @brief Partitions of one size with their frequency-domain delay line.
+ *
+ * Partition `j` and the spectrum of input block `n` are at `j * stride` and
+ * `(n % count) * stride` of their arrays.
+ */
+typedef struct {
+  size_t size;     /**< Samples per partition, half the transform */
+  size_t bins;     /**< `size + 1` */
+  size_t stride;   /**< `bins` rounded up to whole cache lines */
+  int count;       /**< Partitions */
+  FftPlan *plan;   /**< Transform of `2 * size` */
+  float *ir_re;    /**< Spectra of the partitions, real parts */
+  float *ir_im;    /**< Spectra of the partitions, imaginary parts */
+  float *delay_re; /**< Spectra of the last `count` input blocks, real */
+  float *delay_im; /**< Spectra of the last `count` input blocks, imaginary */
+  float *sum_re;   /**< Sum of the products for a block, real parts */
+  float *sum_im;   /**< Sum of the products for a block, imaginary parts */
+  float *frame;    /**< Input of the transform, then its inverse */
+} Partitions;
+
+struct Convolver {
+  Partitions head;      /**< Start of the response, on the caller */
+  Partitions tail;      /**< Rest of the response from `2 * tail.size` */
+  float *window;        /**< Previous and current head block */
+  float *current_re;    /**< Head sum plus the current block, real */
+  float *current_im;    /**< Head sum plus the current block, imaginary */
+  size_t fill;          /**< Samples of the current head block */
+  uint64_t blocks;      /**< Head blocks finished */
+  float *tail_input;    /**< Three tail blocks: two for the job, one filling */
+  float *tail_output;   /**< Output of the last two tail jobs */
+  size_t tail_fill;     /**< Samples of the current tail block */
+  uint64_t tail_blocks; /**< Tail blocks finished by the caller */
+  uint64_t jobs;        /**< Tail jobs run */
+  bool background;      /**< Tail jobs run on `helper` */
+  bool started;         /**< `helper` was created */
+  pthread_t helper;     /**< Runs the tail jobs */
+  atomic_bool running;  /**< Cleared to stop `helper` */
+  _Alignas(CACHE_LINE) atomic_uint requested; /**< Tail jobs handed over */
+  _Alignas(CACHE_LINE) atomic_uint completed; /**< Tail jobs done */
+  atomic_uint_fast64_t late;                  /**< Waits for `helper` */
+};
+
+static bool partitions_init(Partitions *p, const float *ir, size_t length,
+                            size_t size) {
+  p->size = size;
+  p->bins = size + 1;
+  p->stride = (p->bins + SPECTRUM_ALIGN - 1) / SPECTRUM_ALIGN * SPECTRUM_ALIGN;
+  p->count = (int)((length + size - 1) / size);
+  p->plan = fft_plan_create(2 * size);
+  size_t spectra = sizeof(float) * p->stride * p->count;
+  p->ir_re = engine_alloc(spectra);
+  p->ir_im = engine_alloc(spectra);
+  p->delay_re = engine_calloc(1, spectra);
+  p->delay_im = engine_calloc(1, spectra);
+  p->sum_re = engine_alloc(sizeof(float) * p->stride);
+  p->sum_im = engine_alloc(sizeof(float) * p->stride);
+  p->frame = engine_alloc(sizeof(float) * 2 * size);
+  if (!p->plan || !p->ir_re || !p->ir_im || !p->delay_re || !p->delay_im ||
+      !p->sum_re || !p->sum_im || !p->frame)
+    return false;
+  // Partitions are zero-padded to the transform so the products are linear
+  for (int j = 0; j < p->count; j++) {
+    size_t start = j * size;
+    size_t n = length - start < size ? length - start : size;
+    memset(p->frame, 0, sizeof(float) * 2 * size);
+    memcpy(p->frame, ir + start, sizeof(float) * n);
+    fft_forward(p->plan, p->frame, p->ir_re + j * p->stride,
+                p->ir_im + j * p->stride);
+  }
+  return true;
+}
+
+static void partitions_free(Partitions *p) {
+  fft_plan_destroy(p->plan);
+  engine_free(p->ir_re);
+  engine_free(p->ir_im);
+  engine_free(p->delay_re);
+  engine_free(p->delay_im);
+  engine_free(p->sum_re);
+  engine_free(p->sum_im);
+  engine_free(p->frame);
+}
+
+/**
+ * @brief Sums the products of the partitions from `first` on with the input
+ * blocks before `block`, each with the partition as old as the block.
+ */
+static void partitions_sum(Partitions *p, uint64_t block, int first) {
+  memset(p->sum_re, 0, sizeof(float) * p->bins);
+  memset(p->sum_im, 0, sizeof(float) * p->bins);
+  for (int j = first; j < p->count; j++) {
+    size_t slot = (block + p->count - j) % p->count * p->stride;
+    fft_multiply_add(p->sum_re, p->sum_im, p->delay_re + slot,
+                     p->delay_im + slot, p->ir_re + j * p->stride,
+                     p->ir_im + j * p->stride, p->bins);
+  }
+}
+
+/**
+ * @brief Estimated cost per sample of a layout: a complex multiply-add per
+ * partition and two transforms per block of each size.
+ */
+static double convolver_cost(size_t length, size_t block, size_t tail) {
+  double cost = 2 * log2(2.0 * block);
+  if (tail == block)
+    return cost + ceil((double)length / block);
+  return cost + 2.0 * tail / block + ceil((double)(length - 2 * tail) / tail) +
+         2 * log2(2.0 * tail);
+}
+
+/** Tail size with the lowest estimated cost, `block` for none. */
+static size_t convolver_pick(size_t length, size_t block) {
+  size_t best = block;
+  for (size_t tail = 2 * block; 2 * tail < length; tail *= 2)
+    if (convolver_cost(length, block, tail) <
+        convolver_cost(length, block, best))
+      best = tail;
+  return best;
+}
+
+/**
+ * @brief Convolves tail block `job` with the tail partitions.
+ *
+ * Its output is heard from `2 * tail.size` samples after the block started,
+ * so the job has the whole next tail block to finish.
+ */
+static void convolver_tail(Convolver *c, uint64_t job) {
+  Partitions *p = &c->tail;
+  const size_t size = p->size;
+  size_t slot = job % p->count * p->stride;
+  memcpy(p->frame, c->tail_input + (job + 2) % 3 * size,
+         sizeof(float) * size);
+  memcpy(p->frame + size, c->tail_input + job % 3 * size,
+         sizeof(float) * size);
+  fft_forward(p->plan, p->frame, p->delay_re + slot, p->delay_im + slot);
+  partitions_sum(p, job, 0);
+  fft_inverse(p->plan, p->sum_re, p->sum_im, p->frame);
+  memcpy(c->tail_output + job % 2 * size, p->frame + size,
+         sizeof(float) * size);
+}
+
+static void *convolver_help(void *arg) {
+  Convolver *c = arg;
+  // Below the audio thread and on any CPU, so the next callback preempts it
+  realtime_flush_denormals();
+  while (true) {
+    unsigned requested = atomic_load_explicit(&c->requested,
+                                              memory_order_acquire);
+    if (!atomic_load(&c->running))
+      break;
+    if (requested == atomic_load_explicit(&c->completed,
+                                          memory_order_relaxed)) {
+      futex_wait(&c->requested, requested);
+      continue;
+    }
+    convolver_tail(c, c->jobs++);
+    atomic_fetch_add_explicit(&c->completed, 1, memory_order_release);
+    futex_wake(&c->completed);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Waits until the helper has finished every job handed over.
+ *
+ * Sleeps in the kernel. The helper runs one step below `rt_priority`, so it
+ * is preempted by the audio thread while the tail is not due and runs in the
+ * time the waiting thread gives up.
+ */
+static void convolver_wait(Convolver *c) {
+  unsigned completed;
+  bool waited = false;
+  while ((completed = atomic_load_explicit(
+              &c->completed, memory_order_acquire)) !=
+         atomic_load_explicit(&c->requested, memory_order_relaxed)) {
+    waited = true;
+    futex_wait(&c->completed, completed);
+  }
+  if (waited)
+    atomic_fetch_add_explicit(&c->late, 1, memory_order_relaxed);
+}
+
+static bool convolver_start(Convolver *c) {
+  atomic_store(&c->running, true);
+  pthread_attr_t attr;
+  // Without the privilege for SCHED_FIFO, run at the default priority
+  c->started = (realtime_helper_attr(&attr) > 0 &&
+                pthread_create(&c->helper, &attr, convolver_help, c) == 0) ||
+               pthread_create(&c->helper, NULL, convolver_help, c) == 0;
+  pthread_attr_destroy(&attr);
+  if (!c->started)
+    log_e("Can not start the convolver thread");
+  return c->started;
+}
+
+Convolver *convolver_create(const float *ir, size_t length, size_t block,
+                            size_t tail_block, bool background) {
+  bool power = block >= 2 && (block & (block - 1)) == 0 &&
+               (tail_block & (tail_block - 1)) == 0;
+  if (!power || length == 0 ||
+      (tail_block && tail_block != block && tail_block < 2 * block)) {
+    log_e("Convolver partitions %zu/%zu are not powers of two with a tail of "
+          "at least twice the head",
+          block, tail_block);
+    return NULL;
+  }
+  if (tail_block == 0)
+    tail_block = convolver_pick(length, block);
+  // A tail starts after two of its partitions, which the head covers
+  if (2 * tail_block >= length)
+    tail_block = block;
+  Convolver *c = calloc(1, sizeof(Convolver));
+  if (!c)
+    return NULL;
+  bool tail = tail_block != block;
+  size_t head_length = tail ? 2 * tail_block : length;
+  bool allocated = partitions_init(&c->head, ir, head_length, block);
+  c->window = engine_calloc(2 * block, sizeof(float));
+  c->current_re = engine_alloc(sizeof(float) * c->head.stride);
+  c->current_im = engine_alloc(sizeof(float) * c->head.stride);
+  allocated &= c->window && c->current_re && c->current_im;
+  if (allocated && tail) {
+    allocated = partitions_init(&c->tail, ir + head_length,
+                                length - head_length, tail_block);
+    c->tail_input = engine_calloc(3 * tail_block, sizeof(float));
+    c->tail_output = engine_calloc(2 * tail_block, sizeof(float));
+    allocated &= c->tail_input && c->tail_output;
+    c->background = background;
+  }
+  if (!allocated) {
+    log_e("Can not allocate a convolver for %zu samples", length);
+    convolver_destroy(c);
+    return NULL;
+  }
+  if (c->background && !convolver_start(c)) {
+    convolver_destroy(c);
+    return NULL;
+  }
+  return c;
+}
+
+void convolver_destroy(Convolver *c) {
+  if (!c)
+    return;
+  if (c->started) {
+    atomic_store(&c->running, false);
+    atomic_fetch_add(&c->requested, 1);
+    futex_wake(&c->requested);
+    pthread_join(c->helper, NULL);
+  }
+  partitions_free(&c->head);
+  partitions_free(&c->tail);
+  engine_free(c->window);
+  engine_free(c->current_re);
+  engine_free(c->current_im);
+  engine_free(c->tail_input);
+  engine_free(c->tail_output);
+  free(c);
+}
+
+void convolver_reset(Convolver *c) {
+  if (c->background)
+    convolver_wait(c);
+  Partitions *parts[] = {&c->head, &c->tail};
+  for (int i = 0; i < 2; i++) {
+    size_t spectra = sizeof(float) * parts[i]->stride * parts[i]->count;
+    if (parts[i]->count) {
+      memset(parts[i]->delay_re, 0, spectra);
+      memset(parts[i]->delay_im, 0, spectra);
+    }
+  }
+  memset(c->window, 0, sizeof(float) * 2 * c->head.size);
+  if (c->tail.count) {
+    memset(c->tail_input, 0, sizeof(float) * 3 * c->tail.size);
+    memset(c->tail_output, 0, sizeof(float) * 2 * c->tail.size);
+  }
+  c->fill = c->tail_fill = 0;
+  c->blocks = c->tail_blocks = c->jobs = 0;
+}
+
+/**
+ * @brief Hands the tail block just completed to the helper, or convolves it
+ * at once without one.
+ */
+static void convolver_tail_block(Convolver *c) {
+  if (c->background) {
+    // The job before must be done: its output is played from now on
+    convolver_wait(c);
+    atomic_fetch_add_explicit(&c->requested, 1, memory_order_release);
+    futex_wake(&c->requested);
+  } else {
+    convolver_tail(c, c->jobs++);
+  }
+  c->tail_fill = 0;
+  c->tail_blocks++;
+}
+
+void convolver_process(Convolver *c, const float *in, float *out,
+                       size_t frames) {
+  Partitions *head = &c->head;
+  const size_t block = head->size, tail = c->tail.size;
+  size_t position = 0;
+  while (position < frames) {
+    size_t count = block - c->fill;
+    if (count > frames - position)
+      count = frames - position;
+    // The older blocks are summed once per block, the current one per call
+    if (c->fill == 0)
+      partitions_sum(head, c->blocks, 1);
+
+    float *current = c->window + block + c->fill;
+    if (in)
+      memcpy(current, in + position, sizeof(float) * count);
+    else
+      memset(current, 0, sizeof(float) * count);
+    if (tail)
+      memcpy(c->tail_input + c->tail_blocks % 3 * tail + c->tail_fill,
+             current, sizeof(float) * count);
+
+    // The rest of the block is still zero, so the output up to here is exact
+    size_t slot = c->blocks % head->count * head->stride;
+    fft_forward(head->plan, c->window, head->delay_re + slot,
+                head->delay_im + slot);
+    memcpy(c->current_re, head->sum_re, sizeof(float) * head->bins);
+    memcpy(c->current_im, head->sum_im, sizeof(float) * head->bins);
+    fft_multiply_add(c->current_re, c->current_im, head->delay_re + slot,
+                     head->delay_im + slot, head->ir_re, head->ir_im,
+                     head->bins);
+    fft_inverse(head->plan, c->current_re, c->current_im, head->frame);
+
+    const float *y = head->frame + block + c->fill;
+    if (tail) {
+      // Computed by the job of two tail blocks ago
+      const float *t =
+          c->tail_output + c->tail_blocks % 2 * tail + c->tail_fill;
+      for (size_t i = 0; i < count; i++)
+        out[position + i] = y[i] + t[i];
+    } else {
+      memcpy(out + position, y, sizeof(float) * count);
+    }
+
+    position += count;
+    c->fill += count;
+    if (c->fill == block) {
+      memcpy(c->window, c->window + block, sizeof(float) * block);
+      memset(c->window + block, 0, sizeof(float) * block);
+      c->fill = 0;
+      c->blocks++;
+    }
+    if (tail && (c->tail_fill += count) == tail)
+      convolver_tail_block(c);
+  }
+}
+
+void convolver_info(const Convolver *c, ConvolverInfo *info) {
+  *info = (ConvolverInfo){
+      .block = c->head.size,
+      .tail_block = c->tail.size,
+      .head_partitions = c->head.count,
+      .tail_partitions = c->tail.count,
+      .background = c->background,
+      .late_tails = atomic_load_explicit(&c->late, memory_order_relaxed),
+  };
+}
+
+void convolver_node(const NodeContext *context, void *state) {
+  convolver_process(state, context->audio_in[0], context->audio_out[0],
+                    context->frames);
+}
@@ -0,0 +1,29 @@
+#include "workbench_internal.h"
+#include <pthread.h>
+
+static unsigned features = 0;
+static pthread_once_t features_once = PTHREAD_ONCE_INIT;
+
+static void features_query() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse"))
+    features |= CPU_SSE;
+  if (__builtin_cpu_supports("sse2"))
+    features |= CPU_SSE2;
+  if (__builtin_cpu_supports("ssse3"))
+    features |= CPU_SSSE3;
+  if (__builtin_cpu_supports("avx2"))
+    features |= CPU_AVX2;
+  if (__builtin_cpu_supports("fma"))
+    features |= CPU_FMA;
+#elif defined(__aarch64__)
+  // Advanced SIMD is part of every AArch64 CPU
+  features |= CPU_NEON;
+#endif
+}
+
+unsigned cpu_features() {
+  pthread_once(&features_once, features_query);
+  return features;
+}
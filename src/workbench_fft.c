@@ -0,0 +1,389 @@
+#include "workbench_internal.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FFT_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define FFT_NEON 1
+#endif
+
+// The tables and buffers come from `engine_alloc` and use aligned loads
+_Static_assert(ENGINE_ALIGNMENT >= 32, "Tables must be aligned for AVX2");
+
+struct FftPlan {
+  size_t size;       /**< Real samples per transform */
+  size_t half;       /**< Points of the complex transform, `size / 2` */
+  uint32_t *reverse; /**< Bit-reversal permutation of `half` points */
+  float *twiddle_re; /**< `exp(-i pi j / h)` at `h + j` for every stage `h` */
+  float *twiddle_im; /**< Imaginary parts of `twiddle_re` */
+  float *split_re;   /**< `exp(-2 i pi k / size)` for `k <= half / 2` */
+  float *split_im;   /**< Imaginary parts of `split_re` */
+  float *work_re;    /**< Complex transform in place, real parts */
+  float *work_im;    /**< Complex transform in place, imaginary parts */
+};
+
+/**
+ * @brief One radix-2 stage: butterflies `span` points apart, with the twiddle
+ * factors of the stage at `wr + span`, `wi + span`.
+ */
+typedef void (*Stage)(float *, float *, const float *, const float *, size_t,
+                      size_t);
+typedef void (*MultiplyAdd)(float *, float *, const float *, const float *,
+                            const float *, const float *, size_t);
+
+/**
+ * @brief One implementation of the butterflies and the complex
+ * multiply-add.
+ *
+ * `stage` handles any `span` of at least `width`; narrower stages run on the
+ * scalar code.
+ */
+typedef struct {
+  const char *isa;
+  size_t width;
+  Stage stage;
+  MultiplyAdd multiply_add;
+} FftKernels;
+
+static void stage_scalar(float *re, float *im, const float *wr,
+                         const float *wi, size_t points, size_t span) {
+  for (size_t s = 0; s < points; s += 2 * span)
+    for (size_t j = 0; j < span; j++) {
+      float *ar = re + s + j, *ai = im + s + j;
+      float *br = ar + span, *bi = ai + span;
+      float tr = *br * wr[span + j] - *bi * wi[span + j];
+      float ti = *br * wi[span + j] + *bi * wr[span + j];
+      *br = *ar - tr;
+      *bi = *ai - ti;
+      *ar += tr;
+      *ai += ti;
+    }
+}
+
+static void multiply_add_scalar(float *acc_re, float *acc_im,
+                                const float *a_re, const float *a_im,
+                                const float *b_re, const float *b_im,
+                                size_t bins) {
+  for (size_t k = 0; k < bins; k++) {
+    acc_re[k] += a_re[k] * b_re[k] - a_im[k] * b_im[k];
+    acc_im[k] += a_re[k] * b_im[k] + a_im[k] * b_re[k];
+  }
+}
+
+static const FftKernels scalar_kernels = {
+    .isa = "scalar",
+    .width = 1,
+    .stage = stage_scalar,
+    .multiply_add = multiply_add_scalar,
+};
+
+#if defined(FFT_X86)
+__attribute__((target("sse"))) static void
+stage_sse(float *re, float *im, const float *wr, const float *wi,
+          size_t points, size_t span) {
+  for (size_t s = 0; s < points; s += 2 * span)
+    for (size_t j = 0; j < span; j += 4) {
+      float *ar = re + s + j, *ai = im + s + j;
+      __m128 xr = _mm_load_ps(ar + span), xi = _mm_load_ps(ai + span);
+      __m128 cr = _mm_load_ps(wr + span + j), ci = _mm_load_ps(wi + span + j);
+      __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+      __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+      __m128 yr = _mm_load_ps(ar), yi = _mm_load_ps(ai);
+      _mm_store_ps(ar + span, _mm_sub_ps(yr, tr));
+      _mm_store_ps(ai + span, _mm_sub_ps(yi, ti));
+      _mm_store_ps(ar, _mm_add_ps(yr, tr));
+      _mm_store_ps(ai, _mm_add_ps(yi, ti));
+    }
+}
+
+__attribute__((target("sse"))) static void
+multiply_add_sse(float *acc_re, float *acc_im, const float *a_re,
+                 const float *a_im, const float *b_re, const float *b_im,
+                 size_t bins) {
+  size_t k = 0;
+  for (; k + 4 <= bins; k += 4) {
+    __m128 ar = _mm_loadu_ps(a_re + k), ai = _mm_loadu_ps(a_im + k);
+    __m128 br = _mm_loadu_ps(b_re + k), bi = _mm_loadu_ps(b_im + k);
+    __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+    __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+    _mm_storeu_ps(acc_re + k, _mm_add_ps(_mm_loadu_ps(acc_re + k), re));
+    _mm_storeu_ps(acc_im + k, _mm_add_ps(_mm_loadu_ps(acc_im + k), im));
+  }
+  multiply_add_scalar(acc_re + k, acc_im + k, a_re + k, a_im + k, b_re + k,
+                      b_im + k, bins - k);
+}
+
+static const FftKernels sse_kernels = {
+    .isa = "sse",
+    .width = 4,
+    .stage = stage_sse,
+    .multiply_add = multiply_add_sse,
+};
+
+__attribute__((target("avx2,fma"))) static void
+stage_avx2(float *re, float *im, const float *wr, const float *wi,
+           size_t points, size_t span) {
+  if (span < 8) {
+    stage_sse(re, im, wr, wi, points, span);
+    return;
+  }
+  for (size_t s = 0; s < points; s += 2 * span)
+    for (size_t j = 0; j < span; j += 8) {
+      float *ar = re + s + j, *ai = im + s + j;
+      __m256 xr = _mm256_load_ps(ar + span), xi = _mm256_load_ps(ai + span);
+      __m256 cr = _mm256_load_ps(wr + span + j);
+      __m256 ci = _mm256_load_ps(wi + span + j);
+      __m256 tr = _mm256_fmsub_ps(xr, cr, _mm256_mul_ps(xi, ci));
+      __m256 ti = _mm256_fmadd_ps(xr, ci, _mm256_mul_ps(xi, cr));
+      __m256 yr = _mm256_load_ps(ar), yi = _mm256_load_ps(ai);
+      _mm256_store_ps(ar + span, _mm256_sub_ps(yr, tr));
+      _mm256_store_ps(ai + span, _mm256_sub_ps(yi, ti));
+      _mm256_store_ps(ar, _mm256_add_ps(yr, tr));
+      _mm256_store_ps(ai, _mm256_add_ps(yi, ti));
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void
+multiply_add_avx2(float *acc_re, float *acc_im, const float *a_re,
+                  const float *a_im, const float *b_re, const float *b_im,
+                  size_t bins) {
+  size_t k = 0;
+  for (; k + 8 <= bins; k += 8) {
+    __m256 ar = _mm256_loadu_ps(a_re + k), ai = _mm256_loadu_ps(a_im + k);
+    __m256 br = _mm256_loadu_ps(b_re + k), bi = _mm256_loadu_ps(b_im + k);
+    __m256 re = _mm256_fmadd_ps(ar, br, _mm256_loadu_ps(acc_re + k));
+    __m256 im = _mm256_fmadd_ps(ar, bi, _mm256_loadu_ps(acc_im + k));
+    _mm256_storeu_ps(acc_re + k, _mm256_fnmadd_ps(ai, bi, re));
+    _mm256_storeu_ps(acc_im + k, _mm256_fmadd_ps(ai, br, im));
+  }
+  multiply_add_scalar(acc_re + k, acc_im + k, a_re + k, a_im + k, b_re + k,
+                      b_im + k, bins - k);
+}
+
+static const FftKernels avx2_kernels = {
+    .isa = "avx2",
+    .width = 4,
+    .stage = stage_avx2,
+    .multiply_add = multiply_add_avx2,
+};
+#elif defined(FFT_NEON)
+static void stage_neon(float *re, float *im, const float *wr, const float *wi,
+                       size_t points, size_t span) {
+  for (size_t s = 0; s < points; s += 2 * span)
+    for (size_t j = 0; j < span; j += 4) {
+      float *ar = re + s + j, *ai = im + s + j;
+      float32x4_t xr = vld1q_f32(ar + span), xi = vld1q_f32(ai + span);
+      float32x4_t cr = vld1q_f32(wr + span + j), ci = vld1q_f32(wi + span + j);
+      float32x4_t tr = vmlsq_f32(vmulq_f32(xr, cr), xi, ci);
+      float32x4_t ti = vmlaq_f32(vmulq_f32(xr, ci), xi, cr);
+      float32x4_t yr = vld1q_f32(ar), yi = vld1q_f32(ai);
+      vst1q_f32(ar + span, vsubq_f32(yr, tr));
+      vst1q_f32(ai + span, vsubq_f32(yi, ti));
+      vst1q_f32(ar, vaddq_f32(yr, tr));
+      vst1q_f32(ai, vaddq_f32(yi, ti));
+    }
+}
+
+static void multiply_add_neon(float *acc_re, float *acc_im,
+                              const float *a_re, const float *a_im,
+                              const float *b_re, const float *b_im,
+                              size_t bins) {
+  size_t k = 0;
+  for (; k + 4 <= bins; k += 4) {
+    float32x4_t ar = vld1q_f32(a_re + k), ai = vld1q_f32(a_im + k);
+    float32x4_t br = vld1q_f32(b_re + k), bi = vld1q_f32(b_im + k);
+    float32x4_t re = vmlaq_f32(vld1q_f32(acc_re + k), ar, br);
+    float32x4_t im = vmlaq_f32(vld1q_f32(acc_im + k), ar, bi);
+    vst1q_f32(acc_re + k, vmlsq_f32(re, ai, bi));
+    vst1q_f32(acc_im + k, vmlaq_f32(im, ai, br));
+  }
+  multiply_add_scalar(acc_re + k, acc_im + k, a_re + k, a_im + k, b_re + k,
+                      b_im + k, bins - k);
+}
+
+static const FftKernels neon_kernels = {
+    .isa = "neon",
+    .width = 4,
+    .stage = stage_neon,
+    .multiply_add = multiply_add_neon,
+};
+#endif
+
+static inline const FftKernels *kernels_get() {
+#if defined(FFT_X86)
+  unsigned cpu = cpu_features();
+  if ((cpu & CPU_AVX2) && (cpu & CPU_FMA))
+    return &avx2_kernels;
+  if (cpu & CPU_SSE)
+    return &sse_kernels;
+#elif defined(FFT_NEON)
+  if (cpu_features() & CPU_NEON)
+    return &neon_kernels;
+#endif
+  return &scalar_kernels;
+}
+
+const char *fft_isa() { return kernels_get()->isa; }
+
+void fft_multiply_add(float *acc_re, float *acc_im, const float *a_re,
+                      const float *a_im, const float *b_re, const float *b_im,
+                      size_t bins) {
+  kernels_get()->multiply_add(acc_re, acc_im, a_re, a_im, b_re, b_im, bins);
+}
+
+FftPlan *fft_plan_create(size_t size) {
+  if (size < FFT_MIN_SIZE || (size & (size - 1)) || size > (1UL << 31)) {
+    log_e("FFT size %zu is not a power of two of at least %d", size,
+          FFT_MIN_SIZE);
+    return NULL;
+  }
+  FftPlan *plan = calloc(1, sizeof(FftPlan));
+  if (!plan)
+    return NULL;
+  size_t half = size / 2;
+  plan->size = size;
+  plan->half = half;
+  plan->reverse = engine_alloc(sizeof(uint32_t) * half);
+  plan->twiddle_re = engine_alloc(sizeof(float) * half);
+  plan->twiddle_im = engine_alloc(sizeof(float) * half);
+  plan->split_re = engine_alloc(sizeof(float) * (half / 2 + 1));
+  plan->split_im = engine_alloc(sizeof(float) * (half / 2 + 1));
+  plan->work_re = engine_alloc(sizeof(float) * half);
+  plan->work_im = engine_alloc(sizeof(float) * half);
+  if (!plan->reverse || !plan->twiddle_re || !plan->twiddle_im ||
+      !plan->split_re || !plan->split_im || !plan->work_re ||
+      !plan->work_im) {
+    log_e("Can not allocate an FFT plan of size %zu", size);
+    fft_plan_destroy(plan);
+    return NULL;
+  }
+
+  int bits = 0;
+  while ((1UL << bits) < half)
+    bits++;
+  for (size_t k = 0; k < half; k++) {
+    uint32_t r = 0;
+    for (int b = 0; b < bits; b++)
+      r |= ((k >> b) & 1) << (bits - 1 - b);
+    plan->reverse[k] = r;
+  }
+  // Index 0 is never read; stage `span` uses `span` to `2 * span - 1`
+  plan->twiddle_re[0] = 1;
+  plan->twiddle_im[0] = 0;
+  for (size_t span = 1; span < half; span *= 2)
+    for (size_t j = 0; j < span; j++) {
+      plan->twiddle_re[span + j] = (float)cos(M_PI * j / span);
+      plan->twiddle_im[span + j] = (float)-sin(M_PI * j / span);
+    }
+  for (size_t k = 0; k <= half / 2; k++) {
+    plan->split_re[k] = (float)cos(2 * M_PI * k / size);
+    plan->split_im[k] = (float)-sin(2 * M_PI * k / size);
+  }
+  return plan;
+}
+
+void fft_plan_destroy(FftPlan *plan) {
+  if (!plan)
+    return;
+  engine_free(plan->reverse);
+  engine_free(plan->twiddle_re);
+  engine_free(plan->twiddle_im);
+  engine_free(plan->split_re);
+  engine_free(plan->split_im);
+  engine_free(plan->work_re);
+  engine_free(plan->work_im);
+  free(plan);
+}
+
+size_t fft_size(const FftPlan *plan) { return plan->size; }
+
+/**
+ * @brief Complex transform of the work buffers, filled in bit-reversed
+ * order.
+ *
+ * The first two stages need no multiplications and run as one radix-4 pass.
+ */
+static void fft_complex(FftPlan *plan) {
+  const FftKernels *k = kernels_get();
+  float *re = plan->work_re, *im = plan->work_im;
+  size_t points = plan->half, span = 1;
+  if (points >= 4) {
+    for (size_t s = 0; s < points; s += 4) {
+      float ar = re[s] + re[s + 1], ai = im[s] + im[s + 1];
+      float br = re[s] - re[s + 1], bi = im[s] - im[s + 1];
+      float cr = re[s + 2] + re[s + 3], ci = im[s + 2] + im[s + 3];
+      float dr = re[s + 2] - re[s + 3], di = im[s + 2] - im[s + 3];
+      // d times -i
+      re[s] = ar + cr;
+      im[s] = ai + ci;
+      re[s + 2] = ar - cr;
+      im[s + 2] = ai - ci;
+      re[s + 1] = br + di;
+      im[s + 1] = bi - dr;
+      re[s + 3] = br - di;
+      im[s + 3] = bi + dr;
+    }
+    span = 4;
+  }
+  for (; span < points; span *= 2)
+    (span >= k->width ? k->stage : stage_scalar)(
+        re, im, plan->twiddle_re, plan->twiddle_im, points, span);
+}
+
+void fft_forward(FftPlan *plan, const float *in, float *re, float *im) {
+  const size_t half = plan->half;
+  float *zr = plan->work_re, *zi = plan->work_im;
+  // Even samples are the real parts, odd samples the imaginary parts
+  for (size_t n = 0; n < half; n++) {
+    zr[plan->reverse[n]] = in[2 * n];
+    zi[plan->reverse[n]] = in[2 * n + 1];
+  }
+  fft_complex(plan);
+
+  // Bins k and half - k from the transforms of the even (e) and odd (o)
+  // samples, which are the symmetric and antisymmetric parts of z
+  re[0] = zr[0] + zi[0];
+  im[0] = 0;
+  re[half] = zr[0] - zi[0];
+  im[half] = 0;
+  for (size_t k = 1; k <= half / 2; k++) {
+    size_t m = half - k;
+    float er = 0.5f * (zr[k] + zr[m]), ei = 0.5f * (zi[k] - zi[m]);
+    float qr = 0.5f * (zi[k] + zi[m]), qi = -0.5f * (zr[k] - zr[m]);
+    float wr = plan->split_re[k], wi = plan->split_im[k];
+    float tr = wr * qr - wi * qi, ti = wr * qi + wi * qr;
+    re[k] = er + tr;
+    im[k] = ei + ti;
+    re[m] = er - tr;
+    im[m] = ti - ei;
+  }
+}
+
+void fft_inverse(FftPlan *plan, const float *re, const float *im, float *out) {
+  const size_t half = plan->half;
+  float *zr = plan->work_re, *zi = plan->work_im;
+  const uint32_t *reverse = plan->reverse;
+  // Twice the transform of z, conjugated so the forward stages run backwards
+  zr[0] = re[0] + re[half];
+  zi[0] = -(re[0] - re[half]);
+  for (size_t k = 1; k <= half / 2; k++) {
+    size_t m = half - k;
+    float er = re[k] + re[m], ei = im[k] - im[m];
+    float dr = re[k] - re[m], di = im[k] + im[m];
+    float wr = plan->split_re[k], wi = plan->split_im[k];
+    float qr = dr * wr + di * wi, qi = di * wr - dr * wi;
+    zr[reverse[k]] = er - qi;
+    zi[reverse[k]] = -(ei + qr);
+    zr[reverse[m]] = er + qi;
+    zi[reverse[m]] = -(qr - ei);
+  }
+  fft_complex(plan);
+
+  const float scale = 1.0f / plan->size;
+  for (size_t n = 0; n < half; n++) {
+    out[2 * n] = zr[n] * scale;
+    out[2 * n + 1] = -zi[n] * scale;
+  }
+}
@@ -0,0 +1,839 @@
+#include "workbench_internal.h"
+
+/**
+ * @brief A connection between two ports.
+ */
+typedef struct {
+  PortType type; /**< Type of both ports */
+  int from;      /**< Node of the output port */
+  int from_port; /**< Output port index */
+  int to;        /**< Node of the input port */
+  int to_port;   /**< Input port index */
+} GraphEdge;
+
+/**
+ * @brief A node and the port buffers assigned to it by `graph_compile`.
+ */
+typedef struct {
+  NodeDesc desc;         /**< Ports and processing function */
+  float **audio_in;      /**< Buffers of the audio inputs */
+  float **audio_out;     /**< Buffers of the audio outputs */
+  MidiBuffer **midi_in;  /**< Buffers of the MIDI inputs */
+  MidiBuffer **midi_out; /**< Buffers of the MIDI outputs */
+  int *audio_out_index;  /**< Pool index of each audio output */
+  int *midi_out_index;   /**< Pool index of each MIDI output */
+  NodeContext context;   /**< Passed to `desc.process` */
+} GraphNode;
+
+/**
+ * @brief Several outputs summed into one input before a node runs.
+ */
+typedef struct {
+  PortType type;  /**< Type of the ports */
+  void *mixed;    /**< `float *` or `MidiBuffer *` read by the node */
+  void **sources; /**< Buffers of the connected outputs */
+  int count;      /**< Number of sources */
+} GraphMix;
+
+/**
+ * @brief One entry of the execution order.
+ */
+typedef struct {
+  GraphNode *node; /**< Node to run */
+  GraphMix *mixes; /**< Inputs to mix first */
+  int mix_count;   /**< Number of mixes */
+} GraphStep;
+
+/**
+ * @brief Buffers of one port type, recycled while compiling.
+ */
+typedef struct {
+  void **buffers;  /**< Every buffer ever handed out */
+  int *readers;    /**< Reads still to come of each buffer */
+  int *free;       /**< Indices of the buffers free for reuse */
+  int **users;     /**< Steps that used each buffer since it was acquired */
+  int *user_count; /**< Number of users of each buffer */
+  int count;       /**< Number of buffers */
+  int free_count;  /**< Number of free buffers */
+} GraphPool;
+
+struct Graph {
+  GraphNode *nodes;      /**< Nodes by id */
+  int node_count;        /**< Number of nodes */
+  GraphEdge *edges;      /**< Connections */
+  int edge_count;        /**< Number of connections */
+  GraphStep *steps;      /**< Nodes in execution order */
+  TaskDeps *deps;        /**< Dependencies between the steps */
+  int deps_count;        /**< Length of `deps`, the nodes when compiled */
+  int step_count;        /**< Number of steps, 0 before compiling */
+  GraphPool audio;       /**< Audio port buffers */
+  GraphPool midi;        /**< MIDI port buffers */
+  WorkerPool *workers;   /**< Worker threads, or `NULL` */
+  int threads;           /**< Threads running the steps */
+  float *silence;        /**< Read by unconnected audio inputs */
+  MidiBuffer no_events;  /**< Read by unconnected MIDI inputs */
+  MidiBuffer sent;       /**< Events that reached `GRAPH_OUTPUT` */
+  unsigned long frames;  /**< Capacity of the audio buffers */
+  int midi_capacity;     /**< Capacity of the MIDI buffers */
+  bool planar;           /**< Device buffers are `non_interleaved` */
+  const void *input;     /**< Device input of the current block */
+  void *output;          /**< Device output of the current block */
+  unsigned long offset;  /**< Frame of the block the steps are running */
+  unsigned long length;  /**< Frames the steps are running */
+  const PmEvent *events; /**< Incoming events of the current block */
+  int event_count;       /**< Number of incoming events */
+  uint64_t *ancestors;   /**< Ancestor bits of each step, compiling */
+  int words;             /**< Words in the bit set of one step */
+
+  // Profile, only kept with `graph_profile`
+  TripleBuffer *stats;                   /**< Published `GraphStats` */
+  int64_t *step_ns;                      /**< Time of each step */
+  int64_t *path_ns;                      /**< Longest chain to each step */
+  int64_t busy_ns[GRAPH_MAX_THREADS];    /**< Step time of each thread */
+  int64_t total_busy[GRAPH_MAX_THREADS]; /**< Step time since compiling */
+  int64_t total_wall;                    /**< Block time since compiling */
+  int64_t total_work;                    /**< Step time of all threads */
+  int64_t total_path;                    /**< Sum of the critical paths */
+  int64_t max_path;                      /**< Longest critical path */
+  uint64_t blocks;                       /**< Blocks profiled */
+};
+
+static float *audio_buffer_alloc(unsigned long frames) {
+  return engine_calloc(frames, sizeof(float));
+}
+
+static MidiBuffer *midi_buffer_alloc(int capacity) {
+  MidiBuffer *buffer = engine_alloc(sizeof(MidiBuffer));
+  if (!buffer)
+    return NULL;
+  buffer->events = engine_calloc(capacity, sizeof(PmEvent));
+  buffer->capacity = capacity;
+  if (!buffer->events) {
+    engine_free(buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+/**
+ * @brief Makes step `to` wait for step `from`.
+ *
+ * @return `false` if the successor list can not be grown.
+ */
+static bool graph_depend(Graph *graph, int from, int to) {
+  TaskDeps *deps = &graph->deps[from];
+  if (from == to)
+    return true;
+  for (int i = 0; i < deps->successor_count; i++)
+    if (deps->successors[i] == to)
+      return true;
+  int *successors =
+      realloc(deps->successors, sizeof(int) * (deps->successor_count + 1));
+  if (!successors)
+    return false;
+  deps->successors = successors;
+  deps->successors[deps->successor_count++] = to;
+  graph->deps[to].predecessors++;
+  return true;
+}
+
+/** Records that a step writes or reads a buffer. */
+static bool pool_use(GraphPool *pool, int index, int step) {
+  int *users =
+      realloc(pool->users[index], sizeof(int) * (pool->user_count[index] + 1));
+  if (!users)
+    return false;
+  pool->users[index] = users;
+  users[pool->user_count[index]++] = step;
+  return true;
+}
+
+/** Tells if every step that used a buffer is an ancestor of `step`. */
+static bool pool_settled(const Graph *graph, const GraphPool *pool, int index,
+                         int step) {
+  const uint64_t *ancestors = graph->ancestors + (size_t)step * graph->words;
+  for (int i = 0; i < pool->user_count[index]; i++) {
+    int user = pool->users[index][i];
+    if (user != step && !(ancestors[user / 64] >> (user % 64) & 1))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Hands out a free buffer of the pool, allocating one if none is free.
+ *
+ * When the steps run in parallel, a free buffer may still be in use by a
+ * step that is not an ancestor of `step`. Only buffers whose users are all
+ * ancestors are reused then, which never serialises independent branches.
+ */
+static int pool_acquire(Graph *graph, PortType type, int readers, int step) {
+  GraphPool *pool = type == PORT_AUDIO ? &graph->audio : &graph->midi;
+  int index = -1;
+  for (int i = pool->free_count - 1; i >= 0 && index < 0; i--) {
+    if (graph->ancestors && !pool_settled(graph, pool, pool->free[i], step))
+      continue;
+    index = pool->free[i];
+    pool->free[i] = pool->free[--pool->free_count];
+    pool->user_count[index] = 0;
+  }
+  if (index < 0) {
+    void *buffer = type == PORT_AUDIO
+                       ? (void *)audio_buffer_alloc(graph->frames)
+                       : (void *)midi_buffer_alloc(graph->midi_capacity);
+    void **buffers = realloc(pool->buffers, sizeof(void *) * (pool->count + 1));
+    int *counts = realloc(pool->readers, sizeof(int) * (pool->count + 1));
+    int *free_list = realloc(pool->free, sizeof(int) * (pool->count + 1));
+    int **users = realloc(pool->users, sizeof(int *) * (pool->count + 1));
+    int *user_count =
+        realloc(pool->user_count, sizeof(int) * (pool->count + 1));
+    if (buffers)
+      pool->buffers = buffers;
+    if (counts)
+      pool->readers = counts;
+    if (free_list)
+      pool->free = free_list;
+    if (users)
+      pool->users = users;
+    if (user_count)
+      pool->user_count = user_count;
+    if (!buffer || !buffers || !counts || !free_list || !users ||
+        !user_count) {
+      engine_free(buffer);
+      return -1;
+    }
+    index = pool->count++;
+    pool->buffers[index] = buffer;
+    pool->users[index] = NULL;
+    pool->user_count[index] = 0;
+  }
+  pool->readers[index] = readers;
+  return pool_use(pool, index, step) ? index : -1;
+}
+
+/** Accounts one read of a buffer, it is free again after the last one. */
+static bool pool_release(GraphPool *pool, int index, int step) {
+  if (--pool->readers[index] <= 0)
+    pool->free[pool->free_count++] = index;
+  return pool_use(pool, index, step);
+}
+
+static void pool_free(GraphPool *pool, PortType type) {
+  for (int i = 0; i < pool->count; i++) {
+    if (type == PORT_MIDI)
+      engine_free(((MidiBuffer *)pool->buffers[i])->events);
+    engine_free(pool->buffers[i]);
+    free(pool->users[i]);
+  }
+  free(pool->buffers);
+  free(pool->readers);
+  free(pool->free);
+  free(pool->users);
+  free(pool->user_count);
+  *pool = (GraphPool){0};
+}
+
+/** Frees what `graph_compile` made, the graph can be compiled again. */
+static void graph_release(Graph *graph) {
+  workers_destroy(graph->workers);
+  graph->workers = NULL;
+  for (int i = 0; i < graph->step_count; i++) {
+    for (int j = 0; j < graph->steps[i].mix_count; j++)
+      free(graph->steps[i].mixes[j].sources);
+    free(graph->steps[i].mixes);
+  }
+  for (int i = 0; graph->deps && i < graph->deps_count; i++)
+    free(graph->deps[i].successors);
+  free(graph->steps);
+  free(graph->deps);
+  free(graph->step_ns);
+  free(graph->path_ns);
+  graph->steps = NULL;
+  graph->deps = NULL;
+  graph->deps_count = 0;
+  graph->step_ns = graph->path_ns = NULL;
+  graph->step_count = 0;
+  pool_free(&graph->audio, PORT_AUDIO);
+  pool_free(&graph->midi, PORT_MIDI);
+}
+
+/** Copies the device inputs and the incoming events into the graph. */
+static void graph_input(const NodeContext *context, void *state) {
+  Graph *graph = state;
+  int channels = graph->nodes[GRAPH_INPUT].desc.audio_outputs;
+  for (int c = 0; c < channels; c++) {
+    float *out = context->audio_out[c];
+    if (!graph->input) {
+      memset(out, 0, sizeof(float) * context->frames);
+    } else if (graph->planar) {
+      memcpy(out, ((const float *const *)graph->input)[c] + graph->offset,
+             sizeof(float) * context->frames);
+    } else {
+      const float *in =
+          (const float *)graph->input + graph->offset * channels + c;
+      for (unsigned long i = 0; i < context->frames; i++)
+        out[i] = in[i * channels];
+    }
+  }
+  MidiBuffer *midi = context->midi_out[0];
+  for (int i = 0; i < graph->event_count && midi->length < midi->capacity;
+       i++) {
+    unsigned long frame = graph->events[i].timestamp;
+    if (frame < graph->offset || frame >= graph->offset + context->frames)
+      continue;
+    midi->events[midi->length] = graph->events[i];
+    midi->events[midi->length++].timestamp = frame - graph->offset;
+  }
+}
+
+/** Copies the graph outputs to the device and collects the sent events. */
+static void graph_output(const NodeContext *context, void *state) {
+  Graph *graph = state;
+  int channels = graph->nodes[GRAPH_OUTPUT].desc.audio_inputs;
+  for (int c = 0; c < channels; c++) {
+    const float *in = context->audio_in[c];
+    if (graph->planar) {
+      memcpy(((float **)graph->output)[c] + graph->offset, in,
+             sizeof(float) * context->frames);
+    } else {
+      float *out = (float *)graph->output + graph->offset * channels + c;
+      for (unsigned long i = 0; i < context->frames; i++)
+        out[i * channels] = in[i];
+    }
+  }
+  const MidiBuffer *midi = context->midi_in[0];
+  for (int i = 0; i < midi->length && graph->sent.length < graph->sent.capacity;
+       i++) {
+    graph->sent.events[graph->sent.length] = midi->events[i];
+    graph->sent.events[graph->sent.length++].timestamp += graph->offset;
+  }
+}
+
+Graph *graph_create() {
+  Config *cfg = config_get();
+  Graph *graph = calloc(1, sizeof(Graph));
+  if (!graph)
+    return NULL;
+  graph->frames = cfg->block_size;
+  graph->midi_capacity = cfg->midi_buffer_size;
+  graph->planar = cfg->non_interleaved;
+  graph->silence = audio_buffer_alloc(graph->frames);
+  graph->no_events.events = engine_calloc(1, sizeof(PmEvent));
+  graph->sent.events = engine_calloc(graph->midi_capacity, sizeof(PmEvent));
+  graph->sent.capacity = graph->midi_capacity;
+  NodeDesc input = {.name = "input",
+                    .audio_outputs = cfg->in_channel_count,
+                    .midi_outputs = 1,
+                    .process = graph_input,
+                    .state = graph};
+  NodeDesc output = {.name = "output",
+                     .audio_inputs = cfg->out_channel_count,
+                     .midi_inputs = 1,
+                     .process = graph_output,
+                     .state = graph};
+  if (cfg->graph_profile && posix_memalign((void **)&graph->stats, CACHE_LINE,
+                                            sizeof(TripleBuffer)) == 0)
+    triple_buffer_init(graph->stats, sizeof(GraphStats));
+  if (!graph->silence || !graph->no_events.events || !graph->sent.events ||
+      (cfg->graph_profile && (!graph->stats || !graph->stats->data)) ||
+      graph_add_node(graph, &input) != GRAPH_INPUT ||
+      graph_add_node(graph, &output) != GRAPH_OUTPUT) {
+    graph_destroy(graph);
+    return NULL;
+  }
+  return graph;
+}
+
+void graph_destroy(Graph *graph) {
+  if (!graph)
+    return;
+  graph_release(graph);
+  for (int i = 0; i < graph->node_count; i++) {
+    GraphNode *node = &graph->nodes[i];
+    free(node->audio_in);
+    free(node->audio_out);
+    free(node->midi_in);
+    free(node->midi_out);
+    free(node->audio_out_index);
+    free(node->midi_out_index);
+  }
+  free(graph->nodes);
+  free(graph->edges);
+  engine_free(graph->silence);
+  engine_free(graph->no_events.events);
+  engine_free(graph->sent.events);
+  if (graph->stats)
+    triple_buffer_free(graph->stats);
+  free(graph->stats);
+  free(graph);
+}
+
+int graph_add_node(Graph *graph, const NodeDesc *desc) {
+  if (!desc->process || desc->audio_inputs < 0 || desc->audio_outputs < 0 ||
+      desc->midi_inputs < 0 || desc->midi_outputs < 0)
+    return -1;
+  GraphNode *nodes =
+      realloc(graph->nodes, sizeof(GraphNode) * (graph->node_count + 1));
+  if (!nodes)
+    return -1;
+  graph->nodes = nodes;
+  GraphNode *node = &graph->nodes[graph->node_count];
+  // One spare entry keeps the allocations valid for nodes without ports
+  *node = (GraphNode){
+      .desc = *desc,
+      .audio_in = calloc(desc->audio_inputs + 1, sizeof(float *)),
+      .audio_out = calloc(desc->audio_outputs + 1, sizeof(float *)),
+      .midi_in = calloc(desc->midi_inputs + 1, sizeof(MidiBuffer *)),
+      .midi_out = calloc(desc->midi_outputs + 1, sizeof(MidiBuffer *)),
+      .audio_out_index = calloc(desc->audio_outputs + 1, sizeof(int)),
+      .midi_out_index = calloc(desc->midi_outputs + 1, sizeof(int)),
+  };
+  if (!node->audio_in || !node->audio_out || !node->midi_in ||
+      !node->midi_out || !node->audio_out_index || !node->midi_out_index) {
+    free(node->audio_in);
+    free(node->audio_out);
+    free(node->midi_in);
+    free(node->midi_out);
+    free(node->audio_out_index);
+    free(node->midi_out_index);
+    return -1;
+  }
+  return graph->node_count++;
+}
+
+bool graph_connect(Graph *graph, PortType type, int from, int from_port,
+                   int to, int to_port) {
+  if (from < 0 || from >= graph->node_count || to < 0 ||
+      to >= graph->node_count) {
+    log_e("Can not connect missing graph node %d", from < 0 ? from : to);
+    return false;
+  }
+  const NodeDesc *source = &graph->nodes[from].desc;
+  const NodeDesc *target = &graph->nodes[to].desc;
+  int outputs = type == PORT_AUDIO ? source->audio_outputs
+                                   : source->midi_outputs;
+  int inputs = type == PORT_AUDIO ? target->audio_inputs : target->midi_inputs;
+  if (from_port < 0 || from_port >= outputs || to_port < 0 ||
+      to_port >= inputs) {
+    log_e("Can not connect \"%s\" port %d to \"%s\" port %d", source->name,
+          from_port, target->name, to_port);
+    return false;
+  }
+  GraphEdge *edges =
+      realloc(graph->edges, sizeof(GraphEdge) * (graph->edge_count + 1));
+  if (!edges)
+    return false;
+  graph->edges = edges;
+  graph->edges[graph->edge_count++] =
+      (GraphEdge){type, from, from_port, to, to_port};
+  return true;
+}
+
+/**
+ * @brief Lists the nodes so that every node comes after the nodes that feed
+ * it (Kahn's algorithm, lowest id first among the ready nodes).
+ *
+ * @return `false` if some nodes are on a cycle.
+ */
+static bool graph_sort(Graph *graph, int *order) {
+  int *pending = calloc(graph->node_count, sizeof(int));
+  int sorted = 0;
+  for (int i = 0; i < graph->edge_count; i++)
+    pending[graph->edges[i].to]++;
+  for (int i = 0; i < graph->node_count; i++)
+    if (pending[i] == 0)
+      order[sorted++] = i;
+  for (int next = 0; next < sorted; next++) {
+    for (int i = 0; i < graph->edge_count; i++)
+      if (graph->edges[i].from == order[next] &&
+          --pending[graph->edges[i].to] == 0)
+        order[sorted++] = graph->edges[i].to;
+  }
+  for (int i = 0; i < graph->node_count && sorted < graph->node_count; i++) {
+    if (pending[i] > 0) {
+      log_e("Graph has a cycle through \"%s\"", graph->nodes[i].desc.name);
+      break;
+    }
+  }
+  free(pending);
+  return sorted == graph->node_count;
+}
+
+/** Counts the connections that read an output port. */
+static int graph_readers(const Graph *graph, PortType type, int node,
+                         int port) {
+  int readers = 0;
+  for (int i = 0; i < graph->edge_count; i++)
+    readers += graph->edges[i].type == type && graph->edges[i].from == node &&
+               graph->edges[i].from_port == port;
+  return readers;
+}
+
+/**
+ * @brief Points an input port at the buffer of its source, or at a mix of
+ * its sources.
+ *
+ * @return Pool index of the mix buffer, -1 if there is none, -2 on failure.
+ */
+static int graph_assign_input(Graph *graph, GraphStep *step, PortType type,
+                              int node, int port, void **input) {
+  GraphPool *pool = type == PORT_AUDIO ? &graph->audio : &graph->midi;
+  int count = 0;
+  for (int i = 0; i < graph->edge_count; i++)
+    count += graph->edges[i].type == type && graph->edges[i].to == node &&
+             graph->edges[i].to_port == port;
+  if (count == 0) {
+    *input = type == PORT_AUDIO ? (void *)graph->silence
+                                : (void *)&graph->no_events;
+    return -1;
+  }
+
+  void **sources = malloc(sizeof(void *) * count);
+  if (!sources)
+    return -2;
+  count = 0;
+  for (int i = 0; i < graph->edge_count; i++) {
+    const GraphEdge *edge = &graph->edges[i];
+    if (edge->type != type || edge->to != node || edge->to_port != port)
+      continue;
+    const GraphNode *source = &graph->nodes[edge->from];
+    int index = type == PORT_AUDIO ? source->audio_out_index[edge->from_port]
+                                   : source->midi_out_index[edge->from_port];
+    sources[count++] = pool->buffers[index];
+  }
+  if (count == 1) {
+    *input = sources[0];
+    free(sources);
+    return -1;
+  }
+
+  // The mix buffer is released right after the node, it has one reader
+  int mixed = pool_acquire(graph, type, 1, (int)(step - graph->steps));
+  GraphMix *mixes =
+      realloc(step->mixes, sizeof(GraphMix) * (step->mix_count + 1));
+  if (mixed < 0 || !mixes) {
+    free(sources);
+    return -2;
+  }
+  step->mixes = mixes;
+  *input = pool->buffers[mixed];
+  step->mixes[step->mix_count++] = (GraphMix){type, *input, sources, count};
+  return mixed;
+}
+
+/**
+ * @brief Releases the buffers of the outputs that feed a node, one per edge,
+ * and makes the step wait for the steps of those outputs.
+ */
+static bool graph_release_inputs(Graph *graph, int node, int step,
+                                 const int *position) {
+  for (int i = 0; i < graph->edge_count; i++) {
+    const GraphEdge *edge = &graph->edges[i];
+    if (edge->to != node)
+      continue;
+    const GraphNode *source = &graph->nodes[edge->from];
+    bool released =
+        edge->type == PORT_AUDIO
+            ? pool_release(&graph->audio,
+                           source->audio_out_index[edge->from_port], step)
+            : pool_release(&graph->midi,
+                           source->midi_out_index[edge->from_port], step);
+    if (!released || !graph_depend(graph, position[edge->from], step))
+      return false;
+  }
+  return true;
+}
+
+/** Collects the ancestors of a step from the steps that feed it. */
+static void graph_inherit(Graph *graph, int step, int node,
+                          const int *position) {
+  uint64_t *ancestors = graph->ancestors + (size_t)step * graph->words;
+  for (int i = 0; i < graph->edge_count; i++) {
+    if (graph->edges[i].to != node)
+      continue;
+    int from = position[graph->edges[i].from];
+    const uint64_t *inherited = graph->ancestors + (size_t)from * graph->words;
+    for (int w = 0; w < graph->words; w++)
+      ancestors[w] |= inherited[w];
+    ancestors[from / 64] |= 1ULL << (from % 64);
+  }
+}
+
+/**
+ * @brief Assigns the port buffers of a node in execution order.
+ *
+ * Outputs are acquired before the inputs are released, so a node never
+ * writes into a buffer it reads. Unconnected outputs get a buffer of their
+ * own that is released right away, parallel steps must not share one.
+ */
+static bool graph_assign(Graph *graph, int s, int id, const int *position) {
+  GraphStep *step = &graph->steps[s];
+  GraphNode *node = &graph->nodes[id];
+  const NodeDesc *desc = &node->desc;
+  int audio_mixes[desc->audio_inputs + 1];
+  int midi_mixes[desc->midi_inputs + 1];
+
+  if (graph->ancestors)
+    graph_inherit(graph, s, id, position);
+  for (int p = 0; p < desc->audio_inputs; p++)
+    if ((audio_mixes[p] = graph_assign_input(graph, step, PORT_AUDIO, id, p,
+                                             (void **)&node->audio_in[p])) <
+        -1)
+      return false;
+  for (int p = 0; p < desc->midi_inputs; p++)
+    if ((midi_mixes[p] = graph_assign_input(graph, step, PORT_MIDI, id, p,
+                                            (void **)&node->midi_in[p])) < -1)
+      return false;
+
+  for (int p = 0; p < desc->audio_outputs; p++) {
+    int readers = graph_readers(graph, PORT_AUDIO, id, p);
+    node->audio_out_index[p] =
+        pool_acquire(graph, PORT_AUDIO, readers ? readers : 1, s);
+    if (node->audio_out_index[p] < 0)
+      return false;
+    node->audio_out[p] = graph->audio.buffers[node->audio_out_index[p]];
+  }
+  for (int p = 0; p < desc->midi_outputs; p++) {
+    int readers = graph_readers(graph, PORT_MIDI, id, p);
+    node->midi_out_index[p] =
+        pool_acquire(graph, PORT_MIDI, readers ? readers : 1, s);
+    if (node->midi_out_index[p] < 0)
+      return false;
+    node->midi_out[p] = graph->midi.buffers[node->midi_out_index[p]];
+  }
+
+  bool released = graph_release_inputs(graph, id, s, position);
+  for (int p = 0; p < desc->audio_inputs; p++)
+    if (audio_mixes[p] >= 0)
+      released &= pool_release(&graph->audio, audio_mixes[p], s);
+  for (int p = 0; p < desc->midi_inputs; p++)
+    if (midi_mixes[p] >= 0)
+      released &= pool_release(&graph->midi, midi_mixes[p], s);
+  for (int p = 0; p < desc->audio_outputs; p++)
+    if (!graph_readers(graph, PORT_AUDIO, id, p))
+      released &= pool_release(&graph->audio, node->audio_out_index[p], s);
+  for (int p = 0; p < desc->midi_outputs; p++)
+    if (!graph_readers(graph, PORT_MIDI, id, p))
+      released &= pool_release(&graph->midi, node->midi_out_index[p], s);
+
+  node->context = (NodeContext){
+      .audio_in = (const float *const *)node->audio_in,
+      .audio_out = node->audio_out,
+      .midi_in = (const MidiBuffer *const *)node->midi_in,
+      .midi_out = node->midi_out,
+  };
+  step->node = node;
+  return released;
+}
+
+bool graph_compile(Graph *graph) {
+  Config *cfg = config_get();
+  int workers = cfg->graph_workers < GRAPH_MAX_THREADS
+                    ? (int)cfg->graph_workers
+                    : GRAPH_MAX_THREADS - 1;
+  graph_release(graph);
+  int *order = malloc(sizeof(int) * graph->node_count);
+  int *position = malloc(sizeof(int) * graph->node_count);
+  graph->steps = calloc(graph->node_count, sizeof(GraphStep));
+  graph->deps = calloc(graph->node_count, sizeof(TaskDeps));
+  graph->deps_count = graph->deps ? graph->node_count : 0;
+  graph->step_ns = calloc(graph->node_count, sizeof(int64_t));
+  graph->path_ns = calloc(graph->node_count, sizeof(int64_t));
+  graph->words = (graph->node_count + 63) / 64;
+  graph->ancestors =
+      workers > 0 ? calloc((size_t)graph->node_count * graph->words,
+                           sizeof(uint64_t))
+                  : NULL;
+  bool compiled = order && position && graph->steps && graph->deps &&
+                  graph->step_ns && graph->path_ns &&
+                  (workers == 0 || graph->ancestors) &&
+                  graph_sort(graph, order);
+  for (int i = 0; compiled && i < graph->node_count; i++)
+    position[order[i]] = i;
+  for (int i = 0; compiled && i < graph->node_count; i++) {
+    graph->step_count = i + 1;
+    compiled = graph_assign(graph, i, order[i], position);
+    if (!compiled)
+      log_e("Can not allocate the graph buffers");
+  }
+  free(order);
+  free(position);
+  free(graph->ancestors);
+  graph->ancestors = NULL;
+  if (!compiled) {
+    graph_release(graph);
+    return false;
+  }
+
+  graph->workers =
+      workers > 0 ? workers_create(workers, graph->step_count) : NULL;
+  if (workers > 0 && !graph->workers)
+    log_w("Running the graph on the audio thread only");
+  graph->threads = graph->workers ? workers + 1 : 1;
+  graph->blocks = 0;
+  graph->total_wall = graph->total_work = 0;
+  graph->total_path = graph->max_path = 0;
+  memset(graph->total_busy, 0, sizeof(graph->total_busy));
+  log_d("Graph compiled: %d nodes, %d connections, %d audio and %d MIDI "
+        "buffers, %d threads",
+        graph->node_count, graph->edge_count, graph->audio.count,
+        graph->midi.count, graph->threads);
+  return true;
+}
+
+int graph_buffer_count(const Graph *graph) { return graph->audio.count; }
+
+/** Sums audio sources or merges MIDI sources in time order. */
+static void graph_mix(const GraphMix *mix, unsigned long frames) {
+  if (mix->type == PORT_AUDIO) {
+    float *mixed = mix->mixed;
+    memcpy(mixed, mix->sources[0], sizeof(float) * frames);
+    for (int s = 1; s < mix->count; s++) {
+      const float *source = mix->sources[s];
+      for (unsigned long i = 0; i < frames; i++)
+        mixed[i] += source[i];
+    }
+    return;
+  }
+  MidiBuffer *mixed = mix->mixed;
+  mixed->length = 0;
+  for (int s = 0; s < mix->count; s++) {
+    const MidiBuffer *source = mix->sources[s];
+    for (int i = 0; i < source->length && mixed->length < mixed->capacity;
+         i++) {
+      // Insertion keeps equal timestamps in source order
+      int j = mixed->length++;
+      while (j > 0 &&
+             mixed->events[j - 1].timestamp > source->events[i].timestamp) {
+        mixed->events[j] = mixed->events[j - 1];
+        j--;
+      }
+      mixed->events[j] = source->events[i];
+    }
+  }
+}
+
+/** Runs one step, called by the worker pool with the graph as context. */
+static void graph_step(void *context, int index, int thread) {
+  Graph *graph = context;
+  const GraphStep *step = &graph->steps[index];
+  GraphNode *node = step->node;
+  int64_t start = graph->stats ? monotonic_ns() : 0;
+  for (int m = 0; m < step->mix_count; m++)
+    graph_mix(&step->mixes[m], graph->length);
+  for (int p = 0; p < node->desc.midi_outputs; p++)
+    node->midi_out[p]->length = 0;
+  node->context.frames = graph->length;
+  node->context.scratch = scratch_bind(thread);
+  node->desc.process(&node->context, node->desc.state);
+  if (graph->stats) {
+    int64_t elapsed = monotonic_ns() - start;
+    graph->step_ns[index] = elapsed;
+    graph->busy_ns[thread] += elapsed;
+  }
+}
+
+/** Longest chain of dependent steps in the last pass, in nanoseconds. */
+static int64_t graph_critical_path(Graph *graph) {
+  int64_t longest = 0;
+  memset(graph->path_ns, 0, sizeof(int64_t) * graph->step_count);
+  // Successors always come later in the execution order
+  for (int i = 0; i < graph->step_count; i++) {
+    const TaskDeps *deps = &graph->deps[i];
+    int64_t path = graph->path_ns[i] + graph->step_ns[i];
+    for (int j = 0; j < deps->successor_count; j++)
+      if (graph->path_ns[deps->successors[j]] < path)
+        graph->path_ns[deps->successors[j]] = path;
+    if (path > longest)
+      longest = path;
+  }
+  return longest;
+}
+
+/** Accumulates the profile of a block and publishes it. */
+static void graph_publish(Graph *graph, int64_t wall, int64_t path) {
+  GraphStats *stats = triple_buffer_write(graph->stats);
+  int64_t work = 0;
+  for (int t = 0; t < graph->threads; t++) {
+    work += graph->busy_ns[t];
+    graph->total_busy[t] += graph->busy_ns[t];
+  }
+  graph->blocks++;
+  graph->total_wall += wall;
+  graph->total_work += work;
+  graph->total_path += path;
+  if (path > graph->max_path)
+    graph->max_path = path;
+
+  stats->blocks = graph->blocks;
+  stats->threads = graph->threads;
+  for (int t = 0; t < graph->threads; t++)
+    stats->utilisation[t] =
+        graph->total_wall ? (double)graph->total_busy[t] / graph->total_wall
+                          : 0.0;
+  stats->wall_last = (double)wall / NS_PER_SEC;
+  stats->work_last = (double)work / NS_PER_SEC;
+  stats->critical_path_last = (double)path / NS_PER_SEC;
+  stats->critical_path_max = (double)graph->max_path / NS_PER_SEC;
+  stats->parallelism =
+      graph->total_path ? (double)graph->total_work / graph->total_path : 0.0;
+  triple_buffer_publish(graph->stats);
+}
+
+const MidiBuffer *graph_process(Graph *graph, const void *input, void *output,
+                                unsigned long frames, const PmEvent *events,
+                                int event_count) {
+  int64_t start = 0, path = 0;
+  if (graph->stats) {
+    start = monotonic_ns();
+    memset(graph->busy_ns, 0, sizeof(graph->busy_ns));
+  }
+  graph->input = input;
+  graph->output = output;
+  graph->events = events;
+  graph->event_count = event_count;
+  graph->sent.length = 0;
+  // Blocks longer than the buffers run in several passes
+  for (graph->offset = 0; graph->offset < frames;
+       graph->offset += graph->frames) {
+    graph->length = frames - graph->offset < graph->frames
+                        ? frames - graph->offset
+                        : graph->frames;
+    if (graph->workers) {
+      workers_run(graph->workers, graph->deps, graph->step_count, graph_step,
+                  graph);
+    } else {
+      for (int i = 0; i < graph->step_count; i++)
+        graph_step(graph, i, 0);
+    }
+    if (graph->stats)
+      path += graph_critical_path(graph);
+  }
+  if (graph->stats)
+    graph_publish(graph, monotonic_ns() - start, path);
+  return &graph->sent;
+}
+
+bool graph_get_stats(Graph *graph, GraphStats *stats) {
+  if (!graph->stats)
+    return false;
+  *stats = *(const GraphStats *)triple_buffer_read(graph->stats, NULL);
+  return true;
+}
+
+void graph_print_stats(Graph *graph) {
+  GraphStats s;
+  if (!graph_get_stats(graph, &s)) {
+    printf("Graph stats: profiling is off, set graph_profile\n");
+    return;
+  }
+  printf("Graph stats:\n"
+         "  blocks: \t%llu on %d threads\n"
+         "  last block: \t%.1f us wall, %.1f us work, %.1f us critical path\n"
+         "  critical path: \tmax %.1f us, parallelism %.2f\n",
+         (unsigned long long)s.blocks, s.threads, 1e6 * s.wall_last,
+         1e6 * s.work_last, 1e6 * s.critical_path_last,
+         1e6 * s.critical_path_max, s.parallelism);
+  for (int t = 0; t < s.threads; t++)
+    printf("  thread %d: \t%.2f%% busy\n", t, 100 * s.utilisation[t]);
+}
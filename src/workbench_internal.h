@@ -0,0 +1,642 @@
+/**
+ * @file workbench_internal.h
+ * @brief Declarations shared between the Workbench translation units.
+ *
+ * Nothing in this header is part of the public API. It connects the audio
+ * engine in `workbench_audio.c` with the alternative audio backends that
+ * drive the same callback pipeline without a PortAudio stream.
+ */
+#pragma once
+
+#include "workbench.h"
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * @brief Audio backends selectable with the `audio_backend` config field.
+ */
+typedef enum {
+  AUDIO_BACKEND_PORTAUDIO, /**< Hardware device through PortAudio (default) */
+  AUDIO_BACKEND_OFFLINE,   /**< Faster than realtime render of a WAV file */
+  AUDIO_BACKEND_NULL,      /**< Headless device clocked by a timer thread */
+} AudioBackend;
+
+#define NS_PER_SEC 1000000000LL /**< @brief Nanoseconds in a second. */
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return Nanoseconds since an arbitrary fixed point.
+ */
+static inline int64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return Seconds since an arbitrary fixed point.
+ */
+static inline double monotonic_seconds() {
+  return monotonic_ns() / (double)NS_PER_SEC;
+}
+
+/**
+ * @brief Logs how long a startup phase took and starts timing the next one.
+ *
+ * @param phase Name of the phase that just finished.
+ * @param start `monotonic_ns` at the start of the phase, set to now.
+ */
+static inline void startup_phase(const char *phase, int64_t *start) {
+  int64_t now = monotonic_ns();
+  log_d("Startup: %-20s %8.2f ms", phase, (now - *start) * 1e-6);
+  *start = now;
+}
+
+/**
+ * @name CPU features
+ * Instruction set extensions the SIMD kernels are selected by. Every module
+ * with kernels picks its table from `cpu_features`, so the CPU is queried
+ * once for all of them.
+ * @{ */
+#define CPU_SSE (1u << 0)   /**< @brief SSE, x86 */
+#define CPU_SSE2 (1u << 1)  /**< @brief SSE2, x86 */
+#define CPU_SSSE3 (1u << 2) /**< @brief SSSE3, x86 */
+#define CPU_AVX2 (1u << 3)  /**< @brief AVX2, x86 */
+#define CPU_FMA (1u << 4)   /**< @brief FMA3, x86 */
+#define CPU_NEON (1u << 5)  /**< @brief Advanced SIMD, AArch64 */
+
+/**
+ * @brief Instruction set extensions of the CPU.
+ *
+ * Queried on the first call; later calls only read the result. Safe to call
+ * from any thread, including the audio thread.
+ *
+ * @return A mask of `CPU_*` flags.
+ */
+unsigned cpu_features();
+/** @} */
+
+/**
+ * @brief Prepares the calling thread for real-time work on its first call.
+ *
+ * Sets flush-to-zero and denormals-are-zero, and applies the `rt_priority`
+ * (`SCHED_FIFO`) and `cpu_affinity` config fields. What was granted is
+ * written to a static report once per thread, without any stdio, for
+ * `realtime_report` to log; later calls return at once.
+ *
+ * @param role Name of the thread in the log.
+ */
+void realtime_enter(const char *role);
+
+/**
+ * @brief Sets what `realtime_enter` needs to know about the engine. Called
+ * before the real-time threads start.
+ *
+ * @param offline_render The engine renders offline, flat out, so threads keep
+ * their scheduling policy.
+ */
+void realtime_init(bool offline_render);
+
+/**
+ * @brief Logs the reports of the threads that entered real-time mode since
+ * the last call. Not real-time safe.
+ */
+void realtime_report();
+
+/**
+ * @brief Makes the FPU of the calling thread treat denormals as zero.
+ *
+ * Part of `realtime_enter`, for helper threads that keep their own priority.
+ *
+ * @return `true` if the mode reads back as set.
+ */
+bool realtime_flush_denormals();
+
+/**
+ * @brief Prepares the attributes of a helper thread of the real-time threads.
+ *
+ * Helpers run `SCHED_FIFO` one step below `rt_priority`, so the thread they
+ * serve preempts them on a shared CPU, and they are not pinned to
+ * `cpu_affinity`. Without `rt_priority`, or when rendering offline, they keep
+ * the normal policy.
+ *
+ * @param attr Initialised attributes; destroy them after `pthread_create`.
+ * @return The `SCHED_FIFO` priority set, or 0 for the normal policy.
+ */
+int realtime_helper_attr(pthread_attr_t *attr);
+
+/**
+ * @brief Allocates a scratch arena of `scratch_size` KiB for the audio thread
+ * and for every graph worker.
+ *
+ * @return `false` if the engine memory is exhausted.
+ */
+bool scratch_init();
+
+/**
+ * @brief Frees the scratch arenas.
+ */
+void scratch_deinit();
+
+/**
+ * @brief Makes arena `thread` the one of the calling thread.
+ *
+ * @param thread 0 for the audio thread, else the graph thread number.
+ * @return The arena.
+ */
+ScratchArena *scratch_bind(int thread);
+
+/**
+ * @brief Releases everything allocated during the block and records the use
+ * of the arenas. Called by the audio thread at the end of every block, when
+ * the graph workers are idle.
+ */
+void scratch_finish();
+
+/**
+ * @brief Computes the parameter ramps from frame `offset` of the block on.
+ *
+ * Called by the audio thread once the MIDI events before `offset` are
+ * dispatched. At offset 0 every parameter is advanced by a block; further
+ * in, only parameters with a new target start a new ramp there.
+ *
+ * @param offset First frame of the callback that follows.
+ * @param frames Frames from `offset` to the end of the block.
+ */
+void params_process(unsigned long offset, unsigned long frames);
+
+/**
+ * @brief Frees the parameter table.
+ */
+void params_deinit();
+
+/**
+ * @brief Takes the module for the block that starts. Audio thread only.
+ */
+void module_block_begin();
+
+/**
+ * @brief Tells whether a module processes the current block.
+ */
+bool module_running();
+
+/**
+ * @brief Runs the module of the block on a slice of it. Audio thread only.
+ *
+ * @return `false` if no module is running.
+ */
+bool module_process(const void *input_buffer, void *output_buffer,
+                    unsigned long frames);
+
+/**
+ * @brief Marks the end of the block, releasing the modules swapped out
+ * before it. Audio thread only.
+ */
+void module_block_end();
+
+/**
+ * @brief Destroys the running and the retired modules. The stream must be
+ * stopped.
+ */
+void module_deinit();
+
+/**
+ * @brief Allocates the meters of the output channels and designs their
+ * filters for the sample rate.
+ *
+ * @return `false` if the engine memory is exhausted.
+ */
+bool meter_init();
+
+/**
+ * @brief Frees the meters.
+ */
+void meter_deinit();
+
+/**
+ * @brief Meters a block of engine output and publishes every step it
+ * completes. Audio thread only.
+ *
+ * @param output Float output of the callbacks, planar if `non_interleaved`.
+ */
+void meter_process(const void *output, unsigned long frames);
+
+/**
+ * @brief Allocates a device buffer in the layout selected by
+ * `non_interleaved`.
+ *
+ * Interleaved buffers are a single array of frames. Planar buffers are an
+ * array of channel pointers followed by the channels, each aligned to
+ * `AUDIO_BUFFER_ALIGNMENT`. Either way the buffer is zeroed and released
+ * with `engine_free`.
+ *
+ * @param channels Number of channels.
+ * @param frames Frames per channel.
+ */
+static inline void *device_buffer_alloc(int channels, unsigned long frames) {
+  size_t bytes = sizeof(AudioSample_t) * frames;
+  size_t header = sizeof(AudioSample_t *) * channels;
+  void *buffer;
+  if (!config_get()->non_interleaved)
+    return engine_calloc(channels * frames, sizeof(AudioSample_t));
+  bytes = (bytes + AUDIO_BUFFER_ALIGNMENT - 1) & ~(AUDIO_BUFFER_ALIGNMENT - 1);
+  header =
+      (header + AUDIO_BUFFER_ALIGNMENT - 1) & ~(AUDIO_BUFFER_ALIGNMENT - 1);
+  buffer = engine_alloc(header + bytes * channels);
+  if (!buffer)
+    return NULL;
+  for (int c = 0; c < channels; c++)
+    ((AudioSample_t **)buffer)[c] =
+        (AudioSample_t *)((char *)buffer + header + bytes * c);
+  return buffer;
+}
+
+/**
+ * @brief Addresses one sample of a buffer made by `device_buffer_alloc`.
+ */
+static inline AudioSample_t *device_sample(void *buffer, int channels,
+                                           unsigned long frame, int channel) {
+  if (config_get()->non_interleaved)
+    return ((AudioSample_t **)buffer)[channel] + frame;
+  return (AudioSample_t *)buffer + frame * channels + channel;
+}
+
+/**
+ * @brief Resolves the `audio_backend` config field.
+ *
+ * @return The backend selected in the configuration.
+ */
+AudioBackend audio_backend_get();
+
+/**
+ * @brief First half of `audio_init`: everything up to an open stream.
+ *
+ * Initialises PortAudio, selects the devices and opens the streams, but does
+ * not start calling the engine. It may run while `midi_open` runs on another
+ * thread.
+ */
+void audio_open();
+
+/**
+ * @brief Second half of `audio_init`: starts the backend opened by
+ * `audio_open`. Nothing happens if opening failed or it already runs.
+ */
+void audio_start();
+
+/**
+ * @brief First half of `midi_init`: initialises PortMidi and opens the
+ * devices. It may run while `audio_open` runs on another thread.
+ */
+void midi_open();
+
+/**
+ * @brief Second half of `midi_init`: starts the MIDI I/O thread when the
+ * events go through the audio engine. Nothing happens if opening failed.
+ */
+void midi_start();
+
+/**
+ * @brief The engine callback shared by all audio backends.
+ *
+ * PortAudio calls it directly; the other backends call it with synthetic
+ * timing information.
+ */
+int __audio_callback(const void *input_buffer, void *output_buffer,
+                     unsigned long block_size,
+                     const PaStreamCallbackTimeInfo *time_info,
+                     PaStreamCallbackFlags status_flags, void *user_data);
+
+/**
+ * @brief CPU load reported by PortAudio.
+ *
+ * @return `Pa_GetStreamCpuLoad` of the open stream or a negative value when
+ * the engine is not driven by a PortAudio stream.
+ */
+double audio_cpu_load();
+
+/**
+ * @brief Accounts one engine callback in the statistics.
+ *
+ * Called by the audio thread only.
+ *
+ * @param frames Frames processed by the callback.
+ * @param elapsed Duration of the callback in nanoseconds.
+ * @param flags Status flags passed by the backend.
+ */
+void stats_record(unsigned long frames, int64_t elapsed,
+                  PaStreamCallbackFlags flags);
+
+/**
+ * @brief Current time of the audio stream clock.
+ *
+ * This is the time base of `PaStreamCallbackTimeInfo` for every backend.
+ * Safe to call from any thread.
+ *
+ * @return Stream time in seconds, 0 until `audio_start` has started the
+ * backend.
+ */
+double audio_stream_time();
+
+/**
+ * @name MIDI block interface
+ * The audio thread runs the user MIDI callback through these functions.
+ * Incoming events are taken from the queue filled by the MIDI I/O thread and
+ * outgoing events are handed back to it, so the audio thread only touches
+ * preallocated memory.
+ * @{ */
+/**
+ * @brief Collects the events received since the previous block.
+ *
+ * The timestamps of the collected events are replaced with their frame
+ * offsets in the current block, in non-decreasing order.
+ *
+ * @param time_info Timing of the current block.
+ * @param block_size Frames in the current block.
+ * @return Number of events, or -1 when MIDI is not running.
+ */
+int midi_block_begin(const PaStreamCallbackTimeInfo *time_info,
+                     unsigned long block_size);
+
+/**
+ * @brief Events collected by `midi_block_begin`.
+ */
+const PmEvent *midi_block_events();
+
+/**
+ * @brief Passes a range of the collected events to the user MIDI callback.
+ *
+ * The callback writes after the output of the earlier calls in the block,
+ * with room for `midi_buffer_size - midi_out_length` events. It is skipped
+ * once the output is full.
+ *
+ * @param first Index of the first event.
+ * @param count Number of events.
+ * @param user_data Pointer passed to the MIDI callback.
+ */
+void midi_block_dispatch(int first, int count, void *user_data);
+
+/**
+ * @brief Adds events to the output of the current block.
+ *
+ * @param events Events stamped with frame offsets in the block.
+ * @param count Number of events; what does not fit is dropped.
+ */
+void midi_block_send(const PmEvent *events, int count);
+
+/**
+ * @brief Queues the events produced by the callback for the MIDI I/O thread.
+ */
+void midi_block_end();
+/** @} */
+
+/**
+ * @name Offline backend
+ * @{ */
+/**
+ * @brief Opens the offline input and output files and starts the render
+ * thread.
+ */
+void offline_start();
+
+/**
+ * @brief Interrupts the render if it is still running and waits for it.
+ */
+void offline_stop();
+
+/**
+ * @brief Tells whether the render thread is still producing blocks.
+ */
+bool offline_is_active();
+
+/**
+ * @brief Position of the render in seconds.
+ */
+double offline_stream_time();
+/** @} */
+
+/**
+ * @name Null backend
+ * @{ */
+/**
+ * @brief Starts the thread that calls the engine on a software clock.
+ */
+void null_start();
+
+/**
+ * @brief Stops the clock thread and logs its timing summary.
+ */
+void null_stop();
+
+/**
+ * @brief Tells whether the clock thread is running.
+ */
+bool null_is_active();
+
+/**
+ * @brief Seconds elapsed on the software clock since it started.
+ */
+double null_stream_time();
+/** @} */
+
+/**
+ * @name Fixed quantum
+ * With `device_block_size` set, the PortAudio stream is opened with that
+ * many frames per buffer, or lets the host choose, while the engine keeps
+ * running on blocks of exactly `block_size` frames.
+ * @{ */
+/**
+ * @brief Tells whether device buffers differ from the engine blocks.
+ */
+bool quantum_enabled();
+
+/**
+ * @brief Frames per buffer to open the device stream with.
+ */
+unsigned long quantum_device_frames();
+
+/**
+ * @brief Allocates the FIFOs for the primary stream.
+ *
+ * @param in_channels Input channels of the device stream.
+ * @param out_channels Output channels of the device stream.
+ * @param format Sample format of the device stream.
+ * @return `false` if they can not be allocated.
+ */
+bool quantum_init(int in_channels, int out_channels, PaSampleFormat format);
+
+/**
+ * @brief Frees the FIFOs.
+ */
+void quantum_deinit();
+
+/**
+ * @brief Stream callback that runs `__audio_callback` on whole quanta.
+ */
+int quantum_callback(const void *input_buffer, void *output_buffer,
+                     unsigned long frames,
+                     const PaStreamCallbackTimeInfo *time_info,
+                     PaStreamCallbackFlags status_flags, void *user_data);
+/** @} */
+
+/**
+ * @name Worker pool
+ * Runs a set of tasks with dependencies on the audio thread and a pool of
+ * pre-spawned threads. Every thread owns a work-stealing deque; a finished
+ * task pushes the tasks it unblocks on its own deque, idle threads steal from
+ * the others and sleep on a futex when there is nothing to steal.
+ * @{ */
+/**
+ * @brief Dependencies of one task.
+ */
+typedef struct {
+  int predecessors;    /**< Tasks that must finish first */
+  int *successors;     /**< Tasks that wait for this one */
+  int successor_count; /**< Number of successors */
+} TaskDeps;
+
+/**
+ * @brief Function that runs one task.
+ *
+ * @param context Pointer given to `workers_run`.
+ * @param task Index of the task.
+ * @param thread 0 on the calling thread, 1 to `threads` on the workers.
+ */
+typedef void (*WorkerTask)(void *context, int task, int thread);
+
+typedef struct WorkerPool WorkerPool;
+
+/**
+ * @brief Starts the worker threads.
+ *
+ * The workers ask for the priority of `realtime_helper_attr` and keep the
+ * default policy if it is not granted.
+ *
+ * @param threads Number of threads besides the calling thread.
+ * @param capacity Largest number of tasks passed to `workers_run`.
+ * @return A new pool, or `NULL` if the threads can not be started.
+ */
+WorkerPool *workers_create(int threads, int capacity);
+
+/**
+ * @brief Stops and joins the worker threads.
+ */
+void workers_destroy(WorkerPool *pool);
+
+/**
+ * @brief Runs tasks in an order that respects their dependencies.
+ *
+ * The calling thread takes part and returns when every task has finished.
+ * Nothing is allocated. Must not be called from two threads at once.
+ *
+ * @param pool Pool to run on.
+ * @param deps Dependencies of each task.
+ * @param count Number of tasks, at most the `capacity` of the pool.
+ * @param task Function called for each task.
+ * @param context Pointer passed to `task`.
+ */
+void workers_run(WorkerPool *pool, const TaskDeps *deps, int count,
+                 WorkerTask task, void *context);
+
+/**
+ * @brief Sleeps while `*word` equals `expected`, or until woken.
+ *
+ * May return early; callers check the word again.
+ */
+void futex_wait(atomic_uint *word, unsigned expected);
+
+/**
+ * @brief Wakes every thread sleeping in `futex_wait` on `word`.
+ */
+void futex_wake(atomic_uint *word);
+/** @} */
+
+/**
+ * @name Secondary devices
+ * Extra PortAudio streams for `secondary_input` and `secondary_output`. Each
+ * runs on its own device clock and exchanges frames with the engine through
+ * an `SpscRing`. On the audio thread, a control loop keeps every ring at its
+ * target fill by steering the ratio of a `Resampler`; the integral term of
+ * the loop is the drift of the device clock against the primary one.
+ * @{ */
+/**
+ * @brief Finds a PortAudio device by name.
+ *
+ * @param name Exact device name.
+ * @param input Look at the input side of the device, else the output side.
+ * @param channels Channels the device must offer on that side.
+ * @return The device index, or `paNoDevice`.
+ */
+PaDeviceIndex audio_device_find(const char *name, bool input, int channels);
+
+/**
+ * @brief Fills the parameters of one direction of a PortAudio stream.
+ */
+void stream_configure(PaStreamParameters *stream_parameters, int device_idx,
+                      int channel_count, unsigned long sample_format,
+                      double suggested_latency);
+
+/**
+ * @brief Engine input channels taken from `secondary_input`, the last ones.
+ */
+int secondary_in_channels();
+
+/**
+ * @brief Engine output channels sent to `secondary_output`, the last ones.
+ */
+int secondary_out_channels();
+
+/**
+ * @brief Opens the configured secondary streams. PortAudio must be running.
+ */
+void secondary_open();
+
+/**
+ * @brief Starts the secondary streams, before the primary one.
+ */
+void secondary_start();
+
+/**
+ * @brief Stops and closes the secondary streams.
+ */
+void secondary_close();
+
+/**
+ * @brief Writes the secondary input channels of one block. Audio thread only.
+ *
+ * Channel `c` of frame `i` goes to `first[c * channel_step + i * frame_step]`.
+ * Silence is written while the device is not delivering.
+ */
+void secondary_capture(float *first, size_t channel_step, size_t frame_step,
+                       unsigned long frames);
+
+/**
+ * @brief Sends the secondary output channels of one block. Audio thread only.
+ *
+ * Channel `c` of frame `i` is read from
+ * `first[c * channel_step + i * frame_step]`.
+ */
+void secondary_play(const float *first, size_t channel_step,
+                    size_t frame_step, unsigned long frames);
+
+/**
+ * @brief Hands the state of a secondary device to the next `stats_record`.
+ *
+ * @param device `STATS_SECONDARY_INPUT` or `STATS_SECONDARY_OUTPUT`.
+ * @param drift_ppm Drift of the device clock in parts per million.
+ * @param xruns Frames lost so far by the device ring.
+ * @param device_xruns Device callbacks flagged with an xrun so far.
+ */
+void stats_record_secondary(int device, double drift_ppm, uint64_t xruns,
+                            uint64_t device_xruns);
+
+/**
+ * @brief Hands the scratch use of a block to the next `stats_record`.
+ *
+ * @param used Bytes taken from the fullest arena.
+ * @param failures Allocations that did not fit.
+ */
+void stats_record_scratch(size_t used, uint64_t failures);
+/** @} */
@@ -0,0 +1,323 @@
+#include "workbench_internal.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** Pool size in MiB when `memory_pool_size` is not set */
+#ifndef ENGINE_POOL_MIB
+#define ENGINE_POOL_MIB 64
+#endif
+
+/** Granule in which the pool is locked and faulted in, one huge page */
+#define ENGINE_HUGE_PAGE (2u << 20)
+
+/**
+ * @brief Header in front of every block.
+ */
+typedef struct Block {
+  size_t size;        /**< Bytes of the block, header included */
+  struct Block *next; /**< Next free block by address */
+  bool pooled;        /**< Carved out of the pool, else `posix_memalign` */
+} Block;
+
+#define ENGINE_HEADER                                                          \
+  ((sizeof(Block) + ENGINE_ALIGNMENT - 1) & ~(size_t)(ENGINE_ALIGNMENT - 1))
+
+_Static_assert(AUDIO_BUFFER_ALIGNMENT <= ENGINE_ALIGNMENT,
+               "Engine blocks must be aligned for audio buffers");
+
+/**
+ * @brief The pool. It is reserved by the first allocation and never
+ * unmapped.
+ *
+ * Blocks are taken first-fit from the free list, which is kept in address
+ * order so neighbours merge, and otherwise from `top`. Everything below
+ * `prepared` has been locked and written, so blocks handed out never fault.
+ */
+static struct {
+  pthread_mutex_t lock;
+  char *base;        /**< Start of the pool, `NULL` if there is none */
+  size_t size;       /**< Bytes in the pool */
+  size_t top;        /**< End of the part of the pool handed out so far */
+  size_t prepared;   /**< Bytes locked and faulted in from the start */
+  Block *free;       /**< Free blocks below `top` */
+  size_t used;       /**< Bytes in blocks handed out */
+  size_t peak;       /**< Largest `used` */
+  size_t outside;    /**< Bytes in blocks outside the pool */
+  bool created;      /**< Creating the pool was attempted */
+  bool locked;       /**< Every `mlock` succeeded */
+  const char *pages; /**< Kind of pages backing the pool */
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .locked = true, .pages = "base"};
+
+static size_t round_up(size_t value, size_t granule) {
+  return (value + granule - 1) / granule * granule;
+}
+
+/**
+ * @brief Tells whether transparent huge pages may back an advised mapping.
+ */
+static bool thp_available() {
+  FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (!file)
+    return false;
+  char line[128] = "";
+  bool available = fgets(line, sizeof(line), file) && !strstr(line, "[never]");
+  fclose(file);
+  return available;
+}
+
+/**
+ * @brief Reserves the address space of the pool.
+ *
+ * Explicit huge pages are used if enough of them are reserved in the system;
+ * otherwise the pool is aligned to a huge page and advised for transparent
+ * huge pages.
+ */
+static void pool_create() {
+  pool.created = true;
+  uint32_t mib = config_get()->memory_pool_size;
+  size_t size = (size_t)(mib ? mib : ENGINE_POOL_MIB) << 20;
+  size = round_up(size, ENGINE_HUGE_PAGE);
+  void *base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (base != MAP_FAILED)
+    pool.pages = "hugetlb";
+#endif
+  if (base == MAP_FAILED) {
+    char *mapping = mmap(NULL, size + ENGINE_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      log_e("Can not reserve the engine memory pool of %zu MiB", size >> 20);
+      return;
+    }
+    base = (void *)round_up((uintptr_t)mapping, ENGINE_HUGE_PAGE);
+#ifdef MADV_HUGEPAGE
+    if (madvise(base, size, MADV_HUGEPAGE) == 0 && thp_available())
+      pool.pages = "thp";
+#endif
+  }
+  pool.base = base;
+  pool.size = size;
+}
+
+/**
+ * @brief Locks and writes the pool up to at least `end`.
+ */
+static void pool_prepare(size_t end) {
+  if (end <= pool.prepared)
+    return;
+  end = round_up(end, ENGINE_HUGE_PAGE);
+  if (end > pool.size)
+    end = pool.size;
+  char *from = pool.base + pool.prepared;
+  size_t length = end - pool.prepared;
+  if (mlock(from, length) != 0)
+    pool.locked = false;
+  size_t page = sysconf(_SC_PAGESIZE);
+  for (size_t i = 0; i < length; i += page)
+    ((volatile char *)from)[i] = 0;
+  pool.prepared = end;
+}
+
+/**
+ * @brief Takes a block from the free list or the top of the pool.
+ */
+static Block *pool_take(size_t size) {
+  for (Block **link = &pool.free; *link; link = &(*link)->next) {
+    Block *block = *link;
+    if (block->size < size)
+      continue;
+    if (block->size - size >= ENGINE_HEADER + ENGINE_ALIGNMENT) {
+      // Keep the rest free in place of the block
+      Block *rest = (Block *)((char *)block + size);
+      *rest = (Block){block->size - size, block->next, true};
+      *link = rest;
+      block->size = size;
+    } else {
+      *link = block->next;
+    }
+    return block;
+  }
+  if (!pool.base || size > pool.size - pool.top)
+    return NULL;
+  Block *block = (Block *)(pool.base + pool.top);
+  pool.top += size;
+  pool_prepare(pool.top);
+  *block = (Block){size, NULL, true};
+  return block;
+}
+
+/**
+ * @brief Puts a block back on the free list and merges its neighbours.
+ */
+static void pool_give(Block *block) {
+  Block **link = &pool.free, *previous = NULL;
+  while (*link && *link < block) {
+    previous = *link;
+    link = &(*link)->next;
+  }
+  block->next = *link;
+  *link = block;
+  if (block->next && (char *)block + block->size == (char *)block->next) {
+    block->size += block->next->size;
+    block->next = block->next->next;
+  }
+  if (previous && (char *)previous + previous->size == (char *)block) {
+    previous->size += block->size;
+    previous->next = block->next;
+  }
+  // A free block at the top goes back to the unused part of the pool
+  for (link = &pool.free; *link && (*link)->next; link = &(*link)->next)
+    ;
+  if (*link && (char *)*link + (*link)->size == pool.base + pool.top) {
+    pool.top -= (*link)->size;
+    *link = NULL;
+  }
+}
+
+/**
+ * @brief Allocates a block outside the pool and makes it resident.
+ */
+static Block *outside_take(size_t size) {
+  Block *block;
+  if (posix_memalign((void **)&block, ENGINE_ALIGNMENT, size) != 0)
+    return NULL;
+  bool locked = mlock(block, size) == 0;
+  memset(block, 0, size);
+  *block = (Block){size, NULL, false};
+  pthread_mutex_lock(&pool.lock);
+  if (pool.outside == 0)
+    log_w("The engine memory pool of %zu MiB is full, raise "
+          "memory_pool_size",
+          pool.size >> 20);
+  pool.locked &= locked;
+  pool.outside += size;
+  pthread_mutex_unlock(&pool.lock);
+  return block;
+}
+
+void *engine_alloc(size_t bytes) {
+  size_t size = ENGINE_HEADER + round_up(bytes, ENGINE_ALIGNMENT);
+  if (size < bytes)
+    return NULL;
+  pthread_mutex_lock(&pool.lock);
+  if (!pool.created)
+    pool_create();
+  Block *block = pool_take(size);
+  if (block) {
+    pool.used += block->size;
+    if (pool.used > pool.peak)
+      pool.peak = pool.used;
+  }
+  pthread_mutex_unlock(&pool.lock);
+  if (!block)
+    block = outside_take(size);
+  if (!block)
+    return NULL;
+  // Blocks from the pool may hold what an earlier owner left
+  char *data = (char *)block + ENGINE_HEADER;
+  if (block->pooled)
+    memset(data, 0, block->size - ENGINE_HEADER);
+  return data;
+}
+
+void *engine_calloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size)
+    return NULL;
+  return engine_alloc(count * size);
+}
+
+void engine_free(void *data) {
+  if (!data)
+    return;
+  Block *block = (Block *)((char *)data - ENGINE_HEADER);
+  pthread_mutex_lock(&pool.lock);
+  if (block->pooled) {
+    pool.used -= block->size;
+    pool_give(block);
+    pthread_mutex_unlock(&pool.lock);
+    return;
+  }
+  pool.outside -= block->size;
+  pthread_mutex_unlock(&pool.lock);
+  munlock(block, block->size);
+  free(block);
+}
+
+/**
+ * @brief Counts the resident and huge page backed bytes of the pool.
+ */
+static void pool_residency(EngineMemoryStats *stats) {
+  stats->resident_bytes = stats->prepared_bytes;
+  stats->huge_bytes =
+      strcmp(pool.pages, "hugetlb") == 0 ? stats->prepared_bytes : 0;
+#ifdef __linux__
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t pages = stats->prepared_bytes / page;
+  unsigned char *residency = malloc(pages ? pages : 1);
+  if (residency && mincore(pool.base, stats->prepared_bytes, residency) == 0) {
+    stats->resident_bytes = 0;
+    for (size_t i = 0; i < pages; i++)
+      stats->resident_bytes += (residency[i] & 1) ? page : 0;
+  }
+  free(residency);
+  if (strcmp(pool.pages, "thp") != 0)
+    return;
+  // The kernel counts transparent huge pages per mapping
+  FILE *smaps = fopen("/proc/self/smaps", "r");
+  if (!smaps)
+    return;
+  char line[256];
+  bool inside = false;
+  while (fgets(line, sizeof(line), smaps)) {
+    unsigned long start, end, kib;
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+      inside = start <= (uintptr_t)pool.base && (uintptr_t)pool.base < end;
+    else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kib) == 1)
+      stats->huge_bytes = (size_t)kib << 10;
+  }
+  fclose(smaps);
+#endif
+}
+
+void engine_memory_stats(EngineMemoryStats *stats) {
+  pthread_mutex_lock(&pool.lock);
+  *stats = (EngineMemoryStats){
+      .pool_bytes = pool.size,
+      .used_bytes = pool.used,
+      .peak_bytes = pool.peak,
+      .prepared_bytes = pool.prepared,
+      .outside_bytes = pool.outside,
+      .locked = pool.locked,
+      .pages = pool.pages,
+  };
+  if (pool.base)
+    pool_residency(stats);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+void engine_memory_report() {
+  EngineMemoryStats stats;
+  // Report the pool even if nothing was allocated yet
+  pthread_mutex_lock(&pool.lock);
+  if (!pool.created)
+    pool_create();
+  pthread_mutex_unlock(&pool.lock);
+  engine_memory_stats(&stats);
+  log_i("Engine memory: %zu KiB used of a %zu MiB pool on %s pages, "
+        "%zu KiB prefaulted, %zu KiB resident, %zu KiB on huge pages",
+        stats.used_bytes >> 10, stats.pool_bytes >> 20, stats.pages,
+        stats.prepared_bytes >> 10, stats.resident_bytes >> 10,
+        stats.huge_bytes >> 10);
+  if (stats.outside_bytes) {
+    log_w("Engine memory: %zu KiB outside the pool",
+          stats.outside_bytes >> 10);
+  }
+  if (!stats.locked) {
+    log_w("Engine memory is not locked, the memlock limit (ulimit -l) must "
+          "allow %zu KiB",
+          (stats.prepared_bytes + stats.outside_bytes) >> 10);
+  }
+}
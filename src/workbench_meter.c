@@ -0,0 +1,520 @@
+#include "workbench_internal.h"
+#include <math.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define METER_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define METER_NEON 1
+#endif
+
+/** Length of a metering step in seconds */
+#define METER_STEP 0.1
+/** Steps in the momentary and short-term windows */
+#define MOMENTARY_STEPS 4
+#define SHORT_TERM_STEPS 30
+
+/** Upsampling factor and taps per phase of the true-peak filter */
+#define TRUE_PEAK_PHASES 4
+#define TRUE_PEAK_TAPS 12
+/** Samples before a block the true-peak filter reads */
+#define TRUE_PEAK_HISTORY (TRUE_PEAK_TAPS - 1)
+
+/** Offset of the loudness scale, ITU-R BS.1770 */
+#define LOUDNESS_OFFSET -0.691
+
+typedef void (*PeakPower)(const float *, size_t, float *, float *);
+typedef float (*TruePeak)(const float *, size_t, const float *);
+
+/**
+ * @brief One implementation of every metering kernel.
+ *
+ * `peak_power` returns the largest magnitude and the sum of squares of
+ * `count` samples. `true_peak` returns the largest magnitude of the 4x
+ * upsampled signal and reads `TRUE_PEAK_HISTORY` samples before `x`; the
+ * taps are stored phase by phase.
+ */
+typedef struct {
+  const char *isa;
+  PeakPower peak_power;
+  TruePeak true_peak;
+} MeterKernels;
+
+static void peak_power_scalar(const float *x, size_t count, float *peak,
+                              float *power) {
+  float m = 0, s = 0;
+  for (size_t i = 0; i < count; i++) {
+    m = fmaxf(m, fabsf(x[i]));
+    s += x[i] * x[i];
+  }
+  *peak = m;
+  *power = s;
+}
+
+static float true_peak_scalar(const float *x, size_t count,
+                              const float *taps) {
+  float m = 0;
+  for (size_t n = 0; n < count; n++)
+    for (int p = 0; p < TRUE_PEAK_PHASES; p++) {
+      const float *h = taps + p * TRUE_PEAK_TAPS;
+      float y = 0;
+      for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+        y += h[k] * x[(ptrdiff_t)n - k];
+      m = fmaxf(m, fabsf(y));
+    }
+  return m;
+}
+
+static const MeterKernels scalar_kernels = {
+    .isa = "scalar",
+    .peak_power = peak_power_scalar,
+    .true_peak = true_peak_scalar,
+};
+
+#if defined(METER_X86)
+__attribute__((target("sse"))) static float hmax_sse(__m128 v) {
+  v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse"))) static float hsum_sse(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse"))) static void
+peak_power_sse(const float *x, size_t count, float *peak, float *power) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 m = _mm_setzero_ps(), s = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps(x + i);
+    m = _mm_max_ps(m, _mm_andnot_ps(sign, v));
+    s = _mm_add_ps(s, _mm_mul_ps(v, v));
+  }
+  peak_power_scalar(x + i, count - i, peak, power);
+  *peak = fmaxf(*peak, hmax_sse(m));
+  *power += hsum_sse(s);
+}
+
+__attribute__((target("sse"))) static float
+true_peak_sse(const float *x, size_t count, const float *taps) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 m = _mm_setzero_ps();
+  size_t n = 0;
+  // Four outputs of one phase at a time
+  for (; n + 4 <= count; n += 4)
+    for (int p = 0; p < TRUE_PEAK_PHASES; p++) {
+      const float *h = taps + p * TRUE_PEAK_TAPS;
+      __m128 y = _mm_setzero_ps();
+      for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+        y = _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(h[k]),
+                                     _mm_loadu_ps(x + n - k)));
+      m = _mm_max_ps(m, _mm_andnot_ps(sign, y));
+    }
+  return fmaxf(hmax_sse(m), true_peak_scalar(x + n, count - n, taps));
+}
+
+static const MeterKernels sse_kernels = {
+    .isa = "sse",
+    .peak_power = peak_power_sse,
+    .true_peak = true_peak_sse,
+};
+
+__attribute__((target("avx2"))) static __m128 fold_avx2(__m256 v, bool max) {
+  __m128 lo = _mm256_castps256_ps128(v), hi = _mm256_extractf128_ps(v, 1);
+  return max ? _mm_max_ps(lo, hi) : _mm_add_ps(lo, hi);
+}
+
+__attribute__((target("avx2"))) static void
+peak_power_avx2(const float *x, size_t count, float *peak, float *power) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 m = _mm256_setzero_ps(), s = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_loadu_ps(x + i);
+    m = _mm256_max_ps(m, _mm256_andnot_ps(sign, v));
+    s = _mm256_add_ps(s, _mm256_mul_ps(v, v));
+  }
+  peak_power_scalar(x + i, count - i, peak, power);
+  *peak = fmaxf(*peak, hmax_sse(fold_avx2(m, true)));
+  *power += hsum_sse(fold_avx2(s, false));
+}
+
+__attribute__((target("avx2"))) static float
+true_peak_avx2(const float *x, size_t count, const float *taps) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 m = _mm256_setzero_ps();
+  size_t n = 0;
+  // Eight outputs of one phase at a time
+  for (; n + 8 <= count; n += 8)
+    for (int p = 0; p < TRUE_PEAK_PHASES; p++) {
+      const float *h = taps + p * TRUE_PEAK_TAPS;
+      __m256 y = _mm256_setzero_ps();
+      for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+        y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_broadcast_ss(h + k),
+                                           _mm256_loadu_ps(x + n - k)));
+      m = _mm256_max_ps(m, _mm256_andnot_ps(sign, y));
+    }
+  return fmaxf(hmax_sse(fold_avx2(m, true)),
+               true_peak_scalar(x + n, count - n, taps));
+}
+
+static const MeterKernels avx2_kernels = {
+    .isa = "avx2",
+    .peak_power = peak_power_avx2,
+    .true_peak = true_peak_avx2,
+};
+#elif defined(METER_NEON)
+static void peak_power_neon(const float *x, size_t count, float *peak,
+                            float *power) {
+  float32x4_t m = vdupq_n_f32(0.0f), s = vdupq_n_f32(0.0f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    float32x4_t v = vld1q_f32(x + i);
+    m = vmaxq_f32(m, vabsq_f32(v));
+    s = vmlaq_f32(s, v, v);
+  }
+  peak_power_scalar(x + i, count - i, peak, power);
+  *peak = fmaxf(*peak, vmaxvq_f32(m));
+  *power += vaddvq_f32(s);
+}
+
+static float true_peak_neon(const float *x, size_t count, const float *taps) {
+  float32x4_t m = vdupq_n_f32(0.0f);
+  size_t n = 0;
+  for (; n + 4 <= count; n += 4)
+    for (int p = 0; p < TRUE_PEAK_PHASES; p++) {
+      const float *h = taps + p * TRUE_PEAK_TAPS;
+      float32x4_t y = vdupq_n_f32(0.0f);
+      for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+        y = vmlaq_n_f32(y, vld1q_f32(x + n - k), h[k]);
+      m = vmaxq_f32(m, vabsq_f32(y));
+    }
+  return fmaxf(vmaxvq_f32(m), true_peak_scalar(x + n, count - n, taps));
+}
+
+static const MeterKernels neon_kernels = {
+    .isa = "neon",
+    .peak_power = peak_power_neon,
+    .true_peak = true_peak_neon,
+};
+#endif
+
+static inline const MeterKernels *kernels_get() {
+#if defined(METER_X86)
+  unsigned cpu = cpu_features();
+  if (cpu & CPU_AVX2)
+    return &avx2_kernels;
+  if (cpu & CPU_SSE)
+    return &sse_kernels;
+#elif defined(METER_NEON)
+  if (cpu_features() & CPU_NEON)
+    return &neon_kernels;
+#endif
+  return &scalar_kernels;
+}
+
+const char *meter_isa() { return kernels_get()->isa; }
+
+/**
+ * @brief Biquad in transposed direct form II.
+ */
+typedef struct {
+  double b0, b1, b2, a1, a2;
+} Biquad;
+
+/**
+ * @brief State of one metered channel.
+ */
+typedef struct {
+  double z[2][2];                     /**< State of the K-weighting stages */
+  float history[TRUE_PEAK_HISTORY];   /**< Last samples of the last block */
+  float weight;                       /**< Loudness weight of the channel */
+  float peak, true_peak;              /**< Maxima of the step */
+  float peak_max, true_peak_max;      /**< Maxima since the reset */
+  double power;                       /**< Sum of squares of the step */
+  double weighted;                    /**< Same, K-weighted */
+} MeterChannel;
+
+/**
+ * @brief The meters. Everything but `snapshots` and `reset` belongs to the
+ * audio thread.
+ */
+static struct {
+  int channels;                  /**< Channels metered, 0 when off */
+  MeterChannel *channel;         /**< State of each channel */
+  float *work;                   /**< History and samples of a channel */
+  float *weighted;               /**< K-weighted samples of a channel */
+  unsigned long capacity;        /**< Frames of `work` after the history */
+  unsigned long step;            /**< Frames of a step */
+  unsigned long fill;            /**< Frames of the current step so far */
+  Biquad stage[2];               /**< K-weighting: shelf, then high-pass */
+  double loudness[SHORT_TERM_STEPS]; /**< Weighted power of the last steps */
+  uint64_t steps;                /**< Steps finished */
+  double momentary_max;          /**< Largest momentary power */
+  _Alignas(CACHE_LINE) float taps[TRUE_PEAK_PHASES * TRUE_PEAK_TAPS];
+  TripleBuffer snapshots;        /**< `MeterSnapshot`s for the readers */
+  atomic_bool reset;             /**< Maxima to clear at the next step */
+} meter = {0};
+
+/**
+ * @brief Designs the K-weighting filter for the sample rate, ITU-R BS.1770.
+ *
+ * The shelf and high-pass are given by their analogue prototypes, so the
+ * filter matches the published 48 kHz coefficients at any rate.
+ */
+static void meter_k_weighting(double rate) {
+  double k = tan(M_PI * 1681.974450955533 / rate);
+  double q = 0.7071752369554196;
+  double vh = pow(10.0, 3.999843853973347 / 20.0);
+  double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+  meter.stage[0] = (Biquad){
+      .b0 = (vh + vb * k / q + k * k) / a0,
+      .b1 = 2.0 * (k * k - vh) / a0,
+      .b2 = (vh - vb * k / q + k * k) / a0,
+      .a1 = 2.0 * (k * k - 1.0) / a0,
+      .a2 = (1.0 - k / q + k * k) / a0,
+  };
+  k = tan(M_PI * 38.13547087602444 / rate);
+  q = 0.5003270373238773;
+  a0 = 1.0 + k / q + k * k;
+  meter.stage[1] = (Biquad){
+      .b0 = 1.0,
+      .b1 = -2.0,
+      .b2 = 1.0,
+      .a1 = 2.0 * (k * k - 1.0) / a0,
+      .a2 = (1.0 - k / q + k * k) / a0,
+  };
+}
+
+/**
+ * @brief Designs the 4x upsampling filter, a Kaiser windowed sinc split into
+ * its phases, each normalised to unity gain at DC.
+ */
+static void meter_true_peak_filter() {
+  const int length = TRUE_PEAK_PHASES * TRUE_PEAK_TAPS;
+  const double beta = 6.0, centre = (length - 1) / 2.0;
+  double i0_beta = 1.0, term = 1.0;
+  for (int n = 1; n < 30; n++) {
+    term *= (beta / 2 / n) * (beta / 2 / n);
+    i0_beta += term;
+  }
+  for (int p = 0; p < TRUE_PEAK_PHASES; p++) {
+    double sum = 0;
+    double h[TRUE_PEAK_TAPS];
+    for (int k = 0; k < TRUE_PEAK_TAPS; k++) {
+      double t = (k * TRUE_PEAK_PHASES + p - centre) / TRUE_PEAK_PHASES;
+      double r = (k * TRUE_PEAK_PHASES + p - centre) / (centre + 1);
+      double arg = beta * sqrt(fmax(0.0, 1.0 - r * r)), i0 = 1.0;
+      term = 1.0;
+      for (int n = 1; n < 30; n++) {
+        term *= (arg / 2 / n) * (arg / 2 / n);
+        i0 += term;
+      }
+      h[k] = (t == 0 ? 1.0 : sin(M_PI * t) / (M_PI * t)) * i0 / i0_beta;
+      sum += h[k];
+    }
+    for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+      meter.taps[p * TRUE_PEAK_TAPS + k] = (float)(h[k] / sum);
+  }
+}
+
+bool meter_init() {
+  Config *cfg = config_get();
+  int channels = cfg->out_channel_count;
+  meter_deinit();
+  if (channels > METER_MAX_CHANNELS)
+    channels = METER_MAX_CHANNELS;
+  if (channels <= 0)
+    return true;
+  meter.capacity = cfg->block_size;
+  meter.channel = engine_calloc(channels, sizeof(MeterChannel));
+  meter.work = engine_calloc(TRUE_PEAK_HISTORY + meter.capacity, sizeof(float));
+  meter.weighted = engine_calloc(meter.capacity, sizeof(float));
+  if (!meter.channel || !meter.work || !meter.weighted ||
+      !triple_buffer_init(&meter.snapshots, sizeof(MeterSnapshot))) {
+    log_e("Can not allocate the meters");
+    meter_deinit();
+    return false;
+  }
+  meter.step = (unsigned long)lround(METER_STEP * cfg->sample_rate);
+  for (int c = 0; c < channels; c++) {
+    // 5.1 in the order L R C LFE Ls Rs
+    bool surround = channels == 6 && c >= 4;
+    meter.channel[c].weight = channels == 6 && c == 3 ? 0.0f
+                              : surround              ? 1.41f
+                                                      : 1.0f;
+  }
+  meter_k_weighting(cfg->sample_rate);
+  meter_true_peak_filter();
+  meter.channels = channels;
+  log_i("Metering %d channels with %s kernels", channels, meter_isa());
+  return true;
+}
+
+void meter_deinit() {
+  engine_free(meter.channel);
+  engine_free(meter.work);
+  engine_free(meter.weighted);
+  triple_buffer_free(&meter.snapshots);
+  memset(&meter, 0, sizeof(meter));
+}
+
+/**
+ * @brief Runs the K-weighting filter over a channel.
+ */
+static void meter_weight(MeterChannel *channel, const float *x, float *y,
+                         unsigned long frames) {
+  const Biquad *s = meter.stage, *t = meter.stage + 1;
+  double (*z)[2] = channel->z;
+  for (unsigned long i = 0; i < frames; i++) {
+    double u = s->b0 * x[i] + z[0][0];
+    z[0][0] = s->b1 * x[i] - s->a1 * u + z[0][1];
+    z[0][1] = s->b2 * x[i] - s->a2 * u;
+    double v = t->b0 * u + z[1][0];
+    z[1][0] = t->b1 * u - t->a1 * v + z[1][1];
+    z[1][1] = t->b2 * u - t->a2 * v;
+    y[i] = (float)v;
+  }
+}
+
+static double meter_lufs(double power) {
+  return power > 0 ? fmax(LOUDNESS_OFFSET + 10.0 * log10(power),
+                          METER_FLOOR_DB)
+                   : METER_FLOOR_DB;
+}
+
+/** Mean weighted power of the last `steps` steps. */
+static double meter_window(int steps) {
+  if ((uint64_t)steps > meter.steps)
+    steps = (int)meter.steps;
+  double sum = 0;
+  for (int i = 1; i <= steps; i++)
+    sum += meter.loudness[(meter.steps - i) % SHORT_TERM_STEPS];
+  return steps ? sum / steps : 0;
+}
+
+/**
+ * @brief Closes a step and publishes the meters.
+ */
+static void meter_publish() {
+  bool reset = atomic_exchange_explicit(&meter.reset, false,
+                                        memory_order_acquire);
+  double power = 0;
+  for (int c = 0; c < meter.channels; c++)
+    power += meter.channel[c].weight * meter.channel[c].weighted / meter.step;
+  meter.loudness[meter.steps % SHORT_TERM_STEPS] = power;
+  meter.steps++;
+  double momentary = meter_window(MOMENTARY_STEPS);
+  if (reset)
+    meter.momentary_max = 0;
+  if (momentary > meter.momentary_max)
+    meter.momentary_max = momentary;
+
+  MeterSnapshot *snapshot = triple_buffer_write(&meter.snapshots);
+  snapshot->steps = meter.steps;
+  snapshot->channels = meter.channels;
+  for (int c = 0; c < meter.channels; c++) {
+    MeterChannel *channel = &meter.channel[c];
+    if (reset)
+      channel->peak_max = channel->true_peak_max = 0;
+    channel->peak_max = fmaxf(channel->peak_max, channel->peak);
+    channel->true_peak_max = fmaxf(channel->true_peak_max, channel->true_peak);
+    snapshot->peak[c] = channel->peak;
+    snapshot->rms[c] = (float)sqrt(channel->power / meter.step);
+    snapshot->true_peak[c] = channel->true_peak;
+    snapshot->peak_max[c] = channel->peak_max;
+    snapshot->true_peak_max[c] = channel->true_peak_max;
+    channel->peak = channel->true_peak = 0;
+    channel->power = channel->weighted = 0;
+  }
+  snapshot->momentary = meter_lufs(momentary);
+  snapshot->short_term = meter_lufs(meter_window(SHORT_TERM_STEPS));
+  snapshot->momentary_max = meter_lufs(meter.momentary_max);
+  triple_buffer_publish(&meter.snapshots);
+}
+
+void meter_process(const void *output, unsigned long frames) {
+  Config *cfg = config_get();
+  const MeterKernels *k = kernels_get();
+  float *x = meter.work + TRUE_PEAK_HISTORY;
+  unsigned long position = 0;
+  if (!meter.channels || !output)
+    return;
+
+  while (position < frames) {
+    unsigned long count = frames - position;
+    if (count > meter.capacity)
+      count = meter.capacity;
+    if (count > meter.step - meter.fill)
+      count = meter.step - meter.fill;
+    for (int c = 0; c < meter.channels; c++) {
+      MeterChannel *channel = &meter.channel[c];
+      if (cfg->non_interleaved) {
+        memcpy(x, ((const float *const *)output)[c] + position,
+               sizeof(float) * count);
+      } else {
+        const float *frame = (const float *)output +
+                             position * cfg->out_channel_count + c;
+        for (unsigned long i = 0; i < count; i++)
+          x[i] = frame[i * cfg->out_channel_count];
+      }
+      memcpy(meter.work, channel->history, sizeof(channel->history));
+      float peak, power, weighted_peak, weighted;
+      k->peak_power(x, count, &peak, &power);
+      float true_peak = k->true_peak(x, count, meter.taps);
+      meter_weight(channel, x, meter.weighted, count);
+      k->peak_power(meter.weighted, count, &weighted_peak, &weighted);
+      memcpy(channel->history, meter.work + count, sizeof(channel->history));
+      channel->peak = fmaxf(channel->peak, peak);
+      channel->true_peak = fmaxf(channel->true_peak, true_peak);
+      channel->power += power;
+      channel->weighted += weighted;
+    }
+    position += count;
+    meter.fill += count;
+    if (meter.fill == meter.step) {
+      meter.fill = 0;
+      meter_publish();
+    }
+  }
+}
+
+bool audio_get_meters(MeterSnapshot *meters) {
+  if (!meter.channels)
+    return false;
+  *meters = *(const MeterSnapshot *)triple_buffer_read(&meter.snapshots, NULL);
+  return true;
+}
+
+void audio_reset_meters() {
+  atomic_store_explicit(&meter.reset, true, memory_order_release);
+}
+
+double meter_db(float level) {
+  return level > 0 ? fmax(20.0 * log10(level), METER_FLOOR_DB)
+                   : METER_FLOOR_DB;
+}
+
+void audio_print_meters() {
+  MeterSnapshot m;
+  if (!audio_get_meters(&m)) {
+    printf("Meters: metering is off, set meter_output\n");
+    return;
+  }
+  printf("Meters (%s):\n", meter_isa());
+  for (int c = 0; c < m.channels; c++)
+    printf("  channel %d: \tpeak %6.1f dBFS (max %6.1f), rms %6.1f dBFS, "
+           "true peak %6.1f dBTP (max %6.1f)\n",
+           c, meter_db(m.peak[c]), meter_db(m.peak_max[c]), meter_db(m.rms[c]),
+           meter_db(m.true_peak[c]), meter_db(m.true_peak_max[c]));
+  printf("  loudness: \tmomentary %6.1f LUFS (max %6.1f), short-term %6.1f "
+         "LUFS\n",
+         m.momentary, m.momentary_max, m.short_term);
+}
@@ -1,4 +1,10 @@
-#include "workbench.h"
+#include "workbench_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifndef MIDI_POLL_INTERVAL_US
+#define MIDI_POLL_INTERVAL_US 1000
+#endif
 
 #define MIDI_TRY(x)                                                            \
   err = (x);                                                                   \
@@ -15,6 +21,84 @@ static PmEvent *midi_in_buffer;
 static PmEvent *midi_out_buffer;
 static PmDeviceID __midi_in_id, __midi_out_id;
 
+static SpscRing midi_in_queue;  /**< MIDI I/O thread -> audio thread */
+static SpscRing midi_out_queue; /**< Audio thread -> MIDI I/O thread */
+static PmEvent *midi_io_buffer;
+static pthread_t midi_io_thread;
+static atomic_bool midi_io_running = false;
+static atomic_uint midi_in_dropped = 0;
+static atomic_uint midi_out_dropped = 0;
+static double midi_block_time = -1.0;  /**< Stream time of the last block */
+static double midi_block_output = 0.0; /**< When the last block is heard */
+static int midi_out_length = 0;        /**< Events produced in this block */
+
+/**
+ * @brief Body of the MIDI I/O thread.
+ *
+ * PortMidi calls may take locks and enter the kernel, so they are made here
+ * instead of on the audio thread. Incoming events are queued for the next
+ * audio block, and events produced by the audio thread are written out.
+ */
+static void *midi_io(void *arg) {
+  (void)arg;
+  struct timespec interval = {.tv_sec = 0,
+                              .tv_nsec = MIDI_POLL_INTERVAL_US * 1000};
+  realtime_enter("MIDI I/O");
+  while (atomic_load_explicit(&midi_io_running, memory_order_relaxed)) {
+    if (midi_in) {
+      int length = Pm_Read(midi_in, midi_io_buffer, cfg->midi_buffer_size);
+      if (length > 0) {
+        int queued = ring_write(&midi_in_queue, midi_io_buffer, length);
+        atomic_fetch_add(&midi_in_dropped, length - queued);
+      }
+    }
+    int length =
+        ring_read(&midi_out_queue, midi_io_buffer, cfg->midi_buffer_size);
+    if (length > 0 && midi_out)
+      Pm_Write(midi_out, midi_io_buffer, length);
+    nanosleep(&interval, NULL);
+  }
+  return NULL;
+}
+
+static void midi_io_start() {
+  bool allocated =
+      ring_init(&midi_in_queue, sizeof(PmEvent), cfg->midi_buffer_size);
+  allocated &=
+      ring_init(&midi_out_queue, sizeof(PmEvent), cfg->midi_buffer_size);
+  midi_io_buffer = engine_calloc(cfg->midi_buffer_size, sizeof(PmEvent));
+  if (!allocated || !midi_io_buffer) {
+    // The audio thread skips MIDI while the I/O thread is not running
+    log_e("Can not allocate the MIDI queues");
+    ring_free(&midi_in_queue);
+    ring_free(&midi_out_queue);
+    engine_free(midi_io_buffer);
+    midi_io_buffer = NULL;
+    return;
+  }
+  atomic_store(&midi_in_dropped, 0);
+  atomic_store(&midi_out_dropped, 0);
+  midi_block_time = -1.0;
+  atomic_store(&midi_io_running, true);
+  if (pthread_create(&midi_io_thread, NULL, midi_io, NULL) != 0) {
+    log_e("Can not start the MIDI I/O thread");
+    atomic_store(&midi_io_running, false);
+  }
+}
+
+static void midi_io_stop() {
+  if (!atomic_exchange(&midi_io_running, false))
+    return;
+  pthread_join(midi_io_thread, NULL);
+  if (atomic_load(&midi_in_dropped) || atomic_load(&midi_out_dropped))
+    log_w("MIDI queues dropped %u incoming and %u outgoing events",
+          atomic_load(&midi_in_dropped), atomic_load(&midi_out_dropped));
+  ring_free(&midi_in_queue);
+  ring_free(&midi_out_queue);
+  engine_free(midi_io_buffer);
+  midi_io_buffer = NULL;
+}
+
 void config_set_midi_input(char *midi_input) {
   free(cfg->midi_input);
   cfg->midi_input = strdup(midi_input);
@@ -38,15 +122,32 @@ static bool midi_device_find(char *pattern, bool input) {
   return false;
 }
 
-void midi_init() {
+/**
+ * @brief PortMidi time source that follows the audio stream clock.
+ *
+ * Incoming events are stamped in the same time base as
+ * `PaStreamCallbackTimeInfo`, which lets the audio thread place each event
+ * at a frame inside the block.
+ */
+static PmTimestamp midi_stream_time(void *time_info) {
+  (void)time_info;
+  return (PmTimestamp)(audio_stream_time() * 1000.0);
+}
+
+void midi_open() {
   log_d("Midi init start");
   PmError err;
+  int64_t phase = monotonic_ns();
   cfg = config_get();
+  // Stamp events with the audio stream clock when they are fed to it
+  bool audio_driven = cfg->audio_callback || cfg->graph;
+  PmTimeProcPtr time_proc = audio_driven ? midi_stream_time : NULL;
   MIDI_TRY(Pm_Initialize());
-  midi_in_buffer = malloc(sizeof(PmEvent) * cfg->midi_buffer_size);
-  midi_out_buffer = malloc(sizeof(PmEvent) * cfg->midi_buffer_size);
+  startup_phase("PortMidi init", &phase);
+  midi_in_buffer = engine_calloc(cfg->midi_buffer_size, sizeof(PmEvent));
+  midi_out_buffer = engine_calloc(cfg->midi_buffer_size, sizeof(PmEvent));
 
-  if (!cfg->audio_callback)
+  if (!audio_driven)
     Pt_Start(1, __midi_callback, cfg->user_data);
   if (!(cfg->flags & DISABLE_MIDI_IN)) {
     if (!cfg->midi_input) {
@@ -58,7 +159,7 @@ void midi_init() {
     }
 
     MIDI_TRY(Pm_OpenInput(&midi_in, __midi_in_id, NULL, cfg->midi_buffer_size,
-                          NULL, NULL));
+                          time_proc, NULL));
     MIDI_TRY(Pm_SetFilter(midi_in, PM_FILT_ACTIVE));
   }
   if (!(cfg->flags & DISABLE_MIDI_OUT)) {
@@ -71,12 +172,26 @@ void midi_init() {
     }
 
     MIDI_TRY(Pm_OpenOutput(&midi_out, __midi_out_id, NULL,
-                           cfg->midi_buffer_size, NULL, NULL,
+                           cfg->midi_buffer_size, time_proc, NULL,
                            cfg->midi_output_latecncy));
   }
+  startup_phase("MIDI devices", &phase);
+}
+
+void midi_start() {
+  // Nothing to start if opening failed
+  if (!midi_in_buffer)
+    return;
+  if (cfg->audio_callback || cfg->graph)
+    midi_io_start();
   log_d("Midi init finish");
 }
 
+void midi_init() {
+  midi_open();
+  midi_start();
+}
+
 #define PRINT_ERROR(x)                                                         \
   err = (x);                                                                   \
   if (err != pmNoError) {                                                      \
@@ -88,20 +203,31 @@ void midi_deinit() {
 #if AUDIO_ENABLED == 0
   Pt_Stop();
 #endif
-  free(midi_in_buffer);
-  free(midi_out_buffer);
+  midi_io_stop();
+  engine_free(midi_in_buffer);
+  engine_free(midi_out_buffer);
+  midi_in_buffer = midi_out_buffer = NULL;
   config_set_flags(DISABLE_MIDI);
-  PRINT_ERROR(Pm_Close(midi_in));
-  PRINT_ERROR(Pm_Close(midi_out));
+  if (midi_in) {
+    PRINT_ERROR(Pm_Close(midi_in));
+  }
+  if (midi_out) {
+    PRINT_ERROR(Pm_Close(midi_out));
+  }
+  midi_in = midi_out = NULL;
   PRINT_ERROR(Pm_Terminate());
+  realtime_report();
 }
 
 void __midi_callback(int32_t timestamp, void *userData) {
   (void)timestamp;
+  realtime_enter("MIDI");
   Config *cfg = config_get();
   if (!cfg->midi_callback)
     return;
   int in_queue_length = Pm_Read(midi_in, midi_in_buffer, cfg->midi_buffer_size);
+  if (in_queue_length < 0)
+    in_queue_length = 0;
 
   int out_queue_length = cfg->midi_callback(midi_in_buffer, midi_out_buffer,
                                             in_queue_length, userData);
@@ -110,6 +236,78 @@ void __midi_callback(int32_t timestamp, void *userData) {
   }
 }
 
+int midi_block_begin(const PaStreamCallbackTimeInfo *time_info,
+                     unsigned long block_size) {
+  if (!atomic_load_explicit(&midi_io_running, memory_order_acquire))
+    return -1;
+  double block_duration = block_size / cfg->sample_rate;
+  // Events stamped since the previous block start are played one block
+  // later at the same relative position, which trades jitter for latency.
+  // Those queued before the first block are all due at its start.
+  double block_start =
+      midi_block_time < 0 ? time_info->currentTime : midi_block_time;
+  midi_block_time = time_info->currentTime;
+  midi_block_output = time_info->outputBufferDacTime > 0
+                          ? time_info->outputBufferDacTime
+                          : time_info->currentTime + block_duration;
+  midi_out_length = 0;
+
+  int length =
+      ring_read(&midi_in_queue, midi_in_buffer, cfg->midi_buffer_size);
+  for (int i = 0; i < length; i++) {
+    double offset =
+        (midi_in_buffer[i].timestamp / 1000.0 - block_start) * cfg->sample_rate;
+    if (offset < 0)
+      offset = 0;
+    if (offset > block_size - 1)
+      offset = block_size - 1;
+    // Timestamps never go back, keep offsets ordered for splitting
+    if (i > 0 && offset < midi_in_buffer[i - 1].timestamp)
+      offset = midi_in_buffer[i - 1].timestamp;
+    midi_in_buffer[i].timestamp = (PmTimestamp)offset;
+  }
+  return length;
+}
+
+const PmEvent *midi_block_events() { return midi_in_buffer; }
+
+void midi_block_dispatch(int first, int count, void *user_data) {
+  // The slices of a block share the output buffer, the callback only gets
+  // the `midi_buffer_size - midi_out_length` events the earlier ones left
+  if (!cfg->midi_callback || midi_out_length >= (int)cfg->midi_buffer_size)
+    return;
+  int length = cfg->midi_callback(midi_in_buffer + first,
+                                  midi_out_buffer + midi_out_length, count,
+                                  user_data);
+  if (length > 0)
+    midi_out_length += length;
+  if (midi_out_length > (int)cfg->midi_buffer_size)
+    midi_out_length = cfg->midi_buffer_size;
+}
+
+void midi_block_send(const PmEvent *events, int count) {
+  if (count > (int)cfg->midi_buffer_size - midi_out_length)
+    count = cfg->midi_buffer_size - midi_out_length;
+  if (count <= 0)
+    return;
+  memcpy(midi_out_buffer + midi_out_length, events, sizeof(PmEvent) * count);
+  midi_out_length += count;
+}
+
+void midi_block_end() {
+  if (midi_out_length <= 0)
+    return;
+  // Outgoing frame offsets become stream times aligned with the audio output
+  for (int i = 0; i < midi_out_length; i++)
+    midi_out_buffer[i].timestamp =
+        (PmTimestamp)((midi_block_output +
+                       midi_out_buffer[i].timestamp / cfg->sample_rate) *
+                      1000.0);
+  int queued = ring_write(&midi_out_queue, midi_out_buffer, midi_out_length);
+  atomic_fetch_add_explicit(&midi_out_dropped, midi_out_length - queued,
+                            memory_order_relaxed);
+}
+
 bool in_sysex = false;
 
 char val_format[] = "    Val %d\n";
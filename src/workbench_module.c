@@ -0,0 +1,165 @@
+#include "workbench_internal.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/**
+ * @brief A loaded module and its instance.
+ */
+typedef struct Module {
+  void *library;          /**< Handle from `dlopen` */
+  const ModuleDesc *desc; /**< Exported description */
+  void *instance;         /**< Made by `desc->create` */
+  uint64_t retired;       /**< Blocks finished when it was swapped out */
+  struct Module *next;    /**< Next retired module */
+} Module;
+
+/**
+ * @brief The module slot.
+ *
+ * Control threads exchange `active`; the audio thread reads it once at the
+ * start of every block and counts the blocks it finishes. A module swapped
+ * out while `blocks` was `n` can only be in use by the block that finishes
+ * as `n + 1`, so it is destroyed once `blocks` passed `n`.
+ */
+static struct {
+  _Atomic(Module *) active;    /**< Module for the next block */
+  Module *running;             /**< Module of the block, audio thread */
+  atomic_uint_fast64_t blocks; /**< Blocks finished by the audio thread */
+  Module *retired;             /**< Swapped out, maybe still running */
+  pthread_mutex_t lock;        /**< Serialises the control threads */
+} modules = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void module_free(Module *module) {
+  if (module->desc->destroy)
+    module->desc->destroy(module->instance);
+  dlclose(module->library);
+  free(module);
+}
+
+/**
+ * @brief Frees the retired modules the audio thread is done with.
+ *
+ * Called with the lock held. Without a running stream no block can use them.
+ */
+static void module_collect(bool all) {
+  uint64_t blocks = atomic_load(&modules.blocks);
+  all |= !audio_is_active();
+  Module **link = &modules.retired;
+  while (*link) {
+    Module *module = *link;
+    if (!all && module->retired >= blocks) {
+      link = &module->next;
+      continue;
+    }
+    *link = module->next;
+    module_free(module);
+  }
+}
+
+/**
+ * @brief Puts `module` in the slot and queues the module it replaces.
+ */
+static void module_swap(Module *module) {
+  pthread_mutex_lock(&modules.lock);
+  Module *old = atomic_exchange(&modules.active, module);
+  if (old) {
+    old->retired = atomic_load(&modules.blocks);
+    old->next = modules.retired;
+    modules.retired = old;
+  }
+  module_collect(false);
+  pthread_mutex_unlock(&modules.lock);
+}
+
+/**
+ * @brief Opens a private copy of a shared object.
+ *
+ * `dlopen` hands out the library already loaded from a path, so a rebuilt
+ * module would never replace the old code.
+ */
+static void *module_open(const char *path) {
+  char copy[] = "/tmp/workbench-module-XXXXXX";
+  int to = mkstemp(copy);
+  int from = open(path, O_RDONLY);
+  bool copied = to >= 0 && from >= 0;
+  char buffer[1 << 16];
+  ssize_t bytes;
+  while (copied && (bytes = read(from, buffer, sizeof(buffer))) != 0)
+    copied = bytes > 0 && write(to, buffer, bytes) == bytes;
+  if (from >= 0)
+    close(from);
+  if (to >= 0)
+    close(to);
+  void *library = copied ? dlopen(copy, RTLD_NOW | RTLD_LOCAL) : NULL;
+  if (to >= 0)
+    unlink(copy);
+  if (!copied) {
+    log_e("Can not copy module %s: %s", path, strerror(errno));
+  } else if (!library) {
+    log_e("Can not load module %s: %s", path, dlerror());
+  }
+  return library;
+}
+
+bool audio_load_module(const char *path) {
+  int64_t start = monotonic_ns();
+  void *library = module_open(path);
+  if (!library)
+    return false;
+  const ModuleDesc *desc = dlsym(library, WORKBENCH_MODULE_SYMBOL);
+  if (!desc || desc->abi != WORKBENCH_MODULE_ABI || !desc->process) {
+    log_e("Module %s does not export a " WORKBENCH_MODULE_SYMBOL
+          " of ABI %d",
+          path, WORKBENCH_MODULE_ABI);
+    dlclose(library);
+    return false;
+  }
+  Module *module = calloc(1, sizeof(Module));
+  if (!module) {
+    dlclose(library);
+    return false;
+  }
+  module->library = library;
+  module->desc = desc;
+  module->instance = desc->create ? desc->create() : NULL;
+  module_swap(module);
+  log_i("Module \"%s\" from %s swapped in after %.2f ms", desc->name, path,
+        (double)(monotonic_ns() - start) / 1e6);
+  return true;
+}
+
+void audio_unload_module() { module_swap(NULL); }
+
+void module_block_begin() {
+  modules.running = atomic_load(&modules.active);
+}
+
+bool module_running() { return modules.running != NULL; }
+
+bool module_process(const void *input_buffer, void *output_buffer,
+                    unsigned long frames) {
+  Module *module = modules.running;
+  if (!module)
+    return false;
+  module->desc->process(module->instance, input_buffer, output_buffer,
+                        frames);
+  return true;
+}
+
+void module_block_end() {
+  modules.running = NULL;
+  atomic_fetch_add(&modules.blocks, 1);
+}
+
+void module_deinit() {
+  pthread_mutex_lock(&modules.lock);
+  Module *module = atomic_exchange(&modules.active, NULL);
+  if (module)
+    module_free(module);
+  module_collect(true);
+  pthread_mutex_unlock(&modules.lock);
+}
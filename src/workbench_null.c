@@ -0,0 +1,139 @@
+#include "workbench_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+static Config *cfg = NULL;
+static pthread_t null_thread;
+static bool null_thread_started = false;
+static atomic_bool null_running = false;
+static int64_t null_start_time = 0;
+
+/**
+ * @brief Timing summary of the clock thread, owned by that thread.
+ */
+static struct {
+  uint64_t blocks;    /**< Callbacks fired */
+  uint64_t missed;    /**< Deadlines skipped because a block overran */
+  int64_t jitter_sum; /**< Sum of wake-up delays in nanoseconds */
+  int64_t jitter_max; /**< Largest wake-up delay in nanoseconds */
+  int64_t busy_sum;   /**< Time spent inside the callback */
+  int64_t busy_max;   /**< Longest callback */
+  int64_t period;     /**< Block duration in nanoseconds */
+} null_timing;
+
+/**
+ * @brief Sleeps until the monotonic clock reaches `deadline`.
+ *
+ * Sleeping to an absolute time keeps the block grid free of accumulated drift
+ * no matter how long each callback took.
+ */
+static void sleep_until(int64_t deadline) {
+#ifdef __linux__
+  struct timespec ts = {.tv_sec = deadline / NS_PER_SEC,
+                        .tv_nsec = deadline % NS_PER_SEC};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+#else
+  int64_t now;
+  while ((now = monotonic_ns()) < deadline) {
+    struct timespec ts = {.tv_sec = (deadline - now) / NS_PER_SEC,
+                          .tv_nsec = (deadline - now) % NS_PER_SEC};
+    nanosleep(&ts, NULL);
+  }
+#endif
+}
+
+static void *null_clock(void *arg) {
+  (void)arg;
+  unsigned long block_size = cfg->block_size;
+  void *in = device_buffer_alloc(cfg->in_channel_count, block_size);
+  void *out = device_buffer_alloc(cfg->out_channel_count, block_size);
+  int64_t period = null_timing.period;
+  PaStreamCallbackTimeInfo time_info = {0};
+  PaStreamCallbackFlags flags = 0;
+  bool allocated = in && out;
+  if (!allocated)
+    log_e("Can not allocate the null device buffers");
+
+  int64_t start = null_start_time;
+  int64_t deadline = start;
+  while (allocated && atomic_load(&null_running)) {
+    sleep_until(deadline);
+    int64_t woke = monotonic_ns();
+
+    // The synthetic stream clock is the ideal deadline, not the wake-up time
+    time_info.currentTime = (double)(deadline - start) / NS_PER_SEC;
+    time_info.inputBufferAdcTime = time_info.currentTime;
+    time_info.outputBufferDacTime =
+        time_info.currentTime + (double)period / NS_PER_SEC;
+    int result = __audio_callback(in, out, block_size, &time_info, flags,
+                                  cfg->user_data);
+    int64_t done = monotonic_ns();
+
+    null_timing.blocks++;
+    null_timing.jitter_sum += woke - deadline;
+    if (woke - deadline > null_timing.jitter_max)
+      null_timing.jitter_max = woke - deadline;
+    null_timing.busy_sum += done - woke;
+    if (done - woke > null_timing.busy_max)
+      null_timing.busy_max = done - woke;
+    if (result != paContinue)
+      break;
+
+    // A device would have underrun for every deadline already passed
+    flags = 0;
+    deadline += period;
+    while (deadline + period <= done) {
+      deadline += period;
+      null_timing.missed++;
+      flags = paOutputUnderflow | paInputOverflow;
+    }
+  }
+
+  engine_free(in);
+  engine_free(out);
+  atomic_store(&null_running, false);
+  return NULL;
+}
+
+void null_start() {
+  cfg = config_get();
+  null_timing = (typeof(null_timing)){0};
+  null_timing.period =
+      (int64_t)(cfg->block_size * NS_PER_SEC / cfg->sample_rate);
+  log_d("Null device: %u frames every %.3f ms", cfg->block_size,
+        null_timing.period / 1e6);
+
+  null_start_time = monotonic_ns();
+  atomic_store(&null_running, true);
+  if (pthread_create(&null_thread, NULL, null_clock, NULL) != 0) {
+    log_e("Can not start the null device clock thread");
+    atomic_store(&null_running, false);
+    return;
+  }
+  null_thread_started = true;
+}
+
+void null_stop() {
+  atomic_store(&null_running, false);
+  if (!null_thread_started)
+    return;
+  pthread_join(null_thread, NULL);
+  null_thread_started = false;
+
+  uint64_t blocks = null_timing.blocks ? null_timing.blocks : 1;
+  log_i("Null device: %llu blocks, %llu missed, jitter avg %.1f us max %.1f "
+        "us, load avg %.1f%% max %.1f%%",
+        (unsigned long long)null_timing.blocks,
+        (unsigned long long)null_timing.missed,
+        null_timing.jitter_sum / 1e3 / blocks, null_timing.jitter_max / 1e3,
+        100.0 * null_timing.busy_sum / blocks / null_timing.period,
+        100.0 * null_timing.busy_max / null_timing.period);
+}
+
+bool null_is_active() { return atomic_load(&null_running); }
+
+double null_stream_time() {
+  return (double)(monotonic_ns() - null_start_time) / NS_PER_SEC;
+}
@@ -0,0 +1,197 @@
+#include "workbench_internal.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+static Config *cfg = NULL;
+static WavFile *offline_in = NULL;
+static WavFile *offline_out = NULL;
+static Resampler *offline_resampler = NULL;
+static pthread_t offline_thread;
+static bool offline_thread_started = false;
+static atomic_bool offline_running = false;
+static atomic_uint_fast64_t offline_position = 0;
+
+/**
+ * @brief Reads one block of the input file at the engine rate.
+ *
+ * A file at another rate is read through `offline_resampler`. Once the file
+ * ends it is fed silence, which flushes the tail out of the filter.
+ *
+ * @param source Room for the file frames the resampler needs.
+ * @return Number of frames written to `raw`.
+ */
+static unsigned long offline_read_file(float *source, float *raw,
+                                       unsigned long block_size) {
+  if (!offline_resampler)
+    return wav_read_float(offline_in, raw, block_size);
+  int file_channels = offline_in->info.channels;
+  size_t needed = resampler_input_needed(offline_resampler, block_size);
+  size_t read = wav_read_float(offline_in, source, needed);
+  memset(source + read * file_channels, 0,
+         sizeof(float) * (needed - read) * file_channels);
+  return resampler_process(offline_resampler, source, needed, raw,
+                           block_size);
+}
+
+/**
+ * @brief Copies one block from the input file into the callback buffer.
+ *
+ * Missing file channels repeat the last one, so a mono file feeds every
+ * input channel. Frames past the end of the file are silent.
+ *
+ * @return Number of frames taken from the file.
+ */
+static unsigned long offline_read_block(float *source, float *raw, void *in,
+                                        unsigned long block_size) {
+  int channels = cfg->in_channel_count;
+  unsigned long frames = 0;
+  int file_channels = 1;
+
+  if (offline_in) {
+    file_channels = offline_in->info.channels;
+    frames = offline_read_file(source, raw, block_size);
+  }
+  for (unsigned long i = 0; i < block_size; i++) {
+    for (int c = 0; c < channels; c++) {
+      int src = c < file_channels ? c : file_channels - 1;
+      *device_sample(in, channels, i, c) =
+          i < frames ? raw[i * file_channels + src] : 0;
+    }
+  }
+  return frames;
+}
+
+static void *offline_render(void *arg) {
+  (void)arg;
+  unsigned long block_size = cfg->block_size;
+  int file_channels = offline_in ? offline_in->info.channels : 1;
+  uint64_t total = (uint64_t)(cfg->offline_duration * cfg->sample_rate);
+  if (offline_in)
+    total = (uint64_t)ceil((double)offline_in->info.frames *
+                           cfg->sample_rate / offline_in->info.sample_rate);
+  float *raw = malloc(sizeof(float) * block_size *
+                      (file_channels > cfg->out_channel_count
+                           ? file_channels
+                           : cfg->out_channel_count));
+  float *source = NULL;
+  if (offline_resampler)
+    source = malloc(sizeof(float) * file_channels *
+                    ((size_t)ceil(block_size *
+                                  resampler_ratio(offline_resampler)) +
+                     resampler_taps(offline_resampler)));
+  void *in = device_buffer_alloc(cfg->in_channel_count, block_size);
+  void *out = device_buffer_alloc(cfg->out_channel_count, block_size);
+  PaStreamCallbackTimeInfo time_info = {0};
+  uint64_t rendered = 0;
+  bool allocated = raw && in && out && (source || !offline_resampler);
+  if (!allocated)
+    log_e("Can not allocate the offline render buffers");
+
+  double start = monotonic_seconds();
+  while (allocated && atomic_load(&offline_running) && rendered < total) {
+    unsigned long frames = block_size;
+    if (total - rendered < frames)
+      frames = total - rendered;
+    offline_read_block(source, raw, in, block_size);
+
+    // The stream clock advances by exactly one block per callback
+    time_info.currentTime = rendered / cfg->sample_rate;
+    time_info.inputBufferAdcTime = time_info.currentTime;
+    time_info.outputBufferDacTime = time_info.currentTime;
+    int result = __audio_callback(in, out, block_size, &time_info, 0,
+                                  cfg->user_data);
+
+    if (offline_out) {
+      int channels = cfg->out_channel_count;
+      for (unsigned long i = 0; i < frames; i++)
+        for (int c = 0; c < channels; c++)
+          raw[i * channels + c] = *device_sample(out, channels, i, c);
+      // A short write, such as on a full disk, ends the render
+      if (wav_write_float(offline_out, raw, frames) < frames)
+        result = paComplete;
+    }
+    rendered += frames;
+    atomic_store_explicit(&offline_position, rendered, memory_order_relaxed);
+    if (result != paContinue)
+      break;
+  }
+  double elapsed = monotonic_seconds() - start;
+
+  log_i("Offline render: %llu frames in %.3f s, %.0f frames/s (%.1fx "
+        "realtime)",
+        (unsigned long long)rendered, elapsed,
+        elapsed > 0 ? rendered / elapsed : 0.0,
+        elapsed > 0 ? rendered / elapsed / cfg->sample_rate : 0.0);
+
+  wav_close(offline_in);
+  wav_close(offline_out);
+  offline_in = offline_out = NULL;
+  resampler_destroy(offline_resampler);
+  offline_resampler = NULL;
+  free(source);
+  free(raw);
+  engine_free(in);
+  engine_free(out);
+  atomic_store(&offline_running, false);
+  return NULL;
+}
+
+void offline_start() {
+  cfg = config_get();
+  if (cfg->offline_input) {
+    offline_in = wav_open_read(cfg->offline_input);
+    if (!offline_in)
+      return;
+    if (offline_in->info.sample_rate != (uint32_t)cfg->sample_rate) {
+      offline_resampler = resampler_create(
+          offline_in->info.channels,
+          offline_in->info.sample_rate / cfg->sample_rate, cfg->block_size,
+          resample_quality_parse(cfg->resample_quality));
+      if (!offline_resampler) {
+        log_e("Can not allocate the resampler");
+        wav_close(offline_in);
+        offline_in = NULL;
+        return;
+      }
+      log_i("Resampling \"%s\" from %u Hz to %.0f Hz", cfg->offline_input,
+            offline_in->info.sample_rate, cfg->sample_rate);
+    }
+  }
+  if (cfg->offline_output) {
+    offline_out = wav_open_write(cfg->offline_output, cfg->out_channel_count,
+                                 cfg->sample_rate);
+    if (!offline_out) {
+      wav_close(offline_in);
+      offline_in = NULL;
+      return;
+    }
+  }
+  log_d("Offline render: \"%s\" -> \"%s\"",
+        cfg->offline_input ? cfg->offline_input : "silence",
+        cfg->offline_output ? cfg->offline_output : "nowhere");
+
+  atomic_store(&offline_position, 0);
+  atomic_store(&offline_running, true);
+  if (pthread_create(&offline_thread, NULL, offline_render, NULL) != 0) {
+    log_e("Can not start the offline render thread");
+    atomic_store(&offline_running, false);
+    return;
+  }
+  offline_thread_started = true;
+}
+
+void offline_stop() {
+  atomic_store(&offline_running, false);
+  if (offline_thread_started) {
+    pthread_join(offline_thread, NULL);
+    offline_thread_started = false;
+  }
+}
+
+bool offline_is_active() { return atomic_load(&offline_running); }
+
+double offline_stream_time() {
+  return atomic_load_explicit(&offline_position, memory_order_relaxed) /
+         cfg->sample_rate;
+}
@@ -0,0 +1,163 @@
+#include "workbench_internal.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * @brief A parameter of the table.
+ *
+ * Only `target` is written outside of the audio thread.
+ */
+typedef struct {
+  _Alignas(CACHE_LINE) _Atomic float target; /**< Set by `param_set` */
+  const char *name;                          /**< Given to `param_add` */
+  double rate; /**< Inverse time constant in frames, 0 to jump */
+  float value; /**< Value at the end of the ramp */
+  float aimed; /**< Target the ramp was computed for */
+  bool moving; /**< The ramp is not constant */
+  bool flat;   /**< The ramp already holds `value` everywhere */
+  float *ramp; /**< One value per frame of a block */
+} Param;
+
+/**
+ * @brief The table. Slots below `count` are complete, so the audio thread
+ * never sees one that `param_add` is still filling.
+ */
+static struct {
+  Param params[PARAM_MAX];
+  atomic_int count;       /**< Slots in use */
+  float *index;           /**< 1 to `capacity`, the ramp of a unit step */
+  unsigned long capacity; /**< Frames of every ramp, `block_size` */
+  unsigned long offset;   /**< First frame of the current callback */
+  pthread_mutex_t lock;   /**< Serialises `param_add` */
+} table = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int param_add(const char *name, float value, double smoothing) {
+  Config *cfg = config_get();
+  pthread_mutex_lock(&table.lock);
+  int count = atomic_load_explicit(&table.count, memory_order_relaxed);
+  if (count == PARAM_MAX) {
+    pthread_mutex_unlock(&table.lock);
+    log_e("Can not add parameter \"%s\", the table holds %d", name, PARAM_MAX);
+    return -1;
+  }
+  if (!table.index) {
+    table.capacity = cfg->block_size;
+    table.index = engine_calloc(table.capacity, sizeof(float));
+    for (unsigned long i = 0; table.index && i < table.capacity; i++)
+      table.index[i] = (float)(i + 1);
+  }
+  Param *param = &table.params[count];
+  param->ramp = engine_calloc(table.capacity, sizeof(float));
+  if (!table.index || !param->ramp) {
+    engine_free(param->ramp);
+    pthread_mutex_unlock(&table.lock);
+    log_e("Can not allocate the ramp of parameter \"%s\"", name);
+    return -1;
+  }
+  for (unsigned long i = 0; i < table.capacity; i++)
+    param->ramp[i] = value;
+  atomic_store_explicit(&param->target, value, memory_order_relaxed);
+  param->name = name;
+  param->rate = smoothing > 0 ? 1.0 / (smoothing * cfg->sample_rate) : 0;
+  param->value = param->aimed = value;
+  param->moving = false;
+  param->flat = true;
+  atomic_store_explicit(&table.count, count + 1, memory_order_release);
+  pthread_mutex_unlock(&table.lock);
+  return count;
+}
+
+int param_find(const char *name) {
+  int count = atomic_load_explicit(&table.count, memory_order_acquire);
+  for (int p = 0; p < count; p++)
+    if (strcmp(table.params[p].name, name) == 0)
+      return p;
+  return -1;
+}
+
+void param_set(int param, float target) {
+  atomic_store_explicit(&table.params[param].target, target,
+                        memory_order_relaxed);
+}
+
+float param_target(int param) {
+  return atomic_load_explicit(&table.params[param].target,
+                             memory_order_relaxed);
+}
+
+const float *param_ramp(int param) {
+  return table.params[param].ramp + table.offset;
+}
+
+float param_value(int param) {
+  return table.params[param].ramp[table.offset];
+}
+
+bool param_moving(int param) { return table.params[param].moving; }
+
+/**
+ * @brief Computes the ramp of a parameter from frame `offset` to `end`.
+ */
+static void param_glide(Param *param, float target, unsigned long offset,
+                        unsigned long end) {
+  float start = offset ? param->ramp[offset - 1] : param->value;
+  float *ramp = param->ramp + offset;
+  unsigned long frames = end - offset;
+  param->aimed = target;
+  if (start == target || param->rate == 0) {
+    param->moving = false;
+    // A settled ramp is only written once
+    if (param->flat && param->value == target)
+      return;
+    for (unsigned long i = 0; i < frames; i++)
+      ramp[i] = target;
+    param->value = target;
+    param->flat = offset == 0 && end == table.capacity;
+    return;
+  }
+  float value =
+      target + (start - target) * (float)exp(-param->rate * (double)frames);
+  // Close enough to stop gliding from the next block on
+  if (fabsf(value - target) <= 1e-6f * fmaxf(1.0f, fabsf(target)))
+    value = target;
+  float step = (value - start) / (float)frames;
+  // One multiply-add per frame
+  for (unsigned long i = 0; i < frames; i++)
+    ramp[i] = start + step * table.index[i];
+  param->value = value;
+  param->moving = true;
+  param->flat = false;
+}
+
+void params_process(unsigned long offset, unsigned long frames) {
+  int count = atomic_load_explicit(&table.count, memory_order_acquire);
+  unsigned long end = offset + frames;
+  if (end > table.capacity)
+    end = table.capacity;
+  if (offset >= end)
+    return;
+  table.offset = offset;
+  for (int p = 0; p < count; p++) {
+    Param *param = &table.params[p];
+    float target = atomic_load_explicit(&param->target, memory_order_relaxed);
+    // Inside a block only parameters with a new target start a new ramp
+    if (offset > 0 && target == param->aimed)
+      continue;
+    param_glide(param, target, offset, end);
+  }
+}
+
+void params_deinit() {
+  pthread_mutex_lock(&table.lock);
+  int count = atomic_load_explicit(&table.count, memory_order_relaxed);
+  atomic_store_explicit(&table.count, 0, memory_order_relaxed);
+  for (int p = 0; p < count; p++)
+    engine_free(table.params[p].ramp);
+  memset(table.params, 0, sizeof(table.params));
+  engine_free(table.index);
+  table.index = NULL;
+  table.capacity = 0;
+  table.offset = 0;
+  pthread_mutex_unlock(&table.lock);
+}
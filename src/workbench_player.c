@@ -0,0 +1,283 @@
+#include "workbench_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Bits of `WavPlayer.command` above the `PlayerMode` flags */
+#define PLAYER_MODE_MASK 7u
+#define PLAYER_COMMAND_START 8u
+#define PLAYER_COMMAND_STOP 16u
+
+struct WavPlayer {
+  WavInfo info;                  /**< Sample layout of the file */
+  uint8_t *map;                  /**< Mapping of the whole file */
+  size_t map_size;               /**< Bytes in `map` */
+  const uint8_t *data;           /**< First frame inside `map` */
+  size_t page_size;              /**< Granularity of `madvise` */
+  float *scratch;                /**< One chunk of converted frames */
+  uint64_t cursor;               /**< Owned by the audio thread */
+  bool reverse;                  /**< Owned by the audio thread */
+  unsigned mode;                 /**< Owned by the audio thread */
+  atomic_uint command;           /**< Request for the audio thread */
+  atomic_bool playing;           /**< Published by the audio thread */
+  atomic_bool heading_back;      /**< Published `reverse` */
+  atomic_uint playing_mode;      /**< Published `mode` */
+  atomic_uint_fast64_t position; /**< Published `cursor` */
+  pthread_t prefetcher;          /**< Follows `position` */
+  atomic_bool running;           /**< Cleared to stop the prefetcher */
+};
+
+/**
+ * @brief Makes frames `[from, to)` resident before the audio thread reads
+ * them.
+ *
+ * The kernel is asked to read the range in one go and then every page is
+ * touched, so the page faults are taken by the calling thread.
+ */
+static void player_prefetch(WavPlayer *player, uint64_t from, uint64_t to) {
+  if (to > player->info.frames)
+    to = player->info.frames;
+  if (from >= to)
+    return;
+  uintptr_t mask = player->page_size - 1;
+  uintptr_t start =
+      (uintptr_t)(player->data + from * player->info.block_align) & ~mask;
+  uintptr_t end = (uintptr_t)(player->data + to * player->info.block_align);
+  madvise((void *)start, end - start, MADV_WILLNEED);
+  for (uintptr_t page = start; page < end; page += player->page_size)
+    (void)*(volatile const uint8_t *)page;
+}
+
+/** Drops the pages that hold only frames in `[from, to)` from the mapping. */
+static void player_release(WavPlayer *player, uint64_t from, uint64_t to) {
+  if (to > player->info.frames)
+    to = player->info.frames;
+  uintptr_t mask = player->page_size - 1;
+  uintptr_t start =
+      ((uintptr_t)(player->data + from * player->info.block_align) + mask) &
+      ~mask;
+  uintptr_t end =
+      (uintptr_t)(player->data + to * player->info.block_align) & ~mask;
+  if (start < end)
+    madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+static void *player_follow(void *arg) {
+  WavPlayer *player = arg;
+  uint64_t frames = player->info.frames;
+  uint64_t ahead = PLAYER_READ_AHEAD_SIZE / player->info.block_align + 1;
+  struct timespec interval = {.tv_sec = 0,
+                              .tv_nsec = PLAYER_PREFETCH_INTERVAL_US * 1000};
+  while (atomic_load_explicit(&player->running, memory_order_relaxed)) {
+    nanosleep(&interval, NULL);
+    if (!atomic_load_explicit(&player->playing, memory_order_relaxed))
+      continue;
+    uint64_t position = atomic_load(&player->position);
+    bool wraps = (atomic_load(&player->playing_mode) &
+                  (PLAYER_LOOP | PLAYER_BACK_AND_FORTH)) == PLAYER_LOOP;
+    // The band behind the window moves less than `ahead` per interval, so
+    // releasing only it eventually covers everything that was played
+    if (!atomic_load(&player->heading_back)) {
+      player_prefetch(player, position, position + ahead);
+      if (wraps && position + ahead > frames)
+        player_prefetch(player, 0, position + ahead - frames);
+      if (position > 2 * ahead)
+        player_release(player, position - 2 * ahead, position - ahead);
+    } else {
+      player_prefetch(player, position > ahead ? position - ahead : 0,
+                      position);
+      if (wraps && position < ahead)
+        player_prefetch(player, frames - (ahead - position), frames);
+      player_release(player, position + ahead, position + 2 * ahead);
+    }
+  }
+  return NULL;
+}
+
+WavPlayer *player_open(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    log_e("Can not open \"%s\": %s", path, strerror(errno));
+    return NULL;
+  }
+  WavPlayer *player = calloc(1, sizeof(WavPlayer));
+  if (!player) {
+    log_e("Can not allocate a player for \"%s\"", path);
+    fclose(file);
+    return NULL;
+  }
+  struct stat st;
+  if (!wav_read_header(file, &player->info) ||
+      fstat(fileno(file), &st) != 0) {
+    log_e("\"%s\" is not a supported WAV file", path);
+    fclose(file);
+    free(player);
+    return NULL;
+  }
+  // Trust the file size over the header of a recording that was cut short
+  uint64_t available = (uint64_t)st.st_size > player->info.data_offset
+                           ? st.st_size - player->info.data_offset
+                           : 0;
+  if (player->info.frames > available / player->info.block_align)
+    player->info.frames = available / player->info.block_align;
+  if (player->info.frames == 0) {
+    log_e("\"%s\" has no frames to play", path);
+    fclose(file);
+    free(player);
+    return NULL;
+  }
+
+  player->map_size = st.st_size;
+  player->map =
+      mmap(NULL, player->map_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+  fclose(file);
+  if (player->map == MAP_FAILED) {
+    log_e("Can not map \"%s\": %s", path, strerror(errno));
+    free(player);
+    return NULL;
+  }
+  // Kernel read-ahead assumes forward play, the prefetcher knows better
+  madvise(player->map, player->map_size, MADV_RANDOM);
+  player->data = player->map + player->info.data_offset;
+  player->page_size = sysconf(_SC_PAGESIZE);
+  player->scratch = engine_calloc(
+      (size_t)PLAYER_CHUNK_FRAMES * player->info.channels, sizeof(float));
+  player_prefetch(player, 0,
+                  PLAYER_READ_AHEAD_SIZE / player->info.block_align + 1);
+
+  atomic_store(&player->running, true);
+  if (!player->scratch ||
+      pthread_create(&player->prefetcher, NULL, player_follow, player) != 0) {
+    log_e("Can not start the player");
+    munmap(player->map, player->map_size);
+    engine_free(player->scratch);
+    free(player);
+    return NULL;
+  }
+  log_d("Playing \"%s\", %d channels, %llu frames", path,
+        player->info.channels, (unsigned long long)player->info.frames);
+  return player;
+}
+
+const WavInfo *player_info(const WavPlayer *player) { return &player->info; }
+
+void player_start(WavPlayer *player, unsigned mode) {
+  uint64_t ahead = PLAYER_READ_AHEAD_SIZE / player->info.block_align + 1;
+  uint64_t frames = player->info.frames;
+  // Have the first block resident before the audio thread asks for it
+  if (mode & PLAYER_REVERSE)
+    player_prefetch(player, frames > ahead ? frames - ahead : 0, frames);
+  else
+    player_prefetch(player, 0, ahead);
+  atomic_store_explicit(&player->command,
+                        PLAYER_COMMAND_START | (mode & PLAYER_MODE_MASK),
+                        memory_order_release);
+  atomic_store(&player->playing, true);
+}
+
+void player_stop(WavPlayer *player) {
+  atomic_store_explicit(&player->command, PLAYER_COMMAND_STOP,
+                        memory_order_release);
+}
+
+bool player_is_playing(WavPlayer *player) {
+  return atomic_load(&player->playing);
+}
+
+uint64_t player_position(WavPlayer *player) {
+  return atomic_load(&player->position);
+}
+
+/**
+ * @brief Copies `count` frames at the cursor to the output and moves the
+ * cursor.
+ *
+ * Forward play with matching channels converts straight from the mapping
+ * into the output; everything else goes through the scratch chunk.
+ */
+static void player_copy(WavPlayer *player, float *out, int channels,
+                        size_t count) {
+  const WavInfo *info = &player->info;
+  if (!player->reverse && channels == info->channels) {
+    wav_decode_float(info, player->data + player->cursor * info->block_align,
+                     out, count);
+    player->cursor += count;
+    return;
+  }
+  while (count) {
+    size_t n = count < PLAYER_CHUNK_FRAMES ? count : PLAYER_CHUNK_FRAMES;
+    uint64_t first = player->reverse ? player->cursor - n : player->cursor;
+    wav_decode_float(info, player->data + first * info->block_align,
+                     player->scratch, n);
+    for (size_t i = 0; i < n; i++) {
+      const float *frame =
+          player->scratch + (player->reverse ? n - 1 - i : i) * info->channels;
+      for (int c = 0; c < channels; c++)
+        *out++ = frame[c < info->channels ? c : info->channels - 1];
+    }
+    player->cursor = player->reverse ? first : first + n;
+    count -= n;
+  }
+}
+
+/** Handles the end of the file, returns `false` if playback is over. */
+static bool player_turn(WavPlayer *player) {
+  if (player->mode & PLAYER_BACK_AND_FORTH) {
+    player->reverse = !player->reverse;
+  } else if (player->mode & PLAYER_LOOP) {
+    player->cursor = player->reverse ? player->info.frames : 0;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+size_t player_render(WavPlayer *player, float *frames, int channels,
+                     size_t count) {
+  unsigned command =
+      atomic_exchange_explicit(&player->command, 0, memory_order_acquire);
+  bool playing = atomic_load_explicit(&player->playing, memory_order_relaxed);
+  if (command & PLAYER_COMMAND_STOP) {
+    playing = false;
+  } else if (command & PLAYER_COMMAND_START) {
+    player->mode = command & PLAYER_MODE_MASK;
+    player->reverse = player->mode & PLAYER_REVERSE;
+    player->cursor = player->reverse ? player->info.frames : 0;
+    atomic_store(&player->playing_mode, player->mode);
+    playing = true;
+  }
+
+  size_t done = 0;
+  while (playing && done < count) {
+    uint64_t left =
+        player->reverse ? player->cursor : player->info.frames - player->cursor;
+    if (left == 0) {
+      playing = player_turn(player);
+      continue;
+    }
+    size_t n = count - done < left ? count - done : left;
+    player_copy(player, frames + done * channels, channels, n);
+    done += n;
+  }
+  memset(frames + done * channels, 0,
+         sizeof(float) * (count - done) * channels);
+
+  atomic_store_explicit(&player->position, player->cursor,
+                        memory_order_relaxed);
+  atomic_store_explicit(&player->heading_back, player->reverse,
+                        memory_order_relaxed);
+  atomic_store_explicit(&player->playing, playing, memory_order_relaxed);
+  return done;
+}
+
+void player_close(WavPlayer *player) {
+  if (!player)
+    return;
+  atomic_store(&player->running, false);
+  pthread_join(player->prefetcher, NULL);
+  munmap(player->map, player->map_size);
+  engine_free(player->scratch);
+  free(player);
+}
@@ -0,0 +1,199 @@
+#include "workbench_internal.h"
+
+/**
+ * @brief One direction of the device stream as seen by the re-blocking.
+ *
+ * Interleaved buffers are handled as a single plane of whole frames, planar
+ * buffers as one plane per channel.
+ */
+typedef struct {
+  int planes;   /**< Planes of a buffer, 0 if the direction is unused */
+  size_t bytes; /**< Bytes of one frame in a plane */
+  char *fifo;   /**< Storage of a quantum in every plane, aligned */
+  void **plane; /**< Plane pointers into `fifo` for planar buffers */
+  void **slice; /**< Plane pointers into a device buffer for planar buffers */
+} QuantumSide;
+
+/**
+ * @brief Re-blocking between the device buffers and the engine.
+ *
+ * When the device buffers are whole multiples of the quantum, each one is
+ * processed in place as consecutive engine blocks. Otherwise the input is
+ * gathered in a FIFO of one quantum while the output of the previous quantum
+ * is played from another at the same offsets, so every frame is delayed by
+ * exactly one quantum whatever the device delivers.
+ */
+static struct {
+  unsigned long quantum; /**< Frames of an engine block, `block_size` */
+  bool fifo;             /**< Device buffers are not whole quanta */
+  bool planar;           /**< Buffers are arrays of channel pointers */
+  unsigned long fill;    /**< Frames gathered in the FIFOs */
+  QuantumSide in;        /**< Device input */
+  QuantumSide out;       /**< Device output */
+} quantum = {0};
+
+bool quantum_enabled() {
+  Config *cfg = config_get();
+  return cfg->device_block_size != 0 &&
+         cfg->device_block_size != (int)cfg->block_size;
+}
+
+unsigned long quantum_device_frames() {
+  Config *cfg = config_get();
+  return cfg->device_block_size < 0 ? paFramesPerBufferUnspecified
+                                    : (unsigned long)cfg->device_block_size;
+}
+
+static bool quantum_side_init(QuantumSide *side, int channels,
+                              size_t sample_bytes) {
+  if (channels <= 0)
+    return true;
+  side->planes = quantum.planar ? channels : 1;
+  side->bytes = quantum.planar ? sample_bytes : sample_bytes * channels;
+  size_t stride = quantum.quantum * side->bytes;
+  stride =
+      (stride + AUDIO_BUFFER_ALIGNMENT - 1) & ~(AUDIO_BUFFER_ALIGNMENT - 1);
+  side->fifo = engine_alloc(stride * side->planes);
+  if (!side->fifo)
+    return false;
+  if (!quantum.planar)
+    return true;
+  side->plane = engine_calloc(side->planes, sizeof(void *));
+  side->slice = engine_calloc(side->planes, sizeof(void *));
+  if (!side->plane || !side->slice)
+    return false;
+  for (int p = 0; p < side->planes; p++)
+    side->plane[p] = side->fifo + stride * p;
+  return true;
+}
+
+static void quantum_side_free(QuantumSide *side) {
+  engine_free(side->fifo);
+  engine_free(side->plane);
+  engine_free(side->slice);
+  *side = (QuantumSide){0};
+}
+
+bool quantum_init(int in_channels, int out_channels, PaSampleFormat format) {
+  Config *cfg = config_get();
+  quantum_deinit();
+  quantum.quantum = cfg->block_size;
+  quantum.planar = cfg->non_interleaved != 0;
+  quantum.fifo = cfg->device_block_size < 0 ||
+                 cfg->device_block_size % cfg->block_size != 0;
+  size_t sample_bytes = Pa_GetSampleSize(format & ~paNonInterleaved);
+  if (!quantum_side_init(&quantum.in, in_channels, sample_bytes) ||
+      !quantum_side_init(&quantum.out, out_channels, sample_bytes)) {
+    log_e("Can not allocate the quantum FIFOs");
+    quantum_deinit();
+    return false;
+  }
+  if (cfg->device_block_size < 0) {
+    log_i("Engine blocks of %lu frames, device blocks chosen by the host, "
+          "%lu frames of latency",
+          quantum.quantum, quantum.quantum);
+  } else {
+    log_i("Engine blocks of %lu frames, device blocks of %d, %lu frames of "
+          "latency",
+          quantum.quantum, cfg->device_block_size,
+          quantum.fifo ? quantum.quantum : 0);
+  }
+  return true;
+}
+
+void quantum_deinit() {
+  quantum_side_free(&quantum.in);
+  quantum_side_free(&quantum.out);
+  quantum.fill = 0;
+}
+
+/**
+ * @brief Buffer handed to the engine for the frames of `buffer` from `frame`.
+ */
+static void *quantum_slice(QuantumSide *side, const void *buffer,
+                           unsigned long frame) {
+  if (!buffer)
+    return NULL;
+  if (!quantum.planar)
+    return (char *)buffer + frame * side->bytes;
+  for (int p = 0; p < side->planes; p++)
+    side->slice[p] = ((char *const *)buffer)[p] + frame * side->bytes;
+  return side->slice;
+}
+
+/**
+ * @brief Copies frames between a device buffer and a FIFO, plane by plane.
+ */
+static void quantum_copy(const QuantumSide *side, void *to,
+                         unsigned long to_frame, const void *from,
+                         unsigned long from_frame, unsigned long frames) {
+  for (int p = 0; p < side->planes; p++) {
+    char *dst = quantum.planar ? ((char **)to)[p] : to;
+    const char *src = quantum.planar ? ((char *const *)from)[p] : from;
+    memcpy(dst + to_frame * side->bytes, src + from_frame * side->bytes,
+           frames * side->bytes);
+  }
+}
+
+int quantum_callback(const void *input_buffer, void *output_buffer,
+                     unsigned long frames,
+                     const PaStreamCallbackTimeInfo *time_info,
+                     PaStreamCallbackFlags status_flags, void *user_data) {
+  double period = 1.0 / config_get()->sample_rate;
+  void *in_fifo = quantum.planar ? (void *)quantum.in.plane : quantum.in.fifo;
+  void *out_fifo =
+      quantum.planar ? (void *)quantum.out.plane : quantum.out.fifo;
+  unsigned long position = 0;
+  int result = paContinue;
+
+  while (position < frames && result == paContinue) {
+    if (quantum.fifo) {
+      unsigned long count = frames - position;
+      if (count > quantum.quantum - quantum.fill)
+        count = quantum.quantum - quantum.fill;
+      if (input_buffer)
+        quantum_copy(&quantum.in, in_fifo, quantum.fill, input_buffer,
+                     position, count);
+      if (output_buffer)
+        quantum_copy(&quantum.out, output_buffer, position, out_fifo,
+                     quantum.fill, count);
+      position += count;
+      quantum.fill += count;
+      if (quantum.fill < quantum.quantum)
+        break;
+      quantum.fill = 0;
+    } else {
+      // PortAudio delivers exactly the requested number of frames
+      if (frames - position < quantum.quantum)
+        break;
+      position += quantum.quantum;
+    }
+
+    // The block ends at `position` of this device buffer; in FIFO mode its
+    // output is heard from there on, else in place
+    long start = (long)position - (long)quantum.quantum;
+    long heard = quantum.fifo ? (long)position : start;
+    PaStreamCallbackTimeInfo timing = {
+        .inputBufferAdcTime = time_info->inputBufferAdcTime > 0
+                                  ? time_info->inputBufferAdcTime +
+                                        start * period
+                                  : 0,
+        .currentTime = time_info->currentTime - (frames - position) * period,
+        .outputBufferDacTime = time_info->outputBufferDacTime > 0
+                                   ? time_info->outputBufferDacTime +
+                                         heard * period
+                                   : 0,
+    };
+    const void *in = quantum.fifo
+                         ? (input_buffer ? in_fifo : NULL)
+                         : quantum_slice(&quantum.in, input_buffer, start);
+    void *out = quantum.fifo
+                    ? (output_buffer ? out_fifo : NULL)
+                    : quantum_slice(&quantum.out, output_buffer, start);
+    result = __audio_callback(in, out, quantum.quantum, &timing,
+                              status_flags, user_data);
+    // Over- and underflows are counted once per device buffer
+    status_flags = 0;
+  }
+  return result;
+}
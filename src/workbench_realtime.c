@@ -0,0 +1,192 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include "workbench_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+/** MXCSR flush-to-zero (bit 15) and denormals-are-zero (bit 6) */
+#define MXCSR_FTZ_DAZ 0x8040
+/** FPCR flush-to-zero, which covers inputs and outputs on AArch64 */
+#define FPCR_FZ (1ULL << 24)
+
+/** Threads whose report is kept until `realtime_report` logs it */
+#define REALTIME_REPORTS 16
+#define REALTIME_REPORT_SIZE 256
+
+/**
+ * @brief What a thread asked for in `realtime_enter` and what it got.
+ *
+ * The thread claims a slot, writes it and sets `state` to written; the first
+ * `realtime_report` to move it on to logged prints it.
+ */
+static struct {
+  char text[REALTIME_REPORT_SIZE]; /**< Role and outcome of each request */
+  bool granted;                    /**< Every request was granted */
+  atomic_int state;                /**< 0 empty, 1 written, 2 logged */
+} reports[REALTIME_REPORTS];
+static atomic_int report_count = 0;
+
+/** Offline renders keep the scheduling policy, set by `realtime_init` */
+static bool offline = false;
+
+bool realtime_flush_denormals() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_setcsr(_mm_getcsr() | MXCSR_FTZ_DAZ);
+  return (_mm_getcsr() & MXCSR_FTZ_DAZ) == MXCSR_FTZ_DAZ;
+#elif defined(__aarch64__)
+  uint64_t fpcr;
+  __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+  __asm__ volatile("msr fpcr, %0" : : "r"(fpcr | FPCR_FZ));
+  __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+  return (fpcr & FPCR_FZ) != 0;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Moves the calling thread to `SCHED_FIFO` at `rt_priority`.
+ *
+ * @return `true` if the policy and priority read back as requested.
+ */
+static bool realtime_schedule(int priority, char *report, size_t size) {
+  int lowest = sched_get_priority_min(SCHED_FIFO);
+  int highest = sched_get_priority_max(SCHED_FIFO);
+  if (priority < lowest)
+    priority = lowest;
+  if (priority > highest)
+    priority = highest;
+  struct sched_param param = {.sched_priority = priority};
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  int policy;
+  bool granted = pthread_getschedparam(pthread_self(), &policy, &param) == 0 &&
+                 policy == SCHED_FIFO && param.sched_priority == priority;
+  snprintf(report, size, "SCHED_FIFO %d %s", priority,
+           granted ? "granted" : err ? strerror(err) : "refused");
+  return granted;
+}
+
+#ifdef __linux__
+/**
+ * @brief Parses a CPU list such as `"2-3,6"`.
+ *
+ * @return `false` if the list is malformed or names no CPU.
+ */
+static bool realtime_cpus_parse(const char *list, cpu_set_t *cpus) {
+  CPU_ZERO(cpus);
+  const char *p = list;
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10), last = first;
+    if (end == p || first < 0)
+      return false;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first)
+        return false;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+      CPU_SET(cpu, cpus);
+    if (*p == ',')
+      p++;
+    else if (*p)
+      return false;
+  }
+  return CPU_COUNT(cpus) > 0;
+}
+#endif
+
+/**
+ * @brief Pins the calling thread to the CPUs of `cpu_affinity`.
+ *
+ * @return `true` if the affinity reads back as requested.
+ */
+static bool realtime_pin(const char *list, char *report, size_t size) {
+#ifdef __linux__
+  cpu_set_t wanted, actual;
+  if (!realtime_cpus_parse(list, &wanted)) {
+    snprintf(report, size, "CPUs \"%s\" malformed", list);
+    return false;
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(wanted), &wanted);
+  bool granted =
+      pthread_getaffinity_np(pthread_self(), sizeof(actual), &actual) == 0 &&
+      CPU_EQUAL(&wanted, &actual);
+  snprintf(report, size, "CPUs %s %s", list,
+           granted ? "granted" : err ? strerror(err) : "refused");
+  return granted;
+#else
+  snprintf(report, size, "CPUs %s not supported on this platform", list);
+  return false;
+#endif
+}
+
+void realtime_init(bool offline_render) { offline = offline_render; }
+
+int realtime_helper_attr(pthread_attr_t *attr) {
+  Config *cfg = config_get();
+  pthread_attr_init(attr);
+  if (cfg->rt_priority == 0 || offline)
+    return 0;
+  int priority = (int)cfg->rt_priority - 1;
+  int lowest = sched_get_priority_min(SCHED_FIFO);
+  int highest = sched_get_priority_max(SCHED_FIFO);
+  if (priority < lowest)
+    priority = lowest;
+  if (priority > highest - 1)
+    priority = highest - 1;
+  struct sched_param param = {.sched_priority = priority};
+  pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+  pthread_attr_setschedparam(attr, &param);
+  return priority;
+}
+
+void realtime_enter(const char *role) {
+  static _Thread_local bool entered = false;
+  if (entered)
+    return;
+  entered = true;
+
+  Config *cfg = config_get();
+  char priority[64] = "priority unchanged", affinity[96] = "any CPU";
+  bool granted = realtime_flush_denormals();
+  const char *denormals = granted ? "FTZ/DAZ on" : "FTZ/DAZ unavailable";
+  // An offline render runs flat out and would starve the system at SCHED_FIFO
+  if (cfg->rt_priority > 0 && !offline)
+    granted &= realtime_schedule(cfg->rt_priority, priority, sizeof(priority));
+  if (cfg->cpu_affinity)
+    granted &= realtime_pin(cfg->cpu_affinity, affinity, sizeof(affinity));
+
+  // No stdio here: the report waits for `realtime_report`
+  int slot = atomic_fetch_add_explicit(&report_count, 1, memory_order_relaxed);
+  if (slot >= REALTIME_REPORTS)
+    return;
+  snprintf(reports[slot].text, REALTIME_REPORT_SIZE, "%s thread: %s, %s, %s",
+           role, denormals, priority, affinity);
+  reports[slot].granted = granted;
+  atomic_store_explicit(&reports[slot].state, 1, memory_order_release);
+}
+
+void realtime_report() {
+  int count = atomic_load_explicit(&report_count, memory_order_relaxed);
+  for (int i = 0; i < count && i < REALTIME_REPORTS; i++) {
+    int written = 1;
+    if (!atomic_compare_exchange_strong_explicit(&reports[i].state, &written,
+                                                 2, memory_order_acquire,
+                                                 memory_order_relaxed))
+      continue;
+    if (reports[i].granted) {
+      log_i("%s", reports[i].text);
+    } else {
+      log_w("%s", reports[i].text);
+    }
+  }
+}
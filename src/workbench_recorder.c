@@ -0,0 +1,222 @@
+#ifdef __linux__
+#define _GNU_SOURCE // fallocate
+#endif
+#include "workbench_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct DiskRecorder {
+  SpscRing ring;                /**< Audio thread -> writer thread */
+  size_t frame_bytes;           /**< Bytes in one interleaved frame */
+  int channels;                 /**< Channels in the file */
+  double sample_rate;           /**< Frames per second */
+  int fd;                       /**< Descriptor of the WAV file */
+  char *staging;                /**< Aligned buffer for one write */
+  size_t staged;                /**< Bytes waiting in `staging` */
+  uint64_t data_bytes;          /**< Sample bytes written to the file */
+  uint64_t reserved;            /**< File bytes preallocated so far */
+  bool preallocate;             /**< Preallocation is still supported */
+  pthread_t writer;             /**< Drains the ring to the file */
+  atomic_bool running;          /**< Cleared to stop the writer */
+  atomic_uint_fast64_t pushed;  /**< Written by the audio thread */
+  atomic_uint_fast64_t dropped; /**< Written by the audio thread */
+  atomic_size_t high_water;     /**< Written by the audio thread */
+  atomic_uint_fast64_t written; /**< Written by the writer thread */
+};
+
+/** Increments a counter that only one thread writes */
+#define ADD(counter, value)                                                    \
+  atomic_store_explicit(                                                       \
+      &(counter),                                                              \
+      atomic_load_explicit(&(counter), memory_order_relaxed) + (value),        \
+      memory_order_relaxed)
+
+/**
+ * @brief Reserves disk space ahead of the writer.
+ *
+ * Allocating in large steps keeps the file contiguous and takes the block
+ * allocation out of the writes. The file size is not changed, so the file
+ * stays valid if the program ends early.
+ */
+static void recorder_reserve(DiskRecorder *rec, uint64_t end) {
+#ifdef __linux__
+  while (rec->preallocate && rec->reserved < end) {
+    if (fallocate(rec->fd, FALLOC_FL_KEEP_SIZE, rec->reserved,
+                  RECORDER_PREALLOCATE_SIZE) != 0) {
+      log_w("Recorder can not preallocate: %s", strerror(errno));
+      rec->preallocate = false;
+      return;
+    }
+    rec->reserved += RECORDER_PREALLOCATE_SIZE;
+  }
+#else
+  (void)rec;
+  (void)end;
+#endif
+}
+
+static void recorder_flush(DiskRecorder *rec) {
+  uint64_t offset = WAV_PADDED_HEADER_SIZE + rec->data_bytes;
+  recorder_reserve(rec, offset + rec->staged);
+  size_t done = 0;
+  while (done < rec->staged) {
+    ssize_t n = pwrite(rec->fd, rec->staging + done, rec->staged - done,
+                       offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      log_e("Recorder write failed: %s", strerror(errno));
+      break;
+    }
+    done += n;
+  }
+  rec->data_bytes += done;
+  rec->staged = 0;
+  atomic_store_explicit(&rec->written, rec->data_bytes / rec->frame_bytes,
+                        memory_order_relaxed);
+}
+
+/** Copies bytes into the staging buffer and writes it whenever it fills. */
+static void recorder_stage(DiskRecorder *rec, const char *bytes, size_t size) {
+  while (size) {
+    size_t n = RECORDER_WRITE_SIZE - rec->staged;
+    if (n > size)
+      n = size;
+    memcpy(rec->staging + rec->staged, bytes, n);
+    rec->staged += n;
+    bytes += n;
+    size -= n;
+    if (rec->staged == RECORDER_WRITE_SIZE)
+      recorder_flush(rec);
+  }
+}
+
+/** Moves everything queued in the ring into the staging buffer. */
+static size_t recorder_drain(DiskRecorder *rec) {
+  size_t total = 0;
+  RingSpan span;
+  size_t count;
+  while ((count = ring_read_begin(&rec->ring, SIZE_MAX, &span)) > 0) {
+    recorder_stage(rec, span.first, span.first_count * rec->frame_bytes);
+    if (span.second)
+      recorder_stage(rec, span.second, span.second_count * rec->frame_bytes);
+    ring_read_commit(&rec->ring, count);
+    total += count;
+  }
+  return total;
+}
+
+static void *recorder_write(void *arg) {
+  DiskRecorder *rec = arg;
+  struct timespec interval = {.tv_sec = 0,
+                              .tv_nsec = RECORDER_POLL_INTERVAL_US * 1000};
+  while (atomic_load_explicit(&rec->running, memory_order_acquire)) {
+    if (recorder_drain(rec) == 0)
+      nanosleep(&interval, NULL);
+  }
+  // The producer has stopped, take what it pushed last
+  recorder_drain(rec);
+  if (rec->staged)
+    recorder_flush(rec);
+  return NULL;
+}
+
+DiskRecorder *recorder_open(const char *path, int channels, double sample_rate,
+                            double buffer_seconds) {
+  DiskRecorder *rec = calloc(1, sizeof(DiskRecorder));
+  uint8_t header[WAV_PADDED_HEADER_SIZE];
+  if (!rec) {
+    log_e("Can not allocate a recorder for \"%s\"", path);
+    return NULL;
+  }
+  rec->channels = channels;
+  rec->sample_rate = sample_rate;
+  rec->frame_bytes = sizeof(float) * channels;
+  rec->preallocate = true;
+  rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (rec->fd < 0) {
+    log_e("Can not create \"%s\": %s", path, strerror(errno));
+    free(rec);
+    return NULL;
+  }
+  if (!ring_init(&rec->ring, rec->frame_bytes,
+                 (size_t)(buffer_seconds * sample_rate)) ||
+      posix_memalign((void **)&rec->staging, WAV_PADDED_HEADER_SIZE,
+                     RECORDER_WRITE_SIZE) != 0) {
+    log_e("Can not allocate the recorder buffers");
+    ring_free(&rec->ring);
+    close(rec->fd);
+    free(rec);
+    return NULL;
+  }
+  // A valid empty file until the real sizes are known
+  wav_build_header(header, channels, sample_rate, 0);
+  recorder_reserve(rec, RECORDER_PREALLOCATE_SIZE);
+  if (pwrite(rec->fd, header, sizeof(header), 0) != sizeof(header))
+    log_e("Can not write the header of \"%s\"", path);
+
+  atomic_store(&rec->running, true);
+  if (pthread_create(&rec->writer, NULL, recorder_write, rec) != 0) {
+    log_e("Can not start the recorder thread");
+    atomic_store(&rec->running, false);
+    ring_free(&rec->ring);
+    free(rec->staging);
+    close(rec->fd);
+    free(rec);
+    return NULL;
+  }
+  log_d("Recording %d channels to \"%s\", %.1f s buffer", channels, path,
+        ring_capacity(&rec->ring) / sample_rate);
+  return rec;
+}
+
+size_t recorder_push(DiskRecorder *rec, const float *frames, size_t count) {
+  size_t queued = ring_write(&rec->ring, frames, count);
+  size_t fill = ring_capacity(&rec->ring) - ring_write_space(&rec->ring);
+  ADD(rec->pushed, queued);
+  if (queued < count)
+    ADD(rec->dropped, count - queued);
+  if (fill > atomic_load_explicit(&rec->high_water, memory_order_relaxed))
+    atomic_store_explicit(&rec->high_water, fill, memory_order_relaxed);
+  return queued;
+}
+
+void recorder_get_stats(DiskRecorder *rec, RecorderStats *stats) {
+  stats->frames_pushed = atomic_load(&rec->pushed);
+  stats->frames_dropped = atomic_load(&rec->dropped);
+  stats->frames_written = atomic_load(&rec->written);
+  stats->ring_frames = ring_capacity(&rec->ring);
+  stats->ring_high_water = atomic_load(&rec->high_water);
+}
+
+void recorder_close(DiskRecorder *rec) {
+  if (!rec)
+    return;
+  atomic_store_explicit(&rec->running, false, memory_order_release);
+  pthread_join(rec->writer, NULL);
+
+  uint64_t frames = rec->data_bytes / rec->frame_bytes;
+  uint8_t header[WAV_PADDED_HEADER_SIZE];
+  wav_build_header(header, rec->channels, rec->sample_rate, frames);
+  if (pwrite(rec->fd, header, sizeof(header), 0) != sizeof(header))
+    log_e("Can not finalize the recording header");
+  // Give back the preallocated space past the end of the data
+  if (ftruncate(rec->fd, WAV_PADDED_HEADER_SIZE + rec->data_bytes) != 0)
+    log_w("Can not trim the recording: %s", strerror(errno));
+  close(rec->fd);
+
+  RecorderStats stats;
+  recorder_get_stats(rec, &stats);
+  log_i("Recorded %llu frames (%.1f s), ring high-water %zu of %zu frames",
+        (unsigned long long)frames, frames / rec->sample_rate,
+        stats.ring_high_water, stats.ring_frames);
+  if (stats.frames_dropped)
+    log_w("Recorder dropped %llu frames, the disk did not keep up",
+          (unsigned long long)stats.frames_dropped);
+
+  ring_free(&rec->ring);
+  free(rec->staging);
+  free(rec);
+}
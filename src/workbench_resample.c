@@ -0,0 +1,439 @@
+#include "workbench_internal.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define RESAMPLE_NEON 1
+#endif
+
+// The banks come from `engine_alloc` and are loaded with aligned loads
+_Static_assert(ENGINE_ALIGNMENT >= 32, "Banks must be aligned for AVX2");
+
+/** Taps are a multiple of this, the widest unrolled loop */
+#define RESAMPLE_TAP_STEP 16
+
+/**
+ * @brief Filter design of each quality level.
+ *
+ * Longer kernels get a steeper Kaiser window for more stopband attenuation,
+ * a cutoff closer to Nyquist, and finer phases so the linear interpolation
+ * between them stays below the stopband.
+ */
+static const struct {
+  int taps;      /**< Kernel length when not downsampling */
+  int phases;    /**< Positions of the interpolated bank per input frame */
+  double beta;   /**< Kaiser window parameter */
+  double cutoff; /**< Cutoff relative to Nyquist of the slower side */
+} qualities[] = {
+    [RESAMPLE_QUALITY_LOW] = {16, 64, 6.0, 0.82},
+    [RESAMPLE_QUALITY_MEDIUM] = {32, 128, 8.6, 0.9},
+    [RESAMPLE_QUALITY_HIGH] = {64, 256, 11.0, 0.94},
+};
+
+struct Resampler {
+  int channels;        /**< Channels of every frame */
+  int taps;            /**< Kernel length, a multiple of 16 */
+  int phases;          /**< Positions of `bank` per input frame */
+  size_t capacity;     /**< Frames of history per channel */
+  size_t fill;         /**< Frames buffered per channel */
+  float *history;      /**< Buffered input, one run of `capacity` per channel */
+  double position;     /**< Input frame of the first tap of the next output */
+  double ratio;        /**< Input frames per output frame */
+  double min_ratio;    /**< Lowest ratio accepted by `resampler_set_ratio` */
+  double max_ratio;    /**< Highest ratio accepted by `resampler_set_ratio` */
+  float *bank;         /**< `phases + 1` kernels for any ratio */
+  float *coefficients; /**< Kernel interpolated for the current frame */
+  double exact_ratio;  /**< Ratio of `exact`, 0 without one */
+  float *exact;        /**< `up` kernels, one per output phase */
+  unsigned up;         /**< Output phases of `exact_ratio`, `L` of `M / L` */
+  unsigned down;       /**< Input frames per `up` outputs, `M` of `M / L` */
+};
+
+typedef void (*Interpolate)(const float *, const float *, float, float *,
+                            int);
+typedef float (*Dot)(const float *, const float *, int);
+
+/**
+ * @brief One implementation of the inner loops.
+ *
+ * `Interpolate` blends two aligned kernels, `Dot` multiplies unaligned input
+ * with an aligned kernel. Both work on a multiple of `RESAMPLE_TAP_STEP`
+ * values.
+ */
+typedef struct {
+  const char *isa;
+  Interpolate interpolate;
+  Dot dot;
+} ResampleKernels;
+
+static void interpolate_scalar(const float *a, const float *b, float fraction,
+                               float *out, int taps) {
+  for (int i = 0; i < taps; i++)
+    out[i] = a[i] + fraction * (b[i] - a[i]);
+}
+
+static float dot_scalar(const float *x, const float *h, int taps) {
+  float sum = 0.0f;
+  for (int i = 0; i < taps; i++)
+    sum += x[i] * h[i];
+  return sum;
+}
+
+static const ResampleKernels scalar_kernels = {
+    .isa = "scalar",
+    .interpolate = interpolate_scalar,
+    .dot = dot_scalar,
+};
+
+#if defined(RESAMPLE_X86)
+__attribute__((target("sse"))) static void interpolate_sse(const float *a,
+                                                           const float *b,
+                                                           float fraction,
+                                                           float *out,
+                                                           int taps) {
+  const __m128 f = _mm_set1_ps(fraction);
+  for (int i = 0; i < taps; i += 4) {
+    __m128 va = _mm_load_ps(a + i);
+    __m128 d = _mm_sub_ps(_mm_load_ps(b + i), va);
+    _mm_store_ps(out + i, _mm_add_ps(va, _mm_mul_ps(f, d)));
+  }
+}
+
+__attribute__((target("sse"))) static float dot_sse(const float *x,
+                                                     const float *h,
+                                                     int taps) {
+  __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+  for (int i = 0; i < taps; i += 8) {
+    sum0 = _mm_add_ps(sum0,
+                      _mm_mul_ps(_mm_loadu_ps(x + i), _mm_load_ps(h + i)));
+    sum1 = _mm_add_ps(
+        sum1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_load_ps(h + i + 4)));
+  }
+  __m128 sum = _mm_add_ps(sum0, sum1);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+static const ResampleKernels sse_kernels = {
+    .isa = "sse",
+    .interpolate = interpolate_sse,
+    .dot = dot_sse,
+};
+
+__attribute__((target("avx2"))) static void interpolate_avx2(const float *a,
+                                                             const float *b,
+                                                             float fraction,
+                                                             float *out,
+                                                             int taps) {
+  const __m256 f = _mm256_set1_ps(fraction);
+  for (int i = 0; i < taps; i += 8) {
+    __m256 va = _mm256_load_ps(a + i);
+    __m256 d = _mm256_sub_ps(_mm256_load_ps(b + i), va);
+    _mm256_store_ps(out + i, _mm256_add_ps(va, _mm256_mul_ps(f, d)));
+  }
+}
+
+__attribute__((target("avx2"))) static float dot_avx2(const float *x,
+                                                      const float *h,
+                                                      int taps) {
+  __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+  for (int i = 0; i < taps; i += 16) {
+    sum0 = _mm256_add_ps(
+        sum0, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_load_ps(h + i)));
+    sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(x + i + 8),
+                                             _mm256_load_ps(h + i + 8)));
+  }
+  __m256 sum8 = _mm256_add_ps(sum0, sum1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8),
+                          _mm256_extractf128_ps(sum8, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+static const ResampleKernels avx2_kernels = {
+    .isa = "avx2",
+    .interpolate = interpolate_avx2,
+    .dot = dot_avx2,
+};
+#elif defined(RESAMPLE_NEON)
+static void interpolate_neon(const float *a, const float *b, float fraction,
+                             float *out, int taps) {
+  for (int i = 0; i < taps; i += 4) {
+    float32x4_t va = vld1q_f32(a + i);
+    float32x4_t d = vsubq_f32(vld1q_f32(b + i), va);
+    vst1q_f32(out + i, vmlaq_n_f32(va, d, fraction));
+  }
+}
+
+static float dot_neon(const float *x, const float *h, int taps) {
+  float32x4_t sum0 = vdupq_n_f32(0.0f), sum1 = vdupq_n_f32(0.0f);
+  for (int i = 0; i < taps; i += 8) {
+    sum0 = vmlaq_f32(sum0, vld1q_f32(x + i), vld1q_f32(h + i));
+    sum1 = vmlaq_f32(sum1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+  }
+  return vaddvq_f32(vaddq_f32(sum0, sum1));
+}
+
+static const ResampleKernels neon_kernels = {
+    .isa = "neon",
+    .interpolate = interpolate_neon,
+    .dot = dot_neon,
+};
+#endif
+
+static inline const ResampleKernels *kernels_get() {
+#if defined(RESAMPLE_X86)
+  unsigned cpu = cpu_features();
+  if (cpu & CPU_AVX2)
+    return &avx2_kernels;
+  if (cpu & CPU_SSE)
+    return &sse_kernels;
+#elif defined(RESAMPLE_NEON)
+  if (cpu_features() & CPU_NEON)
+    return &neon_kernels;
+#endif
+  return &scalar_kernels;
+}
+
+const char *resampler_isa() { return kernels_get()->isa; }
+
+/** Modified Bessel function of the first kind, order zero. */
+static double bessel_i0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+/**
+ * @brief Tabulates the windowed sinc at `count` phases.
+ *
+ * Phase `p` holds the kernel for an output that lies `p / phases` frames
+ * after tap `taps / 2 - 1`. Every phase is normalised to unity gain at DC.
+ */
+static void resampler_design(float *bank, int count, int phases, int taps,
+                             double cutoff, double beta) {
+  const double half = taps / 2;
+  for (int p = 0; p < count; p++) {
+    float *kernel = bank + (size_t)p * taps;
+    double sum = 0.0;
+    for (int k = 0; k < taps; k++) {
+      double d = k - (half - 1) - (double)p / phases;
+      double x = M_PI * cutoff * d;
+      double sinc = x == 0.0 ? 1.0 : sin(x) / x;
+      double w = d / half;
+      double window = w * w < 1.0 ? bessel_i0(beta * sqrt(1.0 - w * w)) /
+                                        bessel_i0(beta)
+                                  : 0.0;
+      kernel[k] = (float)(sinc * window);
+      sum += kernel[k];
+    }
+    for (int k = 0; k < taps; k++)
+      kernel[k] = (float)(kernel[k] / sum);
+  }
+}
+
+/**
+ * @brief Finds the smallest `L` with `ratio * L` an integer.
+ *
+ * @return `L`, or 0 if there is none up to `RESAMPLE_MAX_EXACT_PHASES`.
+ */
+static unsigned resampler_fraction(double ratio) {
+  for (unsigned up = 1; up <= RESAMPLE_MAX_EXACT_PHASES; up++) {
+    double down = ratio * up;
+    if (fabs(down - round(down)) < 1e-9 * down)
+      return up;
+  }
+  return 0;
+}
+
+Resampler *resampler_create(int channels, double ratio, size_t max_frames,
+                            ResampleQuality quality) {
+  if (channels <= 0 || !(ratio > 0.0) || quality < RESAMPLE_QUALITY_LOW ||
+      quality > RESAMPLE_QUALITY_HIGH)
+    return NULL;
+  Resampler *resampler = calloc(1, sizeof(Resampler));
+  if (!resampler)
+    return NULL;
+  // Downsampling lowers the cutoff, a longer kernel keeps the transition band.
+  // Ratios just above 1, as for clock drift, keep the base length.
+  double stretch = ratio > 1.0 ? ratio : 1.0;
+  int taps = (int)ceil(qualities[quality].taps * stretch / RESAMPLE_TAP_STEP -
+                       0.1) *
+             RESAMPLE_TAP_STEP;
+  unsigned up = resampler_fraction(ratio);
+  resampler->channels = channels;
+  resampler->taps = taps;
+  resampler->phases = qualities[quality].phases;
+  resampler->min_ratio = ratio / 2.0;
+  resampler->max_ratio = ratio * 2.0;
+  // Room for the kernel span plus the input of one call at the highest ratio
+  resampler->capacity =
+      taps + 2 + (size_t)ceil(max_frames * fmax(resampler->max_ratio, 1.0));
+  resampler->history =
+      engine_calloc(resampler->capacity * (size_t)channels, sizeof(float));
+  size_t kernels = resampler->phases + 2 + up;
+  resampler->bank = engine_calloc(kernels * taps, sizeof(float));
+  if (!resampler->history || !resampler->bank) {
+    engine_free(resampler->history);
+    engine_free(resampler->bank);
+    free(resampler);
+    return NULL;
+  }
+
+  double cutoff = qualities[quality].cutoff / stretch;
+  double beta = qualities[quality].beta;
+  resampler->coefficients =
+      resampler->bank + (size_t)(resampler->phases + 1) * taps;
+  resampler_design(resampler->bank, resampler->phases + 1, resampler->phases,
+                   taps, cutoff, beta);
+  if (up) {
+    resampler->exact = resampler->coefficients + taps;
+    resampler->exact_ratio = ratio;
+    resampler->up = up;
+    resampler->down = (unsigned)round(ratio * up);
+    resampler_design(resampler->exact, up, up, taps, cutoff, beta);
+  }
+  resampler->ratio = ratio;
+  resampler_reset(resampler);
+  return resampler;
+}
+
+void resampler_destroy(Resampler *resampler) {
+  if (!resampler)
+    return;
+  engine_free(resampler->history);
+  engine_free(resampler->bank);
+  free(resampler);
+}
+
+void resampler_reset(Resampler *resampler) {
+  // Leading silence puts the first input frame under the kernel centre
+  resampler->fill = resampler->taps / 2 - 1;
+  resampler->position = 0.0;
+  for (int c = 0; c < resampler->channels; c++)
+    memset(resampler->history + c * resampler->capacity, 0,
+           sizeof(float) * resampler->fill);
+}
+
+void resampler_set_ratio(Resampler *resampler, double ratio) {
+  resampler->ratio = ratio < resampler->min_ratio   ? resampler->min_ratio
+                     : ratio > resampler->max_ratio ? resampler->max_ratio
+                                                    : ratio;
+}
+
+double resampler_ratio(const Resampler *resampler) { return resampler->ratio; }
+
+bool resampler_is_exact(const Resampler *resampler) {
+  return resampler->ratio == resampler->exact_ratio;
+}
+
+int resampler_taps(const Resampler *resampler) { return resampler->taps; }
+
+/**
+ * @brief Position of the next output on the exact grid, in `1 / up` frames.
+ *
+ * The position only leaves the grid while another ratio is used; it is
+ * rounded back to the nearest phase.
+ */
+static inline uint64_t resampler_grid(const Resampler *resampler) {
+  return (uint64_t)llround(resampler->position * resampler->up);
+}
+
+size_t resampler_input_needed(const Resampler *resampler, size_t frames) {
+  if (frames == 0)
+    return 0;
+  size_t last;
+  if (resampler_is_exact(resampler))
+    last = (resampler_grid(resampler) + (frames - 1) * resampler->down) /
+           resampler->up;
+  else
+    last = (size_t)(resampler->position + (frames - 1) * resampler->ratio);
+  size_t needed = last + resampler->taps;
+  return needed > resampler->fill ? needed - resampler->fill : 0;
+}
+
+size_t resampler_process(Resampler *resampler, const float *in,
+                         size_t in_frames, float *out, size_t out_frames) {
+  const ResampleKernels *k = kernels_get();
+  const int channels = resampler->channels;
+  const int taps = resampler->taps;
+  const size_t capacity = resampler->capacity;
+  float *history = resampler->history;
+
+  if (in_frames > capacity - resampler->fill)
+    in_frames = capacity - resampler->fill;
+  for (int c = 0; c < channels; c++) {
+    float *line = history + c * capacity + resampler->fill;
+    for (size_t i = 0; i < in_frames; i++)
+      line[i] = in[i * channels + c];
+  }
+  resampler->fill += in_frames;
+
+  size_t produced = 0;
+  size_t consumed;
+  if (resampler_is_exact(resampler)) {
+    // Integer phase stepping, the kernels need no interpolation
+    uint64_t grid = resampler_grid(resampler);
+    for (; produced < out_frames; produced++) {
+      size_t first = grid / resampler->up;
+      if (first + taps > resampler->fill)
+        break;
+      const float *kernel = resampler->exact + (grid % resampler->up) * taps;
+      for (int c = 0; c < channels; c++)
+        out[produced * channels + c] =
+            k->dot(history + c * capacity + first, kernel, taps);
+      grid += resampler->down;
+    }
+    consumed = grid / resampler->up;
+    if (consumed > resampler->fill)
+      consumed = resampler->fill;
+    resampler->position = (double)(grid - consumed * resampler->up) /
+                          resampler->up;
+  } else {
+    for (; produced < out_frames; produced++) {
+      // Computed from the start of the call so no error accumulates
+      double position = resampler->position + produced * resampler->ratio;
+      size_t first = (size_t)position;
+      if (first + taps > resampler->fill)
+        break;
+      double phase = (position - first) * resampler->phases;
+      int p = (int)phase;
+      const float *kernel = resampler->bank + (size_t)p * taps;
+      k->interpolate(kernel, kernel + taps, (float)(phase - p),
+                     resampler->coefficients, taps);
+      for (int c = 0; c < channels; c++)
+        out[produced * channels + c] = k->dot(
+            history + c * capacity + first, resampler->coefficients, taps);
+    }
+    // Drop the frames no future output reaches
+    double position = resampler->position + produced * resampler->ratio;
+    consumed = (size_t)position;
+    if (consumed > resampler->fill)
+      consumed = resampler->fill;
+    resampler->position = position - consumed;
+  }
+
+  resampler->fill -= consumed;
+  for (int c = 0; c < channels && consumed > 0; c++)
+    memmove(history + c * capacity, history + c * capacity + consumed,
+            sizeof(float) * resampler->fill);
+  return produced;
+}
+
+ResampleQuality resample_quality_parse(const char *name) {
+  static const char *names[] = {"low", "medium", "high"};
+  for (int q = RESAMPLE_QUALITY_LOW; name && q <= RESAMPLE_QUALITY_HIGH; q++)
+    if (strcmp(name, names[q]) == 0)
+      return q;
+  if (name)
+    log_w("Unknown resample quality \"%s\". Using medium instead.", name);
+  return RESAMPLE_QUALITY_MEDIUM;
+}
@@ -0,0 +1,147 @@
+#include "workbench.h"
+
+/** Set in `TripleBuffer.middle` when it holds an unread snapshot */
+#define TRIPLE_FRESH 4u
+
+bool ring_init(SpscRing *ring, size_t element_size, size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  ring->data = engine_calloc(size, element_size);
+  if (!ring->data)
+    return false;
+  ring->element_size = element_size;
+  ring->mask = size - 1;
+  ring->tail_cache = 0;
+  ring->head_cache = 0;
+  atomic_store(&ring->head, 0);
+  atomic_store(&ring->tail, 0);
+  return true;
+}
+
+void ring_free(SpscRing *ring) {
+  engine_free(ring->data);
+  ring->data = NULL;
+}
+
+size_t ring_capacity(const SpscRing *ring) { return ring->mask + 1; }
+
+size_t ring_write_space(SpscRing *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  return ring->mask + 1 - (head - ring->tail_cache);
+}
+
+size_t ring_read_available(SpscRing *ring) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+  return ring->head_cache - tail;
+}
+
+static void ring_span(const SpscRing *ring, size_t index, size_t count,
+                      RingSpan *span) {
+  size_t offset = index & ring->mask;
+  size_t until_end = ring->mask + 1 - offset;
+  span->first = ring->data + offset * ring->element_size;
+  span->first_count = count < until_end ? count : until_end;
+  span->second_count = count - span->first_count;
+  span->second = span->second_count ? ring->data : NULL;
+}
+
+size_t ring_write_begin(SpscRing *ring, size_t count, RingSpan *span) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t space = ring->mask + 1 - (head - ring->tail_cache);
+  // Only touch the consumer's cache line when the old copy is not enough
+  if (space < count)
+    space = ring_write_space(ring);
+  if (count > space)
+    count = space;
+  ring_span(ring, head, count, span);
+  return count;
+}
+
+void ring_write_commit(SpscRing *ring, size_t count) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + count, memory_order_release);
+}
+
+size_t ring_read_begin(SpscRing *ring, size_t count, RingSpan *span) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t available = ring->head_cache - tail;
+  if (available < count)
+    available = ring_read_available(ring);
+  if (count > available)
+    count = available;
+  ring_span(ring, tail, count, span);
+  return count;
+}
+
+void ring_read_commit(SpscRing *ring, size_t count) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+size_t ring_write(SpscRing *ring, const void *elements, size_t count) {
+  RingSpan span;
+  count = ring_write_begin(ring, count, &span);
+  size_t first = span.first_count * ring->element_size;
+  memcpy(span.first, elements, first);
+  if (span.second)
+    memcpy(span.second, (const char *)elements + first,
+           span.second_count * ring->element_size);
+  ring_write_commit(ring, count);
+  return count;
+}
+
+size_t ring_read(SpscRing *ring, void *elements, size_t count) {
+  RingSpan span;
+  count = ring_read_begin(ring, count, &span);
+  size_t first = span.first_count * ring->element_size;
+  memcpy(elements, span.first, first);
+  if (span.second)
+    memcpy((char *)elements + first, span.second,
+           span.second_count * ring->element_size);
+  ring_read_commit(ring, count);
+  return count;
+}
+
+bool triple_buffer_init(TripleBuffer *triple, size_t size) {
+  triple->size = size;
+  triple->stride = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+  triple->data = engine_alloc(3 * triple->stride);
+  if (!triple->data)
+    return false;
+  triple->back = 0;
+  atomic_store(&triple->middle, 1);
+  triple->front = 2;
+  return true;
+}
+
+void triple_buffer_free(TripleBuffer *triple) {
+  engine_free(triple->data);
+  triple->data = NULL;
+}
+
+void *triple_buffer_write(TripleBuffer *triple) {
+  return triple->data + triple->back * triple->stride;
+}
+
+void triple_buffer_publish(TripleBuffer *triple) {
+  // Release makes the snapshot visible to the reader that takes it
+  unsigned old = atomic_exchange_explicit(
+      &triple->middle, triple->back | TRIPLE_FRESH, memory_order_acq_rel);
+  triple->back = old & ~TRIPLE_FRESH;
+}
+
+const void *triple_buffer_read(TripleBuffer *triple, bool *fresh) {
+  bool updated = atomic_load_explicit(&triple->middle, memory_order_relaxed) &
+                 TRIPLE_FRESH;
+  if (updated) {
+    unsigned old = atomic_exchange_explicit(&triple->middle, triple->front,
+                                            memory_order_acq_rel);
+    triple->front = old & ~TRIPLE_FRESH;
+  }
+  if (fresh)
+    *fresh = updated;
+  return triple->data + triple->front * triple->stride;
+}
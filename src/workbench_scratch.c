@@ -0,0 +1,78 @@
+#include "workbench_internal.h"
+
+_Static_assert(SCRATCH_ALIGNMENT <= ENGINE_ALIGNMENT,
+               "Scratch storage must be aligned for its spans");
+
+/**
+ * @brief Arena of one thread on a cache line of its own, as the workers
+ * bump theirs at the same time.
+ */
+typedef struct {
+  _Alignas(CACHE_LINE) ScratchArena arena;
+} ScratchSlot;
+
+/**
+ * @brief Arenas of the processing threads.
+ *
+ * Arena 0 belongs to the thread that runs `__audio_callback`, the others to
+ * the graph workers by thread number. Arenas past `count` have no storage.
+ */
+static struct {
+  ScratchSlot slots[GRAPH_MAX_THREADS];
+  int count; /**< Arenas with storage */
+} scratch = {0};
+
+/** Arena of the calling thread, bound by `scratch_bind`. */
+static _Thread_local ScratchArena *current = NULL;
+
+bool scratch_init() {
+  Config *cfg = config_get();
+  scratch_deinit();
+  uint32_t workers = cfg->graph_workers < GRAPH_MAX_THREADS
+                         ? cfg->graph_workers
+                         : GRAPH_MAX_THREADS - 1;
+  size_t size = (size_t)cfg->scratch_size << 10;
+  size = (size + SCRATCH_ALIGNMENT - 1) & ~(size_t)(SCRATCH_ALIGNMENT - 1);
+  if (size == 0)
+    return true;
+  for (scratch.count = 0; scratch.count <= (int)workers; scratch.count++) {
+    ScratchArena *arena = &scratch.slots[scratch.count].arena;
+    arena->base = engine_alloc(size);
+    if (!arena->base) {
+      log_e("Can not allocate the scratch arenas");
+      scratch_deinit();
+      return false;
+    }
+    arena->size = size;
+  }
+  log_d("Scratch: %d arenas of %zu KiB", scratch.count, size >> 10);
+  return true;
+}
+
+void scratch_deinit() {
+  for (int i = 0; i < scratch.count; i++)
+    engine_free(scratch.slots[i].arena.base);
+  memset(&scratch, 0, sizeof(scratch));
+}
+
+ScratchArena *scratch_bind(int thread) {
+  current = &scratch.slots[thread].arena;
+  return current;
+}
+
+void scratch_finish() {
+  size_t used = 0;
+  uint64_t failures = 0;
+  // Arenas without storage still count their failures
+  for (int i = 0; i < GRAPH_MAX_THREADS; i++) {
+    ScratchArena *arena = &scratch.slots[i].arena;
+    if (arena->used > used)
+      used = arena->used;
+    failures += arena->failures;
+    arena->used = 0;
+    arena->failures = 0;
+  }
+  stats_record_scratch(used, failures);
+}
+
+ScratchArena *audio_scratch() { return current; }
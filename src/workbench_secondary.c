@@ -0,0 +1,379 @@
+#include "workbench_internal.h"
+#include <math.h>
+
+/** Ring fill the control loop aims at, in engine blocks */
+#ifndef SECONDARY_TARGET_BLOCKS
+#define SECONDARY_TARGET_BLOCKS 3
+#endif
+
+/** Capacity of a ring, in engine blocks */
+#ifndef SECONDARY_RING_BLOCKS
+#define SECONDARY_RING_BLOCKS 16
+#endif
+
+/** Time constant of the control loop in seconds */
+#ifndef SECONDARY_SETTLE_SECONDS
+#define SECONDARY_SETTLE_SECONDS 4.0
+#endif
+
+/** Largest ratio correction, far beyond the drift of real clocks */
+#define SECONDARY_MAX_CORRECTION 0.002
+
+/**
+ * @brief A secondary device and the state of its control loop.
+ *
+ * For an input device the device callback produces into `ring` and the
+ * audio thread consumes; for an output device it is the other way round.
+ * `priming` belongs to the consumer: it waits until the ring holds `target`
+ * frames, at start and after the ring ran dry. The device callback stamps
+ * every exchange under the sequence lock `stamp_seq`, so the audio thread can
+ * tell how far the device has got since.
+ */
+typedef struct {
+  const char *role;             /**< `"input"` or `"output"` */
+  bool input;                   /**< Captures from the device, else plays */
+  int channels;                 /**< Channels exchanged with the device */
+  double rate;                  /**< Nominal sample rate of the device */
+  double scale;                 /**< Nominal ratio of the resampler */
+  PaStream *stream;             /**< Open stream, `NULL` if unused */
+  SpscRing ring;                /**< Device frames between the two clocks */
+  Resampler *resampler;         /**< Converts between the two clocks */
+  float *device_frames;         /**< Device side frames of one block */
+  float *engine_frames;         /**< Engine side frames of one block */
+  size_t target;                /**< Ring fill the control loop aims at */
+  atomic_bool priming;          /**< Consumer waits for `target` frames */
+  atomic_uint_fast64_t xruns;   /**< Frames dropped or missing */
+  atomic_uint_fast64_t flagged; /**< Device callbacks flagged with an xrun */
+  atomic_uint stamp_seq;        /**< Odd while the device callback runs */
+  atomic_int_fast64_t stamp;    /**< Time of the last device callback in ns */
+  atomic_ulong stamp_frames;    /**< Frames of the last device callback */
+  double error;                 /**< Smoothed fill error in blocks */
+  double integral;              /**< Integral term, the relative drift */
+} Secondary;
+
+static Secondary secondaries[STATS_SECONDARY_COUNT] = {
+    [STATS_SECONDARY_INPUT] = {.role = "input", .input = true},
+    [STATS_SECONDARY_OUTPUT] = {.role = "output"},
+};
+
+/**
+ * @brief Gains of the control loop.
+ *
+ * The fill error in blocks changes by the difference between drift and
+ * correction every block, an integrator. Proportional and integral gains of
+ * `2 / tau` and `1 / tau^2` place both closed-loop poles at `1 - 1 / tau`,
+ * critically damped with a time constant of `tau` blocks.
+ */
+static struct {
+  double proportional; /**< Correction per block of smoothed error */
+  double integral;     /**< Integral gain per block */
+  double smoothing;    /**< Weight of a new error in the smoothed one */
+} loop;
+
+int secondary_in_channels() {
+  Config *cfg = config_get();
+  if (!cfg->secondary_input || audio_backend_get() != AUDIO_BACKEND_PORTAUDIO)
+    return 0;
+  return cfg->secondary_in_channels > 0 &&
+                 cfg->secondary_in_channels < cfg->in_channel_count
+             ? cfg->secondary_in_channels
+             : cfg->in_channel_count;
+}
+
+int secondary_out_channels() {
+  Config *cfg = config_get();
+  if (!cfg->secondary_output || audio_backend_get() != AUDIO_BACKEND_PORTAUDIO)
+    return 0;
+  return cfg->secondary_out_channels > 0 &&
+                 cfg->secondary_out_channels < cfg->out_channel_count
+             ? cfg->secondary_out_channels
+             : cfg->out_channel_count;
+}
+
+/** Moves frames between the device ring and the device. */
+static int secondary_callback(const void *input, void *output,
+                              unsigned long frames,
+                              const PaStreamCallbackTimeInfo *time_info,
+                              PaStreamCallbackFlags status_flags,
+                              void *user_data) {
+  Secondary *secondary = user_data;
+  (void)time_info;
+  realtime_enter("Secondary audio");
+  if (status_flags & (paInputUnderflow | paInputOverflow | paOutputUnderflow |
+                      paOutputOverflow))
+    atomic_fetch_add_explicit(&secondary->flagged, 1, memory_order_relaxed);
+  unsigned seq =
+      atomic_load_explicit(&secondary->stamp_seq, memory_order_relaxed);
+  atomic_store_explicit(&secondary->stamp_seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&secondary->stamp, monotonic_ns(),
+                        memory_order_relaxed);
+  atomic_store_explicit(&secondary->stamp_frames, frames,
+                        memory_order_relaxed);
+
+  if (secondary->input) {
+    size_t written = ring_write(&secondary->ring, input, frames);
+    if (written < frames)
+      atomic_fetch_add_explicit(&secondary->xruns, frames - written,
+                                memory_order_relaxed);
+    atomic_store_explicit(&secondary->stamp_seq, seq + 2,
+                          memory_order_release);
+    return paContinue;
+  }
+
+  float *out = output;
+  size_t read = 0;
+  if (atomic_load_explicit(&secondary->priming, memory_order_relaxed) &&
+      ring_read_available(&secondary->ring) >= secondary->target)
+    atomic_store_explicit(&secondary->priming, false, memory_order_relaxed);
+  if (!atomic_load_explicit(&secondary->priming, memory_order_relaxed)) {
+    read = ring_read(&secondary->ring, out, frames);
+    if (read < frames) {
+      atomic_fetch_add_explicit(&secondary->xruns, frames - read,
+                                memory_order_relaxed);
+      atomic_store_explicit(&secondary->priming, true, memory_order_relaxed);
+    }
+  }
+  memset(out + read * secondary->channels, 0,
+         sizeof(float) * (frames - read) * secondary->channels);
+  atomic_store_explicit(&secondary->stamp_seq, seq + 2, memory_order_release);
+  return paContinue;
+}
+
+static void secondary_free(Secondary *secondary) {
+  ring_free(&secondary->ring);
+  resampler_destroy(secondary->resampler);
+  engine_free(secondary->device_frames);
+  engine_free(secondary->engine_frames);
+  secondary->stream = NULL;
+  secondary->resampler = NULL;
+  secondary->device_frames = secondary->engine_frames = NULL;
+  secondary->error = secondary->integral = 0.0;
+}
+
+void secondary_open() {
+  Config *cfg = config_get();
+  double tau = SECONDARY_SETTLE_SECONDS * cfg->sample_rate / cfg->block_size;
+  loop.proportional = 2.0 / tau;
+  loop.integral = 1.0 / (tau * tau);
+  loop.smoothing = 8.0 / tau;
+
+  for (int d = 0; d < STATS_SECONDARY_COUNT; d++) {
+    Secondary *secondary = &secondaries[d];
+    const char *name =
+        secondary->input ? cfg->secondary_input : cfg->secondary_output;
+    secondary->channels = secondary->input ? secondary_in_channels()
+                                           : secondary_out_channels();
+    if (secondary->channels == 0)
+      continue;
+    PaDeviceIndex index =
+        audio_device_find(name, secondary->input, secondary->channels);
+    if (index == paNoDevice) {
+      log_e("Secondary %s device \"%s\" was not found", secondary->role, name);
+      continue;
+    }
+
+    secondary->rate = cfg->secondary_sample_rate > 0
+                          ? cfg->secondary_sample_rate
+                          : cfg->sample_rate;
+    // Device frames per engine frame, the ratio is inverted for playback
+    double device_block = secondary->rate / cfg->sample_rate;
+    secondary->scale = secondary->input ? device_block : 1.0 / device_block;
+    device_block *= cfg->block_size;
+    secondary->target = (size_t)(SECONDARY_TARGET_BLOCKS * device_block);
+    // One call may resample up to a block at the largest ratio plus the taps
+    size_t frames = (size_t)ceil(2 * fmax(device_block, cfg->block_size));
+    secondary->resampler =
+        resampler_create(secondary->channels, secondary->scale, frames,
+                         resample_quality_parse(cfg->resample_quality));
+    if (secondary->resampler)
+      frames += resampler_taps(secondary->resampler);
+    size_t bytes = sizeof(float) * frames * secondary->channels;
+    secondary->device_frames = engine_alloc(bytes);
+    secondary->engine_frames = engine_alloc(bytes);
+    if (!ring_init(&secondary->ring, sizeof(float) * secondary->channels,
+                   (size_t)(SECONDARY_RING_BLOCKS *
+                            fmax(device_block, cfg->block_size))) ||
+        !secondary->resampler || !secondary->device_frames ||
+        !secondary->engine_frames) {
+      log_e("Can not allocate the secondary %s buffers", secondary->role);
+      secondary_free(secondary);
+      continue;
+    }
+
+    const PaDeviceInfo *info = Pa_GetDeviceInfo(index);
+    PaStreamParameters parameters;
+    stream_configure(&parameters, index, secondary->channels, paFloat32,
+                     secondary->input ? info->defaultLowInputLatency
+                                      : info->defaultLowOutputLatency);
+    atomic_store(&secondary->priming, true);
+    atomic_store(&secondary->stamp_frames, 0);
+    PaError err = Pa_OpenStream(
+        &secondary->stream, secondary->input ? &parameters : NULL,
+        secondary->input ? NULL : &parameters, secondary->rate,
+        paFramesPerBufferUnspecified, paNoFlag, secondary_callback, secondary);
+    if (err != paNoError) {
+      log_e("Can not open secondary %s \"%s\": %s", secondary->role, name,
+            Pa_GetErrorText(err));
+      secondary_free(secondary);
+      continue;
+    }
+    log_i("Secondary %s: \"%s\", %d channels at %.0f Hz", secondary->role,
+          name, secondary->channels, secondary->rate);
+  }
+}
+
+void secondary_start() {
+  for (int d = 0; d < STATS_SECONDARY_COUNT; d++) {
+    Secondary *secondary = &secondaries[d];
+    PaError err = secondary->stream ? Pa_StartStream(secondary->stream)
+                                    : paNoError;
+    if (err != paNoError)
+      log_e("Can not start secondary %s: %s", secondary->role,
+            Pa_GetErrorText(err));
+  }
+}
+
+void secondary_close() {
+  for (int d = 0; d < STATS_SECONDARY_COUNT; d++) {
+    Secondary *secondary = &secondaries[d];
+    if (!secondary->stream)
+      continue;
+    Pa_StopStream(secondary->stream);
+    Pa_CloseStream(secondary->stream);
+    secondary_free(secondary);
+  }
+}
+
+/**
+ * @brief Fill of the ring at this moment, interpolated from the last device
+ * callback.
+ *
+ * The ring only changes in bursts of one device buffer, while the device
+ * converts continuously. Counting the frames it has converted since its last
+ * callback removes a sawtooth from the fill that beats with the drift and
+ * that the control loop could not tell from it.
+ *
+ * @return `false` if the device callback ran meanwhile.
+ */
+static bool secondary_fill(Secondary *secondary, double *fill) {
+  unsigned begin =
+      atomic_load_explicit(&secondary->stamp_seq, memory_order_acquire);
+  size_t frames = secondary->input ? ring_read_available(&secondary->ring)
+                                   : ring_capacity(&secondary->ring) -
+                                         ring_write_space(&secondary->ring);
+  int64_t stamp = atomic_load_explicit(&secondary->stamp, memory_order_relaxed);
+  unsigned long period =
+      atomic_load_explicit(&secondary->stamp_frames, memory_order_relaxed);
+  atomic_thread_fence(memory_order_acquire);
+  if ((begin & 1) ||
+      begin != atomic_load_explicit(&secondary->stamp_seq,
+                                    memory_order_relaxed))
+    return false;
+  double elapsed =
+      (double)(monotonic_ns() - stamp) * secondary->rate / NS_PER_SEC;
+  // A stalled device is not converting, stop at its buffer size
+  elapsed = elapsed < 0 ? 0 : elapsed > period ? period : elapsed;
+  *fill = secondary->input ? frames + elapsed : frames - elapsed;
+  return true;
+}
+
+/**
+ * @brief Runs one step of the control loop and sets the resampling ratio.
+ *
+ * A ring that fills up means the consumer is too slow, so the ratio of
+ * input to output frames goes up on both directions. The step is skipped
+ * when the fill can not be read consistently.
+ */
+static void secondary_steer(Secondary *secondary, unsigned long frames) {
+  double fill;
+  if (!secondary_fill(secondary, &fill))
+    return;
+  double block = frames * (secondary->input ? secondary->scale
+                                            : 1.0 / secondary->scale);
+  double error = (fill - (double)secondary->target) / block;
+  secondary->error += loop.smoothing * (error - secondary->error);
+  secondary->integral += loop.integral * secondary->error;
+  if (fabs(secondary->integral) > SECONDARY_MAX_CORRECTION)
+    secondary->integral = copysign(SECONDARY_MAX_CORRECTION,
+                                   secondary->integral);
+  double correction =
+      loop.proportional * secondary->error + secondary->integral;
+  if (fabs(correction) > SECONDARY_MAX_CORRECTION)
+    correction = copysign(SECONDARY_MAX_CORRECTION, correction);
+  resampler_set_ratio(secondary->resampler,
+                      secondary->scale * (1.0 + correction));
+}
+
+void secondary_capture(float *first, size_t channel_step, size_t frame_step,
+                       unsigned long frames) {
+  Secondary *secondary = &secondaries[STATS_SECONDARY_INPUT];
+  size_t produced = 0;
+  if (secondary->channels == 0)
+    return;
+  if (secondary->stream) {
+    size_t fill = ring_read_available(&secondary->ring);
+    if (atomic_load_explicit(&secondary->priming, memory_order_relaxed) &&
+        fill >= secondary->target)
+      atomic_store_explicit(&secondary->priming, false, memory_order_relaxed);
+    if (!atomic_load_explicit(&secondary->priming, memory_order_relaxed)) {
+      secondary_steer(secondary, frames);
+      size_t needed = resampler_input_needed(secondary->resampler, frames);
+      size_t read =
+          ring_read(&secondary->ring, secondary->device_frames, needed);
+      if (read < needed) {
+        // Ran dry: finish the block with silence and wait for a full ring
+        atomic_fetch_add_explicit(&secondary->xruns, needed - read,
+                                  memory_order_relaxed);
+        atomic_store_explicit(&secondary->priming, true, memory_order_relaxed);
+        memset(secondary->device_frames + read * secondary->channels, 0,
+               sizeof(float) * (needed - read) * secondary->channels);
+      }
+      produced = resampler_process(secondary->resampler,
+                                   secondary->device_frames, needed,
+                                   secondary->engine_frames, frames);
+    }
+  }
+  for (int c = 0; c < secondary->channels; c++) {
+    float *out = first + c * channel_step;
+    for (size_t i = 0; i < produced; i++)
+      out[i * frame_step] =
+          secondary->engine_frames[i * secondary->channels + c];
+    for (size_t i = produced; i < frames; i++)
+      out[i * frame_step] = 0.0f;
+  }
+  stats_record_secondary(
+      STATS_SECONDARY_INPUT, secondary->integral * 1e6,
+      atomic_load_explicit(&secondary->xruns, memory_order_relaxed),
+      atomic_load_explicit(&secondary->flagged, memory_order_relaxed));
+}
+
+void secondary_play(const float *first, size_t channel_step,
+                    size_t frame_step, unsigned long frames) {
+  Secondary *secondary = &secondaries[STATS_SECONDARY_OUTPUT];
+  if (!secondary->stream)
+    return;
+  for (int c = 0; c < secondary->channels; c++) {
+    const float *in = first + c * channel_step;
+    for (size_t i = 0; i < frames; i++)
+      secondary->engine_frames[i * secondary->channels + c] =
+          in[i * frame_step];
+  }
+  if (!atomic_load_explicit(&secondary->priming, memory_order_relaxed))
+    secondary_steer(secondary, frames);
+  size_t produced = resampler_process(
+      secondary->resampler, secondary->engine_frames, frames,
+      secondary->device_frames,
+      (size_t)ceil(2 * frames / secondary->scale) +
+          resampler_taps(secondary->resampler));
+  size_t written =
+      ring_write(&secondary->ring, secondary->device_frames, produced);
+  if (written < produced)
+    atomic_fetch_add_explicit(&secondary->xruns, produced - written,
+                              memory_order_relaxed);
+  // The device consumes 1 / ratio frames per engine frame
+  stats_record_secondary(
+      STATS_SECONDARY_OUTPUT, -secondary->integral * 1e6,
+      atomic_load_explicit(&secondary->xruns, memory_order_relaxed),
+      atomic_load_explicit(&secondary->flagged, memory_order_relaxed));
+}
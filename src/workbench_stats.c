@@ -0,0 +1,248 @@
+#include "workbench_internal.h"
+#include <math.h>
+#include <stdatomic.h>
+
+#define STATS_BAR_WIDTH 40
+
+/**
+ * @brief Counters written by the audio thread only.
+ *
+ * Every field is atomic so readers never see torn values, `seq` makes a set
+ * of fields consistent. Durations are kept in nanoseconds and fractions in
+ * millionths so that all of them fit into lock-free integers.
+ */
+static struct {
+  atomic_uint seq;
+  atomic_uint_fast64_t callbacks;
+  atomic_uint_fast64_t frames;
+  atomic_uint_fast64_t overruns;
+  atomic_uint_fast64_t input_underflows;
+  atomic_uint_fast64_t input_overflows;
+  atomic_uint_fast64_t output_underflows;
+  atomic_uint_fast64_t output_overflows;
+  atomic_uint_fast64_t priming_outputs;
+  atomic_uint_fast64_t busy_ns;
+  atomic_uint_fast64_t budget_ns;
+  atomic_uint_fast64_t last_ppm;
+  atomic_uint_fast64_t max_ppm;
+  atomic_uint_fast64_t histogram[STATS_HISTOGRAM_BUCKETS];
+  atomic_int_fast64_t drift_ppb[STATS_SECONDARY_COUNT];
+  atomic_uint_fast64_t secondary_xruns[STATS_SECONDARY_COUNT];
+  atomic_uint_fast64_t secondary_device_xruns[STATS_SECONDARY_COUNT];
+  atomic_uint_fast64_t scratch_last;
+  atomic_uint_fast64_t scratch_peak;
+  atomic_uint_fast64_t scratch_failures;
+} stats;
+
+/**
+ * @brief Secondary device state handed over by `stats_record_secondary`.
+ *
+ * Published with the next `stats_record`. The xrun counters of the devices
+ * never reset, so a reset remembers where they were.
+ */
+static struct {
+  double drift_ppm;
+  uint64_t xruns;
+  uint64_t xruns_reset;
+  uint64_t device_xruns;
+  uint64_t device_xruns_reset;
+} secondary[STATS_SECONDARY_COUNT];
+
+/** Scratch use handed over by `stats_record_scratch`. */
+static struct {
+  size_t used;
+  uint64_t failures;
+} scratch;
+
+static atomic_bool reset_requested = false;
+
+#define STORE(field, value)                                                    \
+  atomic_store_explicit(&stats.field, (value), memory_order_relaxed)
+#define LOAD(field) atomic_load_explicit(&stats.field, memory_order_relaxed)
+#define ADD(field, value) STORE(field, LOAD(field) + (value))
+
+static int bucket_of(double fraction) {
+  if (fraction <= 0)
+    return 0;
+  int bucket = (int)floor((log2(fraction) - STATS_MIN_LOG2) *
+                          STATS_STEPS_PER_OCTAVE) +
+               1;
+  if (bucket < 0)
+    return 0;
+  if (bucket >= STATS_HISTOGRAM_BUCKETS)
+    return STATS_HISTOGRAM_BUCKETS - 1;
+  return bucket;
+}
+
+double audio_stats_bucket_edge(int bucket) {
+  if (bucket <= 0)
+    return 0;
+  return exp2(STATS_MIN_LOG2 + (double)(bucket - 1) / STATS_STEPS_PER_OCTAVE);
+}
+
+void stats_record(unsigned long frames, int64_t elapsed,
+                  PaStreamCallbackFlags flags) {
+  int64_t budget = (int64_t)(frames * NS_PER_SEC / config_get()->sample_rate);
+  double fraction = budget > 0 ? (double)elapsed / budget : 0;
+  unsigned seq = atomic_load_explicit(&stats.seq, memory_order_relaxed);
+
+  // Odd sequence numbers tell readers that an update is in progress
+  atomic_store_explicit(&stats.seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  if (atomic_exchange_explicit(&reset_requested, false,
+                               memory_order_acquire)) {
+    STORE(callbacks, 0);
+    STORE(frames, 0);
+    STORE(overruns, 0);
+    STORE(input_underflows, 0);
+    STORE(input_overflows, 0);
+    STORE(output_underflows, 0);
+    STORE(output_overflows, 0);
+    STORE(priming_outputs, 0);
+    STORE(busy_ns, 0);
+    STORE(budget_ns, 0);
+    STORE(max_ppm, 0);
+    STORE(scratch_peak, 0);
+    STORE(scratch_failures, 0);
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+      STORE(histogram[i], 0);
+    for (int d = 0; d < STATS_SECONDARY_COUNT; d++) {
+      secondary[d].xruns_reset = secondary[d].xruns;
+      secondary[d].device_xruns_reset = secondary[d].device_xruns;
+    }
+  }
+
+  uint64_t ppm = (uint64_t)(fraction * 1e6);
+  ADD(callbacks, 1);
+  ADD(frames, frames);
+  ADD(busy_ns, elapsed);
+  ADD(budget_ns, budget);
+  STORE(last_ppm, ppm);
+  if (ppm > LOAD(max_ppm))
+    STORE(max_ppm, ppm);
+  if (elapsed > budget)
+    ADD(overruns, 1);
+  if (flags & paInputUnderflow)
+    ADD(input_underflows, 1);
+  if (flags & paInputOverflow)
+    ADD(input_overflows, 1);
+  if (flags & paOutputUnderflow)
+    ADD(output_underflows, 1);
+  if (flags & paOutputOverflow)
+    ADD(output_overflows, 1);
+  if (flags & paPrimingOutput)
+    ADD(priming_outputs, 1);
+  ADD(histogram[bucket_of(fraction)], 1);
+  STORE(scratch_last, scratch.used);
+  if (scratch.used > LOAD(scratch_peak))
+    STORE(scratch_peak, scratch.used);
+  ADD(scratch_failures, scratch.failures);
+  scratch = (typeof(scratch)){0};
+  for (int d = 0; d < STATS_SECONDARY_COUNT; d++) {
+    STORE(drift_ppb[d], (int64_t)(secondary[d].drift_ppm * 1e3));
+    STORE(secondary_xruns[d], secondary[d].xruns - secondary[d].xruns_reset);
+    STORE(secondary_device_xruns[d],
+          secondary[d].device_xruns - secondary[d].device_xruns_reset);
+  }
+
+  atomic_store_explicit(&stats.seq, seq + 2, memory_order_release);
+}
+
+void audio_get_stats(AudioStats *out) {
+  unsigned begin, end;
+  uint64_t busy, budget;
+  do {
+    begin = atomic_load_explicit(&stats.seq, memory_order_acquire);
+    out->callbacks = LOAD(callbacks);
+    out->frames = LOAD(frames);
+    out->overruns = LOAD(overruns);
+    out->input_underflows = LOAD(input_underflows);
+    out->input_overflows = LOAD(input_overflows);
+    out->output_underflows = LOAD(output_underflows);
+    out->output_overflows = LOAD(output_overflows);
+    out->priming_outputs = LOAD(priming_outputs);
+    out->budget_last = LOAD(last_ppm) / 1e6;
+    out->budget_max = LOAD(max_ppm) / 1e6;
+    busy = LOAD(busy_ns);
+    budget = LOAD(budget_ns);
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+      out->histogram[i] = LOAD(histogram[i]);
+    for (int d = 0; d < STATS_SECONDARY_COUNT; d++) {
+      out->drift_ppm[d] = LOAD(drift_ppb[d]) / 1e3;
+      out->secondary_xruns[d] = LOAD(secondary_xruns[d]);
+      out->secondary_device_xruns[d] = LOAD(secondary_device_xruns[d]);
+    }
+    out->scratch_last = LOAD(scratch_last);
+    out->scratch_peak = LOAD(scratch_peak);
+    out->scratch_failures = LOAD(scratch_failures);
+    atomic_thread_fence(memory_order_acquire);
+    end = atomic_load_explicit(&stats.seq, memory_order_relaxed);
+  } while ((begin & 1) || begin != end);
+
+  out->budget_avg = budget ? (double)busy / budget : 0;
+  out->cpu_load = audio_cpu_load();
+  if (out->cpu_load < 0)
+    out->cpu_load = out->budget_avg;
+}
+
+void stats_record_secondary(int device, double drift_ppm, uint64_t xruns,
+                            uint64_t device_xruns) {
+  secondary[device].drift_ppm = drift_ppm;
+  secondary[device].xruns = xruns;
+  secondary[device].device_xruns = device_xruns;
+}
+
+void stats_record_scratch(size_t used, uint64_t failures) {
+  scratch.used = used;
+  scratch.failures = failures;
+}
+
+void audio_reset_stats() {
+  atomic_store_explicit(&reset_requested, true, memory_order_release);
+}
+
+void audio_print_stats() {
+  AudioStats s;
+  audio_get_stats(&s);
+  realtime_report();
+
+  uint64_t peak = 1;
+  for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    if (s.histogram[i] > peak)
+      peak = s.histogram[i];
+
+  printf("Audio stats:\n"
+         "  callbacks: \t%llu (%llu frames, %llu over budget)\n"
+         "  xruns: \tin %llu/%llu out %llu/%llu (underflow/overflow)\n"
+         "  budget: \tlast %.2f%% avg %.2f%% max %.2f%%\n"
+         "  cpu load: \t%.2f%%\n",
+         (unsigned long long)s.callbacks, (unsigned long long)s.frames,
+         (unsigned long long)s.overruns,
+         (unsigned long long)s.input_underflows,
+         (unsigned long long)s.input_overflows,
+         (unsigned long long)s.output_underflows,
+         (unsigned long long)s.output_overflows, 100 * s.budget_last,
+         100 * s.budget_avg, 100 * s.budget_max, 100 * s.cpu_load);
+  const char *roles[STATS_SECONDARY_COUNT] = {"input", "output"};
+  for (int d = 0; d < STATS_SECONDARY_COUNT; d++)
+    if (d == STATS_SECONDARY_INPUT ? secondary_in_channels()
+                                   : secondary_out_channels())
+      printf("  secondary %s: \tdrift %+.2f ppm, %llu frames lost, "
+             "%llu device xruns\n",
+             roles[d], s.drift_ppm[d],
+             (unsigned long long)s.secondary_xruns[d],
+             (unsigned long long)s.secondary_device_xruns[d]);
+  printf("  scratch: \tlast %llu peak %llu bytes of %u KiB, %llu failed\n",
+         (unsigned long long)s.scratch_last,
+         (unsigned long long)s.scratch_peak, config_get()->scratch_size,
+         (unsigned long long)s.scratch_failures);
+  for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+    if (!s.histogram[i])
+      continue;
+    int width = (int)(s.histogram[i] * STATS_BAR_WIDTH / peak);
+    printf("  >=%8.3f%% %10llu %.*s\n", 100 * audio_stats_bucket_edge(i),
+           (unsigned long long)s.histogram[i], width > 0 ? width : 1,
+           "########################################");
+  }
+}
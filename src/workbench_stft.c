@@ -0,0 +1,167 @@
+#include "workbench.h"
+#include <math.h>
+
+struct Stft {
+  size_t size;           /**< Samples per frame */
+  size_t hop;            /**< Samples between two frames */
+  size_t fill;           /**< Samples of the current hop so far */
+  FftPlan *plan;         /**< Transform of `size` */
+  StftCallback callback; /**< Processing of every spectrum */
+  void *user_data;       /**< Pointer passed to `callback` */
+  float *analysis;       /**< Window before the forward transform */
+  float *synthesis;      /**< Window after the inverse, normalised */
+  float *input;          /**< Last `size` input samples, oldest first */
+  float *output;         /**< Finished samples played during this hop */
+  float *accumulator;    /**< Overlap-add of the frames, `size` samples */
+  float *frame;          /**< Windowed frame and its inverse */
+  float *re;             /**< Spectrum of the frame, real parts */
+  float *im;             /**< Spectrum of the frame, imaginary parts */
+};
+
+StftWindow stft_window_parse(const char *name) {
+  if (!name)
+    return STFT_WINDOW_HANN;
+  if (strcmp(name, "rectangular") == 0)
+    return STFT_WINDOW_RECTANGULAR;
+  if (strcmp(name, "hamming") == 0)
+    return STFT_WINDOW_HAMMING;
+  if (strcmp(name, "blackman") == 0)
+    return STFT_WINDOW_BLACKMAN;
+  return STFT_WINDOW_HANN;
+}
+
+static double stft_window(StftWindow window, size_t n, size_t size) {
+  double x = 2 * M_PI * n / size;
+  switch (window) {
+  case STFT_WINDOW_RECTANGULAR:
+    return 1.0;
+  case STFT_WINDOW_HAMMING:
+    return 0.54 - 0.46 * cos(x);
+  case STFT_WINDOW_BLACKMAN:
+    return 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+  case STFT_WINDOW_HANN:
+  default:
+    return 0.5 - 0.5 * cos(x);
+  }
+}
+
+Stft *stft_create(size_t size, size_t hop, StftWindow window,
+                  StftCallback callback, void *user_data) {
+  if (hop < 1 || hop > size) {
+    log_e("STFT hop %zu is not between 1 and the size %zu", hop, size);
+    return NULL;
+  }
+  Stft *stft = calloc(1, sizeof(Stft));
+  if (!stft)
+    return NULL;
+  stft->size = size;
+  stft->hop = hop;
+  stft->callback = callback;
+  stft->user_data = user_data;
+  stft->plan = fft_plan_create(size);
+  stft->analysis = engine_alloc(sizeof(float) * size);
+  stft->synthesis = engine_alloc(sizeof(float) * size);
+  stft->input = engine_alloc(sizeof(float) * size);
+  stft->output = engine_alloc(sizeof(float) * hop);
+  stft->accumulator = engine_alloc(sizeof(float) * size);
+  stft->frame = engine_alloc(sizeof(float) * size);
+  stft->re = engine_alloc(sizeof(float) * (size / 2 + 1));
+  stft->im = engine_alloc(sizeof(float) * (size / 2 + 1));
+  if (!stft->plan || !stft->analysis || !stft->synthesis || !stft->input ||
+      !stft->output || !stft->accumulator || !stft->frame || !stft->re ||
+      !stft->im) {
+    log_e("Can not allocate an STFT of size %zu", size);
+    stft_destroy(stft);
+    return NULL;
+  }
+
+  for (size_t n = 0; n < size; n++)
+    stft->analysis[n] = (float)stft_window(window, n, size);
+  // Every output sample is the sum of the frames overlapping it, each
+  // weighted by the window twice; the overlaps repeat every hop
+  for (size_t n = 0; n < size; n++) {
+    double overlap = 0;
+    for (size_t m = n % hop; m < size; m += hop)
+      overlap += (double)stft->analysis[m] * stft->analysis[m];
+    stft->synthesis[n] =
+        overlap > 1e-9 ? (float)(stft->analysis[n] / overlap) : 0.0f;
+  }
+  stft_reset(stft);
+  return stft;
+}
+
+void stft_destroy(Stft *stft) {
+  if (!stft)
+    return;
+  fft_plan_destroy(stft->plan);
+  engine_free(stft->analysis);
+  engine_free(stft->synthesis);
+  engine_free(stft->input);
+  engine_free(stft->output);
+  engine_free(stft->accumulator);
+  engine_free(stft->frame);
+  engine_free(stft->re);
+  engine_free(stft->im);
+  free(stft);
+}
+
+size_t stft_latency(const Stft *stft) { return stft->size; }
+
+void stft_reset(Stft *stft) {
+  stft->fill = 0;
+  memset(stft->input, 0, sizeof(float) * stft->size);
+  memset(stft->output, 0, sizeof(float) * stft->hop);
+  memset(stft->accumulator, 0, sizeof(float) * stft->size);
+}
+
+/**
+ * @brief Transforms the last `size` samples, overlap-adds the result and
+ * moves the next `hop` finished samples to `output`.
+ */
+static void stft_frame(Stft *stft) {
+  const size_t size = stft->size, hop = stft->hop;
+  float *frame = stft->frame, *sum = stft->accumulator;
+  for (size_t n = 0; n < size; n++)
+    frame[n] = stft->input[n] * stft->analysis[n];
+  fft_forward(stft->plan, frame, stft->re, stft->im);
+  if (stft->callback)
+    stft->callback(stft->re, stft->im, size / 2 + 1, stft->user_data);
+  fft_inverse(stft->plan, stft->re, stft->im, frame);
+  for (size_t n = 0; n < size; n++)
+    sum[n] += frame[n] * stft->synthesis[n];
+
+  // No later frame reaches the first hop of the sum
+  memcpy(stft->output, sum, sizeof(float) * hop);
+  memmove(sum, sum + hop, sizeof(float) * (size - hop));
+  memset(sum + size - hop, 0, sizeof(float) * hop);
+  memmove(stft->input, stft->input + hop, sizeof(float) * (size - hop));
+}
+
+void stft_process(Stft *stft, const float *in, float *out, size_t frames) {
+  const size_t size = stft->size, hop = stft->hop;
+  size_t position = 0;
+  while (position < frames) {
+    size_t count = hop - stft->fill;
+    if (count > frames - position)
+      count = frames - position;
+    float *tail = stft->input + size - hop + stft->fill;
+    if (in)
+      memcpy(tail, in + position, sizeof(float) * count);
+    else
+      memset(tail, 0, sizeof(float) * count);
+    if (out)
+      memcpy(out + position, stft->output + stft->fill,
+             sizeof(float) * count);
+    position += count;
+    stft->fill += count;
+    if (stft->fill == hop) {
+      stft->fill = 0;
+      stft_frame(stft);
+    }
+  }
+}
+
+void stft_node(const NodeContext *context, void *state) {
+  stft_process(state, context->audio_in[0], context->audio_out[0],
+               context->frames);
+}
@@ -0,0 +1,284 @@
+#include "workbench.h"
+#include <errno.h>
+
+#define WAV_IO_CHUNK 4096
+
+static const uint8_t wav_float_fact[] = {'f', 'a', 'c', 't', 4, 0, 0, 0};
+
+static uint16_t get_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  put_u16(p, v & 0xffff);
+  put_u16(p + 2, v >> 16);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+  return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+  put_u32(p, v & 0xffffffff);
+  put_u32(p + 4, v >> 32);
+}
+
+bool wav_read_header(FILE *file, WavInfo *info) {
+  uint8_t chunk[40];
+  bool have_format = false;
+  uint64_t rf64_data_size = 0;
+
+  *info = (WavInfo){0};
+  if (fread(chunk, 1, 12, file) != 12 ||
+      (memcmp(chunk, "RIFF", 4) != 0 && memcmp(chunk, "RF64", 4) != 0) ||
+      memcmp(chunk + 8, "WAVE", 4) != 0)
+    return false;
+
+  while (fread(chunk, 1, 8, file) == 8) {
+    uint32_t size = get_u32(chunk + 4);
+    if (memcmp(chunk, "ds64", 4) == 0 && size >= 16) {
+      // RF64 keeps the 64 bit sizes here and 0xffffffff in the chunks
+      if (fread(chunk, 1, 16, file) != 16)
+        return false;
+      rf64_data_size = get_u64(chunk + 8);
+      fseek(file, size - 16 + (size & 1), SEEK_CUR);
+    } else if (memcmp(chunk, "fmt ", 4) == 0) {
+      if (size < 16 || fread(chunk, 1, size < 40 ? size : 40, file) < 16)
+        return false;
+      info->format = get_u16(chunk);
+      info->channels = get_u16(chunk + 2);
+      info->sample_rate = get_u32(chunk + 4);
+      info->block_align = get_u16(chunk + 12);
+      info->bits_per_sample = get_u16(chunk + 14);
+      // The real format is in the first two bytes of the sub-format GUID
+      if (info->format == WAV_FORMAT_EXTENSIBLE && size >= 40)
+        info->format = get_u16(chunk + 24);
+      if (size > 40)
+        fseek(file, size - 40, SEEK_CUR);
+      have_format = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      // Frames are decoded as `channels` samples of `bits_per_sample` each
+      if (!have_format || info->channels == 0 || info->block_align == 0 ||
+          info->block_align != info->channels * info->bits_per_sample / 8)
+        return false;
+      info->data_offset = ftell(file);
+      info->frames = (size == UINT32_MAX && rf64_data_size ? rf64_data_size
+                                                           : size) /
+                     info->block_align;
+      break;
+    } else {
+      fseek(file, size + (size & 1), SEEK_CUR);
+    }
+  }
+  if (!have_format || info->data_offset == 0)
+    return false;
+
+  switch (info->format) {
+  case WAV_FORMAT_PCM:
+    return info->bits_per_sample == 8 || info->bits_per_sample == 16 ||
+           info->bits_per_sample == 24 || info->bits_per_sample == 32;
+  case WAV_FORMAT_FLOAT:
+    return info->bits_per_sample == 32 || info->bits_per_sample == 64;
+  default:
+    return false;
+  }
+}
+
+WavFile *wav_open_read(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    log_e("Can not open \"%s\"", path);
+    return NULL;
+  }
+  WavFile *wav = calloc(1, sizeof(WavFile));
+  if (!wav) {
+    log_e("Can not allocate a WAV file for \"%s\"", path);
+    fclose(file);
+    return NULL;
+  }
+  wav->file = file;
+  if (!wav_read_header(file, &wav->info)) {
+    log_e("\"%s\" is not a supported WAV file", path);
+    fclose(file);
+    free(wav);
+    return NULL;
+  }
+  log_d("%s: %u ch, %u Hz, %u bit, %llu frames", path, wav->info.channels,
+        wav->info.sample_rate, wav->info.bits_per_sample,
+        (unsigned long long)wav->info.frames);
+  return wav;
+}
+
+WavFile *wav_open_write(const char *path, int channels, double sample_rate) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    log_e("Can not create \"%s\"", path);
+    return NULL;
+  }
+  WavFile *wav = calloc(1, sizeof(WavFile));
+  if (!wav) {
+    log_e("Can not allocate a WAV file for \"%s\"", path);
+    fclose(file);
+    return NULL;
+  }
+  wav->file = file;
+  wav->writing = true;
+  wav->info = (WavInfo){.format = WAV_FORMAT_FLOAT,
+                        .channels = channels,
+                        .sample_rate = (uint32_t)sample_rate,
+                        .bits_per_sample = 32,
+                        .block_align = channels * sizeof(float),
+                        .data_offset = WAV_PADDED_HEADER_SIZE};
+  // Reserve the header, it is written with the final sizes on close
+  uint8_t header[WAV_PADDED_HEADER_SIZE];
+  wav_build_header(header, channels, sample_rate, 0);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+    log_e("Can not write \"%s\": %s", path, strerror(errno));
+    fclose(file);
+    free(wav);
+    return NULL;
+  }
+  return wav;
+}
+
+void wav_build_header(uint8_t *header, int channels, double sample_rate,
+                      uint64_t frames) {
+  uint64_t block_align = channels * sizeof(float);
+  uint64_t data_size = frames * block_align;
+  uint64_t riff_size = WAV_PADDED_HEADER_SIZE - 8 + data_size;
+  bool rf64 = riff_size > UINT32_MAX;
+  uint8_t *p = header;
+
+  memset(header, 0, WAV_PADDED_HEADER_SIZE);
+  memcpy(p, rf64 ? "RF64" : "RIFF", 4);
+  put_u32(p + 4, rf64 ? UINT32_MAX : (uint32_t)riff_size);
+  memcpy(p + 8, "WAVE", 4);
+  p += 12;
+  // Reserved for the 64 bit sizes, a JUNK chunk until they are needed
+  memcpy(p, rf64 ? "ds64" : "JUNK", 4);
+  put_u32(p + 4, 28);
+  if (rf64) {
+    put_u64(p + 8, riff_size);
+    put_u64(p + 16, data_size);
+    put_u64(p + 24, frames);
+  }
+  p += 36;
+  memcpy(p, "fmt ", 4);
+  put_u32(p + 4, 18);
+  put_u16(p + 8, WAV_FORMAT_FLOAT);
+  put_u16(p + 10, channels);
+  put_u32(p + 12, (uint32_t)sample_rate);
+  put_u32(p + 16, (uint32_t)(sample_rate * block_align));
+  put_u16(p + 20, block_align);
+  put_u16(p + 22, 32);
+  p += 26;
+  memcpy(p, wav_float_fact, sizeof(wav_float_fact));
+  put_u32(p + 8, frames > UINT32_MAX ? UINT32_MAX : (uint32_t)frames);
+  p += 12;
+  // Pad so that the samples start on a block boundary of the disk
+  uint8_t *data = header + WAV_PADDED_HEADER_SIZE - 8;
+  memcpy(p, "JUNK", 4);
+  put_u32(p + 4, (uint32_t)(data - p - 8));
+  memcpy(data, "data", 4);
+  put_u32(data + 4, rf64 ? UINT32_MAX : (uint32_t)data_size);
+}
+
+static float decode_sample(const uint8_t *p, const WavInfo *info) {
+  switch (info->bits_per_sample) {
+  case 8:
+    return ((int)p[0] - 128) / 128.0f;
+  case 16:
+    return (int16_t)get_u16(p) / 32768.0f;
+  case 24:
+    return (int32_t)(get_u32((uint8_t[]){0, p[0], p[1], p[2]})) /
+           2147483648.0f;
+  case 32:
+    if (info->format == WAV_FORMAT_FLOAT) {
+      float f;
+      memcpy(&f, p, sizeof(f));
+      return f;
+    }
+    return (int32_t)get_u32(p) / 2147483648.0f;
+  case 64: {
+    double d;
+    memcpy(&d, p, sizeof(d));
+    return (float)d;
+  }
+  }
+  return 0.0f;
+}
+
+void wav_decode_float(const WavInfo *info, const void *raw, float *frames,
+                      size_t count) {
+  size_t samples = count * info->channels;
+  if (info->format == WAV_FORMAT_FLOAT && info->bits_per_sample == 32) {
+    memcpy(frames, raw, samples * sizeof(float));
+  } else if (info->format != WAV_FORMAT_FLOAT && info->bits_per_sample == 16) {
+    convert_s16_to_f32(raw, frames, samples);
+  } else if (info->format != WAV_FORMAT_FLOAT && info->bits_per_sample == 24) {
+    convert_s24_to_f32(raw, frames, samples);
+  } else if (info->format != WAV_FORMAT_FLOAT && info->bits_per_sample == 32) {
+    convert_s32_to_f32(raw, frames, samples);
+  } else {
+    // Unsigned 8 bit and 64 bit float have no vector kernel
+    size_t bytes_per_sample = info->bits_per_sample / 8;
+    for (size_t i = 0; i < samples; i++)
+      frames[i] = decode_sample((const uint8_t *)raw + i * bytes_per_sample,
+                                info);
+  }
+}
+
+size_t wav_read_float(WavFile *wav, float *frames, size_t count) {
+  uint8_t raw[WAV_IO_CHUNK];
+  const WavInfo *info = &wav->info;
+  size_t chunk_frames = WAV_IO_CHUNK / info->block_align;
+  size_t total = 0;
+
+  if (count > info->frames - wav->cursor)
+    count = info->frames - wav->cursor;
+  while (total < count) {
+    size_t n = count - total < chunk_frames ? count - total : chunk_frames;
+    n = fread(raw, info->block_align, n, wav->file);
+    if (n == 0)
+      break;
+    wav_decode_float(info, raw, frames, n);
+    frames += n * info->channels;
+    total += n;
+  }
+  wav->cursor += total;
+  return total;
+}
+
+size_t wav_write_float(WavFile *wav, const float *frames, size_t count) {
+  size_t written = fwrite(frames, wav->info.block_align, count, wav->file);
+  wav->cursor += written;
+  if (written < count)
+    log_e("Wrote %zu of %zu frames: %s", written, count, strerror(errno));
+  return written;
+}
+
+void wav_close(WavFile *wav) {
+  if (!wav)
+    return;
+  bool failed = false;
+  if (wav->writing) {
+    // Sizes past 4 GiB turn the header into RF64
+    uint8_t header[WAV_PADDED_HEADER_SIZE];
+    wav_build_header(header, wav->info.channels, wav->info.sample_rate,
+                     wav->cursor);
+    failed = fseek(wav->file, 0, SEEK_SET) != 0 ||
+             fwrite(header, 1, sizeof(header), wav->file) != sizeof(header);
+  }
+  failed |= fclose(wav->file) != 0;
+  if (failed && wav->writing)
+    log_e("Can not finish the WAV file: %s", strerror(errno));
+  free(wav);
+}
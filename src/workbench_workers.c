@@ -0,0 +1,297 @@
+#include "workbench_internal.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/** Failed rounds of stealing before an idle worker goes to sleep */
+#ifndef WORKER_SPINS
+#define WORKER_SPINS 64
+#endif
+
+/**
+ * @brief Chase-Lev work-stealing deque of task indices.
+ *
+ * The owner pushes and pops at `bottom`, thieves take from `top`. The
+ * capacity covers every task of a run, so the deque never grows.
+ */
+typedef struct {
+  _Alignas(CACHE_LINE) atomic_long top;    /**< Oldest task, taken by thieves */
+  _Alignas(CACHE_LINE) atomic_long bottom; /**< Next slot of the owner */
+  atomic_int *tasks;                       /**< `mask + 1` slots */
+  long mask;                               /**< Capacity minus one */
+} Deque;
+
+typedef struct {
+  WorkerPool *pool; /**< Pool of the thread */
+  int index;        /**< Thread number, 1 to `threads` */
+} WorkerSlot;
+
+struct WorkerPool {
+  int threads;          /**< Threads besides the caller of `workers_run` */
+  int capacity;         /**< Largest number of tasks of a run */
+  Deque *deques;        /**< One per thread, the caller's first */
+  atomic_int *pending;  /**< Unfinished predecessors of each task */
+  pthread_t *handles;   /**< Worker threads */
+  WorkerSlot *slots;    /**< Arguments of the worker threads */
+  const TaskDeps *deps; /**< Dependencies of the current run */
+  WorkerTask task;      /**< Function of the current run */
+  void *context;        /**< Context of the current run */
+  atomic_bool running;  /**< Cleared to stop the workers */
+  _Alignas(CACHE_LINE) atomic_int remaining;   /**< Unfinished tasks */
+  _Alignas(CACHE_LINE) atomic_uint generation; /**< Counts the runs */
+  atomic_int parked;                           /**< Workers between runs */
+  _Alignas(CACHE_LINE) atomic_uint epoch;      /**< Bumped when work appears */
+  atomic_int sleepers;                         /**< Workers waiting for work */
+};
+
+#ifdef __linux__
+void futex_wait(atomic_uint *word, unsigned expected) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+void futex_wake(atomic_uint *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else
+// Without futexes a condition variable gives the same wait/wake semantics
+static pthread_mutex_t futex_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t futex_cond = PTHREAD_COND_INITIALIZER;
+
+void futex_wait(atomic_uint *word, unsigned expected) {
+  pthread_mutex_lock(&futex_lock);
+  if (atomic_load(word) == expected)
+    pthread_cond_wait(&futex_cond, &futex_lock);
+  pthread_mutex_unlock(&futex_lock);
+}
+
+void futex_wake(atomic_uint *word) {
+  (void)word;
+  pthread_mutex_lock(&futex_lock);
+  pthread_cond_broadcast(&futex_cond);
+  pthread_mutex_unlock(&futex_lock);
+}
+#endif
+
+static void deque_push(Deque *deque, int task) {
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  atomic_store_explicit(&deque->tasks[bottom & deque->mask], task,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static int deque_pop(Deque *deque) {
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  int task = -1;
+  if (top <= bottom) {
+    task = atomic_load_explicit(&deque->tasks[bottom & deque->mask],
+                                memory_order_relaxed);
+    if (top == bottom) {
+      // Last task, race the thieves for it
+      if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed))
+        task = -1;
+      atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+static int deque_steal(Deque *deque) {
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom)
+    return -1;
+  int task = atomic_load_explicit(&deque->tasks[top & deque->mask],
+                                  memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return -1;
+  return task;
+}
+
+/** Takes a task from the own deque first, then from the others. */
+static int worker_find(WorkerPool *pool, int self) {
+  int task = deque_pop(&pool->deques[self]);
+  for (int i = 1; task < 0 && i <= pool->threads; i++)
+    task = deque_steal(&pool->deques[(self + i) % (pool->threads + 1)]);
+  return task;
+}
+
+static void worker_wake(WorkerPool *pool) {
+  atomic_fetch_add(&pool->epoch, 1);
+  if (atomic_load(&pool->sleepers) > 0)
+    futex_wake(&pool->epoch);
+}
+
+static void worker_execute(WorkerPool *pool, int self, int task) {
+  const TaskDeps *deps = &pool->deps[task];
+  int ready = 0;
+  pool->task(pool->context, task, self);
+  for (int i = 0; i < deps->successor_count; i++) {
+    int next = deps->successors[i];
+    if (atomic_fetch_sub_explicit(&pool->pending[next], 1,
+                                  memory_order_acq_rel) == 1) {
+      deque_push(&pool->deques[self], next);
+      ready++;
+    }
+  }
+  // This thread takes one of them next, the others are for idle threads
+  if (ready > 1)
+    worker_wake(pool);
+  if (atomic_fetch_sub_explicit(&pool->remaining, 1, memory_order_acq_rel) ==
+      1)
+    worker_wake(pool);
+}
+
+/**
+ * @brief Runs tasks until the current run is finished.
+ *
+ * Only the worker threads sleep; the caller of `workers_run` is on the audio
+ * thread and yields instead.
+ */
+static void worker_help(WorkerPool *pool, int self) {
+  int idle = 0;
+  while (atomic_load_explicit(&pool->remaining, memory_order_acquire) > 0) {
+    unsigned epoch = atomic_load(&pool->epoch);
+    int task = worker_find(pool, self);
+    if (task >= 0) {
+      worker_execute(pool, self, task);
+      idle = 0;
+    } else if (self == 0 || ++idle < WORKER_SPINS) {
+      sched_yield();
+    } else {
+      atomic_fetch_add(&pool->sleepers, 1);
+      if (atomic_load(&pool->remaining) > 0)
+        futex_wait(&pool->epoch, epoch);
+      atomic_fetch_sub(&pool->sleepers, 1);
+      idle = 0;
+    }
+  }
+}
+
+static void *worker_main(void *arg) {
+  WorkerSlot *slot = arg;
+  WorkerPool *pool = slot->pool;
+  unsigned seen = 0;
+  // Workers keep the priority of `realtime_helper_attr` and may run on any CPU
+  realtime_flush_denormals();
+  while (true) {
+    unsigned generation = atomic_load(&pool->generation);
+    if (!atomic_load(&pool->running))
+      break;
+    if (generation == seen) {
+      atomic_fetch_add(&pool->parked, 1);
+      futex_wait(&pool->generation, generation);
+      atomic_fetch_sub(&pool->parked, 1);
+      continue;
+    }
+    seen = generation;
+    worker_help(pool, slot->index);
+  }
+  return NULL;
+}
+
+WorkerPool *workers_create(int threads, int capacity) {
+  WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+  if (!pool)
+    return NULL;
+  long size = 1;
+  while (size < capacity)
+    size <<= 1;
+  pool->threads = threads;
+  pool->capacity = capacity;
+  pool->deques = engine_calloc(threads + 1, sizeof(Deque));
+  pool->pending = engine_calloc(capacity, sizeof(atomic_int));
+  pool->handles = calloc(threads, sizeof(pthread_t));
+  pool->slots = calloc(threads, sizeof(WorkerSlot));
+  bool allocated = pool->deques && pool->pending && pool->handles &&
+                   pool->slots;
+  for (int i = 0; allocated && i <= threads; i++) {
+    pool->deques[i].tasks = engine_calloc(size, sizeof(atomic_int));
+    pool->deques[i].mask = size - 1;
+    allocated = pool->deques[i].tasks != NULL;
+  }
+  atomic_store(&pool->running, true);
+
+  pthread_attr_t attr;
+  int priority = realtime_helper_attr(&attr);
+  bool realtime = priority > 0;
+  int started = 0;
+  for (; allocated && started < threads; started++) {
+    pool->slots[started] = (WorkerSlot){pool, started + 1};
+    // Without the privilege for SCHED_FIFO, run at the default priority
+    if (realtime && pthread_create(&pool->handles[started], &attr, worker_main,
+                                   &pool->slots[started]) == 0)
+      continue;
+    realtime = false;
+    if (pthread_create(&pool->handles[started], NULL, worker_main,
+                       &pool->slots[started]) != 0)
+      break;
+  }
+  pthread_attr_destroy(&attr);
+  if (!allocated || started < threads) {
+    log_e("Can not start the worker threads");
+    for (int i = started + 1; pool->deques && i <= threads; i++)
+      engine_free(pool->deques[i].tasks);
+    pool->threads = started;
+    workers_destroy(pool);
+    return NULL;
+  }
+  if (realtime) {
+    log_i("Started %d worker threads, SCHED_FIFO priority %d", threads,
+          priority);
+  } else {
+    log_i("Started %d worker threads at normal priority", threads);
+  }
+  return pool;
+}
+
+void workers_destroy(WorkerPool *pool) {
+  if (!pool)
+    return;
+  atomic_store(&pool->running, false);
+  atomic_fetch_add(&pool->generation, 1);
+  futex_wake(&pool->generation);
+  for (int i = 0; i < pool->threads; i++)
+    pthread_join(pool->handles[i], NULL);
+  for (int i = 0; pool->deques && i <= pool->threads; i++)
+    engine_free(pool->deques[i].tasks);
+  engine_free(pool->deques);
+  engine_free(pool->pending);
+  free(pool->handles);
+  free(pool->slots);
+  free(pool);
+}
+
+void workers_run(WorkerPool *pool, const TaskDeps *deps, int count,
+                 WorkerTask task, void *context) {
+  pool->deps = deps;
+  pool->task = task;
+  pool->context = context;
+  for (int i = 0; i < count; i++)
+    atomic_store_explicit(&pool->pending[i], deps[i].predecessors,
+                          memory_order_relaxed);
+  atomic_store_explicit(&pool->remaining, count, memory_order_relaxed);
+  for (int i = 0; i < count; i++)
+    if (deps[i].predecessors == 0)
+      deque_push(&pool->deques[0], i);
+  // Publishes the run to the workers
+  atomic_fetch_add(&pool->generation, 1);
+  if (atomic_load(&pool->parked) > 0)
+    futex_wake(&pool->generation);
+  worker_help(pool, 0);
+}